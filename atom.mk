@@ -66,7 +66,7 @@ LOCAL_LIBRARIES := \
 	ledd_plugin \
 	libulog
 
-LOCAL_LDLIBS := -ldl
+LOCAL_LDLIBS := -ldl -lpthread
 
 LOCAL_C_INCLUDES := \
 	$(LOCAL_PATH)/ledd_plugins/src \
@@ -118,8 +118,47 @@ LOCAL_EXPORT_C_INCLUDES := \
 
 LOCAL_EXPORT_CFLAGS := -DLEDD_SKIP_PLUGINS=true
 
+LOCAL_EXPORT_LDLIBS := -lpthread
+
 include $(BUILD_STATIC_LIBRARY)
 
+################################################################################
+# ledd-patterns-gen
+################################################################################
+
+include $(CLEAR_VARS)
+
+# runs on the build machine, with the same plug-ins as libledd-static, to turn a
+# patterns.conf into a C file to link with a ledd-static based program
+LOCAL_HOST_MODULE := ledd-patterns-gen
+LOCAL_DESCRIPTION := Generator of C tables from the patterns of a patterns.conf
+LOCAL_CATEGORY_PATH := tools/ledd
+
+LOCAL_SRC_FILES := \
+	utils/ledd_patterns_gen.c \
+	ledd/src/utils.c \
+	ledd/src/compositor.c \
+	$(call all-c-files-in,ledd/src/config) \
+	$(call all-c-files-under,ledd_plugins)
+
+LOCAL_LIBRARIES := \
+	host.libutils \
+	host.librs \
+	host.libpomp \
+	host.libulog \
+	host.liblua
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/ledd_plugins/include \
+	$(LOCAL_PATH)/ledd_plugins/src \
+	$(LOCAL_PATH)/ledd/include \
+	$(LOCAL_PATH)/ledd/src \
+	$(LOCAL_PATH)/ledd/src/config
+
+LOCAL_LDLIBS := -ldl -lm -lpthread
+
+include $(BUILD_EXECUTABLE)
+
 ################################################################################
 # ledd_client
 ################################################################################
@@ -168,6 +207,8 @@ LOCAL_LIBRARIES := \
 	libpomp \
 	librs
 
+LOCAL_LDLIBS := -lpthread
+
 include $(BUILD_LIBRARY)
 
 ################################################################################
@@ -176,18 +217,41 @@ include $(BUILD_LIBRARY)
 
 include $(CLEAR_VARS)
 LOCAL_MODULE := ldc
-LOCAL_DESCRIPTION := Command line interface for ldc
+LOCAL_DESCRIPTION := Command line interface for ledd
 LOCAL_CATEGORY_PATH := tools/ledd
 
+LOCAL_SRC_FILES := \
+	utils/ldc.c
+
 LOCAL_REQUIRED_MODULES := \
-	lua \
-	ledd-ng \
-	pomp-cli
+	ledd-ng
 
-LOCAL_COPY_FILES := \
-	utils/ldc:usr/bin/ldc
+LOCAL_LIBRARIES := \
+	libledd_client
 
-include $(BUILD_CUSTOM)
+include $(BUILD_EXECUTABLE)
+
+################################################################################
+# name_index_bench
+################################################################################
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := name_index_bench
+LOCAL_DESCRIPTION := Benchmark of the lookups by name of leds, channels and \
+	patterns
+LOCAL_CATEGORY_PATH := tools/ledd
+
+LOCAL_SRC_FILES := \
+	utils/name_index_bench.c
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/ledd_plugins/src
+
+LOCAL_LIBRARIES := \
+	ledd_plugin
+
+include $(BUILD_EXECUTABLE)
 
 ################################################################################
 # file_led_driver
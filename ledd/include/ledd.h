@@ -31,6 +31,9 @@
 
 #ifndef LEDD_INCLUDE_LEDD_H_
 #define LEDD_INCLUDE_LEDD_H_
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
 
 #ifndef DEFAULT_GLOBAL_CONF_PATH
 /**
@@ -64,6 +67,17 @@
  */
 int ledd_init_impl(const char *global_config, bool skip_plugins);
 
+/**
+ * @brief Makes ledd load its patterns from an image generated at build time by
+ * ledd-patterns-gen, instead of reading the patterns_config file of
+ * global.conf, must be called before ledd_init(). The C file generated calls it
+ * automatically, when linked in the program
+ * @param image patterns image, must stay valid until ledd_cleanup() is called
+ * @param size size of the image, in bytes
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_set_static_patterns(const void *image, size_t size);
+
 /**
  * @brief Retrieves the underlying file descriptor of the ledd plugin, which
  * will report read events when the ledd_process_events() function must be
@@ -84,4 +98,115 @@ int ledd_process_events(void);
  */
 void ledd_cleanup(void);
 
+/*
+ * In-process control API: the functions below can be called from any thread of
+ * the program embedding ledd, between ledd_init() and ledd_cleanup(), they post
+ * the commands to the ledd loop, which applies them when it processes its
+ * events, with the semantics of the commands received on ledd's socket.
+ */
+
+/**
+ * @struct ledd_batch
+ * @brief commands posted at once to ledd, which applies them all at the same
+ * tick, or none of them if one is invalid, to be used by one thread at a time,
+ * opaque structure
+ */
+struct ledd_batch;
+
+/**
+ * @typedef ledd_batch_cb
+ * @brief type of the callback passed to ledd_batch_post(), called in the ledd
+ * loop once the batch is applied
+ * @param userdata userdata passed to ledd_batch_post()
+ * @param status 0 if the batch was applied, errno-compatible negative value if
+ * it was rejected, -ECANCELED if ledd_cleanup() was called before
+ */
+typedef void (*ledd_batch_cb)(void *userdata, int status);
+
+/**
+ * @def LEDD_BATCH_NOW
+ * @brief flag of ledd_batch_post(), the batch is applied as soon as the ledd
+ * loop processes it, instead of at the next tick
+ */
+#define LEDD_BATCH_NOW (1u << 0)
+
+/**
+ * Sets a pattern to be played, at the next tick, like the set_pattern command.
+ * @param pattern name of the pattern
+ * @param resume_previous if true, the pattern interrupted resumes when the new
+ * pattern ends
+ * @return errno-compatible negative value on error, 0 on success, the pattern
+ * being unknown is only reported in the logs
+ */
+int ledd_set_pattern(const char *pattern, bool resume_previous);
+
+/**
+ * Same as ledd_set_pattern(), but the pattern starts as soon as the ledd loop
+ * processes the command, like the set_pattern_now command.
+ * @param pattern name of the pattern
+ * @param resume_previous if true, the pattern interrupted resumes when the new
+ * pattern ends
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_set_pattern_now(const char *pattern, bool resume_previous);
+
+/**
+ * Sets a led's channel to a given value, regardless of the patterns playing on
+ * it, like the set_value command.
+ * @param led name of the led
+ * @param channel name of the channel of the led
+ * @param value value of the channel
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_set_value(const char *led, const char *channel, uint8_t value);
+
+/**
+ * Allocates an empty batch of commands.
+ * @return batch newly allocated, NULL on error, with errno set
+ */
+struct ledd_batch *ledd_batch_new(void);
+
+/**
+ * Adds the setting of a pattern to a batch, see ledd_set_pattern().
+ * @param batch batch to add the command to
+ * @param pattern name of the pattern
+ * @param resume_previous if true, the pattern interrupted resumes when the new
+ * pattern ends
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_batch_set_pattern(struct ledd_batch *batch, const char *pattern,
+		bool resume_previous);
+
+/**
+ * Adds the setting of the value of a led channel to a batch, see
+ * ledd_set_value().
+ * @param batch batch to add the command to
+ * @param led name of the led
+ * @param channel name of the channel of the led
+ * @param value value of the channel
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_batch_set_value(struct ledd_batch *batch, const char *led,
+		const char *channel, uint8_t value);
+
+/**
+ * Posts a batch to the ledd loop, then empties it, for reuse. Doesn't block.
+ * @param batch batch to post
+ * @param flags LEDD_BATCH_NOW or 0
+ * @param cb if not NULL, called in the ledd loop once the batch is applied or
+ * rejected
+ * @param userdata passed to cb
+ * @return errno-compatible negative value on error, -ENOTCONN if ledd isn't
+ * initialized, -ECANCELED if ledd_cleanup() has begun, 0 on success, the batch
+ * is left untouched on error
+ */
+int ledd_batch_post(struct ledd_batch *batch, uint32_t flags,
+		ledd_batch_cb cb, void *userdata);
+
+/**
+ * Destroys a batch.
+ * @param batch batch to destroy, set to NULL on output
+ */
+void ledd_batch_destroy(struct ledd_batch **batch);
+
 #endif /* LEDD_INCLUDE_LEDD_H_ */
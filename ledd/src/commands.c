@@ -0,0 +1,408 @@
+/**
+ * @file commands.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define ULOG_TAG ledd_commands
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_commands);
+
+#include <rs_node.h>
+#include <rs_dll.h>
+
+#include <ut_utils.h>
+#include <ut_string.h>
+
+#include "pattern.h"
+#include "led_set.h"
+
+#include "commands.h"
+
+struct commands {
+	struct rs_dll pending;
+	/* commands of the batch in progress, if any, queued when it ends */
+	struct rs_dll staged;
+	bool staging;
+	/* last sequence number given, to a command or to a batch */
+	uint64_t seq;
+	/* commands received, and dropped because of a later one */
+	uint64_t received;
+	uint64_t dropped;
+};
+
+static struct commands commands;
+
+#define to_command(n) ut_container_of((n), struct command, node)
+
+int commands_init(void)
+{
+	int ret;
+
+	ret = rs_dll_init(&commands.staged, NULL);
+	if (ret < 0)
+		return ret;
+
+	return rs_dll_init(&commands.pending, NULL);
+}
+
+void command_destroy(struct command *command)
+{
+	if (command == NULL)
+		return;
+
+	free(command->pattern);
+	pattern_release(command->pinned);
+	memset(command, 0, sizeof(*command));
+	free(command);
+}
+
+static void drop(struct command *command)
+{
+	rs_dll_remove(&commands.pending, &command->node);
+	command_destroy(command);
+	commands.dropped++;
+}
+
+/* the patterns which are compared must be on the same layer */
+static bool same_support(const struct pattern *p1, const struct pattern *p2)
+{
+	return pattern_get_layer(p1) == pattern_get_layer(p2) &&
+			patterns_have_same_support(p1, p2);
+}
+
+static bool overlap(const struct pattern *p1, const struct pattern *p2)
+{
+	return pattern_get_layer(p1) == pattern_get_layer(p2) &&
+			patterns_intersect(p1, p2);
+}
+
+/* NULL if not a set_pattern command or if the pattern is unknown */
+static const struct pattern *get_pattern(struct rs_node *node)
+{
+	struct command *command = to_command(node);
+
+	if (command->type != COMMAND_SET_PATTERN)
+		return NULL;
+
+	return pattern_get(command->pattern);
+}
+
+/*
+ * on a given support, a pattern replaces the one playing and, if not resumed,
+ * discards the one it had interrupted, the patterns set before on the same
+ * support are useless then. And setting the pattern playing does nothing.
+ * Only the commands after the last pattern with some leds in common, but not
+ * all, are considered, since its outcome depends on the pattern playing on the
+ * support. When one of the commands dropped set another pattern, the new one
+ * must restart even if playing, as it would have after the other one. Returns
+ * true if the new pattern is useless itself
+ */
+static bool reduce_patterns(const struct pattern *pattern,
+		struct command *command)
+{
+	struct rs_node *node = NULL;
+	struct rs_node *next;
+	struct rs_node *barrier = NULL;
+	struct rs_node *last = NULL;
+	const struct pattern *other;
+
+	/* those ones don't compete for leds */
+	if (led_set_is_empty(pattern_get_led_set(pattern)))
+		return false;
+
+	while ((node = rs_dll_next_from(&commands.pending, node))) {
+		other = get_pattern(node);
+		if (other == NULL || !overlap(pattern, other))
+			continue;
+		if (same_support(pattern, other)) {
+			last = node;
+		} else {
+			barrier = node;
+			last = NULL;
+		}
+	}
+	if (last != NULL && get_pattern(last) == pattern)
+		return true;
+	if (command->resume)
+		return false;
+
+	for (node = rs_dll_next_from(&commands.pending, barrier); node != NULL;
+			node = next) {
+		next = rs_dll_next_from(&commands.pending, node);
+		other = get_pattern(node);
+		if (other == NULL || !same_support(pattern, other))
+			continue;
+		if (other != pattern || to_command(node)->restart)
+			command->restart = true;
+		drop(to_command(node));
+	}
+
+	return false;
+}
+
+/* queues a command, reducing the pending ones, can't fail */
+static void submit(struct command *command)
+{
+	struct rs_node *node = NULL;
+	const struct pattern *pattern;
+
+	if (command->type == COMMAND_SET_PATTERN) {
+		/* unknown patterns are reported when applied */
+		pattern = pattern_get(command->pattern);
+		if (pattern != NULL && reduce_patterns(pattern, command)) {
+			command_destroy(command);
+			commands.dropped++;
+			return;
+		}
+	} else if (command->type == COMMAND_SET_VALUE) {
+		/* the value set last stays, whatever is in between */
+		while ((node = rs_dll_next_from(&commands.pending, node)))
+			if (to_command(node)->type == COMMAND_SET_VALUE &&
+					to_command(node)->channel ==
+					command->channel)
+				break;
+		if (node != NULL) {
+			to_command(node)->value = command->value;
+			to_command(node)->batch = command->batch;
+			rs_dll_remove(&commands.pending, node);
+			rs_dll_enqueue(&commands.pending, node);
+			command_destroy(command);
+			commands.dropped++;
+			return;
+		}
+	}
+
+	rs_dll_enqueue(&commands.pending, &command->node);
+}
+
+/* the commands of a batch are submitted once all of them could be created */
+static void queue(struct command *command)
+{
+	commands.received++;
+	command->seq = ++commands.seq;
+	if (commands.staging)
+		rs_dll_enqueue(&commands.staged, &command->node);
+	else
+		submit(command);
+}
+
+int commands_set_pattern(const char *pattern_name, bool resume)
+{
+	struct command *command;
+
+	if (ut_string_is_invalid(pattern_name))
+		return -EINVAL;
+
+	command = calloc(1, sizeof(*command));
+	if (command == NULL)
+		return -errno;
+	command->type = COMMAND_SET_PATTERN;
+	command->pattern = strdup(pattern_name);
+	if (command->pattern == NULL) {
+		command_destroy(command);
+		return -errno;
+	}
+	command->resume = resume;
+	queue(command);
+
+	return 0;
+}
+
+int commands_set_pinned_pattern(const struct pattern *pattern, bool resume)
+{
+	struct command *command;
+
+	if (pattern == NULL)
+		return -EINVAL;
+
+	command = calloc(1, sizeof(*command));
+	if (command == NULL) {
+		pattern_release(pattern);
+		return -errno;
+	}
+	command->type = COMMAND_SET_PATTERN;
+	command->pinned = pattern;
+	command->pattern = strdup(pattern_get_name(pattern));
+	if (command->pattern == NULL) {
+		command_destroy(command);
+		return -errno;
+	}
+	command->resume = resume;
+	queue(command);
+
+	return 0;
+}
+
+static int check_pattern(struct rs_dll *list, const struct pattern *pattern)
+{
+	struct rs_node *node = NULL;
+	const struct pattern *other;
+
+	while ((node = rs_dll_next_from(list, node))) {
+		other = get_pattern(node);
+		if (other != NULL && overlap(pattern, other) &&
+				!same_support(pattern, other))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+int commands_check_pattern(const struct pattern *pattern)
+{
+	int ret;
+
+	if (pattern == NULL)
+		return -EINVAL;
+
+	ret = check_pattern(&commands.pending, pattern);
+	if (ret < 0)
+		return ret;
+
+	return check_pattern(&commands.staged, pattern);
+}
+
+int commands_set_value(struct led_channel *channel, uint8_t value)
+{
+	struct command *command;
+
+	if (channel == NULL)
+		return -EINVAL;
+
+	command = calloc(1, sizeof(*command));
+	if (command == NULL)
+		return -errno;
+	command->type = COMMAND_SET_VALUE;
+	command->channel = channel;
+	command->value = value;
+	queue(command);
+
+	return 0;
+}
+
+void commands_begin_batch(void)
+{
+	commands.staging = true;
+}
+
+uint64_t commands_end_batch(bool apply)
+{
+	struct rs_node *node;
+	uint64_t batch = ++commands.seq;
+
+	commands.staging = false;
+	while ((node = rs_dll_pop(&commands.staged))) {
+		if (apply) {
+			to_command(node)->batch = batch;
+			submit(to_command(node));
+		} else {
+			command_destroy(to_command(node));
+			commands.dropped++;
+		}
+	}
+
+	return batch;
+}
+
+int commands_live_frame(struct live_source *live)
+{
+	struct command *command;
+
+	if (live == NULL)
+		return -EINVAL;
+
+	commands.received++;
+	command = calloc(1, sizeof(*command));
+	if (command == NULL)
+		return -errno;
+	command->type = COMMAND_LIVE_FRAME;
+	command->seq = ++commands.seq;
+	command->live = live;
+	rs_dll_enqueue(&commands.pending, &command->node);
+
+	return 0;
+}
+
+void commands_drop_live(struct live_source *live)
+{
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&commands.pending, node)))
+		if (to_command(node)->type == COMMAND_LIVE_FRAME &&
+				to_command(node)->live == live) {
+			drop(to_command(node));
+			return;
+		}
+}
+
+bool commands_are_pending(void)
+{
+	return !rs_dll_is_empty(&commands.pending);
+}
+
+bool commands_batch_is_pending(uint64_t batch)
+{
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&commands.pending, node)))
+		if (to_command(node)->seq < batch)
+			return true;
+
+	return false;
+}
+
+struct command *commands_pop(void)
+{
+	struct rs_node *node;
+
+	node = rs_dll_pop(&commands.pending);
+
+	return node == NULL ? NULL : to_command(node);
+}
+
+void commands_dump_stats(void)
+{
+	ULOGI("commands: %"PRIu64" received, %"PRIu64" dropped, %u pending",
+			commands.received, commands.dropped,
+			rs_dll_get_count(&commands.pending));
+}
+
+void commands_cleanup(void)
+{
+	struct command *command;
+
+	commands_end_batch(false);
+	while ((command = commands_pop()) != NULL)
+		command_destroy(command);
+	memset(&commands, 0, sizeof(commands));
+}
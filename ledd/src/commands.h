@@ -0,0 +1,133 @@
+/**
+ * @file commands.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LEDD_SRC_COMMANDS_H_
+#define LEDD_SRC_COMMANDS_H_
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <rs_node.h>
+
+#include <ledd_plugin.h>
+
+struct live_source;
+struct pattern;
+
+/*
+ * the commands received between two ticks are queued, then applied at once, at
+ * the next tick. When queued, a command drops the ones pending it makes
+ * useless, so that only their net effect is applied.
+ */
+
+enum command_type {
+	COMMAND_SET_PATTERN,
+	COMMAND_SET_VALUE,
+	/* the last frame of a live source is taken when applied */
+	COMMAND_LIVE_FRAME,
+};
+
+struct command {
+	struct rs_node node;
+	enum command_type type;
+	/* order in which the commands are received, from 1 */
+	uint64_t seq;
+	/* batch which the command is part of, 0 if none */
+	uint64_t batch;
+	/* COMMAND_SET_PATTERN only */
+	char *pattern;
+	/* pin on the pattern, if checked when queued, NULL otherwise */
+	const struct pattern *pinned;
+	bool resume;
+	/* the pattern restarts even if playing, set by the reduction */
+	bool restart;
+	/* COMMAND_SET_VALUE only */
+	struct led_channel *channel;
+	uint8_t value;
+	/* COMMAND_LIVE_FRAME only */
+	struct live_source *live;
+};
+
+int commands_init(void);
+
+int commands_set_pattern(const char *pattern, bool resume);
+
+/*
+ * same as commands_set_pattern(), but takes over a pin on the pattern, even on
+ * error, which is kept until the command is destroyed, so that the pattern
+ * stays compiled until applied
+ */
+int commands_set_pinned_pattern(const struct pattern *pattern, bool resume);
+
+/*
+ * returns -EINVAL if the pattern has some leds in common, but not all, with a
+ * pattern pending or staged on the same layer, since it couldn't be set once
+ * the latter is
+ */
+int commands_check_pattern(const struct pattern *pattern);
+
+int commands_set_value(struct led_channel *channel, uint8_t value);
+
+/*
+ * the commands set until commands_end_batch() are kept aside, then queued
+ * together if apply is true, or destroyed, for the batches to be all or nothing
+ * even when one of their commands can't be created
+ */
+void commands_begin_batch(void);
+
+/*
+ * returns the id of the batch, set to its commands, which follows the sequence
+ * numbers of the commands received until then
+ */
+uint64_t commands_end_batch(bool apply);
+
+/* the caller ensures that a live source has one command pending at most */
+int commands_live_frame(struct live_source *live);
+
+/* drops the command pending for a live source, before it is closed */
+void commands_drop_live(struct live_source *live);
+
+bool commands_are_pending(void);
+
+/*
+ * true until the batch is applied, that is, until no command received before
+ * its end is pending, the ones dropped in its favor included
+ */
+bool commands_batch_is_pending(uint64_t batch);
+
+/* returns the oldest command pending, to destroy after use, NULL if none */
+struct command *commands_pop(void);
+
+void command_destroy(struct command *command);
+
+void commands_dump_stats(void);
+
+void commands_cleanup(void);
+
+#endif /* LEDD_SRC_COMMANDS_H_ */
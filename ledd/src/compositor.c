@@ -0,0 +1,471 @@
+/**
+ * @file compositor.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define ULOG_TAG ledd_compositor
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_compositor);
+
+#include <rs_node.h>
+#include <rs_dll.h>
+
+#include <ut_utils.h>
+#include <ut_string.h>
+
+#include <ledd_plugin.h>
+
+#include "led_driver_priv.h"
+
+#include "compositor.h"
+
+struct compositor {
+	struct rs_dll layers[COMPOSITOR_NB_LAYERS];
+	/*
+	 * frame and channels are indexed by slot, the dense index of the led
+	 * channels, plus one scratch slot, for the channels absent from the
+	 * platform, so that the blending loops don't need to test them
+	 */
+	uint32_t nb_slots;
+	uint8_t *frame;
+	struct led_channel **channels;
+	/* slots of the overridden channels, their values and a per slot flag */
+	uint32_t *overrides;
+	uint32_t nb_overrides;
+	uint8_t *override_values;
+	bool *overridden;
+	/* true if the frame must be computed again, from the sources' values */
+	bool dirty;
+};
+
+static struct compositor compositor;
+
+#define to_source(n) ut_container_of((n), struct compositor_source, node)
+
+static const char * const blends[] = {
+		[COMPOSITOR_BLEND_REPLACE] = "replace",
+		[COMPOSITOR_BLEND_MAX] = "max",
+		[COMPOSITOR_BLEND_ADD] = "add",
+		[COMPOSITOR_BLEND_ALPHA] = "alpha",
+};
+
+int compositor_init(void)
+{
+	int ret;
+	uint8_t layer;
+	/* + 1 for the scratch slot */
+	uint32_t nb_slots = led_driver_get_nb_slots() + 1;
+
+	ULOGD("%s", __func__);
+
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++)
+		rs_dll_init(compositor.layers + layer, NULL);
+	compositor.frame = calloc(nb_slots, sizeof(*compositor.frame));
+	compositor.channels = calloc(nb_slots, sizeof(*compositor.channels));
+	compositor.overrides = calloc(nb_slots,
+			sizeof(*compositor.overrides));
+	compositor.override_values = calloc(nb_slots,
+			sizeof(*compositor.override_values));
+	compositor.overridden = calloc(nb_slots,
+			sizeof(*compositor.overridden));
+	if (compositor.frame == NULL || compositor.channels == NULL ||
+			compositor.overrides == NULL ||
+			compositor.override_values == NULL ||
+			compositor.overridden == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		compositor_cleanup();
+		return ret;
+	}
+	compositor.nb_slots = nb_slots - 1;
+
+	return 0;
+}
+
+int compositor_blend_from_str(const char *str)
+{
+	int blend;
+
+	for (blend = 0; blend < COMPOSITOR_BLEND_NB; blend++)
+		if (ut_string_match(str, blends[blend]))
+			return blend;
+
+	return -EINVAL;
+}
+
+const char *compositor_blend_to_str(enum compositor_blend blend)
+{
+	if (blend >= COMPOSITOR_BLEND_NB)
+		return "(invalid)";
+
+	return blends[blend];
+}
+
+int compositor_source_init(struct compositor_source *source, uint32_t capacity,
+		uint8_t layer, enum compositor_blend blend, uint8_t alpha)
+{
+	int ret;
+
+	if (layer >= COMPOSITOR_NB_LAYERS || blend >= COMPOSITOR_BLEND_NB)
+		return -EINVAL;
+
+	memset(source, 0, sizeof(*source));
+	source->layer = layer;
+	source->blend = blend;
+	source->alpha = alpha;
+	if (capacity == 0)
+		return 0;
+
+	source->slots = calloc(capacity, sizeof(*source->slots));
+	source->values = calloc(capacity, sizeof(*source->values));
+	source->front = calloc(capacity, sizeof(*source->front));
+	if (source->slots == NULL || source->values == NULL ||
+			source->front == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		compositor_source_cleanup(source);
+		return ret;
+	}
+	source->capacity = capacity;
+
+	return 0;
+}
+
+int compositor_source_add_channel(struct compositor_source *source,
+		struct led_channel *channel, uint8_t value)
+{
+	uint32_t slot = compositor.nb_slots;
+
+	if (source->nb_channels == source->capacity)
+		return -ENOMEM;
+
+	if (channel != NULL) {
+		slot = led_driver_get_channel_slot(channel);
+		if (slot >= compositor.nb_slots)
+			return -ERANGE;
+		compositor.channels[slot] = channel;
+	}
+	source->slots[source->nb_channels] = slot;
+	source->values[source->nb_channels] = value;
+	source->front[source->nb_channels] = value;
+
+	return source->nb_channels++;
+}
+
+void compositor_invalidate(void)
+{
+	compositor.dirty = true;
+}
+
+static void drop_override(uint32_t slot)
+{
+	uint32_t i;
+
+	if (!compositor.overridden[slot])
+		return;
+
+	compositor.overridden[slot] = false;
+	for (i = 0; i < compositor.nb_overrides; i++)
+		if (compositor.overrides[i] == slot)
+			break;
+	compositor.nb_overrides--;
+	for (; i < compositor.nb_overrides; i++)
+		compositor.overrides[i] = compositor.overrides[i + 1];
+}
+
+void compositor_add_source(struct compositor_source *source)
+{
+	uint32_t i;
+
+	if (source->active)
+		return;
+
+	for (i = 0; i < source->nb_channels; i++)
+		if (source->slots[i] != compositor.nb_slots)
+			drop_override(source->slots[i]);
+	/* a source is shown as it is when added */
+	memcpy(source->front, source->values, source->nb_channels);
+	rs_dll_enqueue(compositor.layers + source->layer, &source->node);
+	source->active = true;
+	compositor.dirty = true;
+}
+
+void compositor_remove_source(struct compositor_source *source)
+{
+	if (!source->active)
+		return;
+
+	rs_dll_remove(compositor.layers + source->layer, &source->node);
+	source->active = false;
+	compositor.dirty = true;
+}
+
+void compositor_source_cleanup(struct compositor_source *source)
+{
+	compositor_remove_source(source);
+	free(source->slots);
+	free(source->values);
+	free(source->front);
+	memset(source, 0, sizeof(*source));
+}
+
+int compositor_override(struct led_channel *channel, uint8_t value)
+{
+	uint32_t slot;
+
+	if (channel == NULL)
+		return -EINVAL;
+	slot = led_driver_get_channel_slot(channel);
+	if (slot >= compositor.nb_slots)
+		return -ERANGE;
+
+	compositor.channels[slot] = channel;
+	compositor.override_values[slot] = value;
+	if (!compositor.overridden[slot]) {
+		compositor.overridden[slot] = true;
+		compositor.overrides[compositor.nb_overrides++] = slot;
+	}
+	compositor.dirty = true;
+
+	return 0;
+}
+
+/*
+ * the blend mode is tested once per source, the loops run over the dense
+ * arrays of the source, with no branch
+ */
+static void blend_source(const struct compositor_source *source, bool front)
+{
+	uint32_t i;
+	uint32_t n = source->nb_channels;
+	const uint32_t *slots = source->slots;
+	const uint8_t *values = front ? source->front : source->values;
+	uint8_t *frame = compositor.frame;
+	unsigned alpha = source->alpha;
+
+	switch (source->blend) {
+	case COMPOSITOR_BLEND_REPLACE:
+		for (i = 0; i < n; i++)
+			frame[slots[i]] = values[i];
+		break;
+
+	case COMPOSITOR_BLEND_MAX:
+		for (i = 0; i < n; i++)
+			frame[slots[i]] = MAX(frame[slots[i]], values[i]);
+		break;
+
+	case COMPOSITOR_BLEND_ADD:
+		for (i = 0; i < n; i++)
+			frame[slots[i]] = MIN(frame[slots[i]] + values[i],
+					UINT8_MAX);
+		break;
+
+	case COMPOSITOR_BLEND_ALPHA:
+		for (i = 0; i < n; i++)
+			frame[slots[i]] = (values[i] * alpha +
+					frame[slots[i]] * (UINT8_MAX - alpha) +
+					UINT8_MAX / 2) / UINT8_MAX;
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* returns the last error */
+static int commit_slot(uint32_t slot, int ret)
+{
+	int err;
+	struct led_channel *channel = compositor.channels[slot];
+
+	/* only stages the value, the drivers are called by led_driver_commit */
+	err = led_driver_set_channel_value(channel, compositor.frame[slot]);
+	if (err < 0) {
+		ULOGW("led_driver_set_channel_value(%s, %s, %"PRIu8"): %s",
+				channel->led->id, channel->id,
+				compositor.frame[slot], strerror(-err));
+		return err;
+	}
+
+	return ret;
+}
+
+/*
+ * computes the frame from the values of the sources, or from the values they
+ * had when last presented, if front is true. Only the channels set by the
+ * active sources are computed, starting from 0, a channel no source sets
+ * anymore keeps its last value
+ */
+static void resolve(bool front)
+{
+	uint8_t layer;
+	uint32_t i;
+	uint32_t slot;
+	struct rs_node *node;
+	struct compositor_source *source;
+
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++) {
+		node = NULL;
+		while ((node = rs_dll_next_from(compositor.layers + layer,
+				node))) {
+			source = to_source(node);
+			for (i = 0; i < source->nb_channels; i++)
+				compositor.frame[source->slots[i]] = 0;
+		}
+	}
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++) {
+		node = NULL;
+		while ((node = rs_dll_next_from(compositor.layers + layer,
+				node)))
+			blend_source(to_source(node), front);
+	}
+	for (i = 0; i < compositor.nb_overrides; i++) {
+		slot = compositor.overrides[i];
+		compositor.frame[slot] = compositor.override_values[slot];
+	}
+}
+
+/* stages the values of the frame, returns the last error */
+static int stage(void)
+{
+	int ret = 0;
+	uint8_t layer;
+	uint32_t i;
+	uint32_t slot;
+	struct rs_node *node;
+	struct compositor_source *source;
+
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++) {
+		node = NULL;
+		while ((node = rs_dll_next_from(compositor.layers + layer,
+				node))) {
+			source = to_source(node);
+			for (i = 0; i < source->nb_channels; i++) {
+				slot = source->slots[i];
+				if (slot != compositor.nb_slots)
+					ret = commit_slot(slot, ret);
+			}
+		}
+	}
+	for (i = 0; i < compositor.nb_overrides; i++)
+		ret = commit_slot(compositor.overrides[i], ret);
+
+	return ret;
+}
+
+void compositor_resolve(void)
+{
+	if (!compositor.dirty)
+		return;
+
+	resolve(false);
+	compositor.dirty = false;
+}
+
+int compositor_present(void)
+{
+	int ret;
+	uint8_t layer;
+	struct rs_node *node;
+	struct compositor_source *source;
+
+	compositor_resolve();
+	ret = stage();
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++) {
+		node = NULL;
+		while ((node = rs_dll_next_from(compositor.layers + layer,
+				node))) {
+			source = to_source(node);
+			memcpy(source->front, source->values,
+					source->nb_channels);
+		}
+	}
+
+	return ret;
+}
+
+int compositor_commit(void)
+{
+	int ret;
+	int err;
+
+	/* the frame computed in advance, if any, is invalidated */
+	resolve(true);
+	compositor.dirty = true;
+	ret = stage();
+	err = led_driver_commit();
+
+	return err < 0 ? err : ret;
+}
+
+void compositor_dump_config(void)
+{
+	uint8_t layer;
+	struct rs_node *node;
+	struct compositor_source *source;
+
+	ULOGI("compositor: %"PRIu32" slots, %"PRIu32" overrides",
+			compositor.nb_slots, compositor.nb_overrides);
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++) {
+		node = NULL;
+		while ((node = rs_dll_next_from(compositor.layers + layer,
+				node))) {
+			source = to_source(node);
+			ULOGI("\tlayer %"PRIu8": %"PRIu32" channels, blend %s, "
+					"alpha %"PRIu8, layer,
+					source->nb_channels,
+					compositor_blend_to_str(source->blend),
+					source->alpha);
+		}
+	}
+}
+
+void compositor_cleanup(void)
+{
+	uint8_t layer;
+
+	ULOGD("%s", __func__);
+
+	for (layer = 0; layer < COMPOSITOR_NB_LAYERS; layer++)
+		while (rs_dll_get_count(compositor.layers + layer) != 0)
+			to_source(rs_dll_pop(compositor.layers +
+					layer))->active = false;
+	free(compositor.frame);
+	free(compositor.channels);
+	free(compositor.overrides);
+	free(compositor.override_values);
+	free(compositor.overridden);
+	memset(&compositor, 0, sizeof(compositor));
+}
@@ -0,0 +1,145 @@
+/**
+ * @file compositor.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LEDD_SRC_COMPOSITOR_H_
+#define LEDD_SRC_COMPOSITOR_H_
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <rs_node.h>
+
+#include <ledd_plugin.h>
+
+/*
+ * the compositor resolves the values of the streams playing into one frame,
+ * before the led channels are set. The streams are sources, stacked on layers,
+ * the higher layers being blended over the lower ones, each channel being
+ * computed from the sources setting it only.
+ */
+
+/* layers are in [0, COMPOSITOR_NB_LAYERS), 0 being the lowest */
+#define COMPOSITOR_NB_LAYERS 8
+
+enum compositor_blend {
+	/* the value of the source is taken as is */
+	COMPOSITOR_BLEND_REPLACE,
+	/* the highest value of the source and of the layers below is taken */
+	COMPOSITOR_BLEND_MAX,
+	/* values of the source and of the layers below are added, saturated */
+	COMPOSITOR_BLEND_ADD,
+	/* the value of the source is mixed with the layers' below, by alpha */
+	COMPOSITOR_BLEND_ALPHA,
+
+	COMPOSITOR_BLEND_NB,
+};
+
+struct compositor_source {
+	/* in the sources of its layer, in insertion order */
+	struct rs_node node;
+	uint8_t layer;
+	enum compositor_blend blend;
+	/* weight of the source's values, for COMPOSITOR_BLEND_ALPHA */
+	uint8_t alpha;
+	/* true if added to the compositor */
+	bool active;
+	/* dense arrays of the channels set by the source and of their values */
+	uint32_t nb_channels;
+	uint32_t capacity;
+	uint32_t *slots;
+	uint8_t *values;
+	/* values when the frame was last presented, values may be ahead */
+	uint8_t *front;
+};
+
+int compositor_init(void);
+
+int compositor_blend_from_str(const char *str);
+
+const char *compositor_blend_to_str(enum compositor_blend blend);
+
+int compositor_source_init(struct compositor_source *source, uint32_t capacity,
+		uint8_t layer, enum compositor_blend blend, uint8_t alpha);
+
+/*
+ * appends a channel to the source, NULL for a channel absent from the platform,
+ * whose value will be ignored. Returns the index of the channel's value in
+ * source->values, or a negative errno-compatible value on error
+ */
+int compositor_source_add_channel(struct compositor_source *source,
+		struct led_channel *channel, uint8_t value);
+
+/* must be called after source->values is modified, if the source is active */
+void compositor_invalidate(void);
+
+/*
+ * activates the source, on top of its layer. The overrides of the channels it
+ * sets are dropped
+ */
+void compositor_add_source(struct compositor_source *source);
+
+void compositor_remove_source(struct compositor_source *source);
+
+/* removes the source if active and frees its arrays */
+void compositor_source_cleanup(struct compositor_source *source);
+
+/*
+ * sets a channel's value over all the layers, until a source setting it is
+ * added
+ */
+int compositor_override(struct led_channel *channel, uint8_t value);
+
+/*
+ * the frame can be computed in advance from the values of the sources, with
+ * compositor_resolve(), then presented at its deadline, with
+ * compositor_present(), which only sets the value of the channels and marks
+ * the sources' values as the ones shown
+ */
+void compositor_resolve(void);
+
+/*
+ * computes the frame if not done yet, then sets the value of the channels, the
+ * caller must commit them to the drivers. Returns the last error
+ */
+int compositor_present(void);
+
+/*
+ * sets the channels to a frame computed from the values the sources had when
+ * last presented, or when added, and commits the ones which changed to their
+ * drivers, immediately. To be used when the sources or overrides change
+ * between two presentations, the frame computed in advance is invalidated.
+ * Returns the last error
+ */
+int compositor_commit(void);
+
+void compositor_dump_config(void);
+
+void compositor_cleanup(void);
+
+#endif /* LEDD_SRC_COMPOSITOR_H_ */
@@ -0,0 +1,700 @@
+/**
+ * @file channel_values.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <sys/param.h> /* for MIN */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#define ULOG_TAG ledd_channel_values
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_channel_values);
+
+#include <ut_string.h>
+#include <ut_utils.h>
+
+#include "channel_values.h"
+#include "global.h"
+#include "transitions_priv.h"
+
+static const char * const storage_names[] = {
+	[CHANNEL_VALUES_STORAGE_DENSE] = "dense",
+	[CHANNEL_VALUES_STORAGE_COMPRESSED] = "compressed",
+};
+
+/* channel values shared between all the pattern channels computing to them */
+struct shared_values {
+	struct channel_values v;
+	uint32_t hash;
+	unsigned refcount;
+	struct shared_values *next;
+};
+
+#define to_shared(v) ut_container_of((v), struct shared_values, v)
+
+#define SHARED_VALUES_MIN_BUCKETS 64
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/* hash table of the shared values, chained by hash */
+static struct shared_values **buckets;
+static uint32_t nb_buckets;
+static uint32_t nb_shared;
+/* total size of the shared values */
+static size_t shared_size;
+
+static bool frame_is_transition(const struct pattern_frame *frame)
+{
+	return frame->value >= 0x100;
+}
+
+static int frame_to_segment(const struct pattern_frame *frames,
+		unsigned nb_frames, unsigned i, struct channel_segment *segment)
+{
+	int ret;
+	const struct pattern_frame *frame = frames + i;
+
+	memset(segment, 0, sizeof(*segment));
+	if (!frame_is_transition(frame)) {
+		segment->value = frame->value;
+		return 0;
+	}
+
+	/* transition: need to get start and end values */
+	if (transition_get(frame->value) == NULL) {
+		ret = -errno;
+		ULOGE("transition %"PRIu16" missing: %m", frame->value);
+		return ret;
+	}
+	segment->transition = frame->value;
+	segment->value = (frame - 1)->value;
+	segment->end_value = frames[(i + 1) % nb_frames].value;
+
+	return 0;
+}
+
+/* merges consecutive constant segments with the same value */
+static uint32_t append_segment(struct channel_segment *segments,
+		uint32_t nb_segments, struct channel_segment *last,
+		const struct channel_segment *segment)
+{
+	if (nb_segments != 0 && last->transition == 0 &&
+			segment->transition == 0 &&
+			last->value == segment->value) {
+		last->length += segment->length;
+		if (segments != NULL)
+			segments[nb_segments - 1].length = last->length;
+		return nb_segments;
+	}
+
+	*last = *segment;
+	if (segments != NULL)
+		segments[nb_segments] = *segment;
+
+	return nb_segments + 1;
+}
+
+/*
+ * stores the segments in segments if not NULL, returns the number of segments
+ * found or a negative errno-compatible value on error
+ */
+static int find_segments(const struct pattern_frame *frames,
+		unsigned nb_frames, uint32_t nb_values,
+		struct channel_segment *segments)
+{
+	int ret;
+	unsigned i;
+	uint32_t nb_segments = 0;
+	uint32_t start = 0;
+	uint32_t length;
+	uint32_t granularity = global_get_granularity();
+	struct channel_segment segment;
+	struct channel_segment last;
+
+	if (nb_frames != 0 && frame_is_transition(frames)) {
+		ULOGE("a pattern can't start with a transition");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nb_frames && start < nb_values; i++) {
+		length = MIN(frames[i].duration / granularity,
+				nb_values - start);
+		if (length == 0)
+			continue;
+		ret = frame_to_segment(frames, nb_frames, i, &segment);
+		if (ret < 0)
+			return ret;
+		segment.start = start;
+		segment.length = length;
+		nb_segments = append_segment(segments, nb_segments, &last,
+				&segment);
+		start += length;
+	}
+
+	/* channels shorter than the pattern are completed with zeroes */
+	if (start < nb_values) {
+		memset(&segment, 0, sizeof(segment));
+		segment.start = start;
+		segment.length = nb_values - start;
+		nb_segments = append_segment(segments, nb_segments, &last,
+				&segment);
+	}
+
+	return nb_segments;
+}
+
+/* resolves the transition of each segment, for the compressed storage */
+static int resolve_transitions(struct channel_values *v)
+{
+	int ret;
+	uint32_t i;
+	uint16_t id;
+
+	if (v->segments == NULL || v->transitions != NULL)
+		return 0;
+
+	v->transitions = calloc(v->nb_segments, sizeof(*v->transitions));
+	if (v->transitions == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		return ret;
+	}
+	for (i = 0; i < v->nb_segments; i++) {
+		id = v->segments[i].transition;
+		if (id == 0)
+			continue;
+		v->transitions[i] = transition_get(id);
+		if (v->transitions[i] == NULL) {
+			ret = -errno;
+			ULOGE("transition %"PRIu16" missing: %m", id);
+			free(v->transitions);
+			v->transitions = NULL;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static uint8_t segment_get(const struct channel_values *v, uint32_t position,
+		uint32_t index)
+{
+	const struct channel_segment *segment = v->segments + position;
+
+	if (segment->transition == 0)
+		return segment->value;
+
+	return transition_compute(v->transitions[position], segment->length,
+			index - segment->start, segment->value,
+			segment->end_value);
+}
+
+/* stores the runs in runs if not NULL, returns the number of runs found */
+static uint32_t find_runs(const uint8_t *values, uint32_t nb_values,
+		struct pattern_run *runs)
+{
+	uint32_t i;
+	uint32_t start = 0;
+	uint32_t nb_runs = 0;
+
+	for (i = 1; i <= nb_values; i++) {
+		if (i < nb_values && values[i] == values[start])
+			continue;
+		if (i - start >= 2) {
+			if (runs != NULL) {
+				runs[nb_runs].start = start;
+				runs[nb_runs].end = i;
+			}
+			nb_runs++;
+		}
+		start = i;
+	}
+
+	return nb_runs;
+}
+
+static int compute_runs(struct channel_values *v)
+{
+	int ret;
+
+	v->nb_runs = find_runs(v->values, v->nb_values, NULL);
+	if (v->nb_runs == 0)
+		return 0;
+	v->runs = calloc(v->nb_runs, sizeof(*v->runs));
+	if (v->runs == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		return ret;
+	}
+	find_runs(v->values, v->nb_values, v->runs);
+
+	return 0;
+}
+
+/* expands the segments in a table of values, then drops them */
+static int expand_segments(struct channel_values *v)
+{
+	int ret;
+	uint32_t i;
+	uint32_t j;
+	const struct channel_segment *segment;
+
+	v->values = calloc(v->nb_values, sizeof(*v->values));
+	if (v->values == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		return ret;
+	}
+	for (i = 0; i < v->nb_segments; i++) {
+		segment = v->segments + i;
+		for (j = segment->start; j < segment->start + segment->length;
+				j++)
+			v->values[j] = segment_get(v, i, j);
+	}
+	free(v->segments);
+	v->segments = NULL;
+	free(v->transitions);
+	v->transitions = NULL;
+
+	return compute_runs(v);
+}
+
+int channel_values_check(const struct pattern_frame *frames,
+		unsigned nb_frames, uint32_t nb_values)
+{
+	int ret;
+
+	ret = find_segments(frames, nb_frames, nb_values, NULL);
+
+	return ret < 0 ? ret : 0;
+}
+
+int channel_values_init(struct channel_values *v,
+		const struct pattern_frame *frames, unsigned nb_frames,
+		uint32_t nb_values, enum channel_values_storage storage)
+{
+	int ret;
+
+	memset(v, 0, sizeof(*v));
+	v->storage = storage;
+	v->nb_values = nb_values;
+
+	ret = find_segments(frames, nb_frames, nb_values, NULL);
+	if (ret < 0)
+		return ret;
+	v->nb_segments = ret;
+	if (v->nb_segments == 0)
+		return 0;
+
+	v->segments = calloc(v->nb_segments, sizeof(*v->segments));
+	if (v->segments == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		return ret;
+	}
+	find_segments(frames, nb_frames, nb_values, v->segments);
+	ret = resolve_transitions(v);
+	if (ret < 0) {
+		channel_values_cleanup(v);
+		return ret;
+	}
+
+	if (storage == CHANNEL_VALUES_STORAGE_DENSE) {
+		ret = expand_segments(v);
+		if (ret < 0) {
+			channel_values_cleanup(v);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+uint32_t channel_values_seek(const struct channel_values *v, uint32_t index)
+{
+	uint32_t lo = 0;
+	uint32_t hi = v->nb_segments;
+	uint32_t mid;
+
+	if (v->storage == CHANNEL_VALUES_STORAGE_DENSE || hi == 0)
+		return 0;
+
+	/* look for the last segment starting at or before index */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (v->segments[mid].start <= index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo == 0 ? 0 : lo - 1;
+}
+
+uint32_t channel_values_advance(const struct channel_values *v,
+		uint32_t position, uint32_t index)
+{
+	if (v->storage == CHANNEL_VALUES_STORAGE_DENSE)
+		return 0;
+
+	while (position + 1 < v->nb_segments &&
+			v->segments[position + 1].start <= index)
+		position++;
+
+	return position;
+}
+
+uint8_t channel_values_get(const struct channel_values *v, uint32_t index,
+		uint32_t position)
+{
+	if (index >= v->nb_values)
+		return 0;
+
+	if (v->storage == CHANNEL_VALUES_STORAGE_DENSE)
+		return v->values[index];
+
+	return segment_get(v, position, index);
+}
+
+static uint32_t dense_next_change(const struct channel_values *v,
+		uint32_t index)
+{
+	uint32_t lo = 0;
+	uint32_t hi = v->nb_runs;
+	uint32_t mid;
+	const struct pattern_run *run;
+
+	/* look for the last run starting before index */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (v->runs[mid].start < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return index;
+	run = v->runs + lo - 1;
+
+	return run->end > index ? run->end : index;
+}
+
+uint32_t channel_values_next_change(const struct channel_values *v,
+		uint32_t index, uint32_t position)
+{
+	const struct channel_segment *segment;
+
+	if (v->storage == CHANNEL_VALUES_STORAGE_DENSE)
+		return dense_next_change(v, index);
+
+	if (v->nb_segments == 0)
+		return index;
+
+	/*
+	 * only constant segments are known not to change, a transition may
+	 * produce the same value for consecutive indexes, but waking up early
+	 * is harmless
+	 */
+	segment = v->segments + position;
+	if (segment->transition != 0 || index <= segment->start)
+		return index;
+
+	return segment->start + segment->length;
+}
+
+size_t channel_values_get_size(const struct channel_values *v,
+		enum channel_values_storage storage)
+{
+	if (storage == CHANNEL_VALUES_STORAGE_DENSE)
+		return v->nb_values * sizeof(*v->values);
+
+	return v->nb_segments * sizeof(*v->segments);
+}
+
+const char *channel_values_storage_to_str(enum channel_values_storage storage)
+{
+	if (storage > CHANNEL_VALUES_STORAGE_COMPRESSED)
+		return "(unknown)";
+
+	return storage_names[storage];
+}
+
+int channel_values_storage_from_str(const char *str)
+{
+	enum channel_values_storage storage;
+
+	for (storage = CHANNEL_VALUES_STORAGE_DENSE;
+			storage <= CHANNEL_VALUES_STORAGE_COMPRESSED; storage++)
+		if (ut_string_match(str, storage_names[storage]))
+			return storage;
+
+	return -EINVAL;
+}
+
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/* hashes field by field, the padding of the structures is undefined */
+uint32_t channel_values_hash(const struct channel_values *v)
+{
+	uint32_t i;
+	uint32_t hash = FNV_OFFSET_BASIS;
+	const struct channel_segment *segment;
+
+	hash = hash_bytes(hash, &v->storage, sizeof(v->storage));
+	hash = hash_bytes(hash, &v->nb_values, sizeof(v->nb_values));
+	if (v->storage == CHANNEL_VALUES_STORAGE_DENSE)
+		return hash_bytes(hash, v->values, v->nb_values);
+
+	for (i = 0; i < v->nb_segments; i++) {
+		segment = v->segments + i;
+		hash = hash_bytes(hash, &segment->start,
+				sizeof(segment->start));
+		hash = hash_bytes(hash, &segment->length,
+				sizeof(segment->length));
+		hash = hash_bytes(hash, &segment->transition,
+				sizeof(segment->transition));
+		hash = hash_bytes(hash, &segment->value,
+				sizeof(segment->value));
+		hash = hash_bytes(hash, &segment->end_value,
+				sizeof(segment->end_value));
+	}
+
+	return hash;
+}
+
+static bool segments_equal(const struct channel_segment *s1,
+		const struct channel_segment *s2)
+{
+	return s1->start == s2->start && s1->length == s2->length &&
+			s1->transition == s2->transition &&
+			s1->value == s2->value &&
+			s1->end_value == s2->end_value;
+}
+
+static bool channel_values_equal(const struct channel_values *v1,
+		const struct channel_values *v2)
+{
+	uint32_t i;
+
+	if (v1->storage != v2->storage || v1->nb_values != v2->nb_values ||
+			v1->nb_segments != v2->nb_segments)
+		return false;
+
+	/* e.g. the same table of a mapped file, shared a second time */
+	if (v1->values == v2->values && v1->segments == v2->segments)
+		return true;
+
+	if (v1->storage == CHANNEL_VALUES_STORAGE_DENSE)
+		return v1->nb_values == 0 ||
+				memcmp(v1->values, v2->values,
+						v1->nb_values) == 0;
+
+	for (i = 0; i < v1->nb_segments; i++)
+		if (!segments_equal(v1->segments + i, v2->segments + i))
+			return false;
+
+	return true;
+}
+
+static int grow_buckets(void)
+{
+	int ret;
+	uint32_t i;
+	uint32_t new_nb_buckets;
+	struct shared_values **new_buckets;
+	struct shared_values *shared;
+	struct shared_values *next;
+
+	new_nb_buckets = nb_buckets == 0 ? SHARED_VALUES_MIN_BUCKETS :
+			2 * nb_buckets;
+	new_buckets = calloc(new_nb_buckets, sizeof(*new_buckets));
+	if (new_buckets == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		return ret;
+	}
+	for (i = 0; i < nb_buckets; i++) {
+		for (shared = buckets[i]; shared != NULL; shared = next) {
+			next = shared->next;
+			shared->next = new_buckets[shared->hash &
+					(new_nb_buckets - 1)];
+			new_buckets[shared->hash & (new_nb_buckets - 1)] =
+					shared;
+		}
+	}
+	free(buckets);
+	buckets = new_buckets;
+	nb_buckets = new_nb_buckets;
+
+	return 0;
+}
+
+const struct channel_values *channel_values_share(struct channel_values *v)
+{
+	return channel_values_share_hashed(v, channel_values_hash(v));
+}
+
+const struct channel_values *channel_values_share_hashed(
+		struct channel_values *v, uint32_t hash)
+{
+	int ret;
+	struct shared_values *shared;
+	struct shared_values **bucket;
+
+	if (nb_buckets != 0) {
+		bucket = buckets + (hash & (nb_buckets - 1));
+		for (shared = *bucket; shared != NULL; shared = shared->next) {
+			if (shared->hash != hash ||
+					!channel_values_equal(&shared->v, v))
+				continue;
+			shared->refcount++;
+			channel_values_cleanup(v);
+			return &shared->v;
+		}
+	}
+
+	if (nb_shared >= nb_buckets) {
+		ret = grow_buckets();
+		if (ret < 0) {
+			channel_values_cleanup(v);
+			errno = -ret;
+			return NULL;
+		}
+	}
+	ret = resolve_transitions(v);
+	if (ret < 0) {
+		channel_values_cleanup(v);
+		errno = -ret;
+		return NULL;
+	}
+	shared = calloc(1, sizeof(*shared));
+	if (shared == NULL) {
+		ret = errno;
+		ULOGE("calloc: %m");
+		channel_values_cleanup(v);
+		errno = ret;
+		return NULL;
+	}
+	/* the content of v is moved into the shared values */
+	shared->v = *v;
+	memset(v, 0, sizeof(*v));
+	shared->hash = hash;
+	shared->refcount = 1;
+	bucket = buckets + (hash & (nb_buckets - 1));
+	shared->next = *bucket;
+	*bucket = shared;
+	nb_shared++;
+	shared_size += channel_values_get_size(&shared->v, shared->v.storage);
+
+	return &shared->v;
+}
+
+void channel_values_release(const struct channel_values *v)
+{
+	struct shared_values *shared;
+	struct shared_values **link;
+
+	if (v == NULL)
+		return;
+
+	shared = to_shared(v);
+	if (--shared->refcount != 0)
+		return;
+
+	link = buckets + (shared->hash & (nb_buckets - 1));
+	while (*link != shared)
+		link = &(*link)->next;
+	*link = shared->next;
+	shared_size -= channel_values_get_size(&shared->v, shared->v.storage);
+	channel_values_cleanup(&shared->v);
+	free(shared);
+
+	nb_shared--;
+	if (nb_shared == 0) {
+		free(buckets);
+		buckets = NULL;
+		nb_buckets = 0;
+	}
+}
+
+uint32_t channel_values_get_hash(const struct channel_values *v)
+{
+	return to_shared(v)->hash;
+}
+
+size_t channel_values_get_total_size(void)
+{
+	return shared_size;
+}
+
+void channel_values_get_sharing_stats(size_t *unique, size_t *shared,
+		size_t *saved)
+{
+	uint32_t i;
+	size_t size;
+	const struct shared_values *s;
+
+	*unique = *shared = *saved = 0;
+	for (i = 0; i < nb_buckets; i++) {
+		for (s = buckets[i]; s != NULL; s = s->next) {
+			size = channel_values_get_size(&s->v, s->v.storage);
+			if (s->refcount == 1) {
+				*unique += size;
+			} else {
+				*shared += size;
+				*saved += (s->refcount - 1) * size;
+			}
+		}
+	}
+}
+
+void channel_values_cleanup(struct channel_values *v)
+{
+	if (!v->mapped) {
+		free(v->values);
+		free(v->runs);
+		free(v->segments);
+	}
+	free(v->transitions);
+	memset(v, 0, sizeof(*v));
+}
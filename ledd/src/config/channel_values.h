@@ -0,0 +1,177 @@
+/**
+ * @file channel_values.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SRC_CHANNEL_VALUES_H_
+#define SRC_CHANNEL_VALUES_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct transition;
+
+/* frame as read from patterns.conf, values >= 0x100 are transitions ids */
+struct pattern_frame {
+	uint16_t value;
+	uint16_t duration;
+};
+
+enum channel_values_storage {
+	/* one byte per value index, O(1) random access */
+	CHANNEL_VALUES_STORAGE_DENSE,
+	/* segments, O(log(nb_segments)) random access */
+	CHANNEL_VALUES_STORAGE_COMPRESSED,
+};
+
+/* run of identical values, [start, end) */
+struct pattern_run {
+	uint32_t start;
+	uint32_t end;
+};
+
+/*
+ * [start, start + length) span of value indexes, either constant, or computed
+ * by a transition from value to end_value
+ */
+struct channel_segment {
+	uint32_t start;
+	uint32_t length;
+	/* transition id, 0 for a constant segment, no pointer, can be mapped */
+	uint16_t transition;
+	uint8_t value;
+	uint8_t end_value;
+};
+
+struct channel_values {
+	enum channel_values_storage storage;
+	uint32_t nb_values;
+	/* number of segments the channel decomposes in, whatever the storage */
+	uint32_t nb_segments;
+
+	/* dense storage, indexes x granularity = time in ms */
+	uint8_t *values;
+	/*
+	 * runs of at least 2 identical values, sorted, used to know when the
+	 * value of a channel will change next, dense storage only
+	 */
+	struct pattern_run *runs;
+	uint32_t nb_runs;
+
+	/* compressed storage, sorted, covering [0, nb_values) */
+	struct channel_segment *segments;
+	/*
+	 * transition of each segment, NULL for the constant ones, resolved once
+	 * so that reading a value doesn't look it up, always owned
+	 */
+	const struct transition **transitions;
+
+	/* if true, the tables aren't owned, e.g. they are in a mapped file */
+	bool mapped;
+};
+
+/* checks that channel_values_init() would succeed, without computing anything */
+int channel_values_check(const struct pattern_frame *frames,
+		unsigned nb_frames, uint32_t nb_values);
+
+/*
+ * computes the nb_values values of a channel from its frames, values past the
+ * end of the frames are 0
+ */
+int channel_values_init(struct channel_values *v,
+		const struct pattern_frame *frames, unsigned nb_frames,
+		uint32_t nb_values, enum channel_values_storage storage);
+
+/*
+ * the position is a storage-specific hint, which allows to read the values
+ * sequentially without searching for them, it must be initialized with
+ * channel_values_seek(), then kept in sync with channel_values_advance()
+ */
+uint32_t channel_values_seek(const struct channel_values *v, uint32_t index);
+
+/* index must be greater or equal than the one position has been computed for */
+uint32_t channel_values_advance(const struct channel_values *v,
+		uint32_t position, uint32_t index);
+
+uint8_t channel_values_get(const struct channel_values *v, uint32_t index,
+		uint32_t position);
+
+/*
+ * returns the first value index >= index whose value differs from the one at
+ * index - 1, or index if it can't be known cheaply
+ */
+uint32_t channel_values_next_change(const struct channel_values *v,
+		uint32_t index, uint32_t position);
+
+/* size in bytes of the values tables, for a given storage */
+size_t channel_values_get_size(const struct channel_values *v,
+		enum channel_values_storage storage);
+
+const char *channel_values_storage_to_str(enum channel_values_storage storage);
+
+/* returns a negative errno-compatible value if str is not a valid storage */
+int channel_values_storage_from_str(const char *str);
+
+/*
+ * returns the shared values with the same content as v, creating them if they
+ * don't exist yet, the transitions of segments loaded as is, e.g. from a mapped
+ * file, being resolved then. In all cases, the content of v is either moved or
+ * released. Returns NULL with errno set on error.
+ */
+const struct channel_values *channel_values_share(struct channel_values *v);
+
+/*
+ * hash of the content of v, as used by channel_values_share(), which, unlike
+ * the sharing itself, can be computed concurrently
+ */
+uint32_t channel_values_hash(const struct channel_values *v);
+
+/* same as channel_values_share(), with the hash of v known in advance */
+const struct channel_values *channel_values_share_hashed(
+		struct channel_values *v, uint32_t hash);
+
+/* hash of shared values, stable as long as the layout of the tables is */
+uint32_t channel_values_get_hash(const struct channel_values *v);
+
+/* drops a reference on shared values, freeing them when unused, NULL is ok */
+void channel_values_release(const struct channel_values *v);
+
+/* size in bytes of all the shared values */
+size_t channel_values_get_total_size(void);
+
+/*
+ * reports the sizes of the shared values referenced once (unique), of those
+ * referenced more than once (shared) and of the copies avoided (saved)
+ */
+void channel_values_get_sharing_stats(size_t *unique, size_t *shared,
+		size_t *saved);
+
+void channel_values_cleanup(struct channel_values *v);
+
+#endif /* SRC_CHANNEL_VALUES_H_ */
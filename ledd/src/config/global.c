@@ -28,6 +28,8 @@
  *
  */
 
+#include <stdlib.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <inttypes.h>
@@ -44,6 +46,7 @@ ULOG_DECLARE_TAG(ledd_global);
 
 #include "global.h"
 #include "utils.h"
+#include "arena_priv.h"
 
 static const int default_granularity = 10;
 static char * const default_platform_config = "/etc/ledd/platform.conf";
@@ -58,6 +61,45 @@ static char *patterns_config;
 static char *startup_pattern;
 static char *plugins_dir;
 static char *address;
+static bool tickless;
+static bool lazy_patterns;
+/* in bytes, 0 for no limit */
+static uint32_t patterns_memory_budget;
+/* compiled patterns cache file, NULL if disabled */
+static char *patterns_cache;
+/* for loading and compiling the patterns, 0 for one per online cpu */
+static uint32_t patterns_threads;
+static enum overrun_policy overrun_policy;
+
+static const char * const overrun_policies[] = {
+		[OVERRUN_POLICY_CATCH_UP] = "catch_up",
+		[OVERRUN_POLICY_SKIP] = "skip",
+};
+/* strings read from the config, released all at once by global_cleanup() */
+static struct arena global_arena;
+
+static char *read_string(lua_State *l)
+{
+	char *str;
+
+	str = arena_strdup(&global_arena, luaL_checkstring(l, -1));
+	if (str == NULL)
+		config_error(l, errno, "arena_strdup");
+
+	return str;
+}
+
+static void read_overrun_policy(lua_State *l)
+{
+	const char *policy = luaL_checkstring(l, -1);
+
+	if (ut_string_match(policy, overrun_policies[OVERRUN_POLICY_CATCH_UP]))
+		overrun_policy = OVERRUN_POLICY_CATCH_UP;
+	else if (ut_string_match(policy, overrun_policies[OVERRUN_POLICY_SKIP]))
+		overrun_policy = OVERRUN_POLICY_SKIP;
+	else
+		luaL_error(l, "unknown overrun policy '%s'", policy);
+}
 
 static int read_global(lua_State *l)
 {
@@ -77,27 +119,18 @@ static int read_global(lua_State *l)
 	lua_pop(l, 1);
 
 	lua_getglobal(l, "platform_config");
-	if (!lua_isnil(l, -1)) {
-		platform_config = strdup(luaL_checkstring(l, -1));
-		if (platform_config == NULL)
-			config_error(l, errno, "strdup");
-	}
+	if (!lua_isnil(l, -1))
+		platform_config = read_string(l);
 	lua_pop(l, 1);
 
 	lua_getglobal(l, "patterns_config");
-	if (!lua_isnil(l, -1)) {
-		patterns_config = strdup(luaL_checkstring(l, -1));
-		if (patterns_config == NULL)
-			config_error(l, errno, "strdup");
-	}
+	if (!lua_isnil(l, -1))
+		patterns_config = read_string(l);
 	lua_pop(l, 1);
 
 	lua_getglobal(l, "startup_pattern");
-	if (!lua_isnil(l, -1)) {
-		startup_pattern = strdup(luaL_checkstring(l, -1));
-		if (startup_pattern == NULL)
-			config_error(l, errno, "strdup");
-	}
+	if (!lua_isnil(l, -1))
+		startup_pattern = read_string(l);
 	lua_pop(l, 1);
 
 	env = getenv(PLUGINS_DIR_ENV);
@@ -105,20 +138,48 @@ static int read_global(lua_State *l)
 		plugins_dir = env;
 	} else {
 		lua_getglobal(l, "plugins_dir");
-		if (!lua_isnil(l, -1)) {
-			plugins_dir = strdup(luaL_checkstring(l, -1));
-			if (plugins_dir == NULL)
-				config_error(l, errno, "strdup");
-		}
+		if (!lua_isnil(l, -1))
+			plugins_dir = read_string(l);
 		lua_pop(l, 1);
 	}
 
 	lua_getglobal(l, "address");
-	if (!lua_isnil(l, -1)) {
-		address = strdup(luaL_checkstring(l, -1));
-		if (address == NULL)
-			config_error(l, errno, "strdup");
-	}
+	if (!lua_isnil(l, -1))
+		address = read_string(l);
+	lua_pop(l, 1);
+
+	lua_getglobal(l, "tickless");
+	tickless = lua_toboolean(l, -1);
+	lua_pop(l, 1);
+
+	lua_getglobal(l, "lazy_patterns");
+	lazy_patterns = lua_toboolean(l, -1);
+	lua_pop(l, 1);
+
+	lua_getglobal(l, "patterns_memory_budget");
+	if (!lua_isnil(l, -1))
+		patterns_memory_budget = luaL_checkunsigned(l, -1);
+	lua_pop(l, 1);
+
+	lua_getglobal(l, "patterns_cache");
+	if (!lua_isnil(l, -1))
+		patterns_cache = read_string(l);
+	lua_pop(l, 1);
+
+	lua_getglobal(l, "patterns_threads");
+	if (!lua_isnil(l, -1))
+		patterns_threads = luaL_checkunsigned(l, -1);
+	lua_pop(l, 1);
+
+	lua_getglobal(l, "overrun_policy");
+	if (!lua_isnil(l, -1))
+		read_overrun_policy(l);
+	lua_pop(l, 1);
+
+	/* used from the next config file read on */
+	lua_getglobal(l, "bytecode_cache_dir");
+	if (!lua_isnil(l, -1))
+		config_set_bytecode_cache_dir(luaL_checkstring(l, -1));
 	lua_pop(l, 1);
 
 	return 0;
@@ -136,6 +197,12 @@ void global_dump_config(void)
 	ULOGI("patterns config directory = %s", patterns_config);
 	ULOGI("startup pattern = %s", startup_pattern);
 	ULOGI("plugins directory = %s", plugins_dir);
+	ULOGI("tickless = %s", tickless ? "true" : "false");
+	ULOGI("lazy patterns = %s", lazy_patterns ? "true" : "false");
+	ULOGI("patterns memory budget = %"PRIu32, patterns_memory_budget);
+	ULOGI("patterns cache = %s", patterns_cache);
+	ULOGI("patterns threads = %"PRIu32, patterns_threads);
+	ULOGI("overrun policy = %s", overrun_policies[overrun_policy]);
 }
 
 uint32_t global_get_granularity(void)
@@ -167,18 +234,48 @@ const char *global_get_address()
 	return address;
 }
 
+bool global_get_tickless(void)
+{
+	return tickless;
+}
+
+bool global_get_lazy_patterns(void)
+{
+	return lazy_patterns;
+}
+
+uint32_t global_get_patterns_memory_budget(void)
+{
+	return patterns_memory_budget;
+}
+
+const char *global_get_patterns_cache(void)
+{
+	return patterns_cache;
+}
+
+uint32_t global_get_patterns_threads(void)
+{
+	return patterns_threads;
+}
+
+enum overrun_policy global_get_overrun_policy(void)
+{
+	return overrun_policy;
+}
+
 void global_cleanup(void)
 {
 	ULOGD("%s", __func__);
 
-	if (address != default_address)
-		ut_string_free(&address);
-	if (plugins_dir != default_plugins_dir)
-		ut_string_free(&plugins_dir);
-	if (startup_pattern != NULL)
-		ut_string_free(&startup_pattern);
-	if (patterns_config != default_patterns_conf)
-		ut_string_free(&patterns_config);
-	if (platform_config != default_platform_config)
-		ut_string_free(&platform_config);
+	address = default_address;
+	plugins_dir = default_plugins_dir;
+	startup_pattern = NULL;
+	patterns_cache = NULL;
+	patterns_threads = 0;
+	overrun_policy = OVERRUN_POLICY_CATCH_UP;
+	config_set_bytecode_cache_dir(NULL);
+	patterns_config = default_patterns_conf;
+	platform_config = default_platform_config;
+	arena_release(&global_arena);
 }
@@ -30,11 +30,20 @@
 
 #ifndef SRC_GLOBAL_H_
 #define SRC_GLOBAL_H_
+#include <stdbool.h>
 
 #ifndef PLUGINS_DIR_ENV
 #define PLUGINS_DIR_ENV "LEDD_PLUGINS_DIR"
 #endif
 
+/* what to do with the ticks missed when the event loop stalled */
+enum overrun_policy {
+	/* played in a burst, the patterns stay in phase with the clock */
+	OVERRUN_POLICY_CATCH_UP,
+	/* dropped, the patterns are delayed by the stall */
+	OVERRUN_POLICY_SKIP,
+};
+
 int global_init(const char *path);
 
 void global_dump_config(void);
@@ -51,6 +60,21 @@ const char *global_get_plugins_dir(void);
 
 const char *global_get_address(void);
 
+bool global_get_tickless(void);
+
+bool global_get_lazy_patterns(void);
+
+/* in bytes, 0 means no limit */
+uint32_t global_get_patterns_memory_budget(void);
+
+/* path of the compiled patterns cache, NULL if disabled */
+const char *global_get_patterns_cache(void);
+
+/* threads loading and compiling the patterns, 0 means one per online cpu */
+uint32_t global_get_patterns_threads(void);
+
+enum overrun_policy global_get_overrun_policy(void);
+
 void global_cleanup(void);
 
 #endif /* SRC_GLOBAL_H_ */
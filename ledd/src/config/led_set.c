@@ -0,0 +1,180 @@
+/**
+ * @file led_set.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <sys/param.h> /* for MIN and MAX */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "led_set.h"
+
+#define BITS_PER_WORD 64
+
+static uint32_t word_of(uint32_t led)
+{
+	return led / BITS_PER_WORD;
+}
+
+static uint64_t bit_of(uint32_t led)
+{
+	return UINT64_C(1) << (led % BITS_PER_WORD);
+}
+
+/* grows the window so that it contains the given word */
+static int led_set_extend(struct led_set *set, uint32_t word)
+{
+	uint32_t first;
+	uint32_t end;
+	uint64_t *words;
+
+	if (set->nb_words == 0) {
+		first = end = word;
+	} else {
+		first = MIN(set->first_word, word);
+		end = MAX(set->first_word + set->nb_words - 1, word);
+	}
+	words = calloc(end - first + 1, sizeof(*words));
+	if (words == NULL)
+		return -errno;
+	if (set->nb_words != 0)
+		memcpy(words + set->first_word - first, set->words,
+				set->nb_words * sizeof(*words));
+	free(set->words);
+	set->words = words;
+	set->first_word = first;
+	set->nb_words = end - first + 1;
+
+	return 0;
+}
+
+static bool led_set_has_word(const struct led_set *set, uint32_t word)
+{
+	return set->nb_words != 0 && word >= set->first_word &&
+			word - set->first_word < set->nb_words;
+}
+
+int led_set_add(struct led_set *set, uint32_t led)
+{
+	int ret;
+	uint32_t word = word_of(led);
+
+	if (!led_set_has_word(set, word)) {
+		ret = led_set_extend(set, word);
+		if (ret < 0)
+			return ret;
+	}
+	set->words[word - set->first_word] |= bit_of(led);
+
+	return 0;
+}
+
+bool led_set_contains(const struct led_set *set, uint32_t led)
+{
+	uint32_t word = word_of(led);
+
+	if (!led_set_has_word(set, word))
+		return false;
+
+	return (set->words[word - set->first_word] & bit_of(led)) != 0;
+}
+
+bool led_set_is_empty(const struct led_set *set)
+{
+	return set->nb_words == 0;
+}
+
+bool led_sets_intersect(const struct led_set *set1,
+		const struct led_set *set2)
+{
+	uint32_t word;
+	uint32_t start;
+	uint32_t end;
+
+	if (led_set_is_empty(set1) || led_set_is_empty(set2))
+		return false;
+
+	start = MAX(set1->first_word, set2->first_word);
+	end = MIN(set1->first_word + set1->nb_words,
+			set2->first_word + set2->nb_words);
+	for (word = start; word < end; word++)
+		if ((set1->words[word - set1->first_word] &
+				set2->words[word - set2->first_word]) != 0)
+			return true;
+
+	return false;
+}
+
+bool led_sets_equal(const struct led_set *set1, const struct led_set *set2)
+{
+	/* windows are tight, equal sets have equal windows */
+	if (set1->first_word != set2->first_word ||
+			set1->nb_words != set2->nb_words)
+		return false;
+
+	return set1->nb_words == 0 || memcmp(set1->words, set2->words,
+			set1->nb_words * sizeof(*set1->words)) == 0;
+}
+
+int64_t led_set_next(const struct led_set *set, uint32_t led)
+{
+	uint32_t word;
+	uint64_t bits;
+
+	if (led_set_is_empty(set))
+		return -1;
+
+	word = word_of(led);
+	if (word < set->first_word) {
+		word = set->first_word;
+		bits = set->words[0];
+	} else if (word - set->first_word < set->nb_words) {
+		bits = set->words[word - set->first_word] &
+				~(bit_of(led) - 1);
+	} else {
+		return -1;
+	}
+
+	while (bits == 0) {
+		word++;
+		if (word - set->first_word >= set->nb_words)
+			return -1;
+		bits = set->words[word - set->first_word];
+	}
+
+	return (int64_t)word * BITS_PER_WORD + __builtin_ctzll(bits);
+}
+
+void led_set_cleanup(struct led_set *set)
+{
+	free(set->words);
+	memset(set, 0, sizeof(*set));
+}
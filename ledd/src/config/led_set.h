@@ -0,0 +1,70 @@
+/**
+ * @file led_set.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SRC_LED_SET_H_
+#define SRC_LED_SET_H_
+#include <inttypes.h>
+#include <stdbool.h>
+
+/*
+ * set of leds, given their dense index. Stored as the window of 64 bits words
+ * spanning from the first to the last led of the set, so that the leds of a
+ * pattern, usually close to each other, take a few words at most.
+ * a set must be zeroed before first use, it is then empty.
+ */
+struct led_set {
+	/* index of the first word of the window */
+	uint32_t first_word;
+	/* 0 for an empty set, otherwise first and last words are not 0 */
+	uint32_t nb_words;
+	uint64_t *words;
+};
+
+int led_set_add(struct led_set *set, uint32_t led);
+
+bool led_set_contains(const struct led_set *set, uint32_t led);
+
+bool led_set_is_empty(const struct led_set *set);
+
+bool led_sets_intersect(const struct led_set *set1,
+		const struct led_set *set2);
+
+bool led_sets_equal(const struct led_set *set1, const struct led_set *set2);
+
+/*
+ * returns the first led of the set with an index >= led, or -1 if none, e.g.:
+ * for (led = led_set_next(set, 0); led != -1; led = led_set_next(set, led + 1))
+ */
+int64_t led_set_next(const struct led_set *set, uint32_t led);
+
+void led_set_cleanup(struct led_set *set);
+
+#endif /* SRC_LED_SET_H_ */
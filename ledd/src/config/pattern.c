@@ -28,8 +28,17 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+
 #include <sys/param.h> /* for MIN and MAX */
+#include <sys/stat.h>
+#include <sys/types.h>
 
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -48,80 +57,82 @@ ULOG_DECLARE_TAG(ledd_patterns);
 #include <ut_utils.h>
 
 #include "pattern.h"
+#include "pattern_priv.h"
+#include "pattern_cache.h"
+#include "channel_values.h"
+#include "led_set.h"
 #include "global.h"
 #include "utils.h"
 #include "transitions_priv.h"
 #include "led_driver_priv.h"
+#include "name_index_priv.h"
+#include "arena_priv.h"
+#include "string_pool_priv.h"
 
-struct pattern_frame {
-	uint16_t value;
-	uint16_t duration;
-};
-
-#define MAX_CHANNELS_PER_PATTERN 20
-
-struct pattern_channel {
-	/* values read from patterns config file */
-	char *led_id;
-	char *channel_id;
-	unsigned nb_frames;
-	struct pattern_frame *frames;
-
-	/* post-processed fields */
-	uint32_t duration; /* in ms, multiple of granularity */
-};
-
-struct pattern_values {
-	/* indexes x granularity = time in ms */
-	uint8_t *values[MAX_CHANNELS_PER_PATTERN];
+/* the list keeps the declaration order, the index is for lookups by name */
+static struct rs_dll patterns;
+static struct name_index patterns_index;
+/* patterns and their channels, released all at once by patterns_cleanup() */
+static struct arena patterns_arena;
+/* frames, only needed until the patterns values are computed */
+static struct arena frames_arena;
+/* compiled patterns, least recently used first, lazy mode only */
+static struct rs_dll lru;
+
+/* replaced or removed by a reload, but still pinned by streams */
+static struct rs_dll retired;
+
+/*
+ * destination of the patterns read from a patterns file by a worker thread,
+ * when patterns_config is a directory or on reload, before they are merged in
+ * the global list
+ */
+struct patterns_loader {
+	struct rs_node node;
+	char *path;
+	/* own the memory of the patterns */
+	struct arena arena;
+	struct arena frames_arena;
+	/* patterns read, not registered yet, ids not interned yet */
+	struct rs_dll patterns;
+	/* patterns registered from this loader, alive or retired */
+	unsigned refcount;
+	int result;
 };
 
-struct pattern {
-	struct rs_node node;
+/* loaders owning at least one pattern */
+static struct rs_dll loaders;
 
-	/* values read from patterns config file */
-	char *name;
-	struct pattern_channel *channels[MAX_CHANNELS_PER_PATTERN];
-	/* leds with at least one channel modified by this pattern */
-	const char *leds[MAX_CHANNELS_PER_PATTERN];
-	uint8_t nb_channels;
-	uint8_t default_value;
-	uint8_t repetitions;
-	uint32_t intro;
-	uint32_t outro;
-
-	/* post-processed fields */
-	struct pattern_values v;
-	/* max of channels durations */
-	uint32_t total_duration; /* in ms, multiple of granularity */
-};
+#define to_loader(n) ut_container_of(n, struct patterns_loader, node)
 
-static struct rs_dll patterns;
+#define FNV64_OFFSET_BASIS 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
 
 #define to_pattern(n) ut_container_of(n, struct pattern, node)
+#define lru_to_pattern(n) ut_container_of(n, struct pattern, lru_node)
 
-static int read_frame(lua_State *l, struct pattern_channel *channel, int index)
+static int read_frame(lua_State *l, struct pattern_frame *frames, int index)
 {
 	uint16_t value;
 	const struct transition *transition;
 
 	/* beware, lua tables' indices start at 1, not 0 */
 	lua_rawgeti(l, -1, 1);
-	channel->frames[index - 1].value = value = luaL_checknumber(l, -1);
+	frames[index - 1].value = value = luaL_checknumber(l, -1);
 	lua_pop(l, 1);
 
 	lua_rawgeti(l, -1, 2);
-	channel->frames[index - 1].duration = luaL_checknumber(l, -1);
+	frames[index - 1].duration = luaL_checknumber(l, -1);
 	lua_pop(l, 1);
 
 	if (value < 0x100) {
 		ULOGD("frame = {.value = %d, .duration = %d}", value,
-				channel->frames[index - 1].duration);
+				frames[index - 1].duration);
 	} else {
 		transition = transition_get(value);
 		ULOGD("frame = {.transition = %s, .duration = %d}",
 				transition_get_name(transition),
-				channel->frames[index - 1].duration);
+				frames[index - 1].duration);
 	}
 
 	return 0;
@@ -138,67 +149,208 @@ static int pattern_store_channel(struct pattern *pattern,
 	return 0;
 }
 
-static void pattern_destroy(struct pattern *pattern)
+static struct pattern *pattern_alloc(struct arena *arena, const char *name)
+{
+	struct pattern *pattern;
+
+	pattern = arena_alloc(arena, sizeof(*pattern));
+	if (pattern == NULL)
+		return NULL;
+	pattern->name = arena_strdup(arena, name);
+	if (pattern->name == NULL)
+		return NULL;
+	pattern->repetitions = 1;
+	pattern->alpha = UINT8_MAX;
+
+	return pattern;
+}
+
+/* makes a pattern visible, its name must be unique */
+static int pattern_register(struct pattern *pattern)
+{
+	int ret;
+
+	ret = name_index_add(&patterns_index, pattern->name, pattern);
+	if (ret < 0)
+		return ret;
+	rs_dll_enqueue(&patterns, &pattern->node);
+
+	return 0;
+}
+
+struct pattern *pattern_new(const char *name)
 {
-	int i;
+	int ret;
+	struct pattern *pattern;
+
+	pattern = pattern_alloc(&patterns_arena, name);
+	if (pattern == NULL)
+		return NULL;
+
+	ret = pattern_register(pattern);
+	if (ret < 0) {
+		errno = -ret;
+		return NULL;
+	}
+
+	return pattern;
+}
+
+/* loader is NULL when reading directly in the global list */
+static struct pattern *loader_pattern_new(struct patterns_loader *loader,
+		const char *name)
+{
+	struct pattern *pattern;
+
+	if (loader == NULL)
+		return pattern_new(name);
+
+	pattern = pattern_alloc(&loader->arena, name);
+	if (pattern == NULL)
+		return NULL;
+	rs_dll_enqueue(&loader->patterns, &pattern->node);
+
+	return pattern;
+}
+
+static struct pattern_channel *channel_alloc(struct arena *arena,
+		struct pattern *pattern)
+{
+	int ret;
 	struct pattern_channel *channel;
 
+	channel = arena_alloc(arena, sizeof(*channel));
+	if (channel == NULL)
+		return NULL;
+	ret = pattern_store_channel(pattern, channel);
+	if (ret < 0) {
+		errno = -ret;
+		return NULL;
+	}
+
+	return channel;
+}
+
+struct pattern_channel *pattern_channel_new(struct pattern *pattern)
+{
+	return channel_alloc(&patterns_arena, pattern);
+}
+
+/* the string pool isn't thread-safe, loaders' ids are interned when merged */
+static const char *loader_store_id(struct patterns_loader *loader,
+		const char *id)
+{
+	if (loader == NULL)
+		return string_pool_intern(id);
+
+	return arena_strdup(&loader->arena, id);
+}
+
+struct pattern *patterns_next_from(struct pattern *pattern)
+{
+	struct rs_node *node;
+
+	node = rs_dll_next_from(&patterns, pattern == NULL ? NULL :
+			&pattern->node);
+
+	return node == NULL ? NULL : to_pattern(node);
+}
+
+static void pattern_release_values(struct pattern *pattern)
+{
+	unsigned i;
+
 	for (i = 0; i < pattern->nb_channels; i++) {
-		channel = pattern->channels[i];
-		if (channel != NULL) {
-			ut_string_free(&channel->channel_id);
-			ut_string_free(&channel->led_id);
-			free(channel->frames);
-			channel->frames = NULL;
-			memset(channel, 0, sizeof(*channel));
-			free(channel);
-		}
-		if (pattern->v.values[i] != NULL)
-			free(pattern->v.values[i]);
+		channel_values_release(pattern->v.channels[i]);
+		pattern->v.channels[i] = NULL;
 	}
+	pattern->compiled = false;
+}
+
+static void loader_destroy(struct patterns_loader *loader)
+{
+	free(loader->path);
+	arena_release(&loader->frames_arena);
+	arena_release(&loader->arena);
+	free(loader);
+}
+
+/* frees the loader once none of its patterns is alive anymore */
+static void loader_unref(struct patterns_loader *loader)
+{
+	if (--loader->refcount != 0)
+		return;
+
+	rs_dll_remove(&loaders, &loader->node);
+	loader_destroy(loader);
+}
+
+/*
+ * the pattern's memory is released with its loader, or with patterns_arena if
+ * it has none
+ */
+static void pattern_destroy(struct pattern *pattern)
+{
+	struct patterns_loader *loader = pattern->loader;
+
+	pattern_release_values(pattern);
+	led_set_cleanup(&pattern->led_set);
 
-	ut_string_free(&pattern->name);
 	memset(pattern, 0, sizeof(*pattern));
-	free(pattern);
+	if (loader != NULL)
+		loader_unref(loader);
 }
 
-static int read_channel(lua_State *l, struct pattern *pattern)
+static int read_channel(lua_State *l, struct patterns_loader *loader,
+		struct pattern *pattern)
 {
 	int ret;
 	struct pattern_channel *channel;
+	struct pattern_frame *frames;
 	int index;
 	const char *key;
 
 	ULOGD("%s", __func__);
 
-	channel = calloc(1, sizeof(*channel));
-	if (channel == NULL)
-		config_error(l, errno, "calloc");
+	channel = channel_alloc(loader == NULL ? &patterns_arena :
+			&loader->arena, pattern);
+	if (channel == NULL) {
+		ret = -errno;
+		ULOGE("channel_alloc: %m");
+		return ret;
+	}
 	channel->nb_frames = luaL_len(l, -1);
-	channel->frames = calloc(channel->nb_frames, sizeof(*channel->frames));
-	if (channel->frames == NULL)
-		config_error(l, errno, "calloc");
+	channel->frames = frames = arena_calloc(loader == NULL ? &frames_arena :
+			&loader->frames_arena, channel->nb_frames,
+			sizeof(*frames));
+	if (frames == NULL)
+		config_error(l, errno, "arena_calloc");
 
 	/* iterate over the channel's content */
 	lua_pushnil(l);
 	while (lua_next(l, -2) != 0) {
 		if (lua_isnumber(l, -2)) {
 			index = luaL_checknumber(l, -2);
-			ret = read_frame(l, channel, index);
+			ret = read_frame(l, frames, index);
 			if (ret != 0)
 				config_error(l, -ret, "read_frame");
 		} else if (lua_isstring(l, -2)) {
 			key = lua_tostring(l, -2);
 			if (ut_string_match(key, "led_id")) {
-				channel->led_id = strdup(
+				channel->led_id = loader_store_id(loader,
 						luaL_checkstring(l, -1));
 				if (channel->led_id == NULL)
-					config_error(l, errno, "strdup");
+					config_error(l, errno,
+							"loader_store_id");
 			} else if (ut_string_match(key, "channel_id")) {
-				channel->channel_id = strdup(
+				channel->channel_id = loader_store_id(loader,
 						luaL_checkstring(l, -1));
 				if (channel->channel_id == NULL)
-					config_error(l, errno, "strdup");
+					config_error(l, errno,
+							"loader_store_id");
+			} else if (ut_string_match(key, "master")) {
+				luaL_checktype(l, -1, LUA_TBOOLEAN);
+				channel->master = lua_toboolean(l, -1);
 			} else {
 				luaL_error(l, "unknown pattern key '%s'", key);
 			}
@@ -208,16 +360,46 @@ static int read_channel(lua_State *l, struct pattern *pattern)
 		}
 		lua_pop(l, 1);
 	}
-	ret = pattern_store_channel(pattern, channel);
-	if (ret < 0) {
-		ULOGE("pattern_store_channel: %s", strerror(-ret));
-		pattern_destroy(pattern);
-	}
 
-	return ret;
+	return 0;
+}
+
+static void read_storage(lua_State *l, struct pattern *pattern)
+{
+	int ret;
+	const char *storage = luaL_checkstring(l, -1);
+
+	ret = channel_values_storage_from_str(storage);
+	if (ret < 0)
+		luaL_error(l, "unknown storage '%s' for pattern %s", storage,
+				pattern->name);
+	pattern->storage = ret;
+}
+
+static void read_layer(lua_State *l, struct pattern *pattern)
+{
+	unsigned layer = luaL_checkunsigned(l, -1);
+
+	if (layer >= COMPOSITOR_NB_LAYERS)
+		luaL_error(l, "layer %u of pattern %s above maximum %d", layer,
+				pattern->name, COMPOSITOR_NB_LAYERS - 1);
+	pattern->layer = layer;
+}
+
+static void read_blend(lua_State *l, struct pattern *pattern)
+{
+	int ret;
+	const char *blend = luaL_checkstring(l, -1);
+
+	ret = compositor_blend_from_str(blend);
+	if (ret < 0)
+		luaL_error(l, "unknown blend '%s' for pattern %s", blend,
+				pattern->name);
+	pattern->blend = ret;
 }
 
-static int read_pattern(lua_State *l, const char *pattern_name)
+static int read_pattern(lua_State *l, struct patterns_loader *loader,
+		const char *pattern_name)
 {
 	int ret;
 	const char *key = "";
@@ -225,21 +407,15 @@ static int read_pattern(lua_State *l, const char *pattern_name)
 
 	ULOGD("%s(%s)", __func__, pattern_name);
 
-	p = calloc(1, sizeof(*p));
+	p = loader_pattern_new(loader, pattern_name);
 	if (p == NULL)
-		config_error(l, errno, "calloc");
-	p->name = strdup(pattern_name);
-	if (p->name == NULL)
-		config_error(l, errno, "strdup");
-
-	p->repetitions = 1;
-	rs_dll_enqueue(&patterns, &p->node);
+		config_error(l, errno, "loader_pattern_new");
 
 	/* iterate over the pattern's content */
 	lua_pushnil(l);
 	while (lua_next(l, -2) != 0) {
 		if (lua_isnumber(l, -2)) {
-			ret = read_channel(l, p);
+			ret = read_channel(l, loader, p);
 			if (ret != 0)
 				config_error(l, -ret, "read_channel");
 		} else if (lua_isstring(l, -2)) {
@@ -252,6 +428,14 @@ static int read_pattern(lua_State *l, const char *pattern_name)
 				p->intro = luaL_checkunsigned(l, -1);
 			else if (ut_string_match(key, "outro"))
 				p->outro = luaL_checkunsigned(l, -1);
+			else if (ut_string_match(key, "storage"))
+				read_storage(l, p);
+			else if (ut_string_match(key, "layer"))
+				read_layer(l, p);
+			else if (ut_string_match(key, "blend"))
+				read_blend(l, p);
+			else if (ut_string_match(key, "alpha"))
+				p->alpha = luaL_checkunsigned(l, -1);
 			else
 				luaL_error(l, "unknown pattern key '%s'", key);
 		} else {
@@ -268,6 +452,7 @@ static int read_patterns(lua_State *l)
 {
 	int ret;
 	const char *key;
+	struct patterns_loader *loader = config_get_userdata(l);
 
 	ULOGD("%s", __func__);
 
@@ -286,7 +471,7 @@ static int read_patterns(lua_State *l)
 					lua_typename(l, lua_type(l, -1)));
 
 		key = lua_tostring(l, -2);
-		ret = read_pattern(l, key);
+		ret = read_pattern(l, loader, key);
 		if (ret != 0)
 			config_error(l, -ret, "read_pattern");
 		lua_pop(l, 1);
@@ -303,7 +488,7 @@ static int read_patterns(lua_State *l)
 static int compute_channel_duration(struct pattern_channel *channel)
 {
 	unsigned i;
-	struct pattern_frame *frame;
+	const struct pattern_frame *frame;
 	uint32_t granularity = global_get_granularity();
 
 	for (i = 0; i < channel->nb_frames; i++) {
@@ -321,78 +506,6 @@ static int compute_channel_duration(struct pattern_channel *channel)
 	return 0;
 }
 
-static bool frame_is_transition(const struct pattern_frame *frame)
-{
-	return frame->value >= 0x100;
-}
-
-static int compute_channel_values(const struct pattern_channel *channel,
-		uint8_t **values, uint32_t total_duration)
-{
-	uint32_t i;
-	uint32_t frame_index = 0;
-	int ret;
-	struct pattern_frame *frame;
-	struct pattern_frame *next_frame;
-	uint32_t nb_values;
-	uint32_t value_idx = 0;
-	uint32_t granularity = global_get_granularity();
-	uint8_t start_value = 0;
-	uint8_t end_value = 0;
-	const struct transition *transition = NULL;
-
-	if (frame_is_transition(channel->frames)) {
-		ULOGE("a pattern can't start with a transition");
-		return -EINVAL;
-	}
-
-	*values = calloc(total_duration / granularity, sizeof(**values));
-	if (*values == NULL) {
-		ret = -errno;
-		ULOGE("calloc: %m");
-		return ret;
-	}
-
-	frame = channel->frames;
-	nb_values = frame->duration / granularity;
-	for (i = 0; i < total_duration / granularity; i++) {
-		if (!frame_is_transition(frame))
-			(*values)[i] = frame->value;
-		else
-			(*values)[i] = transition_compute(transition, nb_values,
-					value_idx, start_value, end_value);
-		value_idx++;
-
-		if (value_idx == nb_values) {
-			/* when end of frame reached, jump to next if any */
-			frame_index++;
-			if (frame_index >= channel->nb_frames)
-				return 0;
-
-			frame = channel->frames + frame_index;
-			value_idx = 0;
-			nb_values = frame->duration / granularity;
-			if (!frame_is_transition(frame))
-				continue;
-
-			/* transition: need to get start and end values */
-			transition = transition_get(frame->value);
-			if (transition == NULL) {
-				ret = -errno;
-				ULOGE("transition %"PRIu8" missing: %m",
-						frame->value);
-				return ret;
-			}
-			start_value = (frame - 1)->value;
-			next_frame = channel->frames;
-			next_frame += (frame_index + 1) % channel->nb_frames;
-			end_value = next_frame->value;
-		}
-	}
-
-	return 0;
-}
-
 static struct pattern_channel *pattern_get_channel(
 		const struct pattern *pattern, unsigned i)
 {
@@ -418,6 +531,81 @@ static int add_modified_led(struct pattern *pattern, const char *led_id)
 	return 0;
 }
 
+static void pattern_unbind_channels(struct pattern *pattern)
+{
+	unsigned i;
+
+	for (i = 0; i < pattern->nb_channels; i++)
+		pattern_get_channel(pattern, i)->handle = NULL;
+	led_set_cleanup(&pattern->led_set);
+}
+
+/*
+ * resolves the led channel handles and builds the set of leds bound, reports
+ * the last error
+ */
+static int pattern_bind_channels(struct pattern *pattern)
+{
+	int ret = 0;
+	int err;
+	unsigned i;
+	struct pattern_channel *channel;
+
+	pattern_unbind_channels(pattern);
+	for (i = 0; i < pattern->nb_channels; i++) {
+		channel = pattern_get_channel(pattern, i);
+		channel->handle = led_driver_get_channel(channel->led_id,
+				channel->channel_id);
+		if (channel->handle == NULL) {
+			ret = -ESRCH;
+			ULOGW("pattern %s: no channel %s for led %s",
+					pattern->name, channel->channel_id,
+					channel->led_id);
+			continue;
+		}
+		err = led_set_add(&pattern->led_set,
+				channel->handle->led->index);
+		if (err < 0) {
+			ret = err;
+			ULOGE("led_set_add: %s", strerror(-err));
+		}
+	}
+
+	return ret;
+}
+
+static int find_master_channel(struct pattern *pattern)
+{
+	unsigned i;
+	struct pattern_channel *channel;
+
+	for (i = 0; i < pattern->nb_channels; i++) {
+		channel = pattern_get_channel(pattern, i);
+		if (!channel->master)
+			continue;
+		if (pattern->master != NULL) {
+			ULOGE("pattern %s has more than one master channel",
+					pattern->name);
+			return -EINVAL;
+		}
+		pattern->master = channel;
+	}
+
+	return 0;
+}
+
+/* value indexes the values of a channel span */
+static uint32_t channel_get_nb_values(const struct pattern *pattern,
+		const struct pattern_channel *channel)
+{
+	uint32_t duration;
+
+	duration = pattern->master != NULL ? channel->duration :
+			pattern->total_duration;
+
+	return duration / global_get_granularity();
+}
+
 static int post_process_pattern(struct pattern *pattern)
 {
 	int ret;
@@ -425,6 +613,10 @@ static int post_process_pattern(struct pattern *pattern)
 	struct pattern_channel *channel;
 	uint32_t old_total_duration;
 
+	ret = find_master_channel(pattern);
+	if (ret < 0)
+		return ret;
+
 	/* compute total duration */
 	for (i = 0; i < pattern->nb_channels; i++) {
 		channel = pattern_get_channel(pattern, i);
@@ -433,6 +625,8 @@ static int post_process_pattern(struct pattern *pattern)
 			ULOGE("compute_channel_duration: %s", strerror(-ret));
 			return ret;
 		}
+		if (pattern->master != NULL)
+			continue;
 		old_total_duration = pattern->total_duration;
 		pattern->total_duration = MAX(pattern->total_duration,
 				channel->duration);
@@ -443,27 +637,29 @@ static int post_process_pattern(struct pattern *pattern)
 					", new duration %"PRIu32,
 					pattern->name, old_total_duration,
 					pattern->total_duration);
+	}
+	if (pattern->master != NULL)
+		pattern->total_duration = pattern->master->duration;
 
-		/* some sanity checks */
-		if (pattern->intro > pattern->total_duration) {
-			ULOGE("intro time (%"PRIu32"is longer than  duration",
-					pattern->intro);
-			return -EINVAL;
-		}
-		if (pattern->outro > pattern->total_duration) {
-			ULOGE("outro time (%"PRIu32"is longer than  duration",
-					pattern->intro);
-			return -EINVAL;
-		}
+	/* some sanity checks */
+	if (pattern->intro > pattern->total_duration) {
+		ULOGE("intro time (%"PRIu32"is longer than  duration",
+				pattern->intro);
+		return -EINVAL;
+	}
+	if (pattern->outro > pattern->total_duration) {
+		ULOGE("outro time (%"PRIu32"is longer than  duration",
+				pattern->intro);
+		return -EINVAL;
 	}
 
-	/* compute all channel values and list the leds modified */
+	/* check the channels can be computed and list the leds modified */
 	for (i = 0; i < pattern->nb_channels; i++) {
 		channel = pattern_get_channel(pattern, i);
-		ret = compute_channel_values(channel, &(pattern->v.values[i]),
-				pattern->total_duration);
+		ret = channel_values_check(channel->frames, channel->nb_frames,
+				channel_get_nb_values(pattern, channel));
 		if (ret < 0) {
-			ULOGE("compute_channel_values: %s", strerror(-ret));
+			ULOGE("channel_values_check: %s", strerror(-ret));
 			return ret;
 		}
 		ret = add_modified_led(pattern, channel->led_id);
@@ -474,91 +670,932 @@ static int post_process_pattern(struct pattern *pattern)
 	return 0;
 }
 
-static int patterns_post_process(void)
+/* computes the values of all the channels of the pattern */
+static int compile_pattern(struct pattern *pattern)
 {
 	int ret;
-	struct rs_node *node = NULL;
-	struct pattern *pattern;
+	unsigned i;
+	struct pattern_channel *channel;
+	struct channel_values values;
 
-	while ((node = rs_dll_next_from(&patterns, node))) {
-		pattern = to_pattern(node);
-		ret = post_process_pattern(pattern);
+	for (i = 0; i < pattern->nb_channels; i++) {
+		channel = pattern_get_channel(pattern, i);
+		ret = channel_values_init(&values, channel->frames,
+				channel->nb_frames,
+				channel_get_nb_values(pattern, channel),
+				pattern->storage);
 		if (ret < 0) {
-			ULOGE("post_process_pattern: %s", strerror(-ret));
-			return ret;
+			ULOGE("channel_values_init: %s", strerror(-ret));
+			goto err;
+		}
+		pattern->v.channels[i] = channel_values_share(&values);
+		if (pattern->v.channels[i] == NULL) {
+			ret = -errno;
+			ULOGE("channel_values_share: %m");
+			goto err;
 		}
 	}
+	pattern->compiled = true;
 
 	return 0;
+err:
+	pattern_release_values(pattern);
+
+	return ret;
 }
 
-static void pattern_print(struct rs_node *node)
+static void pattern_drop_frames(struct pattern *pattern)
 {
-	struct pattern *pattern = to_pattern(node);
-#ifdef LEDD_VERBOSE_PATTERN_DUMP
-	uint8_t i;
-	uint32_t j;
-	struct pattern_values *values;
-	uint32_t granularity = global_get_granularity();
-#endif /* LEDD_VERBOSE_PATTERN_DUMP */
+	unsigned i;
+	struct pattern_channel *channel;
 
-	ULOGI("\t%s:", pattern->name);
-	ULOGI("\t\tnb_channels = %"PRIu8, pattern->nb_channels);
-	ULOGI("\t\trepetitions = %"PRIu8, pattern->repetitions);
-	ULOGI("\t\tdefault_value = %"PRIu8, pattern->default_value);
-	ULOGI("\t\ttotal_duration = %"PRIu32, pattern->total_duration);
-	ULOGI("\t\tintro = %"PRIu32, pattern->intro);
-	ULOGI("\t\toutro = %"PRIu32, pattern->outro);
-#ifdef LEDD_VERBOSE_PATTERN_DUMP
 	for (i = 0; i < pattern->nb_channels; i++) {
-		values = &pattern->v;
-		ULOGI("\t\tchannel[%"PRIu8"]", i);
-		for (j = 0; j < pattern->total_duration / granularity; j++)
-			ULOGI("\t\t\tvalue = %"PRIu8, values->values[i][j]);
+		channel = pattern_get_channel(pattern, i);
+		channel->frames = NULL;
+		channel->nb_frames = 0;
 	}
-#endif /* LEDD_VERBOSE_PATTERN_DUMP */
 }
 
-static const struct rs_dll_vtable patterns_vtable = {
-		.print = pattern_print,
-};
-
-int patterns_init(const char *path)
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
 {
-	int ret;
+	const uint8_t *p = data;
 
-	rs_dll_init(&patterns, &patterns_vtable);
-	ret = read_config(path, read_patterns, LUA_GLOBALS_CONFIG_PATTERNS);
-	if (ret < 0) {
-		ULOGE("read_config(%s): %s", path, strerror(-ret));
-		return ret;
+	while (size--) {
+		hash ^= *p++;
+		hash *= FNV64_PRIME;
 	}
 
-	ret = patterns_post_process();
-	if (ret < 0) {
-		ULOGE("patterns_post_process: %s", strerror(-ret));
-		return ret;
+	return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+	return str == NULL ? hash_bytes(hash, "", 1) :
+			hash_bytes(hash, str, strlen(str) + 1);
+}
+
+/*
+ * hashes all that was read from the config, field by field, the padding of the
+ * structures is undefined
+ */
+static uint64_t pattern_hash_definition(const struct pattern *pattern)
+{
+	unsigned i;
+	unsigned j;
+	uint64_t hash = FNV64_OFFSET_BASIS;
+	const struct pattern_channel *channel;
+
+	hash = hash_string(hash, pattern->name);
+	hash = hash_bytes(hash, &pattern->nb_channels,
+			sizeof(pattern->nb_channels));
+	hash = hash_bytes(hash, &pattern->default_value,
+			sizeof(pattern->default_value));
+	hash = hash_bytes(hash, &pattern->repetitions,
+			sizeof(pattern->repetitions));
+	hash = hash_bytes(hash, &pattern->intro, sizeof(pattern->intro));
+	hash = hash_bytes(hash, &pattern->outro, sizeof(pattern->outro));
+	hash = hash_bytes(hash, &pattern->storage, sizeof(pattern->storage));
+	hash = hash_bytes(hash, &pattern->layer, sizeof(pattern->layer));
+	hash = hash_bytes(hash, &pattern->blend, sizeof(pattern->blend));
+	hash = hash_bytes(hash, &pattern->alpha, sizeof(pattern->alpha));
+	for (i = 0; i < pattern->nb_channels; i++) {
+		channel = pattern->channels[i];
+		hash = hash_string(hash, channel->led_id);
+		hash = hash_string(hash, channel->channel_id);
+		hash = hash_bytes(hash, &channel->master,
+				sizeof(channel->master));
+		hash = hash_bytes(hash, &channel->nb_frames,
+				sizeof(channel->nb_frames));
+		for (j = 0; j < channel->nb_frames; j++) {
+			hash = hash_bytes(hash, &channel->frames[j].value,
+					sizeof(channel->frames[j].value));
+			hash = hash_bytes(hash, &channel->frames[j].duration,
+					sizeof(channel->frames[j].duration));
+		}
 	}
 
-	return ret;
+	/* 0 means not computed yet */
+	return hash == 0 ? 1 : hash;
 }
 
-static RS_NODE_MATCH_STR_MEMBER(pattern, name, node);
+/* state of patterns_process(), each pattern's part is filled by one worker */
+struct process_context {
+	struct pattern **patterns;
+	/* the values of the channels of pattern i start at values[first[i]] */
+	uint32_t *first;
+	struct channel_values *values;
+	uint32_t *hashes;
+	int *results;
+	bool compile;
+};
 
-static struct pattern *get_pattern(const char *name)
+/* post-processing and values computation, which don't touch shared state */
+static void process_pattern(void *ctx, unsigned worker, unsigned i)
 {
-	struct rs_node *node;
+	int ret;
+	unsigned c;
+	struct process_context *p = ctx;
+	struct pattern *pattern = p->patterns[i];
+	struct pattern_channel *channel;
+	struct channel_values *values = p->values + p->first[i];
 
-	node = rs_dll_find_match(&patterns, pattern_match_str_name, name);
-	if (node == NULL) {
-		errno = ESRCH;
-		return NULL;
+	if (pattern->definition_hash == 0)
+		pattern->definition_hash = pattern_hash_definition(pattern);
+	ret = post_process_pattern(pattern);
+	if (ret < 0) {
+		p->results[i] = ret;
+		return;
 	}
 
-	return to_pattern(node);
+	/* values may come precomputed from the cache */
+	if (!p->compile || pattern->compiled)
+		return;
+	for (c = 0; c < pattern->nb_channels; c++) {
+		channel = pattern_get_channel(pattern, c);
+		ret = channel_values_init(values + c, channel->frames,
+				channel->nb_frames,
+				channel_get_nb_values(pattern, channel),
+				pattern->storage);
+		if (ret < 0) {
+			p->results[i] = ret;
+			return;
+		}
+		p->hashes[p->first[i] + c] = channel_values_hash(values + c);
+	}
 }
 
-const struct pattern *pattern_get(const char *name)
+/* the pool of shared values isn't thread-safe, this part is sequential */
+static int share_pattern_values(struct process_context *p, unsigned i)
+{
+	int ret;
+	unsigned c;
+	struct pattern *pattern = p->patterns[i];
+	uint32_t first = p->first[i];
+
+	for (c = 0; c < pattern->nb_channels; c++) {
+		pattern->v.channels[c] = channel_values_share_hashed(
+				p->values + first + c, p->hashes[first + c]);
+		if (pattern->v.channels[c] == NULL) {
+			ret = -errno;
+			ULOGE("channel_values_share_hashed: %m");
+			pattern_release_values(pattern);
+			return ret;
+		}
+	}
+	pattern->compiled = true;
+
+	return 0;
+}
+
+/*
+ * post-processes the patterns and, if compile is true, computes their values,
+ * concurrently, the results being shared in the patterns' order
+ */
+static int process_patterns(struct pattern **list, unsigned count,
+		bool compile)
+{
+	int ret = 0;
+	unsigned i;
+	uint32_t nb_values = 0;
+	struct process_context p = {
+			.patterns = list,
+			.compile = compile,
+	};
+	double start = monotonic_ms();
+
+	if (count == 0)
+		return 0;
+
+	p.first = calloc(count, sizeof(*p.first));
+	p.results = calloc(count, sizeof(*p.results));
+	if (p.first == NULL || p.results == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		p.first[i] = nb_values;
+		nb_values += list[i]->nb_channels;
+	}
+	p.values = calloc(MAX(nb_values, 1u), sizeof(*p.values));
+	p.hashes = calloc(MAX(nb_values, 1u), sizeof(*p.hashes));
+	if (p.values == NULL || p.hashes == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(count, global_get_patterns_threads(), process_pattern, &p);
+
+	/* report the first error in the patterns' order, for reproducibility */
+	for (i = 0; i < count; i++) {
+		if (p.results[i] == 0)
+			continue;
+		ret = p.results[i];
+		ULOGE("processing pattern %s: %s", list[i]->name,
+				strerror(-ret));
+		goto out;
+	}
+	for (i = 0; i < count && compile; i++) {
+		if (list[i]->compiled)
+			continue;
+		ret = share_pattern_values(&p, i);
+		if (ret < 0)
+			goto out;
+	}
+	ULOGI("%u patterns processed in %.2f ms by %u workers", count,
+			monotonic_ms() - start, parallel_get_nb_workers(count,
+			global_get_patterns_threads()));
+out:
+	/* no-op for the values moved to the shared pool */
+	for (i = 0; p.values != NULL && i < nb_values; i++)
+		channel_values_cleanup(p.values + i);
+	free(p.values);
+	free(p.hashes);
+	free(p.results);
+	free(p.first);
+
+	return ret;
+}
+
+/* same as process_patterns(), for all the patterns registered */
+static int patterns_process(bool compile)
+{
+	int ret;
+	unsigned i;
+	unsigned count = rs_dll_get_count(&patterns);
+	struct rs_node *node = NULL;
+	struct pattern **list;
+
+	list = calloc(MAX(count, 1u), sizeof(*list));
+	if (list == NULL)
+		return -errno;
+	for (i = 0; (node = rs_dll_next_from(&patterns, node)); i++)
+		list[i] = to_pattern(node);
+	ret = process_patterns(list, count, compile);
+	free(list);
+
+	return ret;
+}
+
+/* post-processing common to all the sources of patterns */
+static int patterns_prepare(void)
+{
+	int ret;
+
+	/* in lazy mode, the frames are kept to compute the values on demand */
+	ret = patterns_process(!global_get_lazy_patterns());
+	if (ret < 0) {
+		ULOGE("patterns_process: %s", strerror(-ret));
+		return ret;
+	}
+
+	/* unbound channels are skipped at play time, not a fatal error */
+	patterns_bind_channels();
+
+	return 0;
+}
+
+/* once all the values are computed, the frames are useless */
+static void patterns_drop_frames(void)
+{
+	struct rs_node *node = NULL;
+
+	if (global_get_lazy_patterns())
+		return;
+
+	while ((node = rs_dll_next_from(&patterns, node)))
+		pattern_drop_frames(to_pattern(node));
+	arena_release(&frames_arena);
+	while ((node = rs_dll_next_from(&loaders, node)))
+		arena_release(&to_loader(node)->frames_arena);
+}
+
+static size_t pattern_get_values_size(const struct pattern *pattern,
+		enum channel_values_storage storage)
+{
+	uint8_t i;
+	size_t size = 0;
+
+	for (i = 0; i < pattern->nb_channels && pattern->compiled; i++)
+		size += channel_values_get_size(pattern->v.channels[i],
+				storage);
+
+	return size;
+}
+
+static void pattern_print(struct rs_node *node)
+{
+	struct pattern *pattern = to_pattern(node);
+#ifdef LEDD_VERBOSE_PATTERN_DUMP
+	uint8_t i;
+	uint32_t j;
+	const struct channel_values *values;
+#endif /* LEDD_VERBOSE_PATTERN_DUMP */
+
+	ULOGI("\t%s:", pattern->name);
+	ULOGI("\t\tnb_channels = %"PRIu8, pattern->nb_channels);
+	ULOGI("\t\trepetitions = %"PRIu8, pattern->repetitions);
+	ULOGI("\t\tdefault_value = %"PRIu8, pattern->default_value);
+	ULOGI("\t\ttotal_duration = %"PRIu32, pattern->total_duration);
+	ULOGI("\t\tintro = %"PRIu32, pattern->intro);
+	ULOGI("\t\toutro = %"PRIu32, pattern->outro);
+	ULOGI("\t\tlayer = %"PRIu8", blend = %s, alpha = %"PRIu8,
+			pattern->layer, compositor_blend_to_str(pattern->blend),
+			pattern->alpha);
+	if (pattern->master != NULL)
+		ULOGI("\t\tmaster = %s.%s", pattern->master->led_id,
+				pattern->master->channel_id);
+	ULOGI("\t\tcompiled = %s, pins = %u",
+			pattern->compiled ? "true" : "false", pattern->pins);
+	ULOGI("\t\tstorage = %s (%zu bytes, dense %zu, compressed %zu)",
+			channel_values_storage_to_str(pattern->storage),
+			pattern_get_values_size(pattern, pattern->storage),
+			pattern_get_values_size(pattern,
+					CHANNEL_VALUES_STORAGE_DENSE),
+			pattern_get_values_size(pattern,
+					CHANNEL_VALUES_STORAGE_COMPRESSED));
+#ifdef LEDD_VERBOSE_PATTERN_DUMP
+	for (i = 0; i < pattern->nb_channels && pattern->compiled; i++) {
+		values = pattern->v.channels[i];
+		ULOGI("\t\tchannel[%"PRIu8"]", i);
+		for (j = 0; j < values->nb_values; j++)
+			ULOGI("\t\t\tvalue = %"PRIu8, channel_values_get(
+					values, j,
+					channel_values_seek(values, j)));
+	}
+#endif /* LEDD_VERBOSE_PATTERN_DUMP */
+}
+
+static const struct rs_dll_vtable patterns_vtable = {
+		.print = pattern_print,
+};
+
+static int is_patterns_file(const struct dirent *entry)
+{
+	size_t len = strlen(entry->d_name);
+	size_t suffix_len = strlen(PATTERNS_FILE_SUFFIX);
+
+	/* hidden files are skipped, e.g. editors' temporary files */
+	return entry->d_name[0] != '.' && len > suffix_len &&
+			strcmp(entry->d_name + len - suffix_len,
+					PATTERNS_FILE_SUFFIX) == 0;
+}
+
+int patterns_scan_directory(const char *path, struct dirent ***entries)
+{
+	int ret;
+
+	ret = scandir(path, entries, is_patterns_file, alphasort);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static struct patterns_loader *loader_new(const char *dir,
+		const char *name)
+{
+	int ret;
+	struct patterns_loader *loader;
+
+	loader = calloc(1, sizeof(*loader));
+	if (loader == NULL)
+		return NULL;
+	ret = dir == NULL ? asprintf(&loader->path, "%s", name) :
+			asprintf(&loader->path, "%s/%s", dir, name);
+	if (ret < 0) {
+		free(loader);
+		errno = ENOMEM;
+		return NULL;
+	}
+	rs_dll_init(&loader->patterns, NULL);
+
+	return loader;
+}
+
+/* destroys loaders which don't own any pattern */
+static void loaders_destroy(struct rs_dll *list)
+{
+	while (rs_dll_get_count(list) != 0)
+		loader_destroy(to_loader(rs_dll_pop(list)));
+}
+
+struct read_context {
+	struct patterns_loader **loaders;
+	/*
+	 * one per worker, created on its first file, except for worker 0, the
+	 * calling thread, which uses the state shared by the config files
+	 */
+	lua_State **states;
+};
+
+/* reads the patterns file i in the lua state of the worker */
+static void read_patterns_file(void *ctx, unsigned worker, unsigned i)
+{
+	struct read_context *c = ctx;
+	struct patterns_loader *loader = c->loaders[i];
+
+	if (c->states[worker] == NULL) {
+		c->states[worker] = worker == 0 ? config_state_get() :
+				config_state_new();
+		if (c->states[worker] == NULL) {
+			loader->result = -ENOMEM;
+			return;
+		}
+	}
+	loader->result = read_config_in(c->states[worker], loader->path,
+			read_patterns, LUA_GLOBALS_CONFIG_PATTERNS, loader);
+}
+
+/*
+ * reads a patterns file, or the patterns files of a directory, concurrently,
+ * one lua state per worker, without touching the global patterns. The loaders
+ * are appended to list in the order of the files' names, even on error.
+ */
+static int patterns_read_files(const char *path, struct rs_dll *list)
+{
+	int ret;
+	int n = 1;
+	unsigned i;
+	unsigned nb_threads = global_get_patterns_threads();
+	unsigned nb_workers;
+	struct stat st;
+	struct dirent **entries = NULL;
+	struct read_context ctx = { .loaders = NULL };
+
+	ret = stat(path, &st);
+	if (ret < 0) {
+		ret = -errno;
+		ULOGE("stat(%s): %m", path);
+		return ret;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		n = patterns_scan_directory(path, &entries);
+		if (n < 0) {
+			ULOGE("patterns_scan_directory(%s): %s", path,
+					strerror(-n));
+			return n;
+		}
+		if (n == 0)
+			ULOGW("no *"PATTERNS_FILE_SUFFIX" file in %s", path);
+	}
+
+	nb_workers = parallel_get_nb_workers(n, nb_threads);
+	ctx.loaders = calloc(MAX(n, 1), sizeof(*ctx.loaders));
+	ctx.states = calloc(nb_workers, sizeof(*ctx.states));
+	if (ctx.loaders == NULL || ctx.states == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < (unsigned)n; i++) {
+		ctx.loaders[i] = entries == NULL ? loader_new(NULL, path) :
+				loader_new(path, entries[i]->d_name);
+		if (ctx.loaders[i] == NULL) {
+			ret = -errno;
+			ULOGE("loader_new: %m");
+			goto out;
+		}
+		rs_dll_enqueue(list, &ctx.loaders[i]->node);
+	}
+
+	parallel_for(n, nb_threads, read_patterns_file, &ctx);
+
+	for (i = 0; i < (unsigned)n; i++) {
+		ret = ctx.loaders[i]->result;
+		if (ret < 0) {
+			ULOGE("read_config(%s): %s", ctx.loaders[i]->path,
+					strerror(-ret));
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	/* the state of worker 0 is the shared one */
+	for (i = 1; ctx.states != NULL && i < nb_workers; i++)
+		if (ctx.states[i] != NULL)
+			lua_close(ctx.states[i]);
+	free(ctx.states);
+	free(ctx.loaders);
+	for (i = 0; entries != NULL && i < (unsigned)n; i++)
+		free(entries[i]);
+	free(entries);
+
+	return ret;
+}
+
+/* interns the ids of the channels of a pattern read by a loader */
+static int pattern_intern_ids(struct pattern *pattern)
+{
+	unsigned i;
+	struct pattern_channel *channel;
+
+	for (i = 0; i < pattern->nb_channels; i++) {
+		channel = pattern_get_channel(pattern, i);
+		channel->led_id = string_pool_intern(channel->led_id);
+		channel->channel_id = string_pool_intern(channel->channel_id);
+		if (channel->led_id == NULL || channel->channel_id == NULL)
+			return -errno;
+	}
+
+	return 0;
+}
+
+/* registers a pattern read by a loader, which then owns its memory */
+static int loader_register(struct patterns_loader *loader,
+		struct pattern *pattern)
+{
+	int ret;
+
+	ret = pattern_register(pattern);
+	if (ret == -EEXIST) {
+		ULOGE("pattern %s of %s is already defined by a previous file",
+				pattern->name, loader->path);
+		return ret;
+	}
+	if (ret < 0) {
+		ULOGE("pattern_register: %s", strerror(-ret));
+		return ret;
+	}
+	pattern->loader = loader;
+	loader->refcount++;
+
+	return 0;
+}
+
+/* moves the patterns of a loader to the global list, in their order */
+static int loader_merge(struct patterns_loader *loader)
+{
+	int ret;
+	struct rs_node *node;
+	struct pattern *pattern;
+
+	while (rs_dll_get_count(&loader->patterns) != 0) {
+		node = rs_dll_next_from(&loader->patterns, NULL);
+		rs_dll_remove(&loader->patterns, node);
+		pattern = to_pattern(node);
+		ret = pattern_intern_ids(pattern);
+		if (ret < 0) {
+			ULOGE("pattern_intern_ids: %s", strerror(-ret));
+			return ret;
+		}
+		ret = loader_register(loader, pattern);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * reads the patterns files of a directory concurrently, then merges them in
+ * the order of the files' names
+ */
+static int patterns_read_directory(const char *path)
+{
+	int ret;
+	struct rs_dll list;
+	struct rs_node *node;
+	struct patterns_loader *loader;
+
+	rs_dll_init(&list, NULL);
+	ret = patterns_read_files(path, &list);
+	if (ret < 0) {
+		loaders_destroy(&list);
+		return ret;
+	}
+
+	/* released with the last of their patterns, or by patterns_cleanup() */
+	while (rs_dll_get_count(&list) != 0) {
+		node = rs_dll_next_from(&list, NULL);
+		rs_dll_remove(&list, node);
+		loader = to_loader(node);
+		/* kept until the end, for its refcount not to drop to 0 */
+		loader->refcount++;
+		rs_dll_enqueue(&loaders, node);
+		ret = loader_merge(loader);
+		loader_unref(loader);
+		if (ret < 0) {
+			loaders_destroy(&list);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* path is either a patterns file, or a directory of patterns files */
+static int patterns_read(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return patterns_read_directory(path);
+
+	return read_config(path, read_patterns, LUA_GLOBALS_CONFIG_PATTERNS);
+}
+
+static void patterns_init_lists(void)
+{
+	rs_dll_init(&patterns, &patterns_vtable);
+	rs_dll_init(&lru, NULL);
+	rs_dll_init(&retired, NULL);
+	rs_dll_init(&loaders, NULL);
+}
+
+/* returns true if the patterns could be loaded from the cache */
+static bool patterns_load_cache(const char *cache, uint64_t key)
+{
+	int ret;
+
+	ret = pattern_cache_load(cache, key);
+	if (ret == 0)
+		return true;
+
+	if (ret == -ENOENT)
+		ULOGI("no patterns cache %s yet", cache);
+	else
+		ULOGW("pattern_cache_load(%s): %s, falling back to lua", cache,
+				strerror(-ret));
+	/* drop what could have been loaded before the error */
+	patterns_cleanup();
+	patterns_init_lists();
+
+	return false;
+}
+
+static struct pattern *get_pattern(const char *name)
+{
+	return name_index_find(&patterns_index, name);
+}
+
+/* takes a pattern out of the registry, for good */
+static void pattern_retire(struct pattern *pattern)
+{
+	name_index_remove(&patterns_index, pattern->name);
+	rs_dll_remove(&patterns, &pattern->node);
+	/* in lazy mode, all the compiled patterns are in the lru */
+	if (global_get_lazy_patterns() && pattern->compiled)
+		rs_dll_remove(&lru, &pattern->lru_node);
+	if (pattern->pins == 0) {
+		pattern_destroy(pattern);
+		return;
+	}
+
+	/* streams are playing it, the last one to release it destroys it */
+	ULOGI("old version of pattern %s kept until its streams end",
+			pattern->name);
+	pattern->retired = true;
+	rs_dll_enqueue(&retired, &pattern->node);
+}
+
+/* for patterns read by a loader, but not registered */
+static void pattern_discard(struct pattern *pattern)
+{
+	pattern_release_values(pattern);
+	led_set_cleanup(&pattern->led_set);
+}
+
+/* retires the loaded patterns absent from names */
+static unsigned patterns_retire_removed(const struct name_index *names)
+{
+	unsigned nb_removed = 0;
+	struct rs_node *node;
+	struct rs_node *next;
+	struct pattern *pattern;
+
+	node = rs_dll_next_from(&patterns, NULL);
+	while (node != NULL) {
+		next = rs_dll_next_from(&patterns, node);
+		pattern = to_pattern(node);
+		if (name_index_find(names, pattern->name) == NULL) {
+			ULOGI("pattern %s removed", pattern->name);
+			pattern_retire(pattern);
+			nb_removed++;
+		}
+		node = next;
+	}
+
+	return nb_removed;
+}
+
+int patterns_init(const char *path)
+{
+	int ret;
+	const char *cache = global_get_patterns_cache();
+	uint64_t key = 0;
+	bool cached = false;
+
+	patterns_init_lists();
+	if (cache != NULL) {
+		ret = pattern_cache_compute_key(path, &key);
+		if (ret < 0) {
+			ULOGW("pattern_cache_compute_key: %s", strerror(-ret));
+			cache = NULL;
+		} else {
+			cached = patterns_load_cache(cache, key);
+		}
+	}
+	if (!cached) {
+		ret = patterns_read(path);
+		if (ret < 0) {
+			ULOGE("patterns_read(%s): %s", path, strerror(-ret));
+			return ret;
+		}
+	}
+
+	ret = patterns_prepare();
+	if (ret < 0)
+		return ret;
+
+	/* the cache is only a speedup, failing to store it isn't fatal */
+	if (cache != NULL && !cached) {
+		ret = pattern_cache_store(cache, key);
+		if (ret < 0)
+			ULOGW("pattern_cache_store(%s): %s", cache,
+					strerror(-ret));
+	}
+	patterns_drop_frames();
+
+	return 0;
+}
+
+int patterns_reload(const char *path)
+{
+	int ret;
+	unsigned i;
+	unsigned nb_read = 0;
+	unsigned nb_changed = 0;
+	unsigned nb_added = 0;
+	unsigned nb_removed;
+	unsigned count = 0;
+	bool lazy = global_get_lazy_patterns();
+	struct rs_dll list;
+	struct rs_node *node = NULL;
+	struct rs_node *pnode;
+	struct name_index names;
+	struct pattern **changed = NULL;
+	struct patterns_loader **owners = NULL;
+	struct patterns_loader *loader;
+	struct pattern *pattern;
+	struct pattern *old;
+	double start = monotonic_ms();
+
+	memset(&names, 0, sizeof(names));
+	rs_dll_init(&list, NULL);
+	ret = patterns_read_files(path, &list);
+	if (ret < 0)
+		goto out;
+
+	while ((node = rs_dll_next_from(&list, node)))
+		nb_read += rs_dll_get_count(&to_loader(node)->patterns);
+	changed = calloc(MAX(nb_read, 1u), sizeof(*changed));
+	owners = calloc(MAX(nb_read, 1u), sizeof(*owners));
+	if (changed == NULL || owners == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* only the new or modified definitions need to be processed */
+	while ((node = rs_dll_next_from(&list, node))) {
+		loader = to_loader(node);
+		pnode = NULL;
+		while ((pnode = rs_dll_next_from(&loader->patterns, pnode))) {
+			pattern = to_pattern(pnode);
+			ret = name_index_add(&names, pattern->name, pattern);
+			if (ret == -EEXIST)
+				ULOGE("pattern %s of %s is already defined by "
+						"a previous file",
+						pattern->name, loader->path);
+			if (ret < 0)
+				goto out;
+			pattern->definition_hash =
+					pattern_hash_definition(pattern);
+			old = get_pattern(pattern->name);
+			if (old != NULL && old->definition_hash ==
+					pattern->definition_hash)
+				continue;
+			ret = pattern_intern_ids(pattern);
+			if (ret < 0) {
+				ULOGE("pattern_intern_ids: %s", strerror(-ret));
+				goto out;
+			}
+			owners[count] = loader;
+			changed[count++] = pattern;
+		}
+	}
+
+	/* on error, the patterns loaded are left untouched */
+	ret = process_patterns(changed, count, !lazy);
+	if (ret < 0) {
+		ULOGE("process_patterns: %s", strerror(-ret));
+		goto out;
+	}
+
+	/* from here on, the new definitions replace the old ones */
+	nb_removed = patterns_retire_removed(&names);
+	for (i = 0; i < count; i++) {
+		pattern = changed[i];
+		old = get_pattern(pattern->name);
+		if (old != NULL) {
+			pattern_retire(old);
+			nb_changed++;
+		} else {
+			nb_added++;
+		}
+		rs_dll_remove(&owners[i]->patterns, &pattern->node);
+		changed[i] = NULL;
+		ret = loader_register(owners[i], pattern);
+		if (ret < 0) {
+			pattern_discard(pattern);
+			continue;
+		}
+		pattern_bind_channels(pattern);
+		if (!lazy)
+			pattern_drop_frames(pattern);
+	}
+
+	/* loaders whose patterns were all unchanged aren't needed anymore */
+	while (rs_dll_get_count(&list) != 0) {
+		node = rs_dll_next_from(&list, NULL);
+		rs_dll_remove(&list, node);
+		loader = to_loader(node);
+		if (loader->refcount == 0) {
+			loader_destroy(loader);
+			continue;
+		}
+		if (!lazy)
+			arena_release(&loader->frames_arena);
+		rs_dll_enqueue(&loaders, node);
+	}
+
+	ULOGI("patterns reloaded from %s in %.2f ms: %u added, %u changed, "
+			"%u removed, %u unchanged", path, monotonic_ms() - start,
+			nb_added, nb_changed, nb_removed,
+			nb_read - nb_added - nb_changed);
+out:
+	for (i = 0; changed != NULL && i < count; i++)
+		if (changed[i] != NULL)
+			pattern_discard(changed[i]);
+	/* before the loaders, which own the names */
+	name_index_cleanup(&names);
+	loaders_destroy(&list);
+	free(owners);
+	free(changed);
+
+	return ret;
+}
+
+int patterns_init_static(const void *image, size_t size)
+{
+	int ret;
+
+	patterns_init_lists();
+	ret = pattern_cache_load_image(image, size);
+	if (ret < 0) {
+		ULOGE("pattern_cache_load_image: %s", strerror(-ret));
+		return ret;
+	}
+
+	ret = patterns_prepare();
+	if (ret < 0)
+		return ret;
+	patterns_drop_frames();
+
+	return 0;
+}
+
+int patterns_generate_image(const char *path, FILE *image)
+{
+	int ret;
+	uint64_t key;
+
+	patterns_init_lists();
+	ret = patterns_read(path);
+	if (ret < 0) {
+		ULOGE("patterns_read(%s): %s", path, strerror(-ret));
+		goto out;
+	}
+
+	/* no platform to bind to, the image is used in place, whatever mode */
+	ret = patterns_process(true);
+	if (ret < 0) {
+		ULOGE("patterns_process: %s", strerror(-ret));
+		goto out;
+	}
+
+	ret = pattern_cache_compute_key(path, &key);
+	if (ret < 0) {
+		ULOGE("pattern_cache_compute_key: %s", strerror(-ret));
+		goto out;
+	}
+	ret = pattern_cache_write(image, key);
+	if (ret < 0)
+		ULOGE("pattern_cache_write: %s", strerror(-ret));
+out:
+	patterns_cleanup();
+
+	return ret;
+}
+
+
+const struct pattern *pattern_get(const char *name)
 {
 	if (ut_string_is_invalid(name)) {
 		errno = -EINVAL;
@@ -568,6 +1605,114 @@ const struct pattern *pattern_get(const char *name)
 	return get_pattern(name);
 }
 
+const struct pattern *patterns_next(const struct pattern *pattern)
+{
+	struct rs_node *node;
+
+	node = rs_dll_next_from(&patterns, pattern == NULL ? NULL :
+			(struct rs_node *)&pattern->node);
+
+	return node == NULL ? NULL : to_pattern(node);
+}
+
+/* drops the least recently used values until the memory budget is respected */
+static void patterns_enforce_budget(void)
+{
+	struct rs_node *node;
+	struct rs_node *next;
+	struct pattern *pattern;
+	uint32_t budget = global_get_patterns_memory_budget();
+
+	if (budget == 0)
+		return;
+
+	node = rs_dll_next_from(&lru, NULL);
+	while (node != NULL && channel_values_get_total_size() > budget) {
+		next = rs_dll_next_from(&lru, node);
+		pattern = lru_to_pattern(node);
+		if (pattern->pins == 0) {
+			ULOGD("dropping the values of pattern %s",
+					pattern->name);
+			rs_dll_remove(&lru, node);
+			pattern_release_values(pattern);
+		}
+		node = next;
+	}
+	if (channel_values_get_total_size() > budget)
+		ULOGW("patterns memory budget exceeded by the playing patterns, "
+				"%zu > %"PRIu32, channel_values_get_total_size(),
+				budget);
+}
+
+const struct pattern *pattern_acquire(const char *name)
+{
+	int ret;
+	struct pattern *pattern;
+
+	pattern = get_pattern(name);
+	if (pattern == NULL)
+		return NULL;
+
+	/* in lazy mode, compiled patterns are in lru, most recently used last */
+	if (pattern->compiled) {
+		if (global_get_lazy_patterns())
+			rs_dll_remove(&lru, &pattern->lru_node);
+	} else {
+		ret = compile_pattern(pattern);
+		if (ret < 0) {
+			ULOGE("compile_pattern(%s): %s", name, strerror(-ret));
+			errno = -ret;
+			return NULL;
+		}
+	}
+	pattern->pins++;
+	if (global_get_lazy_patterns()) {
+		rs_dll_enqueue(&lru, &pattern->lru_node);
+		patterns_enforce_budget();
+	}
+
+	return pattern;
+}
+
+void pattern_release(const struct pattern *pattern)
+{
+	struct pattern *p;
+
+	if (pattern == NULL)
+		return;
+
+	/*
+	 * not looked up by name, which may designate a newer version since
+	 * a reload, the const is only for the users of the patterns
+	 */
+	p = (struct pattern *)pattern;
+	if (p->pins == 0)
+		return;
+
+	p->pins--;
+	if (p->pins != 0)
+		return;
+	if (p->retired) {
+		ULOGI("old version of pattern %s released", p->name);
+		rs_dll_remove(&retired, &p->node);
+		pattern_destroy(p);
+	} else if (global_get_lazy_patterns()) {
+		patterns_enforce_budget();
+	}
+}
+
+int patterns_warm_up(const char *name)
+{
+	const struct pattern *pattern;
+
+	pattern = pattern_acquire(name);
+	if (pattern == NULL)
+		return -errno;
+	pattern_release(pattern);
+
+	return 0;
+}
+
 uint32_t pattern_get_total_duration(const struct pattern *pattern)
 {
 	if (pattern == NULL) {
@@ -598,55 +1743,175 @@ const char *pattern_get_name(const struct pattern *pattern)
 	return pattern->name;
 }
 
-static int apply_default_values(const struct pattern *pattern)
+/* value index of a channel, for a given value index of the pattern */
+static uint32_t channel_index(const struct pattern *pattern,
+		const struct channel_values *values, uint32_t index)
+{
+	if (pattern->master == NULL || values->nb_values == 0)
+		return index;
+
+	return index % values->nb_values;
+}
+
+static void cursor_seek_channel(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint8_t i, uint32_t index)
+{
+	const struct channel_values *values = pattern->v.channels[i];
+
+	cursor->indexes[i] = channel_index(pattern, values, index);
+	cursor->positions[i] = channel_values_seek(values, cursor->indexes[i]);
+}
+
+void pattern_cursor_seek(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint32_t index)
+{
+	uint8_t i;
+
+	cursor->index = index;
+	for (i = 0; i < pattern->nb_channels; i++)
+		cursor_seek_channel(pattern, cursor, i, index);
+}
+
+void pattern_cursor_rewind(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint32_t index)
+{
+	uint8_t i;
+	uint32_t nb_values = pattern->total_duration /
+			global_get_granularity();
+
+	cursor->index = index;
+	for (i = 0; i < pattern->nb_channels; i++)
+		if (pattern->master == NULL ||
+				pattern->v.channels[i]->nb_values == nb_values)
+			cursor_seek_channel(pattern, cursor, i, index);
+}
+
+void pattern_cursor_advance(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint32_t ticks)
+{
+	uint8_t i;
+	const struct channel_values *values;
+
+	cursor->index += ticks;
+	for (i = 0; i < pattern->nb_channels; i++) {
+		values = pattern->v.channels[i];
+		cursor->indexes[i] += ticks;
+		/* the channel loops on its own duration */
+		if (pattern->master != NULL &&
+				cursor->indexes[i] >= values->nb_values) {
+			cursor_seek_channel(pattern, cursor, i,
+					cursor->indexes[i]);
+			continue;
+		}
+		cursor->positions[i] = channel_values_advance(values,
+				cursor->positions[i], cursor->indexes[i]);
+	}
+}
+
+/* the channels of the pattern's leds it doesn't set take its default value */
+static int add_default_channels(const struct pattern *pattern,
+		struct compositor_source *source)
 {
 	int ret;
 	uint8_t i;
-	const char *led_id;
+	uint8_t j;
+	uint8_t k;
+	const struct led *led;
 
 	for (i = 0; i < MAX_CHANNELS_PER_PATTERN && pattern->leds[i] != NULL;
 			i++) {
-		led_id = pattern->leds[i];
-		if (led_id == NULL)
-			return 0;
-
-		ret = led_driver_apply_default_value(led_id,
-				pattern->default_value);
-		if (ret < 0)
-			ULOGW("led_driver_apply_default_value: %s",
-					strerror(-ret));
+		led = led_driver_get_led(pattern->leds[i]);
+		if (led == NULL)
+			continue;
+		for (j = 0; j < led->nb_channels; j++) {
+			for (k = 0; k < pattern->nb_channels; k++)
+				if (pattern_get_channel(pattern, k)->handle ==
+						led->channels[j])
+					break;
+			if (k != pattern->nb_channels)
+				continue;
+			ret = compositor_source_add_channel(source,
+					led->channels[j],
+					pattern->default_value);
+			if (ret < 0)
+				return ret;
+		}
 	}
 
 	return 0;
 }
 
-int pattern_apply_values(const struct pattern *pattern, uint32_t cursor,
-		bool apply_default)
+int pattern_init_source(const struct pattern *pattern,
+		const struct pattern_cursor *cursor,
+		struct compositor_source *source)
 {
 	int ret;
-	struct pattern_channel *channel;
 	uint8_t i;
-	uint8_t value;
+	uint8_t nb_leds = 0;
+
+	while (nb_leds < MAX_CHANNELS_PER_PATTERN &&
+			pattern->leds[nb_leds] != NULL)
+		nb_leds++;
+	ret = compositor_source_init(source, pattern->nb_channels +
+			nb_leds * LED_MAX_CHANNELS_PER_LED, pattern->layer,
+			pattern->blend, pattern->alpha);
+	if (ret < 0)
+		return ret;
 
-	if (apply_default) {
-		ret = apply_default_values(pattern);
+	/* the value of the pattern's channel i is source->values[i] */
+	for (i = 0; i < pattern->nb_channels; i++) {
+		ret = compositor_source_add_channel(source,
+				pattern_get_channel(pattern, i)->handle, 0);
 		if (ret < 0)
-			ULOGW("apply_default_values(%s): %s", pattern->name,
-					strerror(-ret));
+			goto err;
 	}
+	ret = add_default_channels(pattern, source);
+	if (ret < 0)
+		goto err;
+	pattern_render(pattern, cursor, source);
+
+	return 0;
+err:
+	compositor_source_cleanup(source);
+
+	return ret;
+}
+
+void pattern_render(const struct pattern *pattern,
+		const struct pattern_cursor *cursor,
+		struct compositor_source *source)
+{
+	uint8_t i;
+	uint8_t value;
+	bool changed = false;
 
 	for (i = 0; i < pattern->nb_channels; i++) {
-		channel = pattern_get_channel(pattern, i);
-		value = pattern->v.values[i][cursor];
-		ret = led_driver_set_value(channel->led_id, channel->channel_id,
-				value);
-		if (ret < 0)
-			ULOGW("led_driver_set_value(%s, %s, %"PRIu8"): %s",
-					channel->led_id, channel->channel_id,
-					value, strerror(-ret));
+		value = channel_values_get(pattern->v.channels[i],
+				cursor->indexes[i], cursor->positions[i]);
+		changed |= source->values[i] != value;
+		source->values[i] = value;
 	}
+	if (changed && source->active)
+		compositor_invalidate();
+}
 
-	return 0;
+uint32_t pattern_next_change(const struct pattern *pattern,
+		const struct pattern_cursor *cursor, uint32_t limit)
+{
+	uint8_t i;
+	uint32_t next = limit;
+	uint32_t index = cursor->index;
+
+	if (index == 0 || index >= limit)
+		return index;
+
+	/* channel indexes may differ from the pattern's, only deltas matter */
+	for (i = 0; i < pattern->nb_channels && next > index; i++)
+		next = MIN(next, index + channel_values_next_change(
+				pattern->v.channels[i], cursor->indexes[i],
+				cursor->positions[i]) - cursor->indexes[i]);
+
+	return next;
 }
 
 int pattern_switch_off(const struct pattern *pattern)
@@ -657,10 +1922,12 @@ int pattern_switch_off(const struct pattern *pattern)
 
 	for (i = 0; i < pattern->nb_channels; i++) {
 		channel = pattern_get_channel(pattern, i);
-		ret = led_driver_set_value(channel->led_id, channel->channel_id,
-				0);
+		if (channel->handle == NULL)
+			continue;
+		ret = led_driver_set_channel_value(channel->handle, 0);
 		if (ret < 0)
-			ULOGW("led_driver_set_value(%s, %s, %"PRIu8"): %s",
+			ULOGW("led_driver_set_channel_value(%s, %s, %"PRIu8
+					"): %s",
 					channel->led_id, channel->channel_id,
 					0, strerror(-ret));
 	}
@@ -668,13 +1935,9 @@ int pattern_switch_off(const struct pattern *pattern)
 	return 0;
 }
 
-static bool channel_have_same_led(const struct pattern_channel *channel1,
-		const struct pattern_channel *channel2)
+uint8_t pattern_get_layer(const struct pattern *pattern)
 {
-	if (channel1 == NULL || channel2 == NULL)
-		return false;
-
-	return ut_string_match(channel1->led_id, channel2->led_id);
+	return pattern->layer;
 }
 
 uint32_t pattern_get_intro(const struct pattern *pattern)
@@ -687,64 +1950,76 @@ uint32_t pattern_get_outro(const struct pattern *pattern)
 	return pattern->outro;
 }
 
-bool patterns_intersect(const struct pattern *pat1, const struct pattern *pat2)
+const struct led_set *pattern_get_led_set(const struct pattern *pattern)
 {
-	uint8_t i;
-	uint8_t j;
-	struct pattern_channel *channel1;
-	struct pattern_channel *channel2;
-
-	for (i = 0; i < pat1->nb_channels; i++)
-		for (j = 0; j < pat2->nb_channels; j++) {
-			channel1 = pattern_get_channel(pat1, i);
-			channel2 = pattern_get_channel(pat2, i);
-			if (channel_have_same_led(channel1, channel2))
-				return true;
-		}
-
-	return false;
+	return &pattern->led_set;
 }
 
-static bool pattern_contains_led(const struct pattern *pattern,
-		const char *led_id)
+bool patterns_intersect(const struct pattern *pat1, const struct pattern *pat2)
 {
-	struct pattern_channel *channel;
-	uint8_t i;
-
-	for (i = 0; i < pattern->nb_channels; i++) {
-		channel = pattern->channels[i];
-		if (ut_string_match(channel->led_id, led_id))
-			return true;
-	}
-
-	return false;
+	return led_sets_intersect(&pat1->led_set, &pat2->led_set);
 }
 
 bool patterns_have_same_support(const struct pattern *pat1,
 		const struct pattern *pat2)
 {
-	struct pattern_channel *channel;
-	uint8_t i;
+	return led_sets_equal(&pat1->led_set, &pat2->led_set);
+}
 
-	/* check that all leds controlled by pat1 are controlled by pat2 */
-	for (i = 0; i < pat1->nb_channels; i++) {
-		channel = pat1->channels[i];
-		if (!pattern_contains_led(pat2, channel->led_id))
-			return false;
-	}
-	/* check that all leds controlled by pat1 are controlled by pat2 */
-	for (i = 0; i < pat2->nb_channels; i++) {
-		channel = pat2->channels[i];
-		if (!pattern_contains_led(pat1, channel->led_id))
-			return false;
-	}
+void patterns_bind_channels(void)
+{
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&patterns, node)))
+		pattern_bind_channels(to_pattern(node));
+	/* old versions still playing */
+	while ((node = rs_dll_next_from(&retired, node)))
+		pattern_bind_channels(to_pattern(node));
+}
+
+void patterns_unbind_channels(void)
+{
+	struct rs_node *node = NULL;
 
-	return true;
+	while ((node = rs_dll_next_from(&patterns, node)))
+		pattern_unbind_channels(to_pattern(node));
+	while ((node = rs_dll_next_from(&retired, node)))
+		pattern_unbind_channels(to_pattern(node));
 }
 
 void patterns_dump_config(void)
 {
+	struct rs_node *node = NULL;
+	const struct pattern *pattern;
+	size_t dense = 0;
+	size_t compressed = 0;
+	size_t unique;
+	size_t shared;
+	size_t saved;
+	unsigned nb_compiled = 0;
+
 	rs_dll_dump(&patterns);
+
+	while ((node = rs_dll_next_from(&patterns, node))) {
+		pattern = to_pattern(node);
+		if (pattern->compiled)
+			nb_compiled++;
+		dense += pattern_get_values_size(pattern,
+				CHANNEL_VALUES_STORAGE_DENSE);
+		compressed += pattern_get_values_size(pattern,
+				CHANNEL_VALUES_STORAGE_COMPRESSED);
+	}
+	channel_values_get_sharing_stats(&unique, &shared, &saved);
+	ULOGI("patterns values: %zu bytes used, %zu unique, %zu shared, "
+			"%zu saved by sharing", unique + shared, unique, shared,
+			saved);
+	ULOGI("patterns compiled: %u/%u", nb_compiled,
+			rs_dll_get_count(&patterns));
+	ULOGI("patterns values without sharing: %zu if all dense, %zu if all "
+			"compressed", dense, compressed);
+	ULOGI("patterns arena: %zu bytes used, %zu allocated, interned strings: "
+			"%zu bytes", patterns_arena.size,
+			patterns_arena.capacity, string_pool_get_size());
 }
 
 void patterns_cleanup(void)
@@ -752,9 +2027,19 @@ void patterns_cleanup(void)
 	struct pattern *pattern;
 	struct rs_node *node;
 
+	name_index_cleanup(&patterns_index);
 	while (rs_dll_get_count(&patterns) != 0) {
 		node = rs_dll_pop(&patterns);
 		pattern = to_pattern(node);
 		pattern_destroy(pattern);
 	}
+	while (rs_dll_get_count(&retired) != 0)
+		pattern_destroy(to_pattern(rs_dll_pop(&retired)));
+	rs_dll_init(&lru, NULL);
+	arena_release(&frames_arena);
+	arena_release(&patterns_arena);
+	/* after the patterns, whose memory they may own */
+	loaders_destroy(&loaders);
+	/* the values mapped from the cache have been released above */
+	pattern_cache_cleanup();
 }
@@ -31,42 +31,149 @@
 #ifndef SRC_PATTERN_H_
 #define SRC_PATTERN_H_
 #include <stdbool.h>
+#include <stdio.h>
 
 #include <rs_node.h>
 
 #include <ledd_plugin.h>
 
+#include "led_set.h"
+#include "compositor.h"
+
+#define MAX_CHANNELS_PER_PATTERN 20
+
 struct pattern;
 
+/* reading head in the values of a pattern */
+struct pattern_cursor {
+	/* value index, index x granularity = time in ms */
+	uint32_t index;
+	/*
+	 * per channel value index, differs from index only for channels looping
+	 * on their own duration
+	 */
+	uint32_t indexes[MAX_CHANNELS_PER_PATTERN];
+	/* per channel reading position, for sequential access */
+	uint32_t positions[MAX_CHANNELS_PER_PATTERN];
+};
+
 int patterns_init(const char *path);
 
+/*
+ * same as patterns_init(), from an image generated at build time from
+ * patterns.conf by ledd-patterns-gen, whose tables are used in place
+ */
+int patterns_init_static(const void *image, size_t size);
+
+/*
+ * reads the patterns from path, computes their values and writes them to image,
+ * for patterns_init_static(), the patterns are cleaned up afterwards
+ */
+int patterns_generate_image(const char *path, FILE *image);
+
+/*
+ * reads path again, a file or a directory, and replaces the patterns whose
+ * definition changed, adds the new ones and removes the missing ones, only the
+ * patterns added or changed are computed. The old versions of the patterns
+ * playing are kept until released by their streams. On error, the patterns
+ * loaded are left untouched.
+ */
+int patterns_reload(const char *path);
+
+/* the values of the pattern returned may not be computed yet, in lazy mode */
 const struct pattern *pattern_get(const char *name);
 
+/*
+ * iterates over the patterns loaded, in their declaration order, starting with
+ * the first if pattern is NULL, returns NULL after the last
+ */
+const struct pattern *patterns_next(const struct pattern *pattern);
+
+/*
+ * returns the pattern, with its values computed, if needed, and pinned in
+ * memory until pattern_release() is called, NULL on error with errno set
+ */
+const struct pattern *pattern_acquire(const char *name);
+
+void pattern_release(const struct pattern *pattern);
+
+/* computes the values of a pattern in advance, in lazy mode */
+int patterns_warm_up(const char *name);
+
 uint32_t pattern_get_total_duration(const struct pattern *pattern);
 
 uint32_t pattern_get_repetitions(const struct pattern *pattern);
 
-/* cursor is the value index */
-int pattern_apply_values(const struct pattern *pattern, uint32_t cursor,
-		bool apply_default);
+/* positions the cursor at a given value index, by binary search */
+void pattern_cursor_seek(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint32_t index);
+
+/*
+ * jumps back to a given value index when the pattern loops, channels looping
+ * on their own duration, if it differs from the pattern's, aren't affected
+ */
+void pattern_cursor_rewind(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint32_t index);
+
+/* moves the cursor forward, in O(1) for a small number of ticks */
+void pattern_cursor_advance(const struct pattern *pattern,
+		struct pattern_cursor *cursor, uint32_t ticks);
+
+/*
+ * initializes a compositor source with the values of the pattern at the
+ * cursor, the channels of the pattern's leds it doesn't set are given its
+ * default value. The source isn't added to the compositor
+ */
+int pattern_init_source(const struct pattern *pattern,
+		const struct pattern_cursor *cursor,
+		struct compositor_source *source);
+
+/* updates the values of a source initialized by pattern_init_source() */
+void pattern_render(const struct pattern *pattern,
+		const struct pattern_cursor *cursor,
+		struct compositor_source *source);
+
+/*
+ * returns the first value index in [cursor->index, limit] at which the value of
+ * at least one channel may differ from the previous index, or limit if none
+ * does. cursor->index - 1 is expected to be the last value index applied.
+ */
+uint32_t pattern_next_change(const struct pattern *pattern,
+		const struct pattern_cursor *cursor, uint32_t limit);
 
 int pattern_switch_off(const struct pattern *pattern);
 
 const char *pattern_get_name(const struct pattern *pattern);
 
+/* compositor layer the pattern is played on */
+uint8_t pattern_get_layer(const struct pattern *pattern);
+
 uint32_t pattern_get_intro(const struct pattern *pattern);
 
 uint32_t pattern_get_outro(const struct pattern *pattern);
 
+/* set of the leds controlled by the pattern, by dense led index */
+const struct led_set *pattern_get_led_set(const struct pattern *pattern);
+
 /*
  * a pair of patterns intersect iif among the leds they control, at least one
- * is in common, even if only different channels are controlled
+ * is in common, even if only different channels are controlled. Only the leds
+ * present on the platform are taken into account.
  */
 bool patterns_intersect(const struct pattern *pat1, const struct pattern *pat2);
 
 bool patterns_have_same_support(const struct pattern *pat1,
 		const struct pattern *pat2);
 
+/*
+ * resolves (again) the led channels each pattern channel drives, must be called
+ * each time the platform is (re)loaded
+ */
+void patterns_bind_channels(void);
+
+/* drops the led channels handles, before the platform is cleaned up */
+void patterns_unbind_channels(void);
+
 void patterns_dump_config(void);
 
 void patterns_cleanup(void);
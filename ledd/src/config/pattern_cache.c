@@ -0,0 +1,895 @@
+/**
+ * @file pattern_cache.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define ULOG_TAG ledd_pattern_cache
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_pattern_cache);
+
+#include <ut_string.h>
+#include <ut_file.h>
+
+#include "pattern_cache.h"
+#include "pattern_priv.h"
+#include "channel_values.h"
+#include "global.h"
+#include "lua_globals_priv.h"
+#include "name_index_priv.h"
+#include "string_pool_priv.h"
+
+#define PATTERN_CACHE_MAGIC "LEDDPATC"
+#define PATTERN_CACHE_VERSION 3
+/* for channels whose values weren't computed when the cache was written */
+#define PATTERN_CACHE_NO_TABLE UINT32_MAX
+/* alignment of the sections, enough for all the structures stored */
+#define PATTERN_CACHE_ALIGNMENT 8
+
+#define FNV64_OFFSET_BASIS 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+/*
+ * layout of the cache file, all the integers are in native byte order and the
+ * offsets are from the start of the file. The sections are aligned, so that
+ * frames, runs and segments can be used in place.
+ */
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	/* sizes of the structures, in case their layout changes */
+	uint16_t header_size;
+	uint16_t pattern_size;
+	uint16_t channel_size;
+	uint16_t table_size;
+	uint16_t segment_size;
+	uint16_t padding;
+	uint64_t key;
+	/* part of the key not depending on patterns.conf */
+	uint64_t env_key;
+	uint32_t granularity;
+	uint32_t nb_patterns;
+	uint32_t nb_channels;
+	uint32_t nb_tables;
+	uint32_t nb_frames;
+	uint32_t strings_size;
+	uint64_t patterns;
+	uint64_t channels;
+	uint64_t tables;
+	uint64_t frames;
+	uint64_t strings;
+	/* of the whole file, to detect truncated files */
+	uint64_t size;
+};
+
+/* names and ids are offsets in the strings section */
+struct cache_pattern {
+	uint32_t name;
+	uint32_t first_channel;
+	uint32_t intro;
+	uint32_t outro;
+	uint32_t storage;
+	uint8_t nb_channels;
+	uint8_t default_value;
+	uint8_t repetitions;
+	uint8_t layer;
+	uint8_t blend;
+	uint8_t alpha;
+	uint8_t padding[2];
+};
+
+struct cache_channel {
+	uint32_t led_id;
+	uint32_t channel_id;
+	uint32_t first_frame;
+	uint32_t nb_frames;
+	uint32_t table;
+	uint32_t master;
+};
+
+/* values of one or more channels, as stored in struct channel_values */
+struct cache_table {
+	uint32_t storage;
+	uint32_t nb_values;
+	uint32_t nb_segments;
+	uint32_t nb_runs;
+	/* hash of the values, as computed by channel_values_share() */
+	uint32_t hash;
+	uint32_t padding;
+	/* 0 if the table is absent */
+	uint64_t values;
+	uint64_t runs;
+	uint64_t segments;
+};
+
+/* state of the writing of the cache, the first error is sticky */
+struct cache_writer {
+	FILE *file;
+	uint64_t offset;
+	int error;
+};
+
+/* sections of the cache, built in memory before being written */
+struct cache_builder {
+	struct cache_header header;
+	struct cache_pattern *patterns;
+	struct cache_channel *channels;
+	struct cache_table *tables;
+	/* values of the tables, sorted by address */
+	const struct channel_values **values;
+	struct pattern_frame *frames;
+	char *strings;
+	uint32_t strings_capacity;
+	/* maps each string to its offset + 1 in the strings section */
+	struct name_index strings_index;
+};
+
+/* cache file mapped read-only, or static image, loaded, if any */
+static void *map;
+static size_t map_size;
+/* false for a static image, which mustn't be unmapped */
+static bool map_owned;
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= FNV64_PRIME;
+	}
+
+	return hash;
+}
+
+static int hash_file(const char *path, uint64_t *hash)
+{
+	int __attribute__((cleanup(ut_file_fd_close))) fd = -1;
+	uint8_t buf[4096];
+	ssize_t len;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while ((len = read(fd, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		*hash = hash_bytes(*hash, buf, len);
+	}
+
+	return 0;
+}
+
+/* for a directory, the names and contents of its patterns files, in order */
+static int hash_path(const char *path, uint64_t *hash)
+{
+	int ret;
+	int n;
+	int i;
+	struct stat st;
+	struct dirent **entries;
+	char *file;
+
+	ret = stat(path, &st);
+	if (ret < 0)
+		return -errno;
+	if (!S_ISDIR(st.st_mode))
+		return hash_file(path, hash);
+
+	n = patterns_scan_directory(path, &entries);
+	if (n < 0)
+		return n;
+	for (i = 0, ret = 0; i < n; i++) {
+		if (ret == 0) {
+			*hash = hash_bytes(*hash, entries[i]->d_name,
+					strlen(entries[i]->d_name) + 1);
+			if (asprintf(&file, "%s/%s", path,
+					entries[i]->d_name) < 0) {
+				ret = -ENOMEM;
+			} else {
+				ret = hash_file(file, hash);
+				free(file);
+			}
+		}
+		free(entries[i]);
+	}
+	free(entries);
+
+	return ret;
+}
+
+uint64_t pattern_cache_compute_env_key(void)
+{
+	uint64_t hash = FNV64_OFFSET_BASIS;
+	uint32_t version = PATTERN_CACHE_VERSION;
+	uint32_t granularity = global_get_granularity();
+
+	hash = hash_bytes(hash, &version, sizeof(version));
+	hash = hash_bytes(hash, &granularity, sizeof(granularity));
+
+	/* transitions are registered as lua globals, along with their ids */
+	return lua_globals_hash(hash, LUA_GLOBALS_CONFIG_PATTERNS);
+}
+
+int pattern_cache_compute_key(const char *path, uint64_t *key)
+{
+	int ret;
+	uint64_t hash = pattern_cache_compute_env_key();
+
+	if (ut_string_is_invalid(path) || key == NULL)
+		return -EINVAL;
+
+	ret = hash_path(path, &hash);
+	if (ret < 0)
+		return ret;
+	*key = hash;
+
+	return 0;
+}
+
+/* the mapping is read-only, nothing is ever written through the result */
+static void *at(uint64_t offset)
+{
+	return (uint8_t *)map + offset;
+}
+
+static bool range_is_valid(uint64_t offset, uint64_t count, size_t size)
+{
+	/* count is 32 bits and size small, the product can't overflow */
+	return offset % PATTERN_CACHE_ALIGNMENT == 0 && offset <= map_size &&
+			count * size <= map_size - offset;
+}
+
+/* key can be NULL for static images, only the environment is checked then */
+static int check_header(const struct cache_header *h, const uint64_t *key)
+{
+	const char *strings;
+
+	if (memcmp(h->magic, PATTERN_CACHE_MAGIC, sizeof(h->magic)) != 0)
+		return -EINVAL;
+	/* written by another version of ledd */
+	if (h->version != PATTERN_CACHE_VERSION ||
+			h->header_size != sizeof(struct cache_header) ||
+			h->pattern_size != sizeof(struct cache_pattern) ||
+			h->channel_size != sizeof(struct cache_channel) ||
+			h->table_size != sizeof(struct cache_table) ||
+			h->segment_size != sizeof(struct channel_segment))
+		return -ESTALE;
+	if ((key != NULL && h->key != *key) ||
+			h->env_key != pattern_cache_compute_env_key() ||
+			h->granularity != global_get_granularity())
+		return -ESTALE;
+	if (h->size != map_size)
+		return -EINVAL;
+
+	if (!range_is_valid(h->patterns, h->nb_patterns,
+			sizeof(struct cache_pattern)) ||
+			!range_is_valid(h->channels, h->nb_channels,
+					sizeof(struct cache_channel)) ||
+			!range_is_valid(h->tables, h->nb_tables,
+					sizeof(struct cache_table)) ||
+			!range_is_valid(h->frames, h->nb_frames,
+					sizeof(struct pattern_frame)) ||
+			!range_is_valid(h->strings, h->strings_size, 1))
+		return -EINVAL;
+
+	/* all the strings are terminated if the last one is */
+	strings = at(h->strings);
+	if (h->strings_size != 0 && strings[h->strings_size - 1] != '\0')
+		return -EINVAL;
+
+	return 0;
+}
+
+static int check_table(const struct cache_table *t)
+{
+	bool dense = t->storage == CHANNEL_VALUES_STORAGE_DENSE;
+
+	if (t->storage > CHANNEL_VALUES_STORAGE_COMPRESSED)
+		return -EINVAL;
+	if (t->nb_values != 0 && (dense ? t->values : t->segments) == 0)
+		return -EINVAL;
+	if (t->values != 0 && !range_is_valid(t->values, t->nb_values, 1))
+		return -EINVAL;
+	if (t->runs != 0 && !range_is_valid(t->runs, t->nb_runs,
+			sizeof(struct pattern_run)))
+		return -EINVAL;
+	if (t->segments != 0 && !range_is_valid(t->segments, t->nb_segments,
+			sizeof(struct channel_segment)))
+		return -EINVAL;
+	if (!dense && t->nb_values != 0 && t->nb_segments == 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* checks all the offsets and indexes, so that loading only fails on ENOMEM */
+static int check_cache(const uint64_t *key)
+{
+	int ret;
+	uint32_t i;
+	const struct cache_header *h = at(0);
+	const struct cache_pattern *p;
+	const struct cache_channel *c;
+
+	ret = check_header(h, key);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < h->nb_tables; i++) {
+		ret = check_table((const struct cache_table *)at(h->tables) + i);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = 0; i < h->nb_patterns; i++) {
+		p = (const struct cache_pattern *)at(h->patterns) + i;
+		if (p->name >= h->strings_size ||
+				p->nb_channels > MAX_CHANNELS_PER_PATTERN ||
+				(uint64_t)p->first_channel + p->nb_channels >
+						h->nb_channels ||
+				p->storage > CHANNEL_VALUES_STORAGE_COMPRESSED ||
+				p->layer >= COMPOSITOR_NB_LAYERS ||
+				p->blend >= COMPOSITOR_BLEND_NB)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < h->nb_channels; i++) {
+		c = (const struct cache_channel *)at(h->channels) + i;
+		if (c->led_id >= h->strings_size ||
+				c->channel_id >= h->strings_size ||
+				(uint64_t)c->first_frame + c->nb_frames >
+						h->nb_frames ||
+				(c->table != PATTERN_CACHE_NO_TABLE &&
+						c->table >= h->nb_tables))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static const struct channel_values *load_table(const struct cache_header *h,
+		uint32_t table)
+{
+	const struct cache_table *t;
+	struct channel_values v;
+
+	t = (const struct cache_table *)at(h->tables) + table;
+	memset(&v, 0, sizeof(v));
+	v.storage = t->storage;
+	v.nb_values = t->nb_values;
+	v.nb_segments = t->nb_segments;
+	v.nb_runs = t->nb_runs;
+	v.values = t->values == 0 ? NULL : at(t->values);
+	v.runs = t->runs == 0 ? NULL : at(t->runs);
+	v.segments = t->segments == 0 ? NULL : at(t->segments);
+	v.mapped = true;
+
+	return channel_values_share_hashed(&v, t->hash);
+}
+
+static int load_channel(const struct cache_header *h, struct pattern *pattern,
+		const struct cache_channel *c, bool with_values)
+{
+	const char *strings = at(h->strings);
+	struct pattern_channel *channel;
+	const struct channel_values *values;
+
+	channel = pattern_channel_new(pattern);
+	if (channel == NULL)
+		return -errno;
+	channel->led_id = string_pool_intern(strings + c->led_id);
+	if (channel->led_id == NULL)
+		return -errno;
+	channel->channel_id = string_pool_intern(strings + c->channel_id);
+	if (channel->channel_id == NULL)
+		return -errno;
+	channel->nb_frames = c->nb_frames;
+	channel->frames = (const struct pattern_frame *)at(h->frames) +
+			c->first_frame;
+	channel->master = c->master != 0;
+
+	if (!with_values)
+		return 0;
+
+	values = load_table(h, c->table);
+	if (values == NULL)
+		return -errno;
+	pattern->v.channels[pattern->nb_channels - 1] = values;
+
+	return 0;
+}
+
+static int load_pattern(const struct cache_header *h,
+		const struct cache_pattern *p)
+{
+	int ret;
+	uint8_t i;
+	const char *strings = at(h->strings);
+	const struct cache_channel *channels;
+	struct pattern *pattern;
+	/* in lazy mode, the values are computed on demand, as usual */
+	bool with_values = !global_get_lazy_patterns();
+
+	pattern = pattern_new(strings + p->name);
+	if (pattern == NULL)
+		return -errno;
+	pattern->intro = p->intro;
+	pattern->outro = p->outro;
+	pattern->storage = p->storage;
+	pattern->default_value = p->default_value;
+	pattern->repetitions = p->repetitions;
+	pattern->layer = p->layer;
+	pattern->blend = p->blend;
+	pattern->alpha = p->alpha;
+
+	channels = (const struct cache_channel *)at(h->channels) +
+			p->first_channel;
+	for (i = 0; i < p->nb_channels; i++)
+		if (channels[i].table == PATTERN_CACHE_NO_TABLE)
+			with_values = false;
+	for (i = 0; i < p->nb_channels; i++) {
+		ret = load_channel(h, pattern, channels + i, with_values);
+		if (ret < 0)
+			return ret;
+	}
+	pattern->compiled = with_values;
+
+	return 0;
+}
+
+static int load_map(const uint64_t *key)
+{
+	int ret;
+	uint32_t i;
+	const struct cache_header *h = at(0);
+
+	if (map_size < sizeof(*h))
+		return -EINVAL;
+
+	ret = check_cache(key);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < h->nb_patterns; i++) {
+		ret = load_pattern(h, (const struct cache_pattern *)
+				at(h->patterns) + i);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int pattern_cache_load(const char *path, uint64_t key)
+{
+	int ret;
+	int __attribute__((cleanup(ut_file_fd_close))) fd = -1;
+	struct stat st;
+	void *m;
+
+	if (ut_string_is_invalid(path))
+		return -EINVAL;
+	pattern_cache_cleanup();
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	ret = fstat(fd, &st);
+	if (ret < 0)
+		return -errno;
+	if ((size_t)st.st_size < sizeof(struct cache_header))
+		return -EINVAL;
+
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+		return -errno;
+	map = m;
+	map_size = st.st_size;
+	map_owned = true;
+
+	ret = load_map(&key);
+	if (ret < 0)
+		return ret;
+	ULOGI("%"PRIu32" patterns loaded from cache %s",
+			((const struct cache_header *)at(0))->nb_patterns, path);
+
+	return 0;
+}
+
+int pattern_cache_load_image(const void *image, size_t size)
+{
+	int ret;
+
+	/* the structures are used in place */
+	if (image == NULL ||
+			(uintptr_t)image % PATTERN_CACHE_ALIGNMENT != 0)
+		return -EINVAL;
+	pattern_cache_cleanup();
+
+	map = (void *)image;
+	map_size = size;
+	map_owned = false;
+
+	ret = load_map(NULL);
+	if (ret < 0)
+		return ret;
+	ULOGI("%"PRIu32" patterns loaded from static image",
+			((const struct cache_header *)at(0))->nb_patterns);
+
+	return 0;
+}
+
+static int compare_addresses(const void *a, const void *b)
+{
+	uintptr_t p1 = (uintptr_t)*(const struct channel_values * const *)a;
+	uintptr_t p2 = (uintptr_t)*(const struct channel_values * const *)b;
+
+	return p1 < p2 ? -1 : p1 > p2;
+}
+
+static uint32_t find_table(const struct cache_builder *b,
+		const struct channel_values *values)
+{
+	const struct channel_values **found;
+
+	found = bsearch(&values, b->values, b->header.nb_tables,
+			sizeof(*b->values), compare_addresses);
+
+	return found - b->values;
+}
+
+static int add_string(struct cache_builder *b, const char *str,
+		uint32_t *offset)
+{
+	int ret;
+	void *found;
+	char *strings;
+	size_t len = strlen(str) + 1;
+	uint32_t capacity;
+
+	found = name_index_find(&b->strings_index, str);
+	if (found != NULL) {
+		*offset = (uintptr_t)found - 1;
+		return 0;
+	}
+
+	capacity = b->strings_capacity == 0 ? 256 : b->strings_capacity;
+	while (b->header.strings_size + len > capacity)
+		capacity *= 2;
+	if (capacity != b->strings_capacity) {
+		strings = realloc(b->strings, capacity);
+		if (strings == NULL)
+			return -errno;
+		b->strings = strings;
+		b->strings_capacity = capacity;
+	}
+	*offset = b->header.strings_size;
+	memcpy(b->strings + *offset, str, len);
+	b->header.strings_size += len;
+
+	/* the strings indexed are owned by the patterns, alive until the end */
+	ret = name_index_add(&b->strings_index, str,
+			(void *)(uintptr_t)(*offset + 1));
+
+	return ret < 0 ? ret : 0;
+}
+
+/* lists the unique values of the patterns compiled, sorted by address */
+static int collect_values(struct cache_builder *b)
+{
+	struct pattern *pattern = NULL;
+	uint32_t nb_values = 0;
+	uint32_t i;
+	uint32_t j;
+	uint8_t k;
+
+	while ((pattern = patterns_next_from(pattern)) != NULL) {
+		b->header.nb_patterns++;
+		b->header.nb_channels += pattern->nb_channels;
+		for (k = 0; k < pattern->nb_channels; k++)
+			b->header.nb_frames += pattern->channels[k]->nb_frames;
+		if (pattern->compiled)
+			nb_values += pattern->nb_channels;
+	}
+
+	b->values = calloc(nb_values + 1, sizeof(*b->values));
+	if (b->values == NULL)
+		return -errno;
+	i = 0;
+	while ((pattern = patterns_next_from(pattern)) != NULL)
+		for (k = 0; k < pattern->nb_channels && pattern->compiled; k++)
+			b->values[i++] = pattern->v.channels[k];
+	qsort(b->values, nb_values, sizeof(*b->values), compare_addresses);
+	for (i = 0, j = 0; i < nb_values; i++)
+		if (j == 0 || b->values[j - 1] != b->values[i])
+			b->values[j++] = b->values[i];
+	b->header.nb_tables = j;
+
+	return 0;
+}
+
+static int build_cache(struct cache_builder *b)
+{
+	int ret;
+	struct pattern *pattern = NULL;
+	const struct pattern_channel *channel;
+	struct cache_pattern *p;
+	struct cache_channel *c;
+	uint32_t nb_channels = 0;
+	uint32_t nb_frames = 0;
+	uint8_t k;
+
+	ret = collect_values(b);
+	if (ret < 0)
+		return ret;
+	b->patterns = calloc(b->header.nb_patterns + 1, sizeof(*b->patterns));
+	b->channels = calloc(b->header.nb_channels + 1, sizeof(*b->channels));
+	b->tables = calloc(b->header.nb_tables + 1, sizeof(*b->tables));
+	b->frames = calloc(b->header.nb_frames + 1, sizeof(*b->frames));
+	if (b->patterns == NULL || b->channels == NULL || b->tables == NULL ||
+			b->frames == NULL)
+		return -errno;
+
+	p = b->patterns;
+	while ((pattern = patterns_next_from(pattern)) != NULL) {
+		ret = add_string(b, pattern->name, &p->name);
+		if (ret < 0)
+			return ret;
+		p->first_channel = nb_channels;
+		p->intro = pattern->intro;
+		p->outro = pattern->outro;
+		p->storage = pattern->storage;
+		p->nb_channels = pattern->nb_channels;
+		p->default_value = pattern->default_value;
+		p->repetitions = pattern->repetitions;
+		p->layer = pattern->layer;
+		p->blend = pattern->blend;
+		p->alpha = pattern->alpha;
+		for (k = 0; k < pattern->nb_channels; k++) {
+			channel = pattern->channels[k];
+			c = b->channels + nb_channels++;
+			ret = add_string(b, channel->led_id, &c->led_id);
+			if (ret < 0)
+				return ret;
+			ret = add_string(b, channel->channel_id,
+					&c->channel_id);
+			if (ret < 0)
+				return ret;
+			c->first_frame = nb_frames;
+			c->nb_frames = channel->nb_frames;
+			if (channel->nb_frames != 0)
+				memcpy(b->frames + nb_frames, channel->frames,
+						channel->nb_frames *
+						sizeof(*b->frames));
+			nb_frames += channel->nb_frames;
+			c->table = pattern->compiled ?
+					find_table(b, pattern->v.channels[k]) :
+					PATTERN_CACHE_NO_TABLE;
+			c->master = channel->master;
+		}
+		p++;
+	}
+
+	return 0;
+}
+
+static void builder_cleanup(struct cache_builder *b)
+{
+	name_index_cleanup(&b->strings_index);
+	free(b->strings);
+	free(b->frames);
+	free(b->values);
+	free(b->tables);
+	free(b->channels);
+	free(b->patterns);
+	memset(b, 0, sizeof(*b));
+}
+
+static void write_data(struct cache_writer *w, const void *data, size_t size)
+{
+	if (w->error != 0 || size == 0)
+		return;
+
+	if (fwrite(data, 1, size, w->file) != size) {
+		w->error = errno != 0 ? -errno : -EIO;
+		return;
+	}
+	w->offset += size;
+}
+
+/* returns the offset the section has been written at */
+static uint64_t write_section(struct cache_writer *w, const void *data,
+		size_t size)
+{
+	static const uint8_t zeroes[PATTERN_CACHE_ALIGNMENT];
+	uint64_t offset;
+
+	write_data(w, zeroes, (PATTERN_CACHE_ALIGNMENT -
+			w->offset % PATTERN_CACHE_ALIGNMENT) %
+			PATTERN_CACHE_ALIGNMENT);
+	offset = w->offset;
+	write_data(w, data, size);
+
+	return offset;
+}
+
+static void write_table(struct cache_writer *w, struct cache_table *t,
+		const struct channel_values *v)
+{
+	t->storage = v->storage;
+	t->nb_values = v->nb_values;
+	t->nb_segments = v->nb_segments;
+	t->nb_runs = v->nb_runs;
+	t->hash = channel_values_get_hash(v);
+	if (v->values != NULL)
+		t->values = write_section(w, v->values,
+				v->nb_values * sizeof(*v->values));
+	if (v->runs != NULL)
+		t->runs = write_section(w, v->runs,
+				v->nb_runs * sizeof(*v->runs));
+	if (v->segments != NULL)
+		t->segments = write_section(w, v->segments,
+				v->nb_segments * sizeof(*v->segments));
+}
+
+static int write_image(FILE *file, struct cache_builder *b, uint64_t key)
+{
+	uint32_t i;
+	struct cache_header *h = &b->header;
+	struct cache_writer w = {.file = file};
+
+	memcpy(h->magic, PATTERN_CACHE_MAGIC, sizeof(h->magic));
+	h->version = PATTERN_CACHE_VERSION;
+	h->header_size = sizeof(struct cache_header);
+	h->pattern_size = sizeof(struct cache_pattern);
+	h->channel_size = sizeof(struct cache_channel);
+	h->table_size = sizeof(struct cache_table);
+	h->segment_size = sizeof(struct channel_segment);
+	h->key = key;
+	h->env_key = pattern_cache_compute_env_key();
+	h->granularity = global_get_granularity();
+
+	/* the header is rewritten once the offsets are known */
+	write_section(&w, h, sizeof(*h));
+	/* tables data first, their offsets are needed by their descriptors */
+	for (i = 0; i < h->nb_tables; i++)
+		write_table(&w, b->tables + i, b->values[i]);
+	h->patterns = write_section(&w, b->patterns,
+			h->nb_patterns * sizeof(*b->patterns));
+	h->channels = write_section(&w, b->channels,
+			h->nb_channels * sizeof(*b->channels));
+	h->tables = write_section(&w, b->tables,
+			h->nb_tables * sizeof(*b->tables));
+	h->frames = write_section(&w, b->frames,
+			h->nb_frames * sizeof(*b->frames));
+	h->strings = write_section(&w, b->strings, h->strings_size);
+	h->size = w.offset;
+	if (w.error != 0)
+		return w.error;
+
+	if (fseek(file, 0, SEEK_SET) < 0)
+		return -errno;
+	w.offset = 0;
+	write_data(&w, h, sizeof(*h));
+	if (w.error != 0)
+		return w.error;
+	/* memory streams report their position as their size */
+	if (fseek(file, h->size, SEEK_SET) < 0 || fflush(file) != 0)
+		return -errno;
+
+	return 0;
+}
+
+int pattern_cache_write(FILE *file, uint64_t key)
+{
+	int ret;
+	struct cache_builder b;
+
+	if (file == NULL)
+		return -EINVAL;
+
+	memset(&b, 0, sizeof(b));
+	ret = build_cache(&b);
+	if (ret < 0)
+		ULOGE("build_cache: %s", strerror(-ret));
+	else
+		ret = write_image(file, &b, key);
+	builder_cleanup(&b);
+
+	return ret;
+}
+
+int pattern_cache_store(const char *path, uint64_t key)
+{
+	int ret;
+	char __attribute__((cleanup(ut_string_free))) *tmp = NULL;
+	FILE *file;
+
+	if (ut_string_is_invalid(path))
+		return -EINVAL;
+
+	/* written aside then renamed, a reader never sees a partial file */
+	ret = asprintf(&tmp, "%s.tmp", path);
+	if (ret < 0) {
+		tmp = NULL;
+		return -ENOMEM;
+	}
+	file = fopen(tmp, "wbe");
+	if (file == NULL) {
+		ret = -errno;
+		ULOGE("fopen(%s): %m", tmp);
+		return ret;
+	}
+	ret = pattern_cache_write(file, key);
+	if (ret == 0 && fsync(fileno(file)) < 0)
+		ret = -errno;
+	if (fclose(file) != 0 && ret == 0)
+		ret = -errno;
+	if (ret == 0 && rename(tmp, path) < 0)
+		ret = -errno;
+	if (ret < 0) {
+		ULOGE("writing %s: %s", tmp, strerror(-ret));
+		unlink(tmp);
+		return ret;
+	}
+	ULOGI("patterns cache %s written", path);
+
+	return 0;
+}
+
+void pattern_cache_cleanup(void)
+{
+	if (map != NULL && map_owned)
+		munmap(map, map_size);
+	map = NULL;
+	map_size = 0;
+	map_owned = false;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file pattern_cache.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SRC_PATTERN_CACHE_H_
+#define SRC_PATTERN_CACHE_H_
+#include <stdio.h>
+#include <inttypes.h>
+
+/*
+ * binary cache of the patterns read from patterns.conf, with their values
+ * computed, to skip lua on the next boots. The file is mapped read-only and
+ * used in place, the mapping lives until pattern_cache_cleanup().
+ * It is only valid for a given cache format, content of patterns.conf,
+ * granularity and set of lua globals (thus transitions) for patterns.conf,
+ * which are summed up in the key of the cache.
+ * The same format is used for the static images, generated at build time and
+ * linked into ledd, for which patterns.conf isn't available at runtime.
+ */
+
+/* part of the key depending on ledd's build and config, not patterns.conf */
+uint64_t pattern_cache_compute_env_key(void);
+
+/* computes the key the cache of the patterns read from path must match */
+int pattern_cache_compute_key(const char *path, uint64_t *key);
+
+/*
+ * creates the patterns stored in the cache, before their post-processing, the
+ * values are attached to the patterns only if not in lazy mode.
+ * returns -ENOENT if there is no cache, -ESTALE if its key doesn't match, or
+ * another negative errno-compatible value if it is invalid
+ */
+int pattern_cache_load(const char *path, uint64_t key);
+
+/*
+ * same as pattern_cache_load(), for an image in memory, which must be aligned
+ * on 8 bytes and stay valid until pattern_cache_cleanup(). Only the part of the
+ * key not depending on patterns.conf is checked.
+ */
+int pattern_cache_load_image(const void *image, size_t size);
+
+/* writes the patterns, post-processed, as an image, to file */
+int pattern_cache_write(FILE *file, uint64_t key);
+
+/* writes the patterns, post-processed, to the cache, atomically */
+int pattern_cache_store(const char *path, uint64_t key);
+
+/*
+ * unmaps the cache or forgets the image, the patterns loaded from them must be
+ * destroyed before
+ */
+void pattern_cache_cleanup(void);
+
+#endif /* SRC_PATTERN_CACHE_H_ */
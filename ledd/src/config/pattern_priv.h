@@ -0,0 +1,143 @@
+/**
+ * @file pattern_priv.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SRC_PATTERN_PRIV_H_
+#define SRC_PATTERN_PRIV_H_
+#include <stdbool.h>
+
+#include <dirent.h>
+
+#include <rs_node.h>
+
+#include <ledd_plugin.h>
+
+#include "pattern.h"
+#include "channel_values.h"
+#include "led_set.h"
+
+/*
+ * internals of the patterns, shared with the modules building them from
+ * something else than patterns.conf, e.g. the compiled patterns cache
+ */
+
+struct patterns_loader;
+
+struct pattern_channel {
+	/* values read from patterns config file, ids are interned */
+	const char *led_id;
+	const char *channel_id;
+	/* dropped once the values are computed, may be in a mapped file */
+	unsigned nb_frames;
+	const struct pattern_frame *frames;
+
+	/* post-processed fields */
+	uint32_t duration; /* in ms, multiple of granularity */
+	/* resolved led channel, NULL if unbound */
+	struct led_channel *handle;
+	/* if true, the pattern's duration, intro and outro are this channel's */
+	bool master;
+};
+
+struct pattern_values {
+	/* shared between the channels of all the patterns, with equal values */
+	const struct channel_values *channels[MAX_CHANNELS_PER_PATTERN];
+};
+
+struct pattern {
+	struct rs_node node;
+
+	/* values read from patterns config file */
+	const char *name;
+	struct pattern_channel *channels[MAX_CHANNELS_PER_PATTERN];
+	/* leds with at least one channel modified by this pattern */
+	const char *leds[MAX_CHANNELS_PER_PATTERN];
+	/* same, for the leds bound, by dense led index */
+	struct led_set led_set;
+	uint8_t nb_channels;
+	uint8_t default_value;
+	uint8_t repetitions;
+	uint32_t intro;
+	uint32_t outro;
+	enum channel_values_storage storage;
+	/* compositing of the pattern's values with the other streams' */
+	uint8_t layer;
+	enum compositor_blend blend;
+	uint8_t alpha;
+	/*
+	 * if not NULL, each channel loops on its own duration, otherwise the
+	 * shorter channels are completed with zeroes
+	 */
+	const struct pattern_channel *master;
+
+	/* post-processed fields */
+	struct pattern_values v;
+	/* false in lazy mode until the pattern is played or warmed up */
+	bool compiled;
+	/* number of users (streams) of the values, which can't be dropped */
+	unsigned pins;
+	/* node in the least recently used list, lazy mode only */
+	struct rs_node lru_node;
+	/* max of channels durations */
+	uint32_t total_duration; /* in ms, multiple of granularity */
+
+	/* of the settings, channels and frames, to detect changes on reload */
+	uint64_t definition_hash;
+	/* owner of the pattern's memory, NULL if it's in the patterns arena */
+	struct patterns_loader *loader;
+	/*
+	 * replaced or removed by a reload, but still pinned, it's destroyed
+	 * when the last pin is released
+	 */
+	bool retired;
+};
+
+/*
+ * allocates a pattern with default settings and appends it to the patterns,
+ * the name is copied. Returns NULL with errno set on error
+ */
+struct pattern *pattern_new(const char *name);
+
+/* allocates an empty channel and appends it to the pattern's */
+struct pattern_channel *pattern_channel_new(struct pattern *pattern);
+
+/* iterates over the patterns in declaration order, starting with NULL */
+struct pattern *patterns_next_from(struct pattern *pattern);
+
+/* files taken into account when patterns_config is a directory */
+#define PATTERNS_FILE_SUFFIX ".conf"
+
+/*
+ * lists the patterns files of a directory, sorted by name, as scandir() does,
+ * returns their number or a negative errno-compatible value on error
+ */
+int patterns_scan_directory(const char *path, struct dirent ***entries);
+
+#endif /* SRC_PATTERN_PRIV_H_ */
@@ -48,6 +48,7 @@ ULOG_DECLARE_TAG(ledd_platform);
 #include "led_driver_priv.h"
 
 #include "platform.h"
+#include "pattern.h"
 #include "utils.h"
 
 #define print_top do {int top = lua_gettop(l); ULOGC("stack_top = %d", top);\
@@ -167,15 +168,21 @@ int platform_init(const char *path)
 
 	led_driver_init();
 	ret = read_config(path, read_platform, LUA_GLOBALS_CONFIG_PLATFORM);
-	if (ret != 0)
+	if (ret != 0) {
 		platform_cleanup();
+		return ret;
+	}
 
-	return ret;
+	/* patterns already loaded must drive the newly created channels */
+	patterns_bind_channels();
+
+	return 0;
 }
 
 void platform_cleanup(void)
 {
 	ULOGD("%s", __func__);
 
+	patterns_unbind_channels();
 	led_driver_cleanup();
 }
@@ -0,0 +1,453 @@
+/**
+ * @file control.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define ULOG_TAG ledd_control
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_control);
+
+#include <rs_node.h>
+#include <rs_dll.h>
+
+#include <ut_string.h>
+#include <ut_utils.h>
+
+#include <ledd.h>
+#include <ledd_plugin.h>
+
+#include "pattern.h"
+#include "commands.h"
+#include "control.h"
+
+struct control_op {
+	enum command_type type;
+	/* name of the pattern for COMMAND_SET_PATTERN, of the led otherwise */
+	char *name;
+	/* COMMAND_SET_VALUE only */
+	char *channel;
+	uint8_t value;
+	/* COMMAND_SET_PATTERN only */
+	bool resume;
+};
+
+struct ledd_batch {
+	struct control_op *ops;
+	size_t count;
+	size_t capacity;
+	/* set once posted */
+	struct ledd_batch *next;
+	struct rs_node node;
+	uint32_t flags;
+	ledd_batch_cb cb;
+	void *userdata;
+};
+
+struct control {
+	/*
+	 * pushed to by any thread, newest first, emptied by the ledd loop,
+	 * INBOX_CLOSED outside of ledd_init() and ledd_cleanup()
+	 */
+	struct ledd_batch *inbox;
+	/* -1 outside of ledd_init() and ledd_cleanup() */
+	int event_fd;
+	/* threads posting, which may still use event_fd */
+	unsigned posters;
+	control_queued_cb queued_cb;
+	/* batches queued, with a callback, not applied yet */
+	struct rs_dll pending;
+};
+
+/* no address of a batch, pushed to the inbox once closed */
+static struct ledd_batch inbox_closed;
+#define INBOX_CLOSED (&inbox_closed)
+
+static struct control control = {
+	.inbox = INBOX_CLOSED,
+	.event_fd = -1,
+};
+
+#define to_batch(n) ut_container_of((n), struct ledd_batch, node)
+
+static void batch_clear(struct ledd_batch *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->count; i++) {
+		free(batch->ops[i].name);
+		free(batch->ops[i].channel);
+	}
+	free(batch->ops);
+	batch->ops = NULL;
+	batch->count = batch->capacity = 0;
+}
+
+/* returns the operation to fill, which is counted by the caller on success */
+static struct control_op *batch_add(struct ledd_batch *batch)
+{
+	size_t capacity;
+	struct control_op *ops;
+
+	if (batch->count == batch->capacity) {
+		capacity = batch->capacity == 0 ? 4 : 2 * batch->capacity;
+		ops = realloc(batch->ops, capacity * sizeof(*ops));
+		if (ops == NULL)
+			return NULL;
+		batch->ops = ops;
+		batch->capacity = capacity;
+	}
+	memset(batch->ops + batch->count, 0, sizeof(*batch->ops));
+
+	return batch->ops + batch->count;
+}
+
+static void complete(struct ledd_batch *batch, int status)
+{
+	if (batch->cb != NULL)
+		batch->cb(batch->userdata, status);
+	batch_clear(batch);
+	free(batch);
+}
+
+static int check_op(const struct control_op *op)
+{
+	if (op->type == COMMAND_SET_PATTERN)
+		return pattern_get(op->name) == NULL ? -ESRCH : 0;
+
+	return led_driver_get_channel(op->name, op->channel) == NULL ?
+			-ESRCH : 0;
+}
+
+static int queue_op(const struct control_op *op)
+{
+	if (op->type == COMMAND_SET_PATTERN)
+		return commands_set_pattern(op->name, op->resume);
+
+	return commands_set_value(led_driver_get_channel(op->name, op->channel),
+			op->value);
+}
+
+static void process_batch(struct ledd_batch *batch)
+{
+	int ret = 0;
+	size_t i;
+	bool now = batch->flags & LEDD_BATCH_NOW;
+
+	/* all or nothing */
+	for (i = 0; ret == 0 && i < batch->count; i++)
+		ret = check_op(batch->ops + i);
+	commands_begin_batch();
+	for (i = 0; ret == 0 && i < batch->count; i++)
+		ret = queue_op(batch->ops + i);
+	commands_end_batch(ret == 0);
+	if (ret < 0) {
+		ULOGE("batch: %s", strerror(-ret));
+		complete(batch, ret);
+		return;
+	}
+
+	if (batch->cb == NULL) {
+		complete(batch, 0);
+	} else {
+		batch_clear(batch);
+		rs_dll_enqueue(&control.pending, &batch->node);
+		/* the batch may be empty, or reduced to nothing */
+		if (!commands_are_pending())
+			control_complete();
+	}
+
+	ret = control.queued_cb(now);
+	if (ret < 0)
+		ULOGE("queued_cb: %s", strerror(-ret));
+}
+
+/*
+ * returns the batches posted, oldest first, and leaves the inbox empty, or
+ * closed
+ */
+static struct ledd_batch *inbox_take(struct ledd_batch *empty)
+{
+	struct ledd_batch *batch;
+	struct ledd_batch *next;
+	struct ledd_batch *fifo = NULL;
+
+	batch = __atomic_exchange_n(&control.inbox, empty, __ATOMIC_ACQ_REL);
+	if (batch == INBOX_CLOSED)
+		return NULL;
+	for (; batch != NULL; batch = next) {
+		next = batch->next;
+		batch->next = fifo;
+		fifo = batch;
+	}
+
+	return fifo;
+}
+
+/* the caller is counted in posters, so that fd stays open */
+static int inbox_push(struct ledd_batch *batch, int fd)
+{
+	uint64_t one = 1;
+	struct ledd_batch *head;
+
+	head = __atomic_load_n(&control.inbox, __ATOMIC_RELAXED);
+	do {
+		/* control_cleanup() has begun */
+		if (head == INBOX_CLOSED)
+			return -ECANCELED;
+		batch->next = head;
+	} while (!__atomic_compare_exchange_n(&control.inbox, &head, batch,
+			true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* the loop is woken up once, until it empties the inbox */
+	if (head == NULL && write(fd, &one, sizeof(one)) < 0)
+		ULOGE("write: %m");
+
+	return 0;
+}
+
+static void inbox_cb(int fd, uint32_t revents, void *userdata)
+{
+	uint64_t count;
+	struct ledd_batch *batch;
+	struct ledd_batch *next;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		ULOGE("read: %m");
+
+	for (batch = inbox_take(NULL); batch != NULL; batch = next) {
+		next = batch->next;
+		process_batch(batch);
+	}
+}
+
+int control_init(struct pomp_loop *loop, control_queued_cb queued_cb)
+{
+	int ret;
+	int fd;
+
+	if (loop == NULL || queued_cb == NULL)
+		return -EINVAL;
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd == -1) {
+		ret = -errno;
+		ULOGE("eventfd: %m");
+		return ret;
+	}
+	ret = pomp_loop_add(loop, fd, POMP_FD_EVENT_IN, inbox_cb, NULL);
+	if (ret < 0) {
+		ULOGE("pomp_loop_add: %s", strerror(-ret));
+		close(fd);
+		return ret;
+	}
+	rs_dll_init(&control.pending, NULL);
+	control.queued_cb = queued_cb;
+	/* from now on, the batches can be posted */
+	__atomic_store_n(&control.inbox, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&control.event_fd, fd, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void control_complete(void)
+{
+	struct rs_node *node;
+
+	while ((node = rs_dll_pop(&control.pending)))
+		complete(to_batch(node), 0);
+}
+
+void control_cleanup(struct pomp_loop *loop)
+{
+	int ret;
+	int fd;
+	struct rs_node *node;
+	struct ledd_batch *batch;
+	struct ledd_batch *next;
+
+	/* sequentially consistent, with the posters' counting */
+	fd = __atomic_exchange_n(&control.event_fd, -1, __ATOMIC_SEQ_CST);
+	if (fd == -1)
+		return;
+	/* the posts from now on fail, those in progress end before the close */
+	batch = inbox_take(INBOX_CLOSED);
+	while (__atomic_load_n(&control.posters, __ATOMIC_SEQ_CST) != 0)
+		sched_yield();
+	ret = pomp_loop_remove(loop, fd);
+	if (ret < 0)
+		ULOGW("pomp_loop_remove: %s", strerror(-ret));
+	close(fd);
+
+	/* the batches not applied yet won't be */
+	while ((node = rs_dll_pop(&control.pending)))
+		complete(to_batch(node), -ECANCELED);
+	for (; batch != NULL; batch = next) {
+		next = batch->next;
+		complete(batch, -ECANCELED);
+	}
+}
+
+struct ledd_batch *ledd_batch_new(void)
+{
+	return calloc(1, sizeof(struct ledd_batch));
+}
+
+int ledd_batch_set_pattern(struct ledd_batch *batch, const char *pattern,
+		bool resume_previous)
+{
+	struct control_op *op;
+
+	if (batch == NULL || ut_string_is_invalid(pattern))
+		return -EINVAL;
+
+	op = batch_add(batch);
+	if (op == NULL)
+		return -errno;
+	op->name = strdup(pattern);
+	if (op->name == NULL)
+		return -errno;
+	op->type = COMMAND_SET_PATTERN;
+	op->resume = resume_previous;
+	batch->count++;
+
+	return 0;
+}
+
+int ledd_batch_set_value(struct ledd_batch *batch, const char *led,
+		const char *channel, uint8_t value)
+{
+	struct control_op *op;
+
+	if (batch == NULL || ut_string_is_invalid(led) ||
+			ut_string_is_invalid(channel))
+		return -EINVAL;
+
+	op = batch_add(batch);
+	if (op == NULL)
+		return -errno;
+	op->name = strdup(led);
+	op->channel = strdup(channel);
+	if (op->name == NULL || op->channel == NULL) {
+		free(op->name);
+		free(op->channel);
+		return -ENOMEM;
+	}
+	op->type = COMMAND_SET_VALUE;
+	op->value = value;
+	batch->count++;
+
+	return 0;
+}
+
+int ledd_batch_post(struct ledd_batch *batch, uint32_t flags,
+		ledd_batch_cb cb, void *userdata)
+{
+	int ret;
+	int fd;
+	struct ledd_batch *posted;
+
+	if (batch == NULL || (flags & ~LEDD_BATCH_NOW) != 0)
+		return -EINVAL;
+
+	posted = calloc(1, sizeof(*posted));
+	if (posted == NULL)
+		return -errno;
+	/* the operations move to the copy posted, the batch can be reused */
+	posted->ops = batch->ops;
+	posted->count = batch->count;
+	posted->capacity = batch->capacity;
+	posted->flags = flags;
+	posted->cb = cb;
+	posted->userdata = userdata;
+
+	/* either control_cleanup() sees the post, or the post sees it */
+	__atomic_add_fetch(&control.posters, 1, __ATOMIC_SEQ_CST);
+	fd = __atomic_load_n(&control.event_fd, __ATOMIC_SEQ_CST);
+	ret = fd == -1 ? -ENOTCONN : inbox_push(posted, fd);
+	__atomic_sub_fetch(&control.posters, 1, __ATOMIC_RELEASE);
+	if (ret < 0) {
+		free(posted);
+		return ret;
+	}
+	batch->ops = NULL;
+	batch->count = batch->capacity = 0;
+
+	return 0;
+}
+
+void ledd_batch_destroy(struct ledd_batch **batch)
+{
+	if (batch == NULL || *batch == NULL)
+		return;
+
+	batch_clear(*batch);
+	free(*batch);
+	*batch = NULL;
+}
+
+static int post_one(struct ledd_batch *batch, int ret, uint32_t flags)
+{
+	if (ret == 0)
+		ret = ledd_batch_post(batch, flags, NULL, NULL);
+	batch_clear(batch);
+
+	return ret;
+}
+
+int ledd_set_pattern(const char *pattern, bool resume_previous)
+{
+	struct ledd_batch batch = { .ops = NULL };
+
+	return post_one(&batch, ledd_batch_set_pattern(&batch, pattern,
+			resume_previous), 0);
+}
+
+int ledd_set_pattern_now(const char *pattern, bool resume_previous)
+{
+	struct ledd_batch batch = { .ops = NULL };
+
+	return post_one(&batch, ledd_batch_set_pattern(&batch, pattern,
+			resume_previous), LEDD_BATCH_NOW);
+}
+
+int ledd_set_value(const char *led, const char *channel, uint8_t value)
+{
+	struct ledd_batch batch = { .ops = NULL };
+
+	return post_one(&batch, ledd_batch_set_value(&batch, led, channel,
+			value), 0);
+}
@@ -0,0 +1,57 @@
+/**
+ * @file control.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LEDD_SRC_CONTROL_H_
+#define LEDD_SRC_CONTROL_H_
+#include <stdbool.h>
+
+#include <libpomp.h>
+
+/*
+ * in-process control API of ledd.h: the batches posted by the threads of the
+ * program embedding ledd are pushed in a lock-free inbox, which the ledd loop
+ * empties when woken up by an eventfd, then they are queued like the commands
+ * received on the socket.
+ */
+
+/*
+ * called in the ledd loop, for each batch queued, now is true if its commands
+ * must be applied right away
+ */
+typedef int (*control_queued_cb)(bool now);
+
+int control_init(struct pomp_loop *loop, control_queued_cb queued_cb);
+
+/* calls the callbacks of the batches applied */
+void control_complete(void);
+
+void control_cleanup(struct pomp_loop *loop);
+
+#endif /* LEDD_SRC_CONTROL_H_ */
@@ -0,0 +1,371 @@
+/**
+ * @file events.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define ULOG_TAG ledd_events
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_events);
+
+#include <rs_node.h>
+#include <rs_dll.h>
+
+#include <ut_utils.h>
+
+#include <ledd_plugin.h>
+
+#include "led_driver_priv.h"
+
+#include "utils.h"
+#include "pattern.h"
+#include "player.h"
+#include "events.h"
+
+/* messages a subscriber can have queued, beyond, they are dropped for it */
+#define EVENTS_MAX_QUEUED 8
+
+struct events_subscriber {
+	struct rs_node node;
+	struct pomp_conn *conn;
+	uint32_t flags;
+	uint32_t values_period_ms;
+	double last_values_ms;
+	/* messages sent since the queue of the connection was last empty */
+	uint32_t queued;
+	uint64_t dropped;
+};
+
+struct events {
+	struct rs_dll subscribers;
+	/* recorded since the last flush, PROTOCOL_EVENT_SIZE bytes each */
+	uint8_t *records;
+	uint32_t count;
+	uint32_t capacity;
+	/* of the last events message broadcast */
+	uint32_t seq;
+	uint64_t broadcasts;
+	/* by the subscribers gone */
+	uint64_t dropped;
+};
+
+static struct events events;
+
+#define to_subscriber(n) ut_container_of((n), struct events_subscriber, node)
+
+static void write_record(uint8_t *record, enum protocol_event_type type,
+		const struct pattern *pattern)
+{
+	uint32_t id = 0;
+
+	memset(record, 0, PROTOCOL_EVENT_SIZE);
+	if (pattern != NULL) {
+		id = protocol_get_pattern_id(pattern_get_name(pattern));
+		record[5] = pattern_get_layer(pattern);
+	}
+	record[0] = id;
+	record[1] = id >> 8;
+	record[2] = id >> 16;
+	record[3] = id >> 24;
+	record[4] = type;
+}
+
+static struct pomp_msg *new_msg(uint32_t msgid, const void *data,
+		uint32_t size)
+{
+	int ret;
+	struct pomp_msg *msg;
+
+	msg = pomp_msg_new();
+	if (msg == NULL)
+		return NULL;
+	/* libpomp doesn't accept NULL, even for 0 bytes */
+	ret = pomp_msg_write(msg, msgid, "%u%p%u", events.seq,
+			size == 0 ? "" : data, size);
+	if (ret < 0) {
+		pomp_msg_destroy(msg);
+		errno = -ret;
+		return NULL;
+	}
+
+	return msg;
+}
+
+static void send_to(struct events_subscriber *subscriber,
+		const struct pomp_msg *msg)
+{
+	int ret;
+
+	if (subscriber->queued >= EVENTS_MAX_QUEUED) {
+		subscriber->dropped++;
+		return;
+	}
+	/* the send callback may reset it before pomp_conn_send_msg returns */
+	subscriber->queued++;
+	ret = pomp_conn_send_msg(subscriber->conn, msg);
+	if (ret < 0) {
+		subscriber->queued--;
+		subscriber->dropped++;
+		ULOGW("pomp_conn_send_msg: %s", strerror(-ret));
+	}
+}
+
+static struct events_subscriber *find_subscriber(struct pomp_conn *conn)
+{
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&events.subscribers, node)))
+		if (to_subscriber(node)->conn == conn)
+			return to_subscriber(node);
+
+	return NULL;
+}
+
+static void remove_subscriber(struct events_subscriber *subscriber)
+{
+	rs_dll_remove(&events.subscribers, &subscriber->node);
+	events.dropped += subscriber->dropped;
+	free(subscriber);
+	/* the events recorded would reach the next subscriber late */
+	if (rs_dll_is_empty(&events.subscribers))
+		events.count = 0;
+}
+
+/* the patterns playing, with the sequence number of the last broadcast */
+static int send_snapshot(struct events_subscriber *subscriber)
+{
+	uint8_t *records;
+	uint32_t count = 0;
+	const struct pattern *pattern = NULL;
+	struct pomp_msg *msg;
+
+	while ((pattern = player_next_pattern(pattern)))
+		count++;
+	records = calloc(count + 1, PROTOCOL_EVENT_SIZE);
+	if (records == NULL)
+		return -errno;
+	count = 0;
+	while ((pattern = player_next_pattern(pattern)))
+		write_record(records + count++ * PROTOCOL_EVENT_SIZE,
+				PROTOCOL_EVENT_PLAYING, pattern);
+
+	msg = new_msg(PROTOCOL_MSG_EVENTS, records,
+			count * PROTOCOL_EVENT_SIZE);
+	free(records);
+	if (msg == NULL)
+		return -errno;
+	send_to(subscriber, msg);
+	pomp_msg_destroy(msg);
+
+	return 0;
+}
+
+static void broadcast_events(void)
+{
+	struct rs_node *node = NULL;
+	struct events_subscriber *subscriber;
+	struct pomp_msg *msg;
+
+	events.seq++;
+	msg = new_msg(PROTOCOL_MSG_EVENTS, events.records,
+			events.count * PROTOCOL_EVENT_SIZE);
+	events.count = 0;
+	if (msg == NULL) {
+		ULOGE("new_msg: %m");
+		return;
+	}
+	events.broadcasts++;
+	while ((node = rs_dll_next_from(&events.subscribers, node))) {
+		subscriber = to_subscriber(node);
+		if (subscriber->flags & PROTOCOL_SUBSCRIBE_EVENTS)
+			send_to(subscriber, msg);
+	}
+	pomp_msg_destroy(msg);
+}
+
+/*
+ * the values committed, to the subscribers whose period has elapsed, or to all
+ * once the player stops, so that they get the last frame
+ */
+static void send_values(void)
+{
+	double now = monotonic_ms();
+	bool last = !player_is_playing();
+	const uint8_t *values;
+	uint32_t nb_slots;
+	struct rs_node *node = NULL;
+	struct events_subscriber *subscriber;
+	struct pomp_msg *msg = NULL;
+
+	while ((node = rs_dll_next_from(&events.subscribers, node))) {
+		subscriber = to_subscriber(node);
+		if (!(subscriber->flags & PROTOCOL_SUBSCRIBE_VALUES))
+			continue;
+		if (!last && now - subscriber->last_values_ms <
+				subscriber->values_period_ms)
+			continue;
+		if (msg == NULL) {
+			values = led_driver_get_committed_values(&nb_slots);
+			msg = new_msg(PROTOCOL_MSG_VALUES, values, nb_slots);
+			if (msg == NULL) {
+				ULOGE("new_msg: %m");
+				return;
+			}
+		}
+		subscriber->last_values_ms = now;
+		send_to(subscriber, msg);
+	}
+	if (msg != NULL)
+		pomp_msg_destroy(msg);
+}
+
+int events_init(void)
+{
+	return rs_dll_init(&events.subscribers, NULL);
+}
+
+void events_record(enum protocol_event_type type, const struct pattern *pattern)
+{
+	uint32_t capacity;
+	uint8_t *records;
+
+	/* nobody listens, the player isn't slowed down */
+	if (rs_dll_is_empty(&events.subscribers))
+		return;
+
+	if (events.count == events.capacity) {
+		capacity = events.capacity == 0 ? 16 : 2 * events.capacity;
+		records = realloc(events.records,
+				capacity * PROTOCOL_EVENT_SIZE);
+		if (records == NULL) {
+			ULOGE("realloc: %m");
+			return;
+		}
+		events.records = records;
+		events.capacity = capacity;
+	}
+	write_record(events.records + events.count++ * PROTOCOL_EVENT_SIZE,
+			type, pattern);
+}
+
+int events_subscribe(struct pomp_conn *conn, const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t flags;
+	uint32_t period;
+	struct events_subscriber *subscriber;
+
+	ret = pomp_msg_read(msg, "%u%u", &flags, &period);
+	if (ret < 0) {
+		ULOGE("pomp_msg_read: %s", strerror(-ret));
+		return ret;
+	}
+	if (flags & ~(PROTOCOL_SUBSCRIBE_EVENTS | PROTOCOL_SUBSCRIBE_VALUES))
+		return -EINVAL;
+
+	subscriber = find_subscriber(conn);
+	if (flags == 0) {
+		if (subscriber != NULL)
+			remove_subscriber(subscriber);
+		return 0;
+	}
+	if (subscriber == NULL) {
+		subscriber = calloc(1, sizeof(*subscriber));
+		if (subscriber == NULL)
+			return -errno;
+		subscriber->conn = conn;
+		rs_dll_enqueue(&events.subscribers, &subscriber->node);
+	}
+	subscriber->flags = flags;
+	subscriber->values_period_ms = period;
+	subscriber->last_values_ms = 0;
+
+	if (!(flags & PROTOCOL_SUBSCRIBE_EVENTS))
+		return 0;
+
+	return send_snapshot(subscriber);
+}
+
+void events_flush(void)
+{
+	if (rs_dll_is_empty(&events.subscribers))
+		return;
+
+	if (events.count != 0)
+		broadcast_events();
+	send_values();
+}
+
+void events_sent(struct pomp_conn *conn, uint32_t status)
+{
+	struct events_subscriber *subscriber;
+
+	if (!(status & POMP_SEND_STATUS_QUEUE_EMPTY))
+		return;
+
+	subscriber = find_subscriber(conn);
+	if (subscriber != NULL)
+		subscriber->queued = 0;
+}
+
+void events_disconnected(struct pomp_conn *conn)
+{
+	struct events_subscriber *subscriber;
+
+	subscriber = find_subscriber(conn);
+	if (subscriber != NULL)
+		remove_subscriber(subscriber);
+}
+
+void events_dump_stats(void)
+{
+	uint64_t dropped = events.dropped;
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&events.subscribers, node)))
+		dropped += to_subscriber(node)->dropped;
+
+	ULOGI("subscribers = %u, events broadcast = %"PRIu64", messages "
+			"dropped = %"PRIu64,
+			rs_dll_get_count(&events.subscribers),
+			events.broadcasts, dropped);
+}
+
+void events_cleanup(void)
+{
+	struct rs_node *node;
+
+	while ((node = rs_dll_pop(&events.subscribers)))
+		free(to_subscriber(node));
+	free(events.records);
+	memset(&events, 0, sizeof(events));
+}
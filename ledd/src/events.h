@@ -0,0 +1,73 @@
+/**
+ * @file events.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LEDD_SRC_EVENTS_H_
+#define LEDD_SRC_EVENTS_H_
+#include <inttypes.h>
+
+#include <libpomp.h>
+
+#include "protocol.h"
+
+struct pattern;
+
+/*
+ * events of the streams, pushed to the clients subscribed with
+ * PROTOCOL_MSG_SUBSCRIBE. They are recorded while the frames are computed, then
+ * broadcast by events_flush(), one message per tick, along with the values of
+ * the channels, if requested. A subscriber has a bounded number of messages
+ * queued, those it can't take are dropped for it, which it notices by the gap
+ * in the sequence numbers, so that a slow subscriber never delays the player.
+ */
+
+int events_init(void);
+
+/* pattern is NULL for PROTOCOL_EVENT_RELOADED */
+void events_record(enum protocol_event_type type, const struct pattern *pattern);
+
+/*
+ * subscribes or unsubscribes a client, the subscribers to the events receive
+ * the patterns playing first, as PROTOCOL_EVENT_PLAYING events
+ */
+int events_subscribe(struct pomp_conn *conn, const struct pomp_msg *msg);
+
+/* broadcasts the events recorded, to call once the frame is presented */
+void events_flush(void);
+
+/* to call from the send callback of the pomp context */
+void events_sent(struct pomp_conn *conn, uint32_t status);
+
+void events_disconnected(struct pomp_conn *conn);
+
+void events_dump_stats(void);
+
+void events_cleanup(void);
+
+#endif /* LEDD_SRC_EVENTS_H_ */
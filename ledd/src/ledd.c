@@ -35,9 +35,12 @@
 #include <sys/un.h>
 #include <dlfcn.h>
 #include <signal.h>
+#include <sys/param.h>
+#include <time.h>
 
 #include <error.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -47,6 +50,9 @@
 #define MSG_QUIT 1
 #define MSG_DUMP_CONFIG 2
 #define MSG_SET_VALUE 3
+#define MSG_WARM_UP_PATTERN 4
+#define MSG_RELOAD_PATTERNS 5
+#define MSG_SET_PATTERN_NOW 6
 
 #define ULOG_TAG ledd_lib
 #include <ulog.h>
@@ -59,12 +65,19 @@ ULOG_DECLARE_TAG(ledd_lib);
 #include <ledd.h>
 
 #include "led_driver_priv.h"
+#include "string_pool_priv.h"
 
 #include "utils.h"
 #include "global.h"
 #include "platform.h"
 #include "pattern.h"
 #include "player.h"
+#include "compositor.h"
+#include "commands.h"
+#include "protocol.h"
+#include "control.h"
+#include "events.h"
+#include "live.h"
 #include "plugins.h"
 
 /* codecheck_ignore[VOLATILE] */
@@ -72,6 +85,42 @@ static volatile bool loop = true;
 
 static struct pomp_ctx *pomp;
 static struct pomp_timer *timer;
+static bool timer_running;
+/* true if the timer expires on each tick, otherwise, it's a one shot */
+static bool timer_periodic;
+/*
+ * one shot timer only, tick of the grid the timer is armed for, either to show
+ * the frame computed in advance, to compute the next one, or to apply the
+ * commands pending
+ */
+static uint64_t timer_deadline;
+
+/*
+ * the ticks are on a grid, tick n being due n x granularity ms after
+ * clock_origin, so that the stalls of the event loop don't stretch the patterns
+ * and that starting a pattern doesn't shift the ones already playing
+ */
+static double clock_origin;
+/*
+ * ticks the player has been advanced by, since clock_origin, if
+ * player_has_lookahead(), the frame of tick clock_ticks is computed but not
+ * shown yet
+ */
+static uint64_t clock_ticks;
+/* timer callbacks which came at least a tick late */
+static uint64_t overruns;
+/* total and max number of ticks the timer callbacks were late by */
+static uint64_t overrun_ticks;
+static uint64_t max_overrun_ticks;
+/* late ticks which weren't played, whatever the policy */
+static uint64_t skipped_ticks;
+
+/* beyond, the late ticks are skipped, even with OVERRUN_POLICY_CATCH_UP */
+#define MAX_CATCH_UP_MS 1000
+
+/* patterns image linked in the program, if any */
+static const void *static_patterns;
+static size_t static_patterns_size;
 
 static const int exit_signals[] = {
 		SIGINT,
@@ -86,6 +135,7 @@ static int command_set_value(const struct pomp_msg *msg)
 	char __attribute__((cleanup(ut_string_free))) *led = NULL;
 	char __attribute__((cleanup(ut_string_free))) *channel = NULL;
 	unsigned value;
+	struct led_channel *handle;
 
 	ret = pomp_msg_read(msg, "%ms%ms%u", &led, &channel, &value);
 	if (ret < 0) {
@@ -99,28 +149,296 @@ static int command_set_value(const struct pomp_msg *msg)
 
 	ULOGD("set_value(%s, %s, %"PRIu8")", led, channel, value);
 
-	return led_driver_set_value(led, channel, value);
+	handle = led_driver_get_channel(led, channel);
+	if (handle == NULL)
+		return -ESRCH;
+
+	return commands_set_value(handle, value);
+}
+
+static void clock_start(void)
+{
+	/* the periodic timer expires mid-tick, hence tolerates its jitter */
+	clock_origin = monotonic_ms() - global_get_granularity() / 2.;
+	clock_ticks = 0;
+}
+
+/* index of the current tick of the grid */
+static uint64_t clock_get_elapsed_ticks(void)
+{
+	double elapsed = monotonic_ms() - clock_origin;
+
+	return elapsed < 0 ? 0 : elapsed / global_get_granularity();
+}
+
+/* drops ticks from the grid, the patterns are delayed by as much */
+static void clock_skip(uint64_t ticks)
+{
+	clock_origin += (double)ticks * global_get_granularity();
+	skipped_ticks += ticks;
 }
 
-static int start_pattern(const char *pattern, bool resume)
+/* advances the player by ticks, in steps it can handle */
+static void advance_player(uint64_t ticks)
 {
 	int ret;
-	uint32_t granularity;
+	uint32_t step;
+
+	while (ticks != 0 && player_is_playing()) {
+		step = MIN(player_get_next_update(), ticks);
+		/* no stream left to update */
+		if (step == 0)
+			break;
+		ret = player_update(step);
+		if (ret < 0)
+			ULOGW("player_update: %s", strerror(-ret));
+		clock_ticks += step;
+		ticks -= step;
+	}
+}
 
-	ret = player_set_pattern(pattern, resume);
-	if (ret < 0) {
-		ULOGE("player_set_pattern: %s", strerror(-ret));
-		return ret;
+/*
+ * shows the frame computed in advance for tick clock_ticks, if its time has
+ * come. If late, according to the overrun policy, either the frames missed are
+ * computed and only the last one is shown, or the grid is shifted
+ */
+static void present_frame(uint64_t elapsed)
+{
+	uint64_t late;
+	uint64_t max_late = MAX_CATCH_UP_MS / global_get_granularity();
+
+	if (!player_has_lookahead() || elapsed < clock_ticks)
+		return;
+
+	late = elapsed - clock_ticks;
+	if (late != 0) {
+		overruns++;
+		overrun_ticks += late;
+		max_overrun_ticks = MAX(max_overrun_ticks, late);
+		ULOGD("timer late by %"PRIu64" ticks", late);
+		if (global_get_overrun_policy() == OVERRUN_POLICY_SKIP) {
+			clock_skip(late);
+		} else {
+			if (late > max_late) {
+				clock_skip(late - max_late);
+				late = max_late;
+			}
+			advance_player(late);
+		}
+	}
+	player_present();
+	events_flush();
+}
+
+static void stop_timer(void)
+{
+	int ret;
+
+	timer_running = false;
+	timer_periodic = false;
+	ret = pomp_timer_clear(timer);
+	if (ret < 0)
+		ULOGW("pomp_timer_clear: %s", strerror(-ret));
+	ULOGI("timer stopped");
+}
+
+/* arms the one shot timer for a tick of the grid */
+static int arm_timer(uint64_t deadline)
+{
+	double delay;
+
+	timer_deadline = deadline;
+	delay = clock_origin + (double)deadline * global_get_granularity() -
+			monotonic_ms();
+	timer_running = true;
+	timer_periodic = false;
+
+	/* rounded up, the timer mustn't expire before the deadline */
+	return pomp_timer_set(timer, delay < 0 ? 1 : (uint32_t)delay + 1);
+}
+
+/*
+ * computes the next frame at the latest a tick before its deadline, so that
+ * showing it on time costs only a commit, whatever the patterns' computations.
+ * Then arms the timer for the deadline of the frame computed, or for the time
+ * to compute the next one, in tickless mode
+ */
+static int schedule_frame(uint64_t elapsed)
+{
+	uint32_t granularity = global_get_granularity();
+	uint32_t next;
+	uint64_t deadline;
+
+	if (!player_has_lookahead()) {
+		/* always 1 if not in tickless mode, 0 if no stream plays */
+		next = player_get_next_update();
+		if (!player_is_playing() || next == 0) {
+			if (timer_running)
+				stop_timer();
+			return 0;
+		}
+		if (clock_ticks + next <= elapsed + 1)
+			advance_player(next);
 	}
 
-	if (!player_is_playing())
+	if (!global_get_tickless()) {
+		/* re-arming the periodic timer would shift its phase */
+		if (timer_periodic)
+			return 0;
+		timer_running = true;
+		timer_periodic = true;
+		return pomp_timer_set_periodic(timer, granularity, granularity);
+	}
+
+	if (player_has_lookahead())
+		deadline = clock_ticks;
+	else
+		deadline = clock_ticks + player_get_next_update() - 1;
+	/* the commands pending are applied at the next tick */
+	if (commands_are_pending())
+		deadline = MIN(deadline, elapsed + 1);
+
+	return arm_timer(deadline);
+}
+
+/*
+ * brings the streams playing up to date, before the player is modified, a
+ * frame computed in advance is kept, the player updates it
+ */
+static void sync_player(void)
+{
+	uint64_t elapsed;
+	uint64_t due;
+
+	if (!timer_running)
+		return;
+
+	elapsed = clock_get_elapsed_ticks();
+	present_frame(elapsed);
+	if (player_has_lookahead())
+		return;
+	/* nothing to advance, the streams started will follow the grid */
+	if (!player_is_playing() || player_get_next_update() == 0) {
+		clock_ticks = MAX(clock_ticks, elapsed);
+		return;
+	}
+
+	/* the values don't change before the next frame to compute */
+	due = elapsed > clock_ticks ? elapsed - clock_ticks : 0;
+	advance_player(MIN(due, player_get_next_update() - 1));
+}
+
+/* applies the commands pending, in their order of arrival */
+static void apply_commands(void)
+{
+	int ret;
+	struct command *command;
+
+	while ((command = commands_pop()) != NULL) {
+		switch (command->type) {
+		case COMMAND_SET_PATTERN:
+			ret = player_set_pattern(command->pattern,
+					command->resume, command->restart);
+			if (ret < 0) {
+				ULOGE("player_set_pattern(%s): %s",
+						command->pattern,
+						strerror(-ret));
+				protocol_batch_failed(command->batch, ret);
+			} else {
+				ULOGD("current pattern set to %s",
+						command->pattern);
+			}
+			break;
+
+		case COMMAND_SET_VALUE:
+			/* or it would be overwritten by the streams playing */
+			ret = compositor_override(command->channel,
+					command->value);
+			if (ret < 0) {
+				ULOGE("compositor_override: %s",
+						strerror(-ret));
+				protocol_batch_failed(command->batch, ret);
+			}
+			break;
+
+		case COMMAND_LIVE_FRAME:
+			live_apply(command->live);
+			break;
+		}
+		command_destroy(command);
+	}
+	protocol_send_acks();
+	control_complete();
+}
+
+/*
+ * applies the commands pending and shows their effect right away, instead of
+ * with the next frame, then schedules the frames accordingly
+ */
+static int commit_commands(void)
+{
+	int ret;
+	bool was_running = timer_running;
+
+	sync_player();
+	apply_commands();
+	ret = compositor_commit();
+	if (ret < 0)
+		ULOGW("compositor_commit: %s", strerror(-ret));
+	player_catch_up();
+	events_flush();
+
+	if (!was_running) {
+		if (!player_is_playing())
+			return 0;
+		clock_start();
+		ULOGI("timer resumed");
+	}
+
+	/* the new streams may need a frame sooner */
+	return schedule_frame(clock_get_elapsed_ticks());
+}
+
+/* makes the timer expire on the next tick, for the commands pending */
+static int schedule_commands(void)
+{
+	uint64_t next;
+
+	if (!timer_running) {
+		clock_start();
+		ULOGI("timer resumed");
+		return arm_timer(1);
+	}
+	/* expires on each tick anyway */
+	if (timer_periodic)
 		return 0;
 
-	ULOGI("timer resumed");
+	next = clock_get_elapsed_ticks() + 1;
 
-	granularity = global_get_granularity();
+	return timer_deadline <= next ? 0 : arm_timer(next);
+}
+
+/*
+ * called for each batch posted by the in-process control API, and when a live
+ * source has a new frame, or must stop being shown
+ */
+static int control_queued(bool now)
+{
+	return now ? commit_commands() : schedule_commands();
+}
 
-	return pomp_timer_set_periodic(timer, granularity, granularity);
+static void dump_timing(void)
+{
+	ULOGI("tick grid: %"PRIu64" ticks of %"PRIu32" ms played, timer %s, "
+			"next frame %s", clock_ticks, global_get_granularity(),
+			timer_running ? "running" : "stopped",
+			player_has_lookahead() ? "computed" : "not computed");
+	commands_dump_stats();
+	events_dump_stats();
+	live_dump_stats();
+	ULOGI("overruns = %"PRIu64", late ticks = %"PRIu64" (max %"PRIu64
+			"), skipped ticks = %"PRIu64, overruns, overrun_ticks,
+			max_overrun_ticks, skipped_ticks);
 }
 
 static void pomp_event_cb(struct pomp_ctx *ctx, enum pomp_event event,
@@ -132,25 +450,41 @@ static void pomp_event_cb(struct pomp_ctx *ctx, enum pomp_event event,
 	char __attribute__((cleanup(ut_string_free))) *pattern = NULL;
 	char __attribute__((cleanup(ut_string_free))) *resume = NULL;
 	char __attribute__((cleanup(ut_string_free))) *config = NULL;
+	bool now;
 
+	if (event == POMP_EVENT_DISCONNECTED) {
+		protocol_disconnected(conn);
+		events_disconnected(conn);
+		live_disconnected(conn);
+	}
 	if (event != POMP_EVENT_MSG)
 		return;
 
 	msgid = pomp_msg_get_id(msg);
 	switch (msgid) {
 	case MSG_SET_PATTERN:
+	case MSG_SET_PATTERN_NOW:
 		ret = pomp_msg_read(msg, "%ms%ms", &pattern, &resume);
 		if (ret < 0) {
 			pattern = resume = NULL;
 			ULOGE("pomp_msg_read: %s", strerror(-ret));
 			return;
 		}
-		ret = start_pattern(pattern, ut_string_match(resume, "true"));
+		ret = commands_set_pattern(pattern,
+				ut_string_match(resume, "true"));
 		if (ret < 0) {
-			ULOGE("start_pattern: %s", strerror(-ret));
+			ULOGE("commands_set_pattern: %s", strerror(-ret));
 			return;
 		}
-		ULOGD("current pattern set to %s", pattern);
+		/* the commands queued before are applied first */
+		if (msgid == MSG_SET_PATTERN_NOW)
+			ret = commit_commands();
+		else
+			ret = schedule_commands();
+		if (ret < 0)
+			ULOGE("%s: %s", msgid == MSG_SET_PATTERN_NOW ?
+					"commit_commands" : "schedule_commands",
+					strerror(-ret));
 		break;
 
 	case MSG_QUIT:
@@ -172,18 +506,104 @@ static void pomp_event_cb(struct pomp_ctx *ctx, enum pomp_event event,
 			led_drivers_dump_config();
 		else if (ut_string_match("global", config))
 			global_dump_config();
+		else if (ut_string_match("timing", config))
+			dump_timing();
+		else if (ut_string_match("compositor", config))
+			compositor_dump_config();
 		else
 			ULOGE("no such config: %s", config);
 		break;
 
 	case MSG_SET_VALUE:
 		ret = command_set_value(msg);
-		if (ret < 0)
+		if (ret < 0) {
 			ULOGE("command_set_value: %s", strerror(-ret));
+			return;
+		}
+		ret = schedule_commands();
+		if (ret < 0)
+			ULOGE("schedule_commands: %s", strerror(-ret));
+		break;
+
+	case MSG_WARM_UP_PATTERN:
+		ret = pomp_msg_read(msg, "%ms", &pattern);
+		if (ret < 0) {
+			pattern = NULL;
+			ULOGE("pomp_msg_read: %s", strerror(-ret));
+			return;
+		}
+		ret = patterns_warm_up(pattern);
+		if (ret < 0)
+			ULOGE("patterns_warm_up(%s): %s", pattern,
+					strerror(-ret));
+		break;
+
+	case MSG_RELOAD_PATTERNS:
+		/* the commands received before use the patterns' old version */
+		if (commands_are_pending()) {
+			ret = commit_commands();
+			if (ret < 0)
+				ULOGE("commit_commands: %s", strerror(-ret));
+		}
+		/* the streams playing keep their version of their pattern */
+		ret = patterns_reload(global_get_patterns_config());
+		if (ret < 0) {
+			ULOGE("patterns_reload(%s): %s",
+					global_get_patterns_config(),
+					strerror(-ret));
+			return;
+		}
+		protocol_ids_changed();
+		events_record(PROTOCOL_EVENT_RELOADED, NULL);
+		events_flush();
+		break;
+
+	case PROTOCOL_MSG_HELLO:
+		ret = protocol_hello(conn, msg);
+		if (ret < 0)
+			ULOGE("protocol_hello: %s", strerror(-ret));
+		break;
+
+	case PROTOCOL_MSG_BATCH:
+		ret = protocol_batch(conn, msg, &now);
+		if (ret < 0) {
+			ULOGE("protocol_batch: %s", strerror(-ret));
+			return;
+		}
+		ret = now ? commit_commands() : schedule_commands();
+		if (ret < 0)
+			ULOGE("%s: %s", now ? "commit_commands" :
+					"schedule_commands", strerror(-ret));
+		break;
+
+	case PROTOCOL_MSG_SUBSCRIBE:
+		ret = events_subscribe(conn, msg);
+		if (ret < 0)
+			ULOGE("events_subscribe: %s", strerror(-ret));
+		break;
+
+	case PROTOCOL_MSG_LIVE_OPEN:
+		ret = live_open(conn, msg);
+		if (ret < 0)
+			ULOGE("live_open: %s", strerror(-ret));
+		break;
+
+	case PROTOCOL_MSG_LIVE_CLOSE:
+		ret = live_close(conn, msg);
+		if (ret < 0)
+			ULOGE("live_close: %s", strerror(-ret));
 		break;
 	}
 }
 
+/* a message was sent, or failed to, on a connection */
+static void pomp_send_cb(struct pomp_ctx *ctx, struct pomp_conn *conn,
+		struct pomp_buffer *buf, uint32_t status, void *cookie,
+		void *userdata)
+{
+	events_sent(conn, status);
+}
+
 static void signal_handler(int signum)
 {
 	ULOGI("terminating on signal %s(%d)", strsignal(signum), signum);
@@ -194,16 +614,24 @@ static void signal_handler(int signum)
 static void timer_cb(struct pomp_timer *timer, void *userdata)
 {
 	int ret;
+	uint64_t elapsed = clock_get_elapsed_ticks();
+
+	if (commands_are_pending()) {
+		if (player_has_lookahead() && elapsed >= clock_ticks) {
+			/* shown by the frame due, with the same commit */
+			apply_commands();
+		} else {
+			ret = commit_commands();
+			if (ret < 0)
+				ULOGW("commit_commands: %s", strerror(-ret));
+			return;
+		}
+	}
 
-	ret = player_update();
+	present_frame(clock_get_elapsed_ticks());
+	ret = schedule_frame(clock_get_elapsed_ticks());
 	if (ret < 0)
-		ULOGW("player_update: %s", strerror(-ret));
-	if (!player_is_playing()) {
-		ret = pomp_timer_clear(timer);
-		if (ret < 0)
-			ULOGW("pomp_timer_clear: %s", strerror(-ret));
-		ULOGI("timer stopped");
-	}
+		ULOGW("schedule_frame: %s", strerror(-ret));
 }
 
 int ledd_init_impl(const char *global_config, bool skip_plugins)
@@ -217,13 +645,20 @@ int ledd_init_impl(const char *global_config, bool skip_plugins)
 	uint32_t addrlen = sizeof(addr.addr_str);
 	const char *address;
 	struct pomp_loop *loop;
+	double start = monotonic_ms();
+	double global_ms;
+	double plugins_ms;
+	double platform_ms;
+	double patterns_ms;
 
 	ret = global_init(global_config);
 	if (ret != 0) {
 		ULOGE("global_init(%s): %s", global_config, strerror(-ret));
 		return ret;
 	}
+	global_ms = monotonic_ms() - start;
 
+	start = monotonic_ms();
 	if (!skip_plugins) {
 		ret = plugins_init(global_get_plugins_dir());
 		if (ret != 0) {
@@ -231,37 +666,98 @@ int ledd_init_impl(const char *global_config, bool skip_plugins)
 			return ret;
 		}
 	}
+	plugins_ms = monotonic_ms() - start;
 
+	start = monotonic_ms();
 	ret = platform_init(global_get_platform_config());
 	if (ret != 0) {
 		ULOGE("platform_init(%s): %s", global_get_platform_config(),
 				strerror(-ret));
 		return ret;
 	}
-	ret = patterns_init(global_get_patterns_config());
+	platform_ms = monotonic_ms() - start;
+
+	start = monotonic_ms();
+	if (static_patterns != NULL) {
+		ret = patterns_init_static(static_patterns,
+				static_patterns_size);
+		if (ret != 0) {
+			ULOGE("patterns_init_static: %s", strerror(-ret));
+			return ret;
+		}
+	} else {
+		ret = patterns_init(global_get_patterns_config());
+		if (ret != 0) {
+			ULOGE("patterns_init(%s): %s",
+					global_get_patterns_config(),
+					strerror(-ret));
+			return ret;
+		}
+	}
+	patterns_ms = monotonic_ms() - start;
+	/* the lua state isn't needed anymore, all the configs have been read */
+	config_cleanup();
+	ULOGI("startup: global %.2f ms, plugins %.2f ms, platform %.2f ms, "
+			"patterns %.2f ms", global_ms, plugins_ms, platform_ms,
+			patterns_ms);
+
+	ret = compositor_init();
 	if (ret != 0) {
-		ULOGE("patterns_init(%s): %s", global_get_patterns_config(),
-				strerror(-ret));
+		ULOGE("compositor_init: %s", strerror(-ret));
 		return ret;
 	}
-
 	ret = player_init();
 	if (ret != 0) {
 		ULOGE("player_init: %s", strerror(-ret));
 		return ret;
 	}
+	ret = commands_init();
+	if (ret != 0) {
+		ULOGE("commands_init: %s", strerror(-ret));
+		return ret;
+	}
+	ret = protocol_init();
+	if (ret != 0) {
+		ULOGE("protocol_init: %s", strerror(-ret));
+		return ret;
+	}
+	ret = events_init();
+	if (ret != 0) {
+		ULOGE("events_init: %s", strerror(-ret));
+		return ret;
+	}
 	pomp = pomp_ctx_new(pomp_event_cb, NULL);
 	if (pomp == NULL) {
 		ret = -errno;
 		ULOGE("pomp_ctx_new: %m");
 		return ret;
 	}
+	ret = pomp_ctx_set_send_cb(pomp, pomp_send_cb);
+	if (ret < 0) {
+		ULOGE("pomp_ctx_set_send_cb: %s", strerror(-ret));
+		return ret;
+	}
 	loop = pomp_ctx_get_loop(pomp);
 	ret = led_driver_register_drivers_in_pomp_loop(loop);
 	if (ret < 0) {
 		ULOGE("drivers_register_in_pomp_loop: %s", strerror(-ret));
 		return ret;
 	}
+	ret = led_driver_start_workers();
+	if (ret < 0) {
+		ULOGE("led_driver_start_workers: %s", strerror(-ret));
+		return ret;
+	}
+	ret = control_init(loop, control_queued);
+	if (ret < 0) {
+		ULOGE("control_init: %s", strerror(-ret));
+		return ret;
+	}
+	ret = live_init(loop, control_queued);
+	if (ret < 0) {
+		ULOGE("live_init: %s", strerror(-ret));
+		return ret;
+	}
 	address = global_get_address();
 	ULOGI("ledd listening on address %s", address);
 	/* coverity[overrun-buffer-val] */
@@ -285,14 +781,32 @@ int ledd_init_impl(const char *global_config, bool skip_plugins)
 	for (i = 0; exit_signals[i] != 0; i++)
 		signal(exit_signals[i], signal_handler);
 
-	if (global_get_startup_pattern() != NULL)
-		start_pattern(global_get_startup_pattern(), false);
-	else
+	if (global_get_startup_pattern() != NULL) {
+		ret = commands_set_pattern(global_get_startup_pattern(),
+				false);
+		if (ret == 0)
+			ret = commit_commands();
+		if (ret < 0)
+			ULOGE("startup pattern %s: %s",
+					global_get_startup_pattern(),
+					strerror(-ret));
+	} else
 		led_driver_paint_it_black();
 
 	return 0;
 }
 
+int ledd_set_static_patterns(const void *image, size_t size)
+{
+	if (image == NULL || size == 0)
+		return -EINVAL;
+
+	static_patterns = image;
+	static_patterns_size = size;
+
+	return 0;
+}
+
 int ledd_get_fd(void)
 {
 	return pomp_ctx_get_fd(pomp);
@@ -317,11 +831,20 @@ void ledd_cleanup(void)
 		pomp_ctx_stop(pomp);
 		led_driver_unregister_drivers_from_pomp_loop(
 				pomp_ctx_get_loop(pomp));
+		control_cleanup(pomp_ctx_get_loop(pomp));
+		live_cleanup();
 		pomp_ctx_destroy(pomp);
 	}
+	led_driver_stop_workers();
+	commands_cleanup();
+	protocol_cleanup();
+	events_cleanup();
 	player_cleanup();
+	compositor_cleanup();
 	patterns_cleanup();
 	platform_cleanup();
 	plugins_cleanup();
 	global_cleanup();
+	config_cleanup();
+	string_pool_cleanup();
 }
@@ -0,0 +1,475 @@
+/**
+ * @file live.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define ULOG_TAG ledd_live
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_live);
+
+#include <rs_node.h>
+#include <rs_dll.h>
+
+#include <ut_utils.h>
+
+#include <ledd_plugin.h>
+
+#include "led_driver_priv.h"
+
+#include "utils.h"
+#include "compositor.h"
+#include "commands.h"
+#include "protocol.h"
+#include "live.h"
+
+/* attempts at reading a frame the client keeps overwriting */
+#define LIVE_MAX_READS 3
+
+struct live_source {
+	struct rs_node node;
+	struct pomp_conn *conn;
+	uint32_t id;
+	/* mapped read-only, the number of frames written, then the ring */
+	const void *shm;
+	size_t size;
+	uint32_t nb_frames;
+	uint32_t nb_channels;
+	int event_fd;
+	struct pomp_timer *timer;
+	uint32_t timeout_ms;
+	/* number of frames written when the last one was taken */
+	uint32_t taken;
+	/* a COMMAND_LIVE_FRAME is queued */
+	bool pending;
+	struct compositor_source source;
+	uint64_t frames;
+	uint64_t skipped;
+};
+
+struct live {
+	struct rs_dll sources;
+	struct pomp_loop *loop;
+	live_changed_cb changed_cb;
+	/* by the sources closed */
+	uint64_t frames;
+	uint64_t skipped;
+};
+
+static struct live live;
+
+#define to_source(n) ut_container_of((n), struct live_source, node)
+
+static uint32_t read_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static struct live_source *find_source(struct pomp_conn *conn, uint32_t id)
+{
+	struct rs_node *node = NULL;
+	struct live_source *source;
+
+	while ((node = rs_dll_next_from(&live.sources, node))) {
+		source = to_source(node);
+		if (source->conn == conn && source->id == id)
+			return source;
+	}
+
+	return NULL;
+}
+
+/*
+ * copies the last frame written in the values of the source, returns false if
+ * none was written since the last one taken, or if it couldn't be read whole
+ */
+static bool take_frame(struct live_source *source)
+{
+	const uint32_t *written_p = source->shm;
+	const uint8_t *frames = (const uint8_t *)source->shm +
+			PROTOCOL_LIVE_FRAMES_OFFSET;
+	uint32_t written;
+	uint32_t after;
+	unsigned i;
+
+	for (i = 0; i < LIVE_MAX_READS; i++) {
+		written = __atomic_load_n(written_p, __ATOMIC_ACQUIRE);
+		if (written == source->taken)
+			return false;
+		memcpy(source->source.values, frames +
+				(size_t)((written - 1) % source->nb_frames) *
+				source->nb_channels, source->nb_channels);
+		/* the copy must be done before the count is read again */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(written_p, __ATOMIC_ACQUIRE);
+		/* the client didn't come back to the frame's index meanwhile */
+		if (after - written < source->nb_frames - 1) {
+			source->skipped += written - source->taken - 1;
+			source->frames++;
+			source->taken = written;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void request_frame(struct live_source *source)
+{
+	int ret;
+
+	if (source->pending)
+		return;
+
+	ret = commands_live_frame(source);
+	if (ret < 0) {
+		ULOGE("commands_live_frame: %s", strerror(-ret));
+		return;
+	}
+	source->pending = true;
+	ret = live.changed_cb(false);
+	if (ret < 0)
+		ULOGE("changed_cb: %s", strerror(-ret));
+}
+
+static void event_cb(int fd, uint32_t revents, void *userdata)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		ULOGE("read: %m");
+
+	request_frame(userdata);
+}
+
+/* no frame came for the timeout, the streams below show again */
+static void timer_cb(struct pomp_timer *timer, void *userdata)
+{
+	int ret;
+	struct live_source *source = userdata;
+
+	if (!source->source.active)
+		return;
+	/*
+	 * a signal came, but its frame isn't taken yet, if there is none, the
+	 * source must time out still
+	 */
+	if (source->pending) {
+		ret = pomp_timer_set(source->timer, source->timeout_ms);
+		if (ret < 0)
+			ULOGW("pomp_timer_set: %s", strerror(-ret));
+		return;
+	}
+
+	ULOGI("live source %"PRIu32" timed out", source->id);
+	compositor_remove_source(&source->source);
+	ret = live.changed_cb(true);
+	if (ret < 0)
+		ULOGE("changed_cb: %s", strerror(-ret));
+}
+
+static void source_destroy(struct live_source *source)
+{
+	int ret;
+
+	commands_drop_live(source);
+	compositor_source_cleanup(&source->source);
+	if (source->timer != NULL)
+		pomp_timer_destroy(source->timer);
+	if (source->event_fd != -1) {
+		ret = pomp_loop_remove(live.loop, source->event_fd);
+		if (ret < 0)
+			ULOGW("pomp_loop_remove: %s", strerror(-ret));
+		close(source->event_fd);
+	}
+	if (source->shm != NULL)
+		munmap((void *)source->shm, source->size);
+	live.frames += source->frames;
+	live.skipped += source->skipped;
+	free(source);
+}
+
+static int source_map(struct live_source *source, int shm_fd)
+{
+	int seals;
+	struct stat st;
+	void *shm;
+
+	if (source->nb_frames > (SIZE_MAX - PROTOCOL_LIVE_FRAMES_OFFSET) /
+			source->nb_channels)
+		return -EINVAL;
+	source->size = PROTOCOL_LIVE_FRAMES_OFFSET +
+			(size_t)source->nb_frames * source->nb_channels;
+	/* a memory the client could shrink would fault in ledd when read */
+	seals = fcntl(shm_fd, F_GET_SEALS);
+	if (seals < 0)
+		return -errno;
+	if (!(seals & F_SEAL_SHRINK))
+		return -EPERM;
+	if (fstat(shm_fd, &st) < 0)
+		return -errno;
+	if ((size_t)st.st_size < source->size)
+		return -EINVAL;
+
+	shm = mmap(NULL, source->size, PROT_READ, MAP_SHARED, shm_fd, 0);
+	if (shm == MAP_FAILED)
+		return -errno;
+	source->shm = shm;
+
+	return 0;
+}
+
+static int source_add_channels(struct live_source *source,
+		const uint8_t *ids)
+{
+	int ret;
+	uint32_t i;
+	struct led_channel *channel;
+
+	for (i = 0; i < source->nb_channels; i++) {
+		channel = led_driver_get_channel_by_slot(read_le32(ids + 4 * i));
+		if (channel == NULL)
+			return -ESRCH;
+		ret = compositor_source_add_channel(&source->source, channel,
+				0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int source_open(struct pomp_conn *conn, const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t id;
+	uint32_t layer;
+	uint32_t timeout;
+	uint32_t nb_frames;
+	const void *ids;
+	uint32_t size;
+	int shm_fd;
+	int event_fd;
+	struct live_source *source;
+
+	ret = pomp_msg_read(msg, "%u%u%u%u%p%u%x%x", &id, &layer, &timeout,
+			&nb_frames, &ids, &size, &shm_fd, &event_fd);
+	if (ret < 0) {
+		ULOGE("pomp_msg_read: %s", strerror(-ret));
+		return ret;
+	}
+	if (find_source(conn, id) != NULL)
+		return -EEXIST;
+	/* one frame at least is never written while the last one is read */
+	if (layer >= COMPOSITOR_NB_LAYERS || timeout == 0 || nb_frames < 2 ||
+			size == 0 || size % 4 != 0)
+		return -EINVAL;
+
+	source = calloc(1, sizeof(*source));
+	if (source == NULL)
+		return -errno;
+	source->conn = conn;
+	source->id = id;
+	source->timeout_ms = timeout;
+	source->nb_frames = nb_frames;
+	source->nb_channels = size / 4;
+	source->event_fd = -1;
+	ret = compositor_source_init(&source->source, source->nb_channels,
+			layer, COMPOSITOR_BLEND_REPLACE, UINT8_MAX);
+	if (ret < 0)
+		goto err;
+	ret = source_add_channels(source, ids);
+	if (ret < 0)
+		goto err;
+	ret = source_map(source, shm_fd);
+	if (ret < 0)
+		goto err;
+	source->timer = pomp_timer_new(live.loop, timer_cb, source);
+	if (source->timer == NULL) {
+		ret = -errno;
+		goto err;
+	}
+	/* the file descriptors of the message are closed with it */
+	source->event_fd = fcntl(event_fd, F_DUPFD_CLOEXEC, 0);
+	if (source->event_fd == -1) {
+		ret = -errno;
+		goto err;
+	}
+	ret = pomp_loop_add(live.loop, source->event_fd, POMP_FD_EVENT_IN,
+			event_cb, source);
+	if (ret < 0) {
+		close(source->event_fd);
+		source->event_fd = -1;
+		goto err;
+	}
+	rs_dll_enqueue(&live.sources, &source->node);
+	ULOGI("live source %"PRIu32" opened, %"PRIu32" channels on layer "
+			"%"PRIu32, id, source->nb_channels, layer);
+
+	/* the frames written before are shown */
+	request_frame(source);
+
+	return 0;
+err:
+	source_destroy(source);
+
+	return ret;
+}
+
+int live_init(struct pomp_loop *loop, live_changed_cb changed_cb)
+{
+	if (loop == NULL || changed_cb == NULL)
+		return -EINVAL;
+
+	live.loop = loop;
+	live.changed_cb = changed_cb;
+
+	return rs_dll_init(&live.sources, NULL);
+}
+
+int live_open(struct pomp_conn *conn, const struct pomp_msg *msg)
+{
+	int ret;
+	int err;
+	uint32_t id = UINT32_MAX;
+
+	ret = source_open(conn, msg);
+	/* the id is known if the message could be read */
+	pomp_msg_read(msg, "%u", &id);
+	err = pomp_conn_send(conn, PROTOCOL_MSG_LIVE_STATUS, "%u%d", id, ret);
+	if (err < 0)
+		ULOGE("pomp_conn_send: %s", strerror(-err));
+
+	return ret;
+}
+
+static void close_source(struct live_source *source)
+{
+	int ret;
+	bool active = source->source.active;
+
+	rs_dll_remove(&live.sources, &source->node);
+	source_destroy(source);
+	if (!active)
+		return;
+
+	ret = live.changed_cb(true);
+	if (ret < 0)
+		ULOGE("changed_cb: %s", strerror(-ret));
+}
+
+int live_close(struct pomp_conn *conn, const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t id;
+	struct live_source *source;
+
+	ret = pomp_msg_read(msg, "%u", &id);
+	if (ret < 0) {
+		ULOGE("pomp_msg_read: %s", strerror(-ret));
+		return ret;
+	}
+	source = find_source(conn, id);
+	if (source == NULL)
+		return -ESRCH;
+
+	close_source(source);
+
+	return 0;
+}
+
+void live_apply(struct live_source *source)
+{
+	int ret;
+
+	source->pending = false;
+	if (!take_frame(source))
+		return;
+
+	if (source->source.active) {
+		/* no lookahead for the live sources, the frame is shown as is */
+		memcpy(source->source.front, source->source.values,
+				source->nb_channels);
+		compositor_invalidate();
+	} else {
+		compositor_add_source(&source->source);
+	}
+	ret = pomp_timer_set(source->timer, source->timeout_ms);
+	if (ret < 0)
+		ULOGW("pomp_timer_set: %s", strerror(-ret));
+}
+
+void live_disconnected(struct pomp_conn *conn)
+{
+	struct rs_node *node;
+	struct rs_node *next;
+
+	for (node = rs_dll_next_from(&live.sources, NULL); node != NULL;
+			node = next) {
+		next = rs_dll_next_from(&live.sources, node);
+		if (to_source(node)->conn == conn)
+			close_source(to_source(node));
+	}
+}
+
+void live_dump_stats(void)
+{
+	uint64_t frames = live.frames;
+	uint64_t skipped = live.skipped;
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&live.sources, node))) {
+		frames += to_source(node)->frames;
+		skipped += to_source(node)->skipped;
+	}
+
+	ULOGI("live sources = %u, frames shown = %"PRIu64", frames skipped = "
+			"%"PRIu64, rs_dll_get_count(&live.sources), frames,
+			skipped);
+}
+
+void live_cleanup(void)
+{
+	struct rs_node *node;
+
+	while ((node = rs_dll_pop(&live.sources)))
+		source_destroy(to_source(node));
+	memset(&live, 0, sizeof(live));
+}
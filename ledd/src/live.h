@@ -0,0 +1,70 @@
+/**
+ * @file live.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LEDD_SRC_LIVE_H_
+#define LEDD_SRC_LIVE_H_
+#include <stdbool.h>
+
+#include <libpomp.h>
+
+/*
+ * live sources: frames computed by a client, written in a ring in shared
+ * memory and signaled through an eventfd. Each live source is a source of the
+ * compositor, on its layer, like the streams of the player. On the tick
+ * following a signal, the last frame written is taken, the ones before it
+ * being skipped, and when no frame comes for the timeout of the source, it is
+ * removed, the streams below it showing again.
+ */
+
+struct live_source;
+
+/*
+ * called when the compositor must be brought up to date, right away if now is
+ * true, at the next tick otherwise
+ */
+typedef int (*live_changed_cb)(bool now);
+
+int live_init(struct pomp_loop *loop, live_changed_cb changed_cb);
+
+/* opens a live source and answers with its status */
+int live_open(struct pomp_conn *conn, const struct pomp_msg *msg);
+
+int live_close(struct pomp_conn *conn, const struct pomp_msg *msg);
+
+/* applies a COMMAND_LIVE_FRAME, the caller must show the frame */
+void live_apply(struct live_source *live);
+
+void live_disconnected(struct pomp_conn *conn);
+
+void live_dump_stats(void);
+
+void live_cleanup(void);
+
+#endif /* LEDD_SRC_LIVE_H_ */
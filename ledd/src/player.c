@@ -44,13 +44,30 @@ ULOG_DECLARE_TAG(ledd_player);
 
 #include <ledd_plugin.h>
 
+#include "led_driver_priv.h"
+
 #include "player.h"
+#include "compositor.h"
 #include "pattern.h"
 #include "global.h"
+#include "events.h"
+
+struct player_stream;
 
 struct player {
 	struct rs_dll streams;
 	bool playing;
+	/*
+	 * true if the streams were advanced to the next frame, which isn't
+	 * presented yet
+	 */
+	bool lookahead;
+	/*
+	 * stream currently playing on each led, by layer, then by dense led
+	 * index, streams on different layers may share leds
+	 */
+	struct player_stream **owners;
+	uint32_t nb_owners;
 };
 
 static struct player player;
@@ -59,9 +76,15 @@ struct player_stream {
 	struct rs_node node;
 	const struct pattern *pattern;
 	uint32_t total_duration;
-	uint32_t cursor;
+	struct pattern_cursor cursor;
+	/* number of ticks before the stream must be updated again, at least 1 */
+	uint32_t wait;
 	uint8_t repetitions;
 	uint8_t repetition;
+	/* values of the stream, blended with the other streams' */
+	struct compositor_source source;
+	/* true until the stream's first values are shown or advanced */
+	bool fresh;
 	struct player_stream *previous;
 };
 
@@ -69,232 +92,426 @@ struct player_stream {
 
 int player_init(void)
 {
+	int ret;
+
 	ULOGD("%s", __func__);
 
+	player.nb_owners = led_driver_get_nb_leds();
+	if (player.nb_owners != 0) {
+		player.owners = calloc(COMPOSITOR_NB_LAYERS *
+				player.nb_owners, sizeof(*player.owners));
+		if (player.owners == NULL) {
+			ret = -errno;
+			ULOGE("calloc: %m");
+			player.nb_owners = 0;
+			return ret;
+		}
+	}
+
 	return rs_dll_init(&player.streams, NULL);
 }
 
-static void player_stream_init(struct player_stream *stream,
-		const struct pattern *pattern, uint32_t total_duration,
-		uint8_t repetitions, struct player_stream *previous)
+/* stream can be NULL, to mark the leds of the pattern as free */
+static void player_set_owner(const struct pattern *pattern,
+		struct player_stream *stream)
 {
-	memset(stream, 0, sizeof(*stream));
-	stream->pattern = pattern;
-	stream->total_duration = total_duration;
-	stream->repetitions = repetitions;
-	stream->previous = previous;
+	const struct led_set *set = pattern_get_led_set(pattern);
+	struct player_stream **owners = player.owners +
+			pattern_get_layer(pattern) * player.nb_owners;
+	int64_t led;
+
+	for (led = led_set_next(set, 0); led != -1;
+			led = led_set_next(set, led + 1))
+		if (led < player.nb_owners)
+			owners[led] = stream;
+}
+
+/*
+ * returns the stream playing on the pattern's layer, on at least one of the
+ * leds of the pattern, or playing the pattern itself, NULL if none
+ */
+static struct player_stream *player_find_stream(const struct pattern *pattern)
+{
+	const struct led_set *set = pattern_get_led_set(pattern);
+	struct player_stream **owners = player.owners +
+			pattern_get_layer(pattern) * player.nb_owners;
+	struct rs_node *node = NULL;
+	int64_t led;
+
+	for (led = led_set_next(set, 0); led != -1;
+			led = led_set_next(set, led + 1))
+		if (led < player.nb_owners && owners[led] != NULL)
+			return owners[led];
+
+	/* patterns without any led on the platform can't be owners */
+	if (led_set_is_empty(set))
+		while ((node = rs_dll_next_from(&player.streams, node)))
+			if (to_stream(node)->pattern == pattern)
+				return to_stream(node);
+
+	return NULL;
 }
 
+/* drops the stream's pin on its pattern */
 static void player_stream_destroy(struct player_stream *stream)
 {
+	compositor_source_cleanup(&stream->source);
+	pattern_release(stream->pattern);
 	memset(stream, 0, sizeof(*stream));
 	free(stream);
 }
 
-static struct player_stream *player_stream_new(
-		const struct pattern *pattern, uint32_t total_duration,
-		uint8_t repetitions, struct player_stream *previous)
+/* the stream takes the pin on the pattern, even on error */
+static struct player_stream *player_stream_new(const struct pattern *pattern)
 {
-	int old_errno;
+	int ret;
 	struct player_stream *stream;
 
 	stream = calloc(1, sizeof(*stream));
 	if (stream == NULL) {
-		old_errno = errno;
+		ret = -errno;
 		ULOGE("calloc: %m");
-		errno = old_errno;
-		return NULL;
+		goto err;
+	}
+	stream->pattern = pattern;
+	stream->total_duration = pattern_get_total_duration(pattern);
+	stream->repetitions = pattern_get_repetitions(pattern);
+	stream->wait = 1;
+	stream->fresh = true;
+	pattern_cursor_seek(pattern, &stream->cursor, 0);
+	/* the first values are known now, the source is ready to be added */
+	ret = pattern_init_source(pattern, &stream->cursor, &stream->source);
+	if (ret < 0) {
+		ULOGE("pattern_init_source: %s", strerror(-ret));
+		free(stream);
+		goto err;
 	}
-	player_stream_init(stream, pattern, total_duration, repetitions,
-			previous);
 
 	return stream;
+err:
+	pattern_release(pattern);
+	errno = -ret;
+
+	return NULL;
 }
 
-int player_set_pattern(const char *new_pattern_name, bool resume)
+/* makes the stream the one playing on the leds of its pattern's layer */
+static void player_stream_start(struct player_stream *stream)
+{
+	rs_dll_push(&player.streams, &stream->node);
+	player_set_owner(stream->pattern, stream);
+	compositor_add_source(&stream->source);
+}
+
+/* the stream's leds become free, its values aren't composited anymore */
+static void player_stream_stop(struct player_stream *stream)
+{
+	rs_dll_remove(&player.streams, &stream->node);
+	player_set_owner(stream->pattern, NULL);
+	compositor_remove_source(&stream->source);
+}
+
+bool player_is_playing(void)
+{
+	/* without streams, nothing would update the player to stop it */
+	return player.playing && !rs_dll_is_empty(&player.streams);
+}
+
+const struct pattern *player_next_pattern(const struct pattern *pattern)
 {
-	int ret;
 	struct rs_node *node = NULL;
+
+	if (pattern != NULL) {
+		/* a pattern is played by one stream at most */
+		while ((node = rs_dll_next_from(&player.streams, node)))
+			if (to_stream(node)->pattern == pattern)
+				break;
+		if (node == NULL)
+			return NULL;
+	}
+	node = rs_dll_next_from(&player.streams, node);
+
+	return node == NULL ? NULL : to_stream(node)->pattern;
+}
+
+/*
+ * in tickless mode, computes how many ticks can be skipped before the values of
+ * the stream change or its cursor reaches the end of a loop,
+ * stream->cursor.index - 1 being the last value index applied
+ */
+static void player_stream_compute_wait(struct player_stream *stream)
+{
+	uint32_t granularity = global_get_granularity();
+	uint32_t nb_values = stream->total_duration / granularity;
+	uint32_t outro = pattern_get_outro(stream->pattern) / granularity;
+	uint32_t limit;
+	uint32_t next;
+
+	stream->wait = 1;
+	if (!global_get_tickless() || nb_values <= outro)
+		return;
+
+	/* last index before player_update() does more than cursor++ */
+	if (outro == 0 || stream->repetition < stream->repetitions - 1)
+		limit = nb_values - outro - 1;
+	else
+		limit = nb_values - 1;
+	if (stream->cursor.index >= limit)
+		return;
+
+	next = pattern_next_change(stream->pattern, &stream->cursor, limit);
+	stream->wait = next - stream->cursor.index + 1;
+}
+
+uint32_t player_get_next_update(void)
+{
+	struct rs_node *node = NULL;
+	uint32_t next = 0;
+	struct player_stream *stream;
+
+	while ((node = rs_dll_next_from(&player.streams, node))) {
+		stream = to_stream(node);
+		if (next == 0 || stream->wait < next)
+			next = stream->wait;
+	}
+
+	return next;
+}
+
+/*
+ * advances a stream, renders its values if they are due, the stream is moved
+ * to trash when finished, its previous, if any, taking its place
+ */
+static void player_stream_update(struct player_stream *stream, uint32_t ticks,
+		struct rs_dll *trash)
+{
+	struct player_stream *previous_stream;
+	uint32_t granularity = global_get_granularity();
+	uint32_t intro;
+	uint32_t outro;
+
+	stream->fresh = false;
+	/* skipped ticks, the values of the stream don't change */
+	if (stream->wait > ticks) {
+		pattern_cursor_advance(stream->pattern, &stream->cursor, ticks);
+		stream->wait -= ticks;
+		return;
+	}
+	pattern_cursor_advance(stream->pattern, &stream->cursor,
+			stream->wait - 1);
+
+	/* render values, they are composited once all are rendered */
+	pattern_render(stream->pattern, &stream->cursor, &stream->source);
+
+	/* advance reading heads */
+	pattern_cursor_advance(stream->pattern, &stream->cursor, 1);
+	outro = pattern_get_outro(stream->pattern) / granularity;
+	if (stream->cursor.index < stream->total_duration / granularity
+			- outro) {
+		player_stream_compute_wait(stream);
+		return;
+	}
+	if (outro != 0 && stream->repetition >= stream->repetitions - 1 &&
+			stream->cursor.index !=
+			stream->total_duration / granularity) {
+		player_stream_compute_wait(stream);
+		return;
+	}
+	stream->repetition++;
+
+	if (stream->repetitions == 0 ||
+			stream->repetition != stream->repetitions) {
+		/* the patterns repeate, jump at intro's end */
+		intro = pattern_get_intro(stream->pattern) / granularity;
+		pattern_cursor_rewind(stream->pattern, &stream->cursor, intro);
+		stream->wait = 1;
+		return;
+	}
+
+	/*
+	 * the stream is finished, drop it and replace it by its previous, if
+	 * any. We can't destroy the stream while the streams are traversed, so
+	 * we store it into trash for removal afterwards
+	 */
+	previous_stream = stream->previous;
+	stream->previous = NULL;
+	player_stream_stop(stream);
+	rs_dll_push(trash, &stream->node);
+	events_record(PROTOCOL_EVENT_FINISHED, stream->pattern);
+	if (previous_stream == NULL)
+		return;
+
+	/*
+	 * if present, the previous becomes the current stream again, with the
+	 * values it had when interrupted
+	 */
+	player_stream_start(previous_stream);
+	pattern_render(previous_stream->pattern, &previous_stream->cursor,
+			&previous_stream->source);
+	previous_stream->wait = 1;
+	events_record(PROTOCOL_EVENT_RESUMED, previous_stream->pattern);
+}
+
+static void player_empty_trash(struct rs_dll *trash)
+{
+	while (rs_dll_get_count(trash) != 0)
+		player_stream_destroy(to_stream(rs_dll_pop(trash)));
+
+	if (player.playing && rs_dll_is_empty(&player.streams)) {
+		player.playing = false;
+		ULOGI("player stopped");
+	}
+}
+
+int player_set_pattern(const char *new_pattern_name, bool resume,
+		bool restart)
+{
+	int ret;
 	struct player_stream *os; /* old_stream */
 	struct player_stream *ns; /* new steam */
-	const char *old_pattern_name;
 	const struct pattern *pattern;
-	const struct pattern *old_pattern;
-	uint32_t total_duration;
-	uint8_t repetitions;
 
-	ULOGD("%s(%s, %d)", __func__, new_pattern_name, resume);
-
-	if (!player.playing) {
-		player.playing = true;
-		ULOGI("player started");
-	}
+	ULOGD("%s(%s, %d, %d)", __func__, new_pattern_name, resume, restart);
 
-	pattern = pattern_get(new_pattern_name);
+	/* the pin is given to the stream which will play the pattern */
+	pattern = pattern_acquire(new_pattern_name);
 	if (pattern == NULL) {
 		ret = -errno;
-		ULOGE("pattern_get:%m");
+		ULOGE("pattern_acquire:%m");
 		return ret;
 	}
-	total_duration = pattern_get_total_duration(pattern);
-	repetitions = pattern_get_repetitions(pattern);
 
-	while ((node = rs_dll_next_from(&player.streams, node))) {
-		os = to_stream(node);
-		old_pattern = os->pattern;
-		old_pattern_name = pattern_get_name(old_pattern);
+	/* only the streams of the same layer compete for the leds */
+	os = player_find_stream(pattern);
+	if (os != NULL) {
 		/* if the pattern is already playing, we do nothing */
-		if (ut_string_match(new_pattern_name, old_pattern_name))
+		if (os->pattern == pattern && !restart) {
+			pattern_release(pattern);
 			return 0;
+		}
 
-		if (patterns_intersect(pattern, old_pattern)) {
-			if (!patterns_have_same_support(pattern, old_pattern)) {
-				ULOGE("patterns %s and %s have some leds in "
-						"common, but not all. This is "
-						"not supported.",
-						old_pattern_name,
-						new_pattern_name);
-				return -EINVAL;
-			}
-			ret = pattern_apply_values(pattern, 0, true);
-			if (ret < 0)
-				ULOGW("pattern_apply_values: %s",
-						strerror(-ret));
-			if (!resume) {
-				/* replace all the "old" streams */
-				if (os->previous != NULL)
-					player_stream_destroy(os->previous);
-				player_stream_init(os, pattern, total_duration,
-						repetitions, os->previous);
-				return 0;
-			}
-			/* here we want to resume after */
-			if (os->previous != NULL) {
-				/* a previous stream exist, replace both */
-				memcpy(os->previous, os, sizeof(*os));
-				os->previous->previous = NULL;
-				player_stream_init(os, pattern, total_duration,
-						repetitions, os->previous);
-				return 0;
-			}
-			/* here os->previous == NULL */
-			/* store a new stream and link it with the old one */
-			rs_dll_remove(&player.streams, &os->node);
-			ns = player_stream_new(pattern, total_duration,
-					repetitions, os);
-			if (ns == NULL)
-				return -errno;
-			rs_dll_push(&player.streams, &ns->node);
-			return 0;
+		if (!patterns_have_same_support(pattern, os->pattern)) {
+			ULOGE("patterns %s and %s have some leds in common, "
+					"but not all, on layer %"PRIu8". This "
+					"is not supported.",
+					pattern_get_name(os->pattern),
+					new_pattern_name,
+					pattern_get_layer(pattern));
+			pattern_release(pattern);
+			return -EINVAL;
 		}
 	}
 
-	/* here, it is guaranteed that there is no intersection */
-	ret = pattern_apply_values(pattern, 0, true);
-	if (ret < 0)
-		ULOGW("pattern_apply_values: %s", strerror(-ret));
-	ns = player_stream_new(pattern, total_duration, repetitions, NULL);
+	ns = player_stream_new(pattern);
 	if (ns == NULL)
 		return -errno;
-	rs_dll_push(&player.streams, &ns->node);
+
+	if (os != NULL) {
+		events_record(PROTOCOL_EVENT_PREEMPTED, os->pattern);
+		player_stream_stop(os);
+		/* only one previous stream is kept */
+		if (os->previous != NULL)
+			player_stream_destroy(os->previous);
+		os->previous = NULL;
+		if (resume)
+			ns->previous = os;
+		else
+			player_stream_destroy(os);
+	}
+	player_stream_start(ns);
+	events_record(PROTOCOL_EVENT_STARTED, pattern);
+	/* only once a stream plays, or nothing would ever stop the player */
+	if (!player.playing) {
+		player.playing = true;
+		ULOGI("player started");
+	}
 
 	return 0;
 }
 
-bool player_is_playing(void)
+int player_check_pattern(const struct pattern *pattern)
 {
-	return player.playing;
+	struct player_stream *stream;
+
+	if (pattern == NULL)
+		return -EINVAL;
+
+	stream = player_find_stream(pattern);
+	if (stream != NULL &&
+			!patterns_have_same_support(pattern, stream->pattern))
+		return -EINVAL;
+
+	return 0;
 }
 
-int player_update(void)
+void player_catch_up(void)
 {
-	int ret;
-	struct rs_node *node = NULL;
-	struct player_stream *stream;
-	struct player_stream *previous_stream;
-	uint32_t granularity = global_get_granularity();
-	uint32_t intro;
-	uint32_t outro;
+	struct rs_node *node;
+	struct rs_node *next;
 	struct rs_dll trash;
+	struct player_stream *stream;
 
-	rs_dll_init(&trash, NULL);
+	if (!player.lookahead)
+		return;
 
-	while ((node = rs_dll_next_from(&player.streams, node))) {
+	/* the other streams are a tick ahead, the new ones must catch up */
+	rs_dll_init(&trash, NULL);
+	next = rs_dll_next_from(&player.streams, NULL);
+	while ((node = next) != NULL) {
+		next = rs_dll_next_from(&player.streams, node);
 		stream = to_stream(node);
-		/* apply values */
-		ret = pattern_apply_values(stream->pattern, stream->cursor,
-				false);
-		if (ret < 0)
-			ULOGW("pattern_apply_values: %s", strerror(-ret));
-
-		/* advance reading heads */
-		stream->cursor++;
-		outro = pattern_get_outro(stream->pattern) / granularity;
-		if (stream->cursor >= stream->total_duration / granularity
-						- outro) {
-			if (outro == 0 || stream->repetition
-					< stream->repetitions - 1 ||
-					stream->cursor == stream->total_duration
-					/ granularity)
-				stream->repetition++;
-			else
-				continue;
-			/*
-			 * the stream is finished, drop it and replace it by
-			 * its previous, if any
-			 */
-			if (stream->repetitions != 0 &&
-					stream->repetition ==
-							stream->repetitions) {
-				previous_stream = stream->previous;
-				rs_dll_remove(&player.streams, &stream->node);
-				/*
-				 * we can't destroy the stream while traversing
-				 * the linked list, so we store it into trash
-				 * for removal afterwards
-				 */
-				rs_dll_push(&trash, &stream->node);
-				stream = previous_stream;
-				if (previous_stream != NULL) {
-					/*
-					 * if present, the previous becomes the
-					 * current stream again
-					 */
-					rs_dll_push(&player.streams,
-							&stream->node);
-					/* reset state of the previous stream */
-					ret = pattern_apply_values(
-							stream->pattern,
-							stream->cursor, true);
-					if (ret < 0)
-						ULOGW("pattern_apply_values: "
-								"%s",
-								strerror(-ret));
-				}
-			} else {
-				/* the patterns repeate, jump at intro's end */
-				intro = pattern_get_intro(stream->pattern) /
-						granularity;
-				stream->cursor = intro;
-			}
-		}
+		if (stream->fresh)
+			player_stream_update(stream, 1, &trash);
 	}
+	player_empty_trash(&trash);
+	compositor_resolve();
+}
 
-	while (rs_dll_get_count(&trash) != 0) {
-		stream = to_stream(rs_dll_pop(&trash));
-		player_stream_destroy(stream);
-	}
+int player_update(uint32_t ticks)
+{
+	struct rs_node *node;
+	struct rs_node *next;
+	struct rs_dll trash;
 
-	if (rs_dll_is_empty(&player.streams)) {
-		player.playing = false;
-		ULOGI("player stopped");
+	rs_dll_init(&trash, NULL);
+
+	/* streams resumed during the traversal are pushed before the next */
+	next = rs_dll_next_from(&player.streams, NULL);
+	while ((node = next) != NULL) {
+		next = rs_dll_next_from(&player.streams, node);
+		player_stream_update(to_stream(node), ticks, &trash);
 	}
+	player_empty_trash(&trash);
 
-	led_driver_tick_all_drivers();
+	/* the frame will be presented by player_present(), at its deadline */
+	compositor_resolve();
+	player.lookahead = true;
 
 	return 0;
 }
 
+bool player_has_lookahead(void)
+{
+	return player.lookahead;
+}
+
+int player_present(void)
+{
+	int ret;
+
+	struct rs_node *node = NULL;
+
+	ret = compositor_present();
+	if (ret < 0)
+		ULOGW("compositor_present: %s", strerror(-ret));
+	led_driver_tick_all_drivers();
+	player.lookahead = false;
+	while ((node = rs_dll_next_from(&player.streams, node)))
+		to_stream(node)->fresh = false;
+
+	return ret;
+}
+
 void player_cleanup(void)
 {
 	struct player_stream *stream;
@@ -303,9 +520,15 @@ void player_cleanup(void)
 
 	while (rs_dll_get_count(&player.streams) != 0) {
 		stream = to_stream(rs_dll_pop(&player.streams));
+		if (stream->previous != NULL)
+			player_stream_destroy(stream->previous);
 		player_stream_destroy(stream);
 	}
 
 	rs_dll_init(&player.streams, NULL);
 	player.playing = false;
+	player.lookahead = false;
+	free(player.owners);
+	player.owners = NULL;
+	player.nb_owners = 0;
 }
@@ -31,19 +31,62 @@
 #ifndef LEDD_SRC_PLAYER_H_
 #define LEDD_SRC_PLAYER_H_
 #include <stdbool.h>
+#include <inttypes.h>
+
+struct pattern;
 
 int player_init(void);
 
 /*
  * resume: if true, if a pattern A was interrupted by pattern B, pattern A will
  * resume after B has finished, otherwise, no pattern will be played.
- * only one previous pattern is stored, though
+ * only one previous pattern is stored, though.
+ * restart: if true, a pattern already playing is replaced by a new stream of
+ * itself, otherwise, setting it does nothing.
+ * The stream starts at its first values, which are shown by the next frame
+ * presented, or right away by compositor_commit(), then player_catch_up()
  */
-int player_set_pattern(const char *pattern, bool resume);
+int player_set_pattern(const char *pattern, bool resume, bool restart);
+
+/*
+ * returns -EINVAL if the pattern has some leds in common, but not all, with a
+ * stream playing on its layer, for player_set_pattern() would fail
+ */
+int player_check_pattern(const struct pattern *pattern);
+
+/*
+ * if a frame was computed ahead, advances the streams started since by one
+ * tick, so that they are part of it, once their first values are shown
+ */
+void player_catch_up(void);
 
 bool player_is_playing(void);
 
-int player_update(void);
+/*
+ * iterates over the patterns of the streams playing, starting with the first if
+ * pattern is NULL, returns NULL after the last
+ */
+const struct pattern *player_next_pattern(const struct pattern *pattern);
+
+/*
+ * advances all the streams by ticks granularity periods, must not be greater
+ * than the value returned by player_get_next_update(). The frame is computed,
+ * but only shown by player_present(), so that it can be computed ahead of its
+ * deadline
+ */
+int player_update(uint32_t ticks);
+
+/* true if a frame was computed by player_update() and not presented yet */
+bool player_has_lookahead(void);
+
+/* sets the channels to the frame computed, then ticks the drivers */
+int player_present(void);
+
+/*
+ * returns the number of ticks before player_update() must be called, always 1
+ * if not in tickless mode, 0 if no stream is playing
+ */
+uint32_t player_get_next_update(void);
 
 void player_cleanup(void);
 
@@ -0,0 +1,483 @@
+/**
+ * @file protocol.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define ULOG_TAG ledd_protocol
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_protocol);
+
+#include <rs_node.h>
+#include <rs_dll.h>
+
+#include <ut_utils.h>
+
+#include <ledd_plugin.h>
+
+#include "led_driver_priv.h"
+#include "name_index_priv.h"
+#include "string_pool_priv.h"
+
+#include "pattern.h"
+#include "commands.h"
+#include "player.h"
+#include "protocol.h"
+
+/* connection which sent a handshake */
+struct protocol_client {
+	struct rs_node node;
+	struct pomp_conn *conn;
+};
+
+/* batch to acknowledge once applied */
+struct protocol_ack {
+	struct rs_node node;
+	struct pomp_conn *conn;
+	uint32_t seq;
+	/* id given by the commands, and first error when applied */
+	uint64_t batch;
+	int status;
+};
+
+struct protocol {
+	struct rs_dll clients;
+	struct rs_dll acks;
+	/*
+	 * interned names of the patterns, by id, an id is never reused, so
+	 * that it stays valid across the reloads, the ids are indexed by name,
+	 * plus 1, for NULL to mean not found
+	 */
+	const char **patterns;
+	uint32_t nb_patterns;
+	uint32_t capacity;
+	struct name_index ids;
+};
+
+static struct protocol protocol;
+
+#define to_client(n) ut_container_of((n), struct protocol_client, node)
+#define to_ack(n) ut_container_of((n), struct protocol_ack, node)
+
+/* gives an id to the patterns which don't have one yet */
+static int assign_pattern_ids(void)
+{
+	int ret;
+	const struct pattern *pattern = NULL;
+	const char *name;
+	const char **patterns;
+	uint32_t capacity;
+
+	while ((pattern = patterns_next(pattern))) {
+		name = string_pool_intern(pattern_get_name(pattern));
+		if (name == NULL)
+			return -errno;
+		if (name_index_find(&protocol.ids, name) != NULL)
+			continue;
+		if (protocol.nb_patterns == protocol.capacity) {
+			capacity = protocol.capacity == 0 ? 16 :
+					2 * protocol.capacity;
+			patterns = realloc(protocol.patterns,
+					capacity * sizeof(*patterns));
+			if (patterns == NULL)
+				return -errno;
+			protocol.patterns = patterns;
+			protocol.capacity = capacity;
+		}
+		ret = name_index_add(&protocol.ids, name,
+				(void *)(uintptr_t)(protocol.nb_patterns + 1));
+		if (ret < 0)
+			return ret;
+		protocol.patterns[protocol.nb_patterns++] = name;
+	}
+
+	return 0;
+}
+
+int protocol_init(void)
+{
+	rs_dll_init(&protocol.clients, NULL);
+	rs_dll_init(&protocol.acks, NULL);
+
+	return assign_pattern_ids();
+}
+
+/* closes stream, if not NULL, returns the error or ret */
+static int close_stream(FILE *stream, int ret)
+{
+	if (stream == NULL)
+		return ret;
+	if (fclose(stream) == 0)
+		return ret;
+	ULOGE("fclose: %m");
+
+	return -EIO;
+}
+
+/* the patterns removed by a reload aren't listed, their id isn't reused */
+static int send_ids(struct pomp_conn *conn)
+{
+	int ret = 0;
+	char *patterns = NULL;
+	char *leds = NULL;
+	char *channels = NULL;
+	size_t patterns_size;
+	size_t leds_size;
+	size_t channels_size;
+	FILE *p;
+	FILE *l;
+	FILE *c;
+	uint32_t i;
+	const struct led *led = NULL;
+	const struct led_channel *channel;
+
+	p = open_memstream(&patterns, &patterns_size);
+	l = open_memstream(&leds, &leds_size);
+	c = open_memstream(&channels, &channels_size);
+	if (p == NULL || l == NULL || c == NULL) {
+		ret = -errno;
+		ULOGE("open_memstream: %m");
+		goto out;
+	}
+
+	for (i = 0; i < protocol.nb_patterns; i++)
+		if (pattern_get(protocol.patterns[i]) != NULL)
+			fprintf(p, "%"PRIu32" %s\n", i, protocol.patterns[i]);
+	while ((led = led_driver_next_led(led))) {
+		fprintf(l, "%"PRIu32" %s\n", led->index, led->id);
+		for (i = 0; i < led->nb_channels; i++) {
+			channel = led->channels[i];
+			fprintf(c, "%"PRIu32" %s %s\n",
+					led_driver_get_channel_slot(channel),
+					led->id, channel->id);
+		}
+	}
+out:
+	ret = close_stream(p, ret);
+	ret = close_stream(l, ret);
+	ret = close_stream(c, ret);
+	if (ret == 0) {
+		ret = pomp_conn_send(conn, PROTOCOL_MSG_IDS, "%u%s%s%s",
+				PROTOCOL_VERSION, patterns, leds, channels);
+		if (ret < 0)
+			ULOGE("pomp_conn_send: %s", strerror(-ret));
+	}
+	free(patterns);
+	free(leds);
+	free(channels);
+
+	return ret;
+}
+
+static struct protocol_client *find_client(struct pomp_conn *conn)
+{
+	struct rs_node *node = NULL;
+
+	while ((node = rs_dll_next_from(&protocol.clients, node)))
+		if (to_client(node)->conn == conn)
+			return to_client(node);
+
+	return NULL;
+}
+
+int protocol_hello(struct pomp_conn *conn, const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t version;
+	struct protocol_client *client;
+
+	ret = pomp_msg_read(msg, "%u", &version);
+	if (ret < 0) {
+		ULOGE("pomp_msg_read: %s", strerror(-ret));
+		return ret;
+	}
+	/* newer clients must speak the version ledd answers with */
+	if (version < PROTOCOL_VERSION) {
+		ULOGE("protocol version %"PRIu32" not supported", version);
+		return -EPROTONOSUPPORT;
+	}
+
+	if (find_client(conn) == NULL) {
+		client = calloc(1, sizeof(*client));
+		if (client == NULL)
+			return -errno;
+		client->conn = conn;
+		rs_dll_enqueue(&protocol.clients, &client->node);
+	}
+
+	return send_ids(conn);
+}
+
+static uint32_t read_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* returns the channel of the led at index, from first, NULL if none */
+static struct led_channel *get_led_channel(uint32_t led, unsigned *first)
+{
+	struct led_channel *channel;
+
+	for (; *first < LED_MAX_CHANNELS_PER_LED; (*first)++) {
+		channel = led_driver_get_channel_by_slot(
+				led * LED_MAX_CHANNELS_PER_LED + *first);
+		if (channel != NULL)
+			return channel;
+	}
+
+	return NULL;
+}
+
+/*
+ * checked against the operations staged before too, for what would fail once
+ * applied to be rejected with the batch
+ */
+static int check_op(const uint8_t *op)
+{
+	int ret;
+	uint32_t id = read_le32(op);
+	unsigned first = 0;
+	const struct pattern *pattern;
+
+	if (op[6] != 0 || op[7] != 0)
+		return -EINVAL;
+
+	switch (op[4]) {
+	case PROTOCOL_OP_SET_PATTERN:
+		if (id >= protocol.nb_patterns)
+			return -ESRCH;
+		pattern = pattern_get(protocol.patterns[id]);
+		if (pattern == NULL)
+			return -ESRCH;
+		ret = player_check_pattern(pattern);
+		if (ret < 0)
+			return ret;
+		return commands_check_pattern(pattern);
+
+	case PROTOCOL_OP_SET_VALUE:
+		return led_driver_get_channel_by_slot(id) == NULL ? -ESRCH : 0;
+
+	case PROTOCOL_OP_SET_LED_VALUE:
+		if (id >= led_driver_get_nb_leds())
+			return -ESRCH;
+		return get_led_channel(id, &first) == NULL ? -ESRCH : 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static int queue_op(const uint8_t *op)
+{
+	int ret = 0;
+	uint32_t id = read_le32(op);
+	uint8_t arg = op[5];
+	unsigned i = 0;
+	struct led_channel *channel;
+	const struct pattern *pattern;
+
+	switch (op[4]) {
+	case PROTOCOL_OP_SET_PATTERN:
+		/* compiled now, pinned until applied, so that it can't fail then */
+		pattern = pattern_acquire(protocol.patterns[id]);
+		if (pattern == NULL)
+			return -errno;
+		return commands_set_pinned_pattern(pattern, arg != 0);
+
+	case PROTOCOL_OP_SET_VALUE:
+		return commands_set_value(led_driver_get_channel_by_slot(id),
+				arg);
+
+	case PROTOCOL_OP_SET_LED_VALUE:
+		for (; (channel = get_led_channel(id, &i)) != NULL; i++) {
+			ret = commands_set_value(channel, arg);
+			if (ret < 0)
+				break;
+		}
+		return ret;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static int send_ack(struct pomp_conn *conn, uint32_t seq, int status)
+{
+	int ret;
+
+	ret = pomp_conn_send(conn, PROTOCOL_MSG_ACK, "%u%d", seq, status);
+	if (ret < 0)
+		ULOGE("pomp_conn_send: %s", strerror(-ret));
+
+	return ret;
+}
+
+int protocol_batch(struct pomp_conn *conn, const struct pomp_msg *msg,
+		bool *now)
+{
+	int ret;
+	uint32_t seq;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t i;
+	uint64_t batch;
+	const void *ops;
+	const uint8_t *op;
+	struct protocol_ack *ack;
+
+	ret = pomp_msg_read(msg, "%u%u%p%u", &seq, &flags, &ops, &size);
+	if (ret < 0) {
+		ULOGE("pomp_msg_read: %s", strerror(-ret));
+		return ret;
+	}
+	*now = flags & PROTOCOL_BATCH_NOW;
+
+	/* all or nothing */
+	ret = size % PROTOCOL_OP_SIZE == 0 ? 0 : -EINVAL;
+	commands_begin_batch();
+	for (i = 0; ret == 0 && i < size; i += PROTOCOL_OP_SIZE) {
+		op = (const uint8_t *)ops + i;
+		ret = check_op(op);
+		if (ret == 0)
+			ret = queue_op(op);
+	}
+	batch = commands_end_batch(ret == 0);
+	if (ret < 0) {
+		ULOGE("batch %"PRIu32": %s", seq, strerror(-ret));
+		if (flags & PROTOCOL_BATCH_ACK)
+			send_ack(conn, seq, ret);
+		return ret;
+	}
+
+	if (!(flags & PROTOCOL_BATCH_ACK))
+		return 0;
+	ack = calloc(1, sizeof(*ack));
+	if (ack == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		return ret;
+	}
+	ack->conn = conn;
+	ack->seq = seq;
+	ack->batch = batch;
+	rs_dll_enqueue(&protocol.acks, &ack->node);
+	/* the batch may be empty, or reduced to nothing */
+	if (!commands_batch_is_pending(batch))
+		protocol_send_acks();
+
+	return 0;
+}
+
+void protocol_batch_failed(uint64_t batch, int status)
+{
+	struct rs_node *node = NULL;
+
+	if (batch == 0)
+		return;
+
+	while ((node = rs_dll_next_from(&protocol.acks, node)))
+		if (to_ack(node)->batch == batch && to_ack(node)->status == 0)
+			to_ack(node)->status = status;
+}
+
+void protocol_send_acks(void)
+{
+	struct rs_node *node;
+	struct rs_node *next;
+	struct protocol_ack *ack;
+
+	for (node = rs_dll_next_from(&protocol.acks, NULL); node != NULL;
+			node = next) {
+		next = rs_dll_next_from(&protocol.acks, node);
+		ack = to_ack(node);
+		if (commands_batch_is_pending(ack->batch))
+			continue;
+		rs_dll_remove(&protocol.acks, node);
+		send_ack(ack->conn, ack->seq, ack->status);
+		free(ack);
+	}
+}
+
+void protocol_ids_changed(void)
+{
+	int ret;
+	struct rs_node *node = NULL;
+
+	ret = assign_pattern_ids();
+	if (ret < 0)
+		ULOGE("assign_pattern_ids: %s", strerror(-ret));
+
+	while ((node = rs_dll_next_from(&protocol.clients, node)))
+		send_ids(to_client(node)->conn);
+}
+
+uint32_t protocol_get_pattern_id(const char *pattern)
+{
+	void *id = name_index_find(&protocol.ids, pattern);
+
+	return id == NULL ? UINT32_MAX : (uintptr_t)id - 1;
+}
+
+void protocol_disconnected(struct pomp_conn *conn)
+{
+	struct rs_node *node;
+	struct rs_node *next;
+	struct protocol_client *client;
+
+	client = find_client(conn);
+	if (client != NULL) {
+		rs_dll_remove(&protocol.clients, &client->node);
+		free(client);
+	}
+	for (node = rs_dll_next_from(&protocol.acks, NULL); node != NULL;
+			node = next) {
+		next = rs_dll_next_from(&protocol.acks, node);
+		if (to_ack(node)->conn != conn)
+			continue;
+		rs_dll_remove(&protocol.acks, node);
+		free(to_ack(node));
+	}
+}
+
+void protocol_cleanup(void)
+{
+	struct rs_node *node;
+
+	while ((node = rs_dll_pop(&protocol.clients)))
+		free(to_client(node));
+	while ((node = rs_dll_pop(&protocol.acks)))
+		free(to_ack(node));
+	free(protocol.patterns);
+	name_index_cleanup(&protocol.ids);
+	memset(&protocol, 0, sizeof(protocol));
+}
@@ -0,0 +1,169 @@
+/**
+ * @file protocol.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef LEDD_SRC_PROTOCOL_H_
+#define LEDD_SRC_PROTOCOL_H_
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <libpomp.h>
+
+/*
+ * version 2 of the control protocol, alongside the string based messages of
+ * version 1: after a handshake, the client gets numeric ids for the patterns,
+ * the leds and the channels, then sends batches of operations, applied at once
+ * at the same tick, optionally acknowledged.
+ * The format of the messages is described in ledd_client/README.md.
+ */
+
+#define PROTOCOL_VERSION 2
+
+/* client -> ledd, "%u", the version of the protocol the client implements */
+#define PROTOCOL_MSG_HELLO 7
+/*
+ * ledd -> client, "%u%s%s%s", the version of the protocol, then the patterns,
+ * the leds and the channels, one "id name" line each, "id led channel" for the
+ * channels
+ */
+#define PROTOCOL_MSG_IDS 8
+/* client -> ledd, "%u%u%p%u", sequence number, flags, then the operations */
+#define PROTOCOL_MSG_BATCH 9
+/* ledd -> client, "%u%d", sequence number and status of the batch */
+#define PROTOCOL_MSG_ACK 10
+/*
+ * client -> ledd, "%u%u", flags of the subscription, 0 to unsubscribe, then the
+ * minimum period of the values messages, in ms
+ */
+#define PROTOCOL_MSG_SUBSCRIBE 11
+/* ledd -> client, "%u%p%u", sequence number, then the events of a tick */
+#define PROTOCOL_MSG_EVENTS 12
+/*
+ * ledd -> client, "%u%p%u", sequence number of the last events message, then
+ * the values of the channels, by channel id, 0 for the ids without a channel
+ */
+#define PROTOCOL_MSG_VALUES 13
+/*
+ * client -> ledd, "%u%u%u%u%p%u%x%x", id of the live source, chosen by the
+ * client, its layer, its timeout in ms, the number of frames of its ring, the
+ * ids of its channels, on 32 bits, little endian, then the file descriptors of
+ * its shared memory, a memfd sealed against shrinking, and of its eventfd
+ */
+#define PROTOCOL_MSG_LIVE_OPEN 14
+/* ledd -> client, "%u%d", id of the live source, 0 if opened or an errno */
+#define PROTOCOL_MSG_LIVE_STATUS 15
+/* client -> ledd, "%u", id of the live source to close */
+#define PROTOCOL_MSG_LIVE_CLOSE 16
+
+/* flags of a batch */
+#define PROTOCOL_BATCH_ACK (1u << 0)
+#define PROTOCOL_BATCH_NOW (1u << 1)
+
+/*
+ * operations are 8 bytes each, little endian, the id on 32 bits, then the type
+ * and the argument on 8 bits, then 2 reserved bytes, set to 0
+ */
+#define PROTOCOL_OP_SIZE 8
+
+/* flags of a subscription */
+#define PROTOCOL_SUBSCRIBE_EVENTS (1u << 0)
+#define PROTOCOL_SUBSCRIBE_VALUES (1u << 1)
+
+/*
+ * events are 8 bytes each, little endian, the id of the pattern on 32 bits,
+ * then the type and the layer of the pattern on 8 bits, then 2 reserved bytes
+ */
+#define PROTOCOL_EVENT_SIZE 8
+
+enum protocol_event_type {
+	/* the stream was playing when the client subscribed */
+	PROTOCOL_EVENT_PLAYING,
+	PROTOCOL_EVENT_STARTED,
+	/* the stream played its last repetition */
+	PROTOCOL_EVENT_FINISHED,
+	/* the stream interrupted plays again, its interrupter being finished */
+	PROTOCOL_EVENT_RESUMED,
+	/* the stream was interrupted by another, on the same leds and layer */
+	PROTOCOL_EVENT_PREEMPTED,
+	/* the patterns were reloaded, the id is 0 */
+	PROTOCOL_EVENT_RELOADED,
+};
+
+/*
+ * the shared memory of a live source starts with the number of frames written,
+ * on 32 bits, native endianness, incremented by the client once a frame is
+ * written. The ring of frames follows, at PROTOCOL_LIVE_FRAMES_OFFSET, frame n
+ * being at index n % number of frames, one byte per channel, in the order of
+ * the channels of PROTOCOL_MSG_LIVE_OPEN
+ */
+#define PROTOCOL_LIVE_FRAMES_OFFSET 64
+
+enum protocol_op_type {
+	/* arg is 1 to resume the pattern interrupted, 0 otherwise */
+	PROTOCOL_OP_SET_PATTERN,
+	/* arg is the value, id the channel's */
+	PROTOCOL_OP_SET_VALUE,
+	/* arg is the value, set to all the channels of the led */
+	PROTOCOL_OP_SET_LED_VALUE,
+};
+
+int protocol_init(void);
+
+/* answers a handshake with the ids */
+int protocol_hello(struct pomp_conn *conn, const struct pomp_msg *msg);
+
+/*
+ * queues the operations of a batch, none if one is invalid, or would fail once
+ * applied, then now is set to true if they must be applied right away. The
+ * ack, if requested, is sent by protocol_send_acks() once they are applied, or
+ * at once on error
+ */
+int protocol_batch(struct pomp_conn *conn, const struct pomp_msg *msg,
+		bool *now);
+
+/*
+ * records the error of a command of a batch, from commands_end_batch(), which
+ * its ack carries, 0 is ignored
+ */
+void protocol_batch_failed(uint64_t batch, int status);
+
+/* acknowledges the batches applied, with their status */
+void protocol_send_acks(void);
+
+/* sends the ids again to the clients, after the patterns have changed */
+void protocol_ids_changed(void);
+
+/* returns the id of a pattern, UINT32_MAX if it has none */
+uint32_t protocol_get_pattern_id(const char *pattern);
+
+void protocol_disconnected(struct pomp_conn *conn);
+
+void protocol_cleanup(void);
+
+#endif /* LEDD_SRC_PROTOCOL_H_ */
@@ -28,13 +28,25 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+
+#include <sys/param.h> /* for MIN and MAX */
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include <unistd.h>
 #include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <lualib.h>
 #include <lauxlib.h>
@@ -43,8 +55,32 @@
 #include <ulog.h>
 ULOG_DECLARE_TAG(ledd_utils);
 
+#include <ut_string.h>
+
 #include "utils.h"
 
+#define BASELINE_KEY "ledd_globals_baseline"
+#define USERDATA_KEY "ledd_config_userdata"
+
+#define BYTECODE_CACHE_MAGIC "LEDDLUAC"
+#define BYTECODE_CACHE_VERSION 1
+
+#define FNV64_OFFSET_BASIS 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+/* precedes the dump of a config file's chunk, in the bytecode cache */
+struct bytecode_header {
+	char magic[8];
+	uint32_t version;
+	/* bytecode isn't portable between lua versions */
+	uint32_t lua_version;
+	/* of the config file when it was compiled */
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t size;
+	uint64_t hash;
+};
+
 /* approximate mapping from lua error codes to errno values */
 static int lua_error_to_errno(int error)
 {
@@ -119,70 +155,582 @@ float linear_map(float value, float range1_min, float range1_max,
 	return result * (range2_max - range2_min) + range2_min;
 }
 
-static void plua_close(lua_State **l)
+/* lua state shared by the reads of all the config files */
+static lua_State *config_state;
+/* directory of the bytecode cache, NULL to use the environment's */
+static char *bytecode_cache_dir;
+
+double monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+unsigned parallel_get_nb_workers(unsigned count, unsigned nb_threads)
 {
-	if (l == NULL || *l == NULL)
+	long nb_cpus;
+
+	if (nb_threads == 0) {
+		nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nb_threads = nb_cpus > 0 ? nb_cpus : 1;
+	}
+
+	return MAX(MIN(nb_threads, count), 1u);
+}
+
+struct parallel_job {
+	unsigned count;
+	/* next item to process, shared by the workers */
+	unsigned next;
+	void (*fn)(void *ctx, unsigned worker, unsigned i);
+	void *ctx;
+};
+
+struct parallel_worker {
+	pthread_t thread;
+	unsigned index;
+	struct parallel_job *job;
+};
+
+static void *parallel_worker_run(void *arg)
+{
+	struct parallel_worker *worker = arg;
+	struct parallel_job *job = worker->job;
+	unsigned i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+			job->count)
+		job->fn(job->ctx, worker->index, i);
+
+	return NULL;
+}
+
+void parallel_for(unsigned count, unsigned nb_threads,
+		void (*fn)(void *ctx, unsigned worker, unsigned i), void *ctx)
+{
+	int ret;
+	unsigned i;
+	unsigned nb_workers = parallel_get_nb_workers(count, nb_threads);
+	unsigned nb_started;
+	struct parallel_job job = {
+			.count = count,
+			.fn = fn,
+			.ctx = ctx,
+	};
+	struct parallel_worker workers[nb_workers];
+
+	/* the calling thread is worker 0, the others only speed things up */
+	for (nb_started = 1; nb_started < nb_workers; nb_started++) {
+		workers[nb_started].index = nb_started;
+		workers[nb_started].job = &job;
+		ret = pthread_create(&workers[nb_started].thread, NULL,
+				parallel_worker_run, workers + nb_started);
+		if (ret != 0) {
+			ULOGW("pthread_create: %s", strerror(ret));
+			break;
+		}
+	}
+	workers[0].index = 0;
+	workers[0].job = &job;
+	parallel_worker_run(workers);
+
+	for (i = 1; i < nb_started; i++)
+		pthread_join(workers[i].thread, NULL);
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= FNV64_PRIME;
+	}
+
+	return hash;
+}
+
+/* stores a copy of the content of the table t in snapshots, by table */
+static void snapshot_table(lua_State *l, int snapshots, int t)
+{
+	lua_pushvalue(l, t);
+	lua_rawget(l, snapshots);
+	if (!lua_isnil(l, -1)) {
+		lua_pop(l, 1);
 		return;
+	}
+	lua_pop(l, 1);
 
-	lua_close(*l);
-	*l = NULL;
+	lua_pushvalue(l, t);
+	lua_newtable(l);
+	lua_pushnil(l);
+	while (lua_next(l, t) != 0) {
+		lua_pushvalue(l, -2);
+		lua_insert(l, -2);
+		lua_rawset(l, -4);
+	}
+	lua_rawset(l, snapshots);
 }
 
-int read_config(const char *path, lua_CFunction config_reader,
-		enum lua_globals_config_type config)
+/*
+ * snapshots the globals of a fresh state, with lua's standard library, and the
+ * tables they reference, down to the ones of package.loaded
+ */
+static int save_baseline(lua_State *l)
+{
+	int globals;
+	int snapshots;
+
+	lua_pushglobaltable(l);
+	globals = lua_gettop(l);
+	lua_newtable(l);
+	snapshots = lua_gettop(l);
+	snapshot_table(l, snapshots, globals);
+
+	lua_pushnil(l);
+	while (lua_next(l, globals) != 0) {
+		if (lua_istable(l, -1) && !lua_rawequal(l, -1, globals)) {
+			snapshot_table(l, snapshots, lua_gettop(l));
+			lua_pushnil(l);
+			while (lua_next(l, -2) != 0) {
+				if (lua_istable(l, -1) &&
+						!lua_rawequal(l, -1, globals))
+					snapshot_table(l, snapshots,
+							lua_gettop(l));
+				lua_pop(l, 1);
+			}
+		}
+		lua_pop(l, 1);
+	}
+	lua_setfield(l, LUA_REGISTRYINDEX, BASELINE_KEY);
+	lua_pop(l, 1);
+
+	return 0;
+}
+
+/* brings the content of the table t back to its copy */
+static void restore_table(lua_State *l, int t, int copy)
+{
+	/* drop the keys added since, assigning nil is allowed by next */
+	lua_pushnil(l);
+	while (lua_next(l, t) != 0) {
+		lua_pop(l, 1);
+		lua_pushvalue(l, -1);
+		lua_rawget(l, copy);
+		if (lua_isnil(l, -1)) {
+			lua_pushvalue(l, -2);
+			lua_pushnil(l);
+			lua_rawset(l, t);
+		}
+		lua_pop(l, 1);
+	}
+
+	/* restore the ones which may have been overwritten */
+	lua_pushnil(l);
+	while (lua_next(l, copy) != 0) {
+		lua_pushvalue(l, -2);
+		lua_insert(l, -2);
+		lua_rawset(l, t);
+	}
+}
+
+/*
+ * brings the globals and the library tables, e.g. string or package.loaded,
+ * back to the baseline, so that a config file doesn't see what the previous one
+ * defined, nor the lua globals of the plug-ins for it. The metatables aren't
+ * restored
+ */
+static int reset_globals(lua_State *l)
+{
+	int snapshots;
+
+	lua_getfield(l, LUA_REGISTRYINDEX, BASELINE_KEY);
+	snapshots = lua_gettop(l);
+
+	lua_pushnil(l);
+	while (lua_next(l, snapshots) != 0) {
+		restore_table(l, lua_gettop(l) - 1, lua_gettop(l));
+		lua_pop(l, 1);
+	}
+	lua_pop(l, 1);
+
+	return 0;
+}
+
+static int call(lua_State *l, lua_CFunction function, const char *name)
 {
 	int ret;
-	lua_State __attribute__((cleanup(plua_close)))*l = NULL;
 	bool is_number;
 
-	ULOGD("%s", __func__);
+	lua_pushcfunction(l, function);
+	ret = lua_pcall(l, 0, 0, 0);
+	if (ret != LUA_OK) {
+		is_number = lua_isnumber(l, -1);
+		ret = -(is_number ? lua_tonumber(l, -1) : EINVAL);
+		ULOGE("%s: %s", name, is_number ? strerror(-ret) :
+				lua_tostring(l, -1));
+		lua_pop(l, 1);
+		return ret;
+	}
+
+	return 0;
+}
+
+lua_State *config_state_new(void)
+{
+	int ret;
+	lua_State *l;
 
 	l = luaL_newstate();
 	if (l == NULL) {
 		ULOGE("luaL_newstate() failed");
-		return -ENOMEM;
+		return NULL;
 	}
 
 	/* allow access to lua's standard library */
 	luaL_openlibs(l);
+	ret = call(l, save_baseline, "save_baseline");
+	if (ret < 0) {
+		lua_close(l);
+		return NULL;
+	}
+
+	return l;
+}
+
+lua_State *config_state_get(void)
+{
+	if (config_state == NULL)
+		config_state = config_state_new();
+
+	return config_state;
+}
+
+static char *get_bytecode_path(const char *path)
+{
+	int ret;
+	char *bytecode_path;
+	char *p;
+	const char *dir = bytecode_cache_dir;
+
+	if (dir == NULL)
+		dir = getenv(BYTECODE_CACHE_DIR_ENV);
+	if (dir == NULL || *dir == '\0')
+		return NULL;
+
+	ret = asprintf(&bytecode_path, "%s/%s.luac", dir, path);
+	if (ret < 0)
+		return NULL;
+	/* the path of the config file, flattened, is the name of the cache */
+	for (p = bytecode_path + strlen(dir) + 1; *p != '\0'; p++)
+		if (*p == '/')
+			*p = '_';
+
+	return bytecode_path;
+}
+
+static int read_file(const char *path, char **content, size_t *size)
+{
+	int ret;
+	FILE *f;
+	long len;
+
+	f = fopen(path, "rbe");
+	if (f == NULL)
+		return -errno;
+	if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0 ||
+			fseek(f, 0, SEEK_SET) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	*content = malloc(len + 1);
+	if (*content == NULL) {
+		ret = -errno;
+		goto out;
+	}
+	*size = fread(*content, 1, len, f);
+	if (*size != (size_t)len) {
+		ret = -EIO;
+		free(*content);
+		*content = NULL;
+		goto out;
+	}
+	ret = 0;
+out:
+	fclose(f);
+
+	return ret;
+}
+
+static bool header_matches_stat(const struct bytecode_header *header,
+		const struct stat *st)
+{
+	return header->size == (uint64_t)st->st_size &&
+			header->mtime_sec == st->st_mtim.tv_sec &&
+			header->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * loads the chunk from the cache if it is valid for the config file, that is,
+ * if its size and mtime are the same, or if its content has the same hash
+ */
+static int load_bytecode(lua_State *l, const char *path,
+		const char *bytecode_path, const struct stat *st,
+		uint64_t source_hash, bool hash_known)
+{
+	int ret;
+	char *content = NULL;
+	size_t size;
+	struct bytecode_header header;
+	char chunk_name[PATH_MAX + 1];
+
+	ret = read_file(bytecode_path, &content, &size);
+	if (ret < 0)
+		return ret;
+	if (size < sizeof(header)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	memcpy(&header, content, sizeof(header));
+	if (memcmp(header.magic, BYTECODE_CACHE_MAGIC,
+			sizeof(header.magic)) != 0 ||
+			header.version != BYTECODE_CACHE_VERSION ||
+			header.lua_version != LUA_VERSION_NUM) {
+		ret = -ESTALE;
+		goto out;
+	}
+	if (!header_matches_stat(&header, st) &&
+			(!hash_known || header.hash != source_hash)) {
+		ret = -ESTALE;
+		goto out;
+	}
+
+	snprintf(chunk_name, sizeof(chunk_name), "@%s", path);
+	ret = luaL_loadbufferx(l, content + sizeof(header),
+			size - sizeof(header), chunk_name, "b");
+	if (ret != LUA_OK) {
+		ULOGW("loading %s: %s", bytecode_path, lua_tostring(l, -1));
+		lua_pop(l, 1);
+		ret = -EINVAL;
+		goto out;
+	}
+	ret = 0;
+out:
+	free(content);
+
+	return ret;
+}
+
+static int write_chunk(lua_State *l, const void *p, size_t size, void *ud)
+{
+	return fwrite(p, 1, size, ud) == size ? 0 : 1;
+}
+
+/* dumps the chunk on the top of the stack, written aside then renamed */
+static int store_bytecode(lua_State *l, const char *bytecode_path,
+		const struct stat *st, uint64_t source_hash)
+{
+	int ret;
+	char __attribute__((cleanup(ut_string_free))) *tmp = NULL;
+	FILE *f;
+	struct bytecode_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BYTECODE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = BYTECODE_CACHE_VERSION;
+	header.lua_version = LUA_VERSION_NUM;
+	header.mtime_sec = st->st_mtim.tv_sec;
+	header.mtime_nsec = st->st_mtim.tv_nsec;
+	header.size = st->st_size;
+	header.hash = source_hash;
+
+	ret = asprintf(&tmp, "%s.tmp", bytecode_path);
+	if (ret < 0) {
+		tmp = NULL;
+		return -ENOMEM;
+	}
+	f = fopen(tmp, "wbe");
+	if (f == NULL)
+		return -errno;
+	ret = fwrite(&header, sizeof(header), 1, f) == 1 ? 0 : -EIO;
+	if (ret == 0 && lua_dump(l, write_chunk, f) != 0)
+		ret = -EIO;
+	if (fclose(f) != 0 && ret == 0)
+		ret = -errno;
+	if (ret == 0 && rename(tmp, bytecode_path) < 0)
+		ret = -errno;
+	if (ret < 0)
+		unlink(tmp);
+
+	return ret;
+}
+
+/*
+ * pushes the chunk of the config file, from the bytecode cache if enabled and
+ * up to date, *origin is set to where it comes from
+ */
+static int load_config(lua_State *l, const char *path, const char **origin)
+{
+	int ret;
+	char __attribute__((cleanup(ut_string_free))) *bytecode_path = NULL;
+	char *source = NULL;
+	size_t size;
+	struct stat st;
+	uint64_t hash;
+	char chunk_name[PATH_MAX + 1];
+
+	*origin = "source";
+	bytecode_path = get_bytecode_path(path);
+	if (bytecode_path == NULL || stat(path, &st) < 0) {
+		ret = luaL_loadfile(l, path);
+		goto out;
+	}
+
+	/* fast path, the config file hasn't been touched */
+	*origin = "bytecode";
+	if (load_bytecode(l, path, bytecode_path, &st, 0, false) == 0)
+		return 0;
+
+	ret = read_file(path, &source, &size);
+	if (ret < 0) {
+		ULOGE("read_file(%s): %s", path, strerror(-ret));
+		return ret;
+	}
+	hash = hash_bytes(FNV64_OFFSET_BASIS, source, size);
+	/* touched, but not modified, e.g. the file was copied again */
+	if (load_bytecode(l, path, bytecode_path, &st, hash, true) == 0) {
+		free(source);
+		/* refreshes the mtime for the fast path, failure is harmless */
+		store_bytecode(l, bytecode_path, &st, hash);
+		return 0;
+	}
+
+	*origin = "source";
+	snprintf(chunk_name, sizeof(chunk_name), "@%s", path);
+	ret = luaL_loadbufferx(l, source, size, chunk_name, NULL);
+	free(source);
+	if (ret == LUA_OK) {
+		ret = store_bytecode(l, bytecode_path, &st, hash);
+		if (ret < 0)
+			ULOGW("store_bytecode(%s): %s", bytecode_path,
+					strerror(-ret));
+		return 0;
+	}
+out:
+	if (ret != LUA_OK) {
+		ULOGE("reading config file: %s", lua_tostring(l, -1));
+		lua_pop(l, 1);
+		return lua_error_to_errno(ret);
+	}
+
+	return 0;
+}
+
+int read_config_in(lua_State *l, const char *path,
+		lua_CFunction config_reader, enum lua_globals_config_type config,
+		void *userdata)
+{
+	int ret;
+	const char *origin = "nothing";
+	double start;
+	double setup_ms;
+	double load_ms = 0;
+	double run_ms = 0;
+	double read_ms;
+
+	ULOGD("%s", __func__);
+
+	start = monotonic_ms();
+	lua_settop(l, 0);
+	ret = call(l, reset_globals, "reset_globals");
+	if (ret < 0)
+		return ret;
+	lua_pushlightuserdata(l, userdata);
+	lua_setfield(l, LUA_REGISTRYINDEX, USERDATA_KEY);
 
 	/* push all the registered lua globals */
 	lua_pushinteger(l, config);
 	lua_setglobal(l, "config");
-	lua_pushcfunction(l, lua_globals_register_all);
-	ret = lua_pcall(l, 0, 0, 0);
-	if (ret != LUA_OK) {
-		is_number = lua_isnumber(l, -1);
-		ret = -(is_number ? lua_tonumber(l, -1) : EINVAL);
-		ULOGE("read_config pl: %s", is_number ? strerror(-ret) :
-						lua_tostring(l, -1));
+	ret = call(l, lua_globals_register_all, "read_config pl");
+	if (ret < 0)
 		return ret;
-	}
+	setup_ms = monotonic_ms() - start;
 
 	/* load the config file */
 	if (path != NULL) {
 		ULOGI("loading configuration file \"%s\"", path);
-		ret = luaL_dofile(l, path);
+		start = monotonic_ms();
+		ret = load_config(l, path, &origin);
+		if (ret < 0)
+			return ret;
+		load_ms = monotonic_ms() - start;
+		start = monotonic_ms();
+		ret = lua_pcall(l, 0, 0, 0);
 		if (ret != LUA_OK) {
 			ULOGE("reading config file: %s", lua_tostring(l, -1));
+			lua_pop(l, 1);
 			return lua_error_to_errno(ret);
 		}
+		run_ms = monotonic_ms() - start;
 	}
 
 	/* parse the config file */
-	lua_pushcfunction(l, config_reader);
-	ret = lua_pcall(l, 0, 0, 0);
-	if (ret != LUA_OK) {
-		is_number = lua_isnumber(l, -1);
-		ret = -(is_number ? lua_tonumber(l, -1) : EINVAL);
-		ULOGE("read_config: %s", is_number ? strerror(-ret) :
-						lua_tostring(l, -1));
+	start = monotonic_ms();
+	ret = call(l, config_reader, "read_config");
+	if (ret < 0)
 		return ret;
-	}
+	read_ms = monotonic_ms() - start;
+
+	/* the values read from this config aren't needed anymore */
+	lua_settop(l, 0);
+	lua_gc(l, LUA_GCCOLLECT, 0);
+	ULOGI("%s read in %.2f ms: setup %.2f, load from %s %.2f, run %.2f, "
+			"parse %.2f", path, setup_ms + load_ms + run_ms +
+			read_ms, setup_ms, origin, load_ms, run_ms, read_ms);
 
 	return 0;
 }
 
+int read_config(const char *path, lua_CFunction config_reader,
+		enum lua_globals_config_type config)
+{
+	lua_State *l;
+
+	l = config_state_get();
+	if (l == NULL)
+		return -ENOMEM;
+
+	return read_config_in(l, path, config_reader, config, NULL);
+}
+
+void *config_get_userdata(lua_State *l)
+{
+	void *userdata;
+
+	lua_getfield(l, LUA_REGISTRYINDEX, USERDATA_KEY);
+	userdata = lua_touserdata(l, -1);
+	lua_pop(l, 1);
+
+	return userdata;
+}
+
+void config_set_bytecode_cache_dir(const char *dir)
+{
+	ut_string_free(&bytecode_cache_dir);
+	if (dir != NULL)
+		bytecode_cache_dir = strdup(dir);
+}
+
+void config_cleanup(void)
+{
+	if (config_state != NULL)
+		lua_close(config_state);
+	config_state = NULL;
+}
+
 void config_error(lua_State *l, int errnum, const char *fmt, ...)
 {
 	va_list args;
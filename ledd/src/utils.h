@@ -48,9 +48,66 @@ float linear_map(float value, float range1_min, float range1_max,
 		float range2_min, float range2_max);
 
 
+#ifndef BYTECODE_CACHE_DIR_ENV
+#define BYTECODE_CACHE_DIR_ENV "LEDD_BYTECODE_CACHE_DIR"
+#endif
+
+/* milliseconds elapsed since an arbitrary point, for measuring durations */
+double monotonic_ms(void);
+
+/*
+ * number of workers parallel_for() uses for count items, nb_threads being 0 for
+ * one per online cpu
+ */
+unsigned parallel_get_nb_workers(unsigned count, unsigned nb_threads);
+
+/*
+ * calls fn(ctx, worker, i) for each i in [0, count), from
+ * parallel_get_nb_workers() threads, the calling one included, worker being the
+ * index of the thread the call is made from. Returns once all the calls are
+ * done, in no particular order.
+ */
+void parallel_for(unsigned count, unsigned nb_threads,
+		void (*fn)(void *ctx, unsigned worker, unsigned i), void *ctx);
+
+/* returns a new lua state suitable for read_config_in(), NULL on error */
+lua_State *config_state_new(void);
+
+/*
+ * returns the lua state of read_config(), created on first use, NULL on error,
+ * it must only be used from the main thread and not be closed
+ */
+lua_State *config_state_get(void);
+
+/*
+ * same as read_config(), in the state l, which can't be used concurrently, but
+ * other states can, from other threads. userdata is available to config_reader
+ * through config_get_userdata().
+ */
+int read_config_in(lua_State *l, const char *path,
+		lua_CFunction config_reader, enum lua_globals_config_type config,
+		void *userdata);
+
+/* returns the userdata read_config_in() was passed, NULL for read_config() */
+void *config_get_userdata(lua_State *l);
+
+/*
+ * runs the config file in a lua state shared by all the config files, whose
+ * globals are reset before each, then calls config_reader to parse them
+ */
 int read_config(const char *path, lua_CFunction config_reader,
 		enum lua_globals_config_type config);
 
+/*
+ * enables the cache of the config files' compiled chunks in dir, NULL falls
+ * back to the directory in the BYTECODE_CACHE_DIR_ENV environment variable, if
+ * any
+ */
+void config_set_bytecode_cache_dir(const char *dir);
+
+/* releases the lua state, until the next read_config() */
+void config_cleanup(void);
+
 /*
  * calls lua_error()
  * returns abs(errnum) in the lua stack, if errnum > 0, prints
@@ -31,7 +31,9 @@
 
 #ifndef LEDD_CLIENT_INCLUDE_LEDD_CLIENT_H_
 #define LEDD_CLIENT_INCLUDE_LEDD_CLIENT_H_
+#include <stddef.h>
 #include <stdbool.h>
+#include <inttypes.h>
 
 /**
  * @def LEDD_DEFAULT_ADDRESS
@@ -39,6 +41,12 @@
  */
 #define LEDD_DEFAULT_ADDRESS "unix:@ledd.socket"
 
+/**
+ * @def LEDD_DEFAULT_GLOBAL_CONF
+ * @brief global.conf configuration file ledd reads when not told otherwise
+ */
+#define LEDD_DEFAULT_GLOBAL_CONF "/etc/ledd/global.conf"
+
 /**
  * @struct ledd_client
  * @brief ledd client context, opaque structure
@@ -55,6 +63,41 @@ struct ledd_client;
  */
 typedef void (*ledd_client_connection_cb)(void *userdata, bool connected);
 
+/**
+ * @enum ledd_client_event_type
+ * @brief type of the events received by the subscribers
+ */
+enum ledd_client_event_type {
+	/** the pattern was playing when the client subscribed */
+	LEDD_CLIENT_EVENT_PLAYING,
+	/** the pattern started */
+	LEDD_CLIENT_EVENT_STARTED,
+	/** the pattern played its last repetition */
+	LEDD_CLIENT_EVENT_FINISHED,
+	/** the pattern plays again, the one which interrupted it being finished */
+	LEDD_CLIENT_EVENT_RESUMED,
+	/**
+	 * the pattern was interrupted by another one, on the same leds and
+	 * layer, it resumes later only if the other was set with resume_previous
+	 */
+	LEDD_CLIENT_EVENT_PREEMPTED,
+	/** the patterns were reloaded, pattern_id is 0 */
+	LEDD_CLIENT_EVENT_RELOADED,
+};
+
+/**
+ * @struct ledd_client_event
+ * @brief event of a pattern, received by the subscribers
+ */
+struct ledd_client_event {
+	/** type of the event */
+	enum ledd_client_event_type type;
+	/** id of the pattern, see ledd_client_get_pattern_name() */
+	uint32_t pattern_id;
+	/** layer of the pattern */
+	uint8_t layer;
+};
+
 /**
  * @struct ledd_client_ops
  * @brief structure holding the callbacks to pass to ledd_client_new()
@@ -62,14 +105,91 @@ typedef void (*ledd_client_connection_cb)(void *userdata, bool connected);
 struct ledd_client_ops {
 	/** callback called when the client gets connected */
 	ledd_client_connection_cb connection_cb;
+	/**
+	 * optional, called when ledd sent the ids of its patterns, leds and
+	 * channels, after ledd_client_hello() and after each reload of the
+	 * patterns
+	 */
+	void (*ids_cb)(void *userdata);
+	/**
+	 * optional, called when ledd acknowledges a batch sent with
+	 * LEDD_CLIENT_BATCH_ACK, status is 0 if the batch was applied, an
+	 * errno-compatible negative value if it was rejected
+	 */
+	void (*ack_cb)(void *userdata, uint32_t seq, int status);
+	/**
+	 * optional, called with the events of a tick, for the subscribers to
+	 * LEDD_CLIENT_SUBSCRIBE_EVENTS. seq is incremented by one for each
+	 * tick with events, a gap means that ledd dropped messages the client
+	 * was too slow to take, the client can subscribe again to get the
+	 * patterns playing
+	 */
+	void (*events_cb)(void *userdata, uint32_t seq,
+			const struct ledd_client_event *events,
+			size_t nb_events);
+	/**
+	 * optional, called with the values of the channels, by channel id, for
+	 * the subscribers to LEDD_CLIENT_SUBSCRIBE_VALUES, seq is the one of
+	 * the last events
+	 */
+	void (*values_cb)(void *userdata, uint32_t seq, const uint8_t *values,
+			size_t nb_values);
+	/**
+	 * optional, called when ledd answers to ledd_client_live_open(),
+	 * status is 0 if the live source was opened, an errno-compatible
+	 * negative value otherwise
+	 */
+	void (*live_cb)(void *userdata, uint32_t live_id, int status);
 };
 
+/**
+ * @struct ledd_client_batch
+ * @brief operations sent at once to ledd, which applies them all at the same
+ * tick, or none of them if one is invalid, opaque structure
+ */
+struct ledd_client_batch;
+
+/**
+ * @def LEDD_CLIENT_BATCH_ACK
+ * @brief flag of ledd_client_batch_send(), asks ledd to acknowledge the batch
+ * once applied, through ledd_client_ops.ack_cb
+ */
+#define LEDD_CLIENT_BATCH_ACK (1u << 0)
+
+/**
+ * @def LEDD_CLIENT_BATCH_NOW
+ * @brief flag of ledd_client_batch_send(), the batch is applied as soon as
+ * received, instead of at the next tick
+ */
+#define LEDD_CLIENT_BATCH_NOW (1u << 1)
+
+/**
+ * @def LEDD_CLIENT_SUBSCRIBE_EVENTS
+ * @brief flag of ledd_client_subscribe(), to receive the events of the patterns
+ * through ledd_client_ops.events_cb
+ */
+#define LEDD_CLIENT_SUBSCRIBE_EVENTS (1u << 0)
+
+/**
+ * @def LEDD_CLIENT_SUBSCRIBE_VALUES
+ * @brief flag of ledd_client_subscribe(), to receive the values of the channels
+ * through ledd_client_ops.values_cb
+ */
+#define LEDD_CLIENT_SUBSCRIBE_VALUES (1u << 1)
+
+/**
+ * @struct ledd_client_live
+ * @brief live source, frames of values written by the client in memory shared
+ * with ledd, which shows the last one at each tick, opaque structure
+ */
+struct ledd_client_live;
+
 /**
  * Retrieves the libpomp address ledd is listening to, by reading ledd's
  * global.conf configuration file. Returns "unix:@ledd.socket" by default if for
- * any reason, no address could be found. If global_conf_path, tries to read the
- * address in /etc/ledd/global.conf by default.
- * @param global_conf_path path to the global.conf configuration file used b
+ * any reason, no address could be found. If global_conf_path is NULL or empty,
+ * tries to read the address in /etc/ledd/global.conf.
+ * @param global_conf_path path to the global.conf configuration file used by
  * ledd, can be NULL
  * @return address used by ledd, defaulting to "unix:@ledd.socket", must be
  * freed after usage, on error, returns NULL with errno set
@@ -116,6 +236,9 @@ int ledd_client_process_events(struct ledd_client *client);
 /**
  * Sets a ledd pattern to be played by ledd. Multiple led patterns can be played
  * at the same time, provided they control different leds.
+ * The pattern starts at the next tick, the patterns set during the same tick
+ * being reduced to their net effect, e.g. only the last one of a series of
+ * patterns on the same leds is played.
  * @param client ledd client context
  * @param pattern name of the pattern, as defined in the platform.conf ledd
  * configuration file
@@ -126,6 +249,247 @@ int ledd_client_process_events(struct ledd_client *client);
 int ledd_client_set_pattern(struct ledd_client *client, const char *pattern,
 		bool resume_previous);
 
+/**
+ * Same as ledd_client_set_pattern(), but the pattern starts as soon as ledd
+ * receives the request, instead of at the next tick, along with the patterns
+ * set before, for latency-critical callers.
+ * @param client ledd client context
+ * @param pattern name of the pattern, as defined in the platform.conf ledd
+ * configuration file
+ * @param resume_previous if true and the patterns doesn't cycle an infinite of
+ * time, pause the previous pattern and resume it when the new pattern ends
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_set_pattern_now(struct ledd_client *client,
+		const char *pattern, bool resume_previous);
+
+/**
+ * Asks ledd to compute in advance the values of a pattern, useful only when
+ * ledd is configured with lazy_patterns, so that the pattern starts without
+ * delay when set.
+ * @param client ledd client context
+ * @param pattern name of the pattern, as defined in the patterns.conf ledd
+ * configuration file
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_warm_up_pattern(struct ledd_client *client,
+		const char *pattern);
+
+/**
+ * Asks ledd to read its patterns configuration again, only the patterns whose
+ * definition changed are recomputed, the patterns playing continue with their
+ * old definition until they end or are set again.
+ * @param client ledd client context
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_reload_patterns(struct ledd_client *client);
+
+/**
+ * Sets a led's channel to a given value, regardless of the patterns playing on
+ * it, debug operation, patterns and values set manually can conflict in
+ * unexpected ways.
+ * @param client ledd client context
+ * @param led name of the led, as defined in the platform.conf ledd
+ * configuration file
+ * @param channel name of the channel of the led
+ * @param value value of the channel
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_set_value(struct ledd_client *client, const char *led,
+		const char *channel, uint8_t value);
+
+/**
+ * Asks ledd to dump (partially) its configuration, or its state, in its logs.
+ * @param client ledd client context
+ * @param config one of "patterns", "platform", "global", "timing" or
+ * "compositor"
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_dump_config(struct ledd_client *client, const char *config);
+
+/**
+ * Asks ledd to quit.
+ * @param client ledd client context
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_quit(struct ledd_client *client);
+
+/**
+ * Starts the handshake of version 2 of the protocol, ledd answers with the ids
+ * of its patterns, leds and channels, ledd_client_ops.ids_cb is called once
+ * they are received.
+ * @param client ledd client context, connected
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_hello(struct ledd_client *client);
+
+/**
+ * Resolves the name of a pattern into its id, for use in a batch. The id of a
+ * pattern stays the same across the reloads of the patterns.
+ * @param client ledd client context
+ * @param pattern name of the pattern
+ * @return id of the pattern, -EAGAIN if the ids weren't received yet, -ESRCH if
+ * ledd has no such pattern
+ */
+int ledd_client_get_pattern_id(struct ledd_client *client,
+		const char *pattern);
+
+/**
+ * Gives the name of a pattern, from its id, e.g. received in an event.
+ * @param client ledd client context
+ * @param id id of the pattern
+ * @return name of the pattern, valid until the ids are received again, NULL if
+ * the id is unknown
+ */
+const char *ledd_client_get_pattern_name(struct ledd_client *client,
+		uint32_t id);
+
+/**
+ * Resolves the name of a led into its id, for use in a batch.
+ * @param client ledd client context
+ * @param led name of the led
+ * @return id of the led, -EAGAIN if the ids weren't received yet, -ESRCH if
+ * ledd has no such led
+ */
+int ledd_client_get_led_id(struct ledd_client *client, const char *led);
+
+/**
+ * Resolves the name of a led channel into its id, for use in a batch.
+ * @param client ledd client context
+ * @param led name of the led
+ * @param channel name of the channel
+ * @return id of the channel, -EAGAIN if the ids weren't received yet, -ESRCH if
+ * ledd has no such channel
+ */
+int ledd_client_get_channel_id(struct ledd_client *client, const char *led,
+		const char *channel);
+
+/**
+ * Subscribes to the events of the patterns and to the values of the channels,
+ * or unsubscribes, the events subscribers first receive the patterns playing,
+ * as LEDD_CLIENT_EVENT_PLAYING events. The ids are those of
+ * ledd_client_hello().
+ * @param client ledd client context, connected
+ * @param flags bitwise or of LEDD_CLIENT_SUBSCRIBE_EVENTS and
+ * LEDD_CLIENT_SUBSCRIBE_VALUES, 0 to unsubscribe
+ * @param values_period_ms minimum period between two values messages, the
+ * values being sent at most once per tick, and once the patterns stop
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_subscribe(struct ledd_client *client, uint32_t flags,
+		uint32_t values_period_ms);
+
+/**
+ * Opens a live source, the frames published are shown by ledd at the next
+ * tick, over the patterns of the layers below and of the same layer, and until
+ * no frame is published for timeout_ms, the patterns showing again. Only
+ * available when ledd listens to a unix socket, the result is notified through
+ * ledd_client_ops.live_cb.
+ * @param client ledd client context, connected
+ * @param layer layer of the live source, in [0, 8)
+ * @param timeout_ms delay after the last frame, after which it stops showing
+ * @param channel_ids ids of the channels of the frames, see
+ * ledd_client_get_channel_id()
+ * @param nb_channels number of channels of the frames
+ * @param nb_frames number of frames in the ring shared with ledd, at least 2,
+ * the frames published faster than ledd ticks being skipped
+ * @return live source newly allocated, NULL on error, with errno set
+ */
+struct ledd_client_live *ledd_client_live_open(struct ledd_client *client,
+		uint8_t layer, uint32_t timeout_ms, const uint32_t *channel_ids,
+		size_t nb_channels, uint32_t nb_frames);
+
+/**
+ * Gets the id of a live source, as passed to ledd_client_ops.live_cb.
+ * @param live live source
+ * @return id of the live source
+ */
+uint32_t ledd_client_live_get_id(const struct ledd_client_live *live);
+
+/**
+ * Gets the frame to write next, one value per channel, in the order of
+ * ledd_client_live_open(), valid until ledd_client_live_publish() is called.
+ * @param live live source
+ * @return frame to write
+ */
+uint8_t *ledd_client_live_get_frame(struct ledd_client_live *live);
+
+/**
+ * Publishes the frame written, for ledd to show it at the next tick. Doesn't
+ * use the client context, hence can be called from any thread, by one thread
+ * at a time.
+ * @param live live source
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_live_publish(struct ledd_client_live *live);
+
+/**
+ * Closes a live source, the patterns below it show again.
+ * @param client ledd client context
+ * @param live live source to close, set to NULL on output
+ */
+void ledd_client_live_close(struct ledd_client *client,
+		struct ledd_client_live **live);
+
+/**
+ * Allocates an empty batch of operations.
+ * @return batch newly allocated, NULL on error, with errno set
+ */
+struct ledd_client_batch *ledd_client_batch_new(void);
+
+/**
+ * Adds the setting of a pattern to a batch, with the semantics of
+ * ledd_client_set_pattern().
+ * @param batch batch to add the operation to
+ * @param pattern_id id of the pattern, see ledd_client_get_pattern_id()
+ * @param resume_previous if true, the pattern interrupted resumes when the new
+ * pattern ends
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_batch_set_pattern(struct ledd_client_batch *batch,
+		uint32_t pattern_id, bool resume_previous);
+
+/**
+ * Adds the setting of the value of a led channel to a batch, the value
+ * overrides the patterns playing on the channel, until a pattern is set on it.
+ * @param batch batch to add the operation to
+ * @param channel_id id of the channel, see ledd_client_get_channel_id()
+ * @param value value of the channel
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_batch_set_value(struct ledd_client_batch *batch,
+		uint32_t channel_id, uint8_t value);
+
+/**
+ * Adds the setting of the value of all the channels of a led to a batch, see
+ * ledd_client_batch_set_value().
+ * @param batch batch to add the operation to
+ * @param led_id id of the led, see ledd_client_get_led_id()
+ * @param value value of the channels
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_batch_set_led_value(struct ledd_client_batch *batch,
+		uint32_t led_id, uint8_t value);
+
+/**
+ * Sends a batch to ledd, then empties it, for reuse.
+ * @param client ledd client context
+ * @param batch batch to send
+ * @param flags bitwise or of LEDD_CLIENT_BATCH_ACK and LEDD_CLIENT_BATCH_NOW,
+ * or 0
+ * @param seq if not NULL, set to the sequence number of the batch, as passed to
+ * ledd_client_ops.ack_cb
+ * @return errno-compatible negative value on error, 0 on success
+ */
+int ledd_client_batch_send(struct ledd_client *client,
+		struct ledd_client_batch *batch, uint32_t flags, uint32_t *seq);
+
+/**
+ * Destroys a batch.
+ * @param batch batch to destroy, set to NULL on output
+ */
+void ledd_client_batch_destroy(struct ledd_client_batch **batch);
+
 /**
  * Destroys a ledd client context.
  * @param client ledd client context to destroy, set to NULL on output
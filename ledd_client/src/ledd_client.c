@@ -28,12 +28,20 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 #include <lualib.h>
 #include <lauxlib.h>
@@ -46,22 +54,291 @@
 #define LEDD_MSG_QUIT 1
 #define LEDD_MSG_DUMP_CONFIG 2
 #define LEDD_MSG_SET_VALUE 3
+#define LEDD_MSG_WARM_UP_PATTERN 4
+#define LEDD_MSG_RELOAD_PATTERNS 5
+#define LEDD_MSG_SET_PATTERN_NOW 6
+/* version 2 of the protocol, described in ledd_client/README.md */
+#define LEDD_MSG_HELLO 7
+#define LEDD_MSG_IDS 8
+#define LEDD_MSG_BATCH 9
+#define LEDD_MSG_ACK 10
+#define LEDD_MSG_SUBSCRIBE 11
+#define LEDD_MSG_EVENTS 12
+#define LEDD_MSG_VALUES 13
+#define LEDD_MSG_LIVE_OPEN 14
+#define LEDD_MSG_LIVE_STATUS 15
+#define LEDD_MSG_LIVE_CLOSE 16
+
+#define LEDD_PROTOCOL_VERSION 2
+
+#define LEDD_OP_SIZE 8
+#define LEDD_OP_SET_PATTERN 0
+#define LEDD_OP_SET_VALUE 1
+#define LEDD_OP_SET_LED_VALUE 2
+
+#define LEDD_EVENT_SIZE 8
+
+/* the number of frames written, then the ring of frames */
+#define LEDD_LIVE_FRAMES_OFFSET 64
+
+/* name, or pair of names, for the channels, with its numeric id */
+struct ledd_client_id {
+	char *name;
+	char *subname;
+	uint32_t id;
+};
+
+/* sorted by name, then subname, for bsearch */
+struct ledd_client_ids {
+	struct ledd_client_id *ids;
+	size_t count;
+	/* the names of all the ids */
+	char *lines;
+};
 
 struct ledd_client {
 	struct pomp_ctx *pomp;
 	struct ledd_client_ops ops;
 	char *address;
 	void *userdata;
+	/* empty until ledd answers to ledd_client_hello() */
+	struct ledd_client_ids patterns;
+	struct ledd_client_ids leds;
+	struct ledd_client_ids channels;
+	uint32_t seq;
+	uint32_t live_id;
+};
+
+struct ledd_client_live {
+	uint32_t id;
+	void *shm;
+	size_t size;
+	uint32_t nb_frames;
+	size_t nb_channels;
+	int event_fd;
+	/* only modified by the client, hence read without atomics */
+	uint32_t written;
+};
+
+struct ledd_client_batch {
+	uint8_t *ops;
+	size_t size;
+	size_t capacity;
 };
 
+static int compare_ids(const void *a, const void *b)
+{
+	const struct ledd_client_id *id1 = a;
+	const struct ledd_client_id *id2 = b;
+	int ret;
+
+	ret = strcmp(id1->name, id2->name);
+	if (ret != 0 || id1->subname == NULL || id2->subname == NULL)
+		return ret;
+
+	return strcmp(id1->subname, id2->subname);
+}
+
+static void ids_cleanup(struct ledd_client_ids *ids)
+{
+	free(ids->ids);
+	free(ids->lines);
+	memset(ids, 0, sizeof(*ids));
+}
+
+/*
+ * parses "id name" lines, or "id name subname" ones if pairs is true, the
+ * names are kept in place, in lines, which is owned by ids on success
+ */
+static int ids_parse(struct ledd_client_ids *ids, char *lines, bool pairs)
+{
+	struct ledd_client_ids new = { .lines = lines };
+	struct ledd_client_id *id;
+	char *line;
+	char *next;
+	char *end;
+	size_t count = 0;
+
+	for (line = lines; *line != '\0'; line++)
+		if (*line == '\n')
+			count++;
+	new.ids = calloc(count + 1, sizeof(*new.ids));
+	if (new.ids == NULL) {
+		free(lines);
+		return -errno;
+	}
+
+	for (line = lines; *line != '\0'; line = next) {
+		next = strchr(line, '\n');
+		if (next == NULL)
+			break;
+		*next++ = '\0';
+		id = new.ids + new.count;
+		id->id = strtoul(line, &end, 10);
+		if (*end != ' ')
+			continue;
+		id->name = end + 1;
+		if (pairs) {
+			id->subname = strchr(id->name, ' ');
+			if (id->subname == NULL)
+				continue;
+			*id->subname++ = '\0';
+		}
+		new.count++;
+	}
+	qsort(new.ids, new.count, sizeof(*new.ids), compare_ids);
+
+	ids_cleanup(ids);
+	*ids = new;
+
+	return 0;
+}
+
+static int ids_find(const struct ledd_client_ids *ids, const char *name,
+		const char *subname)
+{
+	struct ledd_client_id key = {
+		.name = (char *)name,
+		.subname = (char *)subname,
+	};
+	const struct ledd_client_id *id;
+
+	if (ids->lines == NULL)
+		return -EAGAIN;
+	id = bsearch(&key, ids->ids, ids->count, sizeof(*ids->ids),
+			compare_ids);
+
+	return id == NULL ? -ESRCH : (int)id->id;
+}
+
+static void process_ids(struct ledd_client *client,
+		const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t version;
+	char *patterns = NULL;
+	char *leds = NULL;
+	char *channels = NULL;
+
+	ret = pomp_msg_read(msg, "%u%ms%ms%ms", &version, &patterns, &leds,
+			&channels);
+	if (ret < 0 || version != LEDD_PROTOCOL_VERSION) {
+		free(patterns);
+		free(leds);
+		free(channels);
+		return;
+	}
+	/* parsing takes the ownership of the lines */
+	ret = ids_parse(&client->patterns, patterns, false);
+	if (ret == 0)
+		ret = ids_parse(&client->leds, leds, false);
+	else
+		free(leds);
+	if (ret == 0)
+		ret = ids_parse(&client->channels, channels, true);
+	else
+		free(channels);
+
+	if (ret == 0 && client->ops.ids_cb != NULL)
+		client->ops.ids_cb(client->userdata);
+}
+
+static void process_ack(struct ledd_client *client,
+		const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t seq;
+	int32_t status;
+
+	ret = pomp_msg_read(msg, "%u%d", &seq, &status);
+	if (ret == 0 && client->ops.ack_cb != NULL)
+		client->ops.ack_cb(client->userdata, seq, status);
+}
+
+static void process_events(struct ledd_client *client,
+		const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t seq;
+	const uint8_t *data;
+	uint32_t size;
+	size_t i;
+	size_t count;
+	struct ledd_client_event *events;
+
+	if (client->ops.events_cb == NULL)
+		return;
+	ret = pomp_msg_read(msg, "%u%p%u", &seq, &data, &size);
+	if (ret < 0)
+		return;
+
+	count = size / LEDD_EVENT_SIZE;
+	events = calloc(count + 1, sizeof(*events));
+	if (events == NULL)
+		return;
+	for (i = 0; i < count; i++, data += LEDD_EVENT_SIZE) {
+		events[i].pattern_id = data[0] | data[1] << 8 |
+				data[2] << 16 | (uint32_t)data[3] << 24;
+		events[i].type = data[4];
+		events[i].layer = data[5];
+	}
+	client->ops.events_cb(client->userdata, seq, events, count);
+	free(events);
+}
+
+static void process_values(struct ledd_client *client,
+		const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t seq;
+	const uint8_t *values;
+	uint32_t size;
+
+	if (client->ops.values_cb == NULL)
+		return;
+	ret = pomp_msg_read(msg, "%u%p%u", &seq, &values, &size);
+	if (ret == 0)
+		client->ops.values_cb(client->userdata, seq, values, size);
+}
+
+static void process_live_status(struct ledd_client *client,
+		const struct pomp_msg *msg)
+{
+	int ret;
+	uint32_t id;
+	int32_t status;
+
+	ret = pomp_msg_read(msg, "%u%d", &id, &status);
+	if (ret == 0 && client->ops.live_cb != NULL)
+		client->ops.live_cb(client->userdata, id, status);
+}
+
 static void pomp_event_cb(struct pomp_ctx *ctx, enum pomp_event event,
 		struct pomp_conn *conn, const struct pomp_msg *msg,
 		void *userdata)
 {
 	struct ledd_client *client = userdata;
 
-	if (event == POMP_EVENT_MSG)
+	if (event == POMP_EVENT_MSG) {
+		switch (pomp_msg_get_id(msg)) {
+		case LEDD_MSG_IDS:
+			process_ids(client, msg);
+			break;
+		case LEDD_MSG_ACK:
+			process_ack(client, msg);
+			break;
+		case LEDD_MSG_EVENTS:
+			process_events(client, msg);
+			break;
+		case LEDD_MSG_VALUES:
+			process_values(client, msg);
+			break;
+		case LEDD_MSG_LIVE_STATUS:
+			process_live_status(client, msg);
+			break;
+		}
 		return;
+	}
 
 	client->ops.connection_cb(client->userdata,
 			event == POMP_EVENT_CONNECTED);
@@ -74,7 +351,7 @@ char *ledd_client_get_ledd_address(const char *global_conf_path)
 	char *address = NULL;
 
 	if (global_conf_path == NULL || *global_conf_path == '\0')
-		goto err;
+		global_conf_path = LEDD_DEFAULT_GLOBAL_CONF;
 	l = luaL_newstate();
 	if (l == NULL)
 		goto err;
@@ -86,8 +363,8 @@ char *ledd_client_get_ledd_address(const char *global_conf_path)
 	if (ret != LUA_OK)
 		goto err;
 	lua_getglobal(l, "address");
-	if (lua_isnil(l, -1))
-		address = strdup(luaL_checkstring(l, -1));
+	if (lua_isstring(l, -1))
+		address = strdup(lua_tostring(l, -1));
 	if (address == NULL)
 		goto err;
 	lua_pop(l, 1);
@@ -177,6 +454,353 @@ int ledd_client_set_pattern(struct ledd_client *client, const char *pattern,
 			pattern, resume ? "true" : "false");
 }
 
+int ledd_client_set_pattern_now(struct ledd_client *client,
+		const char *pattern, bool resume)
+{
+	return pomp_ctx_send(client->pomp, LEDD_MSG_SET_PATTERN_NOW, "%s%s",
+			pattern, resume ? "true" : "false");
+}
+
+int ledd_client_warm_up_pattern(struct ledd_client *client,
+		const char *pattern)
+{
+	return pomp_ctx_send(client->pomp, LEDD_MSG_WARM_UP_PATTERN, "%s",
+			pattern);
+}
+
+/* no argument, hence no format to pass to pomp_ctx_send() */
+static int send_no_arg(struct ledd_client *client, uint32_t msgid)
+{
+	int ret;
+	struct pomp_msg *msg;
+
+	msg = pomp_msg_new();
+	if (msg == NULL)
+		return -errno;
+	ret = pomp_msg_init(msg, msgid);
+	if (ret == 0)
+		ret = pomp_msg_finish(msg);
+	if (ret == 0)
+		ret = pomp_ctx_send_msg(client->pomp, msg);
+	pomp_msg_destroy(msg);
+
+	return ret;
+}
+
+int ledd_client_reload_patterns(struct ledd_client *client)
+{
+	return send_no_arg(client, LEDD_MSG_RELOAD_PATTERNS);
+}
+
+int ledd_client_set_value(struct ledd_client *client, const char *led,
+		const char *channel, uint8_t value)
+{
+	return pomp_ctx_send(client->pomp, LEDD_MSG_SET_VALUE, "%s%s%u", led,
+			channel, value);
+}
+
+int ledd_client_dump_config(struct ledd_client *client, const char *config)
+{
+	return pomp_ctx_send(client->pomp, LEDD_MSG_DUMP_CONFIG, "%s", config);
+}
+
+int ledd_client_quit(struct ledd_client *client)
+{
+	return send_no_arg(client, LEDD_MSG_QUIT);
+}
+
+int ledd_client_hello(struct ledd_client *client)
+{
+	if (client == NULL)
+		return -EINVAL;
+
+	return pomp_ctx_send(client->pomp, LEDD_MSG_HELLO, "%u",
+			LEDD_PROTOCOL_VERSION);
+}
+
+int ledd_client_get_pattern_id(struct ledd_client *client,
+		const char *pattern)
+{
+	if (client == NULL || pattern == NULL)
+		return -EINVAL;
+
+	return ids_find(&client->patterns, pattern, NULL);
+}
+
+const char *ledd_client_get_pattern_name(struct ledd_client *client,
+		uint32_t id)
+{
+	size_t i;
+
+	if (client == NULL)
+		return NULL;
+
+	/* sorted by name, not by id */
+	for (i = 0; i < client->patterns.count; i++)
+		if (client->patterns.ids[i].id == id)
+			return client->patterns.ids[i].name;
+
+	return NULL;
+}
+
+int ledd_client_get_led_id(struct ledd_client *client, const char *led)
+{
+	if (client == NULL || led == NULL)
+		return -EINVAL;
+
+	return ids_find(&client->leds, led, NULL);
+}
+
+int ledd_client_get_channel_id(struct ledd_client *client, const char *led,
+		const char *channel)
+{
+	if (client == NULL || led == NULL || channel == NULL)
+		return -EINVAL;
+
+	return ids_find(&client->channels, led, channel);
+}
+
+int ledd_client_subscribe(struct ledd_client *client, uint32_t flags,
+		uint32_t values_period_ms)
+{
+	if (client == NULL)
+		return -EINVAL;
+
+	return pomp_ctx_send(client->pomp, LEDD_MSG_SUBSCRIBE, "%u%u", flags,
+			values_period_ms);
+}
+
+static void live_destroy(struct ledd_client_live *live)
+{
+	if (live->shm != NULL)
+		munmap(live->shm, live->size);
+	if (live->event_fd != -1)
+		close(live->event_fd);
+	free(live);
+}
+
+static int live_send_open(struct ledd_client *client,
+		struct ledd_client_live *live, uint8_t layer,
+		uint32_t timeout_ms, const uint32_t *channel_ids, int shm_fd)
+{
+	int ret;
+	size_t i;
+	uint8_t *ids;
+	uint32_t size = live->nb_channels * 4;
+
+	ids = malloc(size);
+	if (ids == NULL)
+		return -errno;
+	for (i = 0; i < live->nb_channels; i++) {
+		ids[4 * i] = channel_ids[i];
+		ids[4 * i + 1] = channel_ids[i] >> 8;
+		ids[4 * i + 2] = channel_ids[i] >> 16;
+		ids[4 * i + 3] = channel_ids[i] >> 24;
+	}
+	ret = pomp_ctx_send(client->pomp, LEDD_MSG_LIVE_OPEN,
+			"%u%u%u%u%p%u%x%x", live->id, layer, timeout_ms,
+			live->nb_frames, ids, size, shm_fd, live->event_fd);
+	free(ids);
+
+	return ret;
+}
+
+struct ledd_client_live *ledd_client_live_open(struct ledd_client *client,
+		uint8_t layer, uint32_t timeout_ms, const uint32_t *channel_ids,
+		size_t nb_channels, uint32_t nb_frames)
+{
+	int ret;
+	int shm_fd;
+	struct ledd_client_live *live;
+
+	if (client == NULL || channel_ids == NULL || nb_channels == 0 ||
+			nb_channels > UINT32_MAX / 4 || nb_frames < 2 ||
+			nb_frames > (SIZE_MAX - LEDD_LIVE_FRAMES_OFFSET) /
+			nb_channels) {
+		errno = EINVAL;
+		return NULL;
+	}
+	live = calloc(1, sizeof(*live));
+	if (live == NULL)
+		return NULL;
+	live->id = client->live_id++;
+	live->nb_frames = nb_frames;
+	live->nb_channels = nb_channels;
+	live->size = LEDD_LIVE_FRAMES_OFFSET + (size_t)nb_frames * nb_channels;
+	live->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (live->event_fd == -1)
+		goto err;
+
+	shm_fd = memfd_create("ledd_live", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (shm_fd == -1)
+		goto err;
+	if (ftruncate(shm_fd, live->size) < 0)
+		goto err_close;
+	/* ledd only maps a memory which can't be shrunk under its feet */
+	if (fcntl(shm_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+		goto err_close;
+	live->shm = mmap(NULL, live->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			shm_fd, 0);
+	if (live->shm == MAP_FAILED) {
+		live->shm = NULL;
+		goto err_close;
+	}
+	ret = live_send_open(client, live, layer, timeout_ms, channel_ids,
+			shm_fd);
+	if (ret < 0) {
+		errno = -ret;
+		goto err_close;
+	}
+	/* ledd has its own reference to the memory */
+	close(shm_fd);
+
+	return live;
+err_close:
+	ret = errno;
+	close(shm_fd);
+	errno = ret;
+err:
+	ret = errno;
+	live_destroy(live);
+	errno = ret;
+
+	return NULL;
+}
+
+uint32_t ledd_client_live_get_id(const struct ledd_client_live *live)
+{
+	return live == NULL ? UINT32_MAX : live->id;
+}
+
+uint8_t *ledd_client_live_get_frame(struct ledd_client_live *live)
+{
+	if (live == NULL)
+		return NULL;
+
+	return (uint8_t *)live->shm + LEDD_LIVE_FRAMES_OFFSET +
+			live->written % live->nb_frames * live->nb_channels;
+}
+
+int ledd_client_live_publish(struct ledd_client_live *live)
+{
+	uint64_t one = 1;
+
+	if (live == NULL)
+		return -EINVAL;
+
+	/* the frame must be written before ledd sees the new count */
+	__atomic_store_n((uint32_t *)live->shm, ++live->written,
+			__ATOMIC_RELEASE);
+	/* ledd is already signaled if the counter overflows */
+	if (write(live->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		return -errno;
+
+	return 0;
+}
+
+void ledd_client_live_close(struct ledd_client *client,
+		struct ledd_client_live **live)
+{
+	if (live == NULL || *live == NULL)
+		return;
+
+	if (client != NULL)
+		pomp_ctx_send(client->pomp, LEDD_MSG_LIVE_CLOSE, "%u",
+				(*live)->id);
+	live_destroy(*live);
+	*live = NULL;
+}
+
+struct ledd_client_batch *ledd_client_batch_new(void)
+{
+	return calloc(1, sizeof(struct ledd_client_batch));
+}
+
+static int batch_add(struct ledd_client_batch *batch, uint8_t type,
+		uint32_t id, uint8_t arg)
+{
+	uint8_t *op;
+	uint8_t *ops;
+	size_t capacity;
+
+	if (batch == NULL)
+		return -EINVAL;
+
+	if (batch->size == batch->capacity) {
+		capacity = batch->capacity == 0 ? 16 * LEDD_OP_SIZE :
+				2 * batch->capacity;
+		ops = realloc(batch->ops, capacity);
+		if (ops == NULL)
+			return -errno;
+		batch->ops = ops;
+		batch->capacity = capacity;
+	}
+	op = batch->ops + batch->size;
+	op[0] = id;
+	op[1] = id >> 8;
+	op[2] = id >> 16;
+	op[3] = id >> 24;
+	op[4] = type;
+	op[5] = arg;
+	op[6] = 0;
+	op[7] = 0;
+	batch->size += LEDD_OP_SIZE;
+
+	return 0;
+}
+
+int ledd_client_batch_set_pattern(struct ledd_client_batch *batch,
+		uint32_t pattern_id, bool resume_previous)
+{
+	return batch_add(batch, LEDD_OP_SET_PATTERN, pattern_id,
+			resume_previous);
+}
+
+int ledd_client_batch_set_value(struct ledd_client_batch *batch,
+		uint32_t channel_id, uint8_t value)
+{
+	return batch_add(batch, LEDD_OP_SET_VALUE, channel_id, value);
+}
+
+int ledd_client_batch_set_led_value(struct ledd_client_batch *batch,
+		uint32_t led_id, uint8_t value)
+{
+	return batch_add(batch, LEDD_OP_SET_LED_VALUE, led_id, value);
+}
+
+int ledd_client_batch_send(struct ledd_client *client,
+		struct ledd_client_batch *batch, uint32_t flags, uint32_t *seq)
+{
+	int ret;
+	uint32_t s;
+
+	if (client == NULL || batch == NULL)
+		return -EINVAL;
+
+	s = client->seq++;
+	/* an empty batch is only acknowledged */
+	ret = pomp_ctx_send(client->pomp, LEDD_MSG_BATCH, "%u%u%p%u", s, flags,
+			batch->size == 0 ? (const void *)"" : batch->ops,
+			(uint32_t)batch->size);
+	if (ret < 0)
+		return ret;
+	if (seq != NULL)
+		*seq = s;
+	batch->size = 0;
+
+	return 0;
+}
+
+void ledd_client_batch_destroy(struct ledd_client_batch **batch)
+{
+	if (batch == NULL || *batch == NULL)
+		return;
+
+	free((*batch)->ops);
+	free(*batch);
+	*batch = NULL;
+}
+
 void ledd_client_destroy(struct ledd_client **client)
 {
 	struct ledd_client *c;
@@ -191,6 +815,9 @@ void ledd_client_destroy(struct ledd_client **client)
 		pomp_ctx_stop(c->pomp);
 		pomp_ctx_destroy(c->pomp);
 	}
+	ids_cleanup(&c->patterns);
+	ids_cleanup(&c->leds);
+	ids_cleanup(&c->channels);
 	memset(c, 0, sizeof(*c));
 	free(c);
 
@@ -90,6 +90,30 @@ static int file_set_value(struct led_channel *channel, uint8_t value)
 	return ret < 0 ? -EIO : 0;
 }
 
+/* the values committed together share the same timestamp */
+static int file_commit(struct led_driver *driver,
+		struct led_channel **channels, unsigned nb_channels)
+{
+	int ret = 0;
+	struct file_led_driver *file_driver = to_file_led_driver(driver);
+	struct file_led_channel *file_channel;
+	struct timespec ts;
+	unsigned i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < nb_channels; i++) {
+		file_channel = to_file_led_channel_from_channel(channels[i]);
+		if (fprintf(file_driver->file, "%s %jd.%.9ld 0x%x\n",
+				file_channel->label, (intmax_t)ts.tv_sec,
+				ts.tv_nsec, channels[i]->value) < 0)
+			ret = -EIO;
+	}
+
+	fflush(file_driver->file);
+
+	return ret;
+}
+
 static void file_channel_destroy(struct led_channel *channel)
 {
 	struct file_led_channel *file_channel =
@@ -141,11 +165,13 @@ err:
 static struct file_led_driver file_led_driver = {
 	.driver = {
 		.name = "file",
+		.async = true,
 		.ops = {
 			.channel_new = file_channel_new,
 			.channel_destroy = file_channel_destroy,
 			.set_value = file_set_value,
 			.process_events = NULL,
+			.commit = file_commit,
 		},
 	},
 };
@@ -417,8 +417,11 @@ static __attribute__((constructor)) void gpio_led_driver_init(void)
 	env = getenv(GPIO_LED_DRIVER_BIT_BANGING_PRECISION_ENV);
 	if (env != NULL)
 		gpio_led_driver.precision = atoi(env);
+	/* when bit banging, the gpios are written by the loop's thread */
 	if (bit_banging_enabled(&gpio_led_driver))
 		setup_bit_banging(&gpio_led_driver);
+	else
+		gpio_led_driver.driver.async = true;
 
 	rs_dll_init(&gpio_led_driver.channels, NULL);
 
@@ -352,6 +352,7 @@ static int pwm_set_value(struct led_channel *channel, uint8_t value)
 
 static struct led_driver pwm_led_driver = {
 		.name = "pwm",
+		.async = true,
 		.ops = {
 			.channel_new = pwm_channel_new,
 			.channel_destroy = pwm_channel_destroy,
@@ -36,6 +36,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -54,6 +56,11 @@ ULOG_DECLARE_TAG(socket_led_driver);
 
 #include <ledd_plugin.h>
 
+/* "%s%s%u", led id, channel id and value of one channel */
+#define SOCKET_LED_DRIVER_MSG_VALUE 0
+/* "%u%s", number of channels, then one "led_id channel_id value" line each */
+#define SOCKET_LED_DRIVER_MSG_VALUES 1
+
 #define SOCKET_LED_DRIVER_ADDRESS_ENV "SOCKET_LED_DRIVER_ADDRESS"
 #ifndef SOCKET_LED_DRIVER_ADDRESS_DEFAULT
 #define SOCKET_LED_DRIVER_ADDRESS_DEFAULT "unix:/tmp/socket_led_driver.sock"
@@ -73,10 +80,49 @@ static int socket_set_value(struct led_channel *channel, uint8_t value)
 	struct socket_led_driver *driver =
 			to_socket_led_driver(channel->led->driver);
 
-	ret = pomp_ctx_send(driver->pomp, 0, "%s%s%"PRIu8, channel->led->id,
-			channel->id, value);
+	ret = pomp_ctx_send(driver->pomp, SOCKET_LED_DRIVER_MSG_VALUE,
+			"%s%s%"PRIu8, channel->led->id, channel->id, value);
+	if (ret < 0)
+		ULOGW("pomp_ctx_send: %s", strerror(-ret));
+
+	return ret;
+}
+
+/* all the values changed during a tick are sent in one message */
+static int socket_commit(struct led_driver *d, struct led_channel **channels,
+		unsigned nb_channels)
+{
+	int ret;
+	struct socket_led_driver *driver = to_socket_led_driver(d);
+	char *lines = NULL;
+	size_t size = 0;
+	FILE *stream;
+	unsigned i;
+
+	if (nb_channels == 1)
+		return socket_set_value(channels[0], channels[0]->value);
+
+	stream = open_memstream(&lines, &size);
+	if (stream == NULL) {
+		ret = -errno;
+		ULOGE("open_memstream: %m");
+		return ret;
+	}
+	for (i = 0; i < nb_channels; i++)
+		fprintf(stream, "%s %s %"PRIu8"\n", channels[i]->led->id,
+				channels[i]->id, channels[i]->value);
+	if (fclose(stream) != 0) {
+		ret = -errno;
+		ULOGE("fclose: %m");
+		free(lines);
+		return ret;
+	}
+
+	ret = pomp_ctx_send(driver->pomp, SOCKET_LED_DRIVER_MSG_VALUES,
+			"%u%s", nb_channels, lines);
 	if (ret < 0)
 		ULOGW("pomp_ctx_send: %s", strerror(-ret));
+	free(lines);
 
 	return ret;
 }
@@ -129,6 +175,7 @@ static struct socket_led_driver socket_led_driver = {
 			.channel_destroy = socket_channel_destroy,
 			.set_value = socket_set_value,
 			.process_events = socket_process_events,
+			.commit = socket_commit,
 		},
 	},
 };
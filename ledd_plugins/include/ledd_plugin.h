@@ -39,6 +39,21 @@
 
 #include <rs_node.h>
 
+/**
+ * @def LEDD_PLUGIN_API_VERSION
+ * @brief version of the plug-ins API, incremented when it changes in a way
+ * which requires the out-of-tree plug-ins to be adapted or rebuilt.
+ * Version 2: the ids of struct led and struct led_channel are interned strings
+ * owned by ledd, which plug-ins mustn't modify nor free, and struct led has an
+ * index field.
+ * Version 3: struct led_driver_ops has a commit callback, and
+ * led_driver_set_value() no longer calls the driver right away, but on the next
+ * commit. struct led_driver has an async field, the callbacks of the async
+ * drivers being called from a worker thread, from which they mustn't use
+ * ledd's API
+ */
+#define LEDD_PLUGIN_API_VERSION 3
+
 /**
  * @def LEDD_PLUGINS_MAX
  * @brief maximum number of plug-ins that ledd can register
@@ -75,23 +90,25 @@ struct led_driver;
  * @brief channel of a led, e.g. red, green or blue channel of an RGB led
  */
 struct led_channel {
-	/** current value of the channel */
+	/** current value of the channel, as last committed to its driver */
 	uint8_t value;
 	/** reference to the led this channel belongs to */
 	struct led *led;
-	/** name (unique) of the channel */
-	char *id;
+	/** name (unique) of the channel, interned, owned by ledd */
+	const char *id;
 };
 
 struct led {
 	/** led driver responsible of this led's channels */
 	struct led_driver *driver;
-	/** name (unique) of the led */
-	char *id;
+	/** name (unique) of the led, interned, owned by ledd */
+	const char *id;
 	/** arrow of channels of this led */
 	struct led_channel *channels[LED_MAX_CHANNELS_PER_LED];
 	/** number of channels of the led */
 	uint8_t nb_channels;
+	/** dense index of the led, in [0, number of leds), set by ledd */
+	uint32_t index;
 	/** node for storage in a container */
 	struct rs_node node;
 };
@@ -152,6 +169,19 @@ struct led_driver_ops {
 	 * @param driver led driver notified of the end of the current tick
 	 */
 	void (*tick)(struct led_driver *driver);
+	/**
+	 * @fn commit
+	 * @brief if not NULL, called instead of set_value, once per commit
+	 * with all the channels of the driver whose value changed, so that
+	 * they can be applied with one write or one message
+	 * @param driver driver for this driver_ops structure
+	 * @param channels channels changed, in led then channel order, the
+	 * value field of each holds its new value
+	 * @param nb_channels number of channels changed, at least 1
+	 * @return 0 on success, errno-compatible negative value on error
+	 */
+	int (*commit)(struct led_driver *driver, struct led_channel **channels,
+			unsigned nb_channels);
 };
 
 /**
@@ -172,6 +202,16 @@ struct led_driver {
 	int fd;
 	/** if true, fd will be registered for write events too */
 	bool rw;
+	/**
+	 * if true, the driver is committed by a worker thread of its own, so
+	 * that slow writes don't delay ledd's event loop. The set_value,
+	 * commit and tick callbacks are then called from this thread, tick
+	 * after each commit. They must not use ledd's API and the value field
+	 * of the driver's channels must only be read from them.
+	 * The frames published while the driver is busy are merged, only the
+	 * latest value of each channel is committed
+	 */
+	bool async;
 };
 
 /**
@@ -182,8 +222,9 @@ struct led_driver {
 int led_driver_register(struct led_driver *driver);
 
 /**
- * @brief notifies all the drivers that all the set_value calls have been
- * performed during this tick
+ * @brief commits the values set, then notifies all the drivers that all the
+ * set_value calls have been performed during this tick, the values set by a
+ * driver's tick callback are committed before the next driver is notified
  */
 void led_driver_tick_all_drivers(void);
 
@@ -214,7 +255,9 @@ int led_channel_new(const char *led_id, const char *channel_id,
 		const char *parameters);
 
 /**
- * @brief sets the value of a led channel
+ * @brief sets the value of a led channel, the driver is called on the next
+ * commit, at the latest during led_driver_tick_all_drivers(), and only if the
+ * value differs from the channel's current one
  * @param led_id name of the led
  * @param channel_id name of the led channel to set the value of
  * @param value value to set
@@ -223,6 +266,28 @@ int led_channel_new(const char *led_id, const char *channel_id,
 int led_driver_set_value(const char *led_id, const char *channel_id,
 		uint8_t value);
 
+/**
+ * @brief retrieves the handle of a led channel, for use with
+ * led_driver_set_channel_value()
+ * @param led_id name of the led
+ * @param channel_id name of the led channel
+ * @return channel handle on success, NULL on error with errno set
+ * @note the handle stays valid until the channel is destroyed, that is, until
+ * the platform is cleaned up
+ */
+struct led_channel *led_driver_get_channel(const char *led_id,
+		const char *channel_id);
+
+/**
+ * @brief sets the value of a led channel, given its handle, without any
+ * lookup, with the same deferred semantics as led_driver_set_value()
+ * @param channel led channel to set the value of, as returned by
+ * led_driver_get_channel()
+ * @param value value to set
+ * @return 0 on success, errno-compatible negative value on error
+ */
+int led_driver_set_channel_value(struct led_channel *channel, uint8_t value);
+
 /***************************** transitions API ********************************/
 
 /**
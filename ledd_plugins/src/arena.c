@@ -0,0 +1,138 @@
+/**
+ * @file arena.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "arena_priv.h"
+
+#define ARENA_CHUNK_SIZE 16384
+/* enough for any scalar or pointer type */
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	/* aligned on ARENA_ALIGN, given the header's size */
+	unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static size_t align(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static struct arena_chunk *arena_add_chunk(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	/* big allocations get a chunk of their own */
+	if (size < ARENA_CHUNK_SIZE)
+		size = ARENA_CHUNK_SIZE;
+	chunk = calloc(1, sizeof(*chunk) + size);
+	if (chunk == NULL)
+		return NULL;
+	chunk->size = size;
+	arena->capacity += size;
+
+	/* keep on filling the current chunk if the new one is dedicated */
+	if (size > ARENA_CHUNK_SIZE && arena->chunks != NULL) {
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+	} else {
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	return chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	void *ptr;
+	struct arena_chunk *chunk = arena->chunks;
+
+	if (size == 0)
+		size = 1;
+	if (size > SIZE_MAX - ARENA_ALIGN - sizeof(*chunk)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = align(size);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		chunk = arena_add_chunk(arena, size);
+		if (chunk == NULL)
+			return NULL;
+	}
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->size += size;
+
+	return ptr;
+}
+
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return arena_alloc(arena, nmemb * size);
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	size_t size = strlen(str) + 1;
+	char *copy;
+
+	copy = arena_alloc(arena, size);
+	if (copy == NULL)
+		return NULL;
+
+	return memcpy(copy, str, size);
+}
+
+void arena_release(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	while (arena->chunks != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	memset(arena, 0, sizeof(*arena));
+}
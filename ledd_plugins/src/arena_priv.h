@@ -0,0 +1,63 @@
+/**
+ * @file arena_priv.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef LEDD_PLUGINS_SRC_ARENA_PRIV_H_
+#define LEDD_PLUGINS_SRC_ARENA_PRIV_H_
+#include <stddef.h>
+
+/*
+ * bump allocator, for data sharing the same lifetime, e.g. everything derived
+ * from a config file. Allocations can't be freed individually, they all are at
+ * once by arena_release().
+ * an arena must be zeroed before first use, no other initialization needed.
+ */
+struct arena_chunk;
+
+struct arena {
+	/* the current chunk is the first of the list */
+	struct arena_chunk *chunks;
+	/* bytes requested by the users of the arena */
+	size_t size;
+	/* bytes allocated for the chunks */
+	size_t capacity;
+};
+
+/* returns zeroed memory, or NULL with errno set on error */
+void *arena_alloc(struct arena *arena, size_t size);
+
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t size);
+
+char *arena_strdup(struct arena *arena, const char *str);
+
+/* frees all the memory of the arena, which is reusable afterwards */
+void arena_release(struct arena *arena);
+
+#endif /* LEDD_PLUGINS_SRC_ARENA_PRIV_H_ */
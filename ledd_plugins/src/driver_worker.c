@@ -0,0 +1,284 @@
+/**
+ * @file driver_worker.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <sys/eventfd.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define ULOG_TAG driver_worker
+#include <ulog.h>
+ULOG_DECLARE_TAG(driver_worker);
+
+#include <ledd_plugin.h>
+
+#include "driver_worker_priv.h"
+#include "led_driver_priv.h"
+
+#define WORD_BITS 64
+#define NB_WORDS(n) (((n) + WORD_BITS - 1) / WORD_BITS)
+
+/*
+ * the mailbox is single producer, single consumer and lock-free: the loop's
+ * thread stores a value, then sets its posted bit, the worker clears a word of
+ * posted bits at once, then loads the values. A value overwritten before the
+ * worker loads it is simply never committed, only the latest one matters
+ */
+struct driver_worker {
+	struct led_driver *driver;
+	pthread_t thread;
+	/* written by the loop's thread to wake the worker up */
+	int event_fd;
+	uint32_t nb_slots;
+	/* channels of the driver, by slot, NULL for the others' slots */
+	struct led_channel **channels;
+	uint8_t *values;
+	uint64_t *posted;
+	/* used by the worker only, channels changed since the last commit */
+	struct led_channel **batch;
+	/* number of frames published, and time of the last publication */
+	uint64_t published;
+	uint64_t publish_ns;
+	bool stop;
+	/* written by the worker, read with atomic loads */
+	struct driver_stats stats;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void stats_add(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/* merges the frames published since the last commit into one */
+static void worker_commit(struct driver_worker *worker, uint64_t nb_frames)
+{
+	int ret;
+	uint32_t w;
+	uint32_t slot;
+	uint64_t bits;
+	uint64_t latency;
+	uint8_t value;
+	unsigned n = 0;
+	struct led_channel *channel;
+	struct led_driver *driver = worker->driver;
+
+	for (w = 0; w < NB_WORDS(worker->nb_slots); w++) {
+		bits = __atomic_exchange_n(worker->posted + w, 0,
+				__ATOMIC_ACQUIRE);
+		for (; bits != 0; bits &= bits - 1) {
+			slot = w * WORD_BITS + __builtin_ctzll(bits);
+			channel = worker->channels[slot];
+			value = __atomic_load_n(worker->values + slot,
+					__ATOMIC_RELAXED);
+			/* already committed, if stored again meanwhile */
+			if (channel == NULL || channel->value == value)
+				continue;
+			channel->value = value;
+			worker->batch[n++] = channel;
+		}
+	}
+
+	if (n != 0) {
+		ret = led_driver_commit_channels(driver, worker->batch, n);
+		if (ret < 0)
+			ULOGW("driver %s commit: %s", driver->name,
+					strerror(-ret));
+	}
+	if (driver->ops.tick != NULL)
+		driver->ops.tick(driver);
+
+	latency = now_ns() - __atomic_load_n(&worker->publish_ns,
+			__ATOMIC_RELAXED);
+	stats_add(&worker->stats.commits, 1);
+	stats_add(&worker->stats.dropped, nb_frames - 1);
+	stats_add(&worker->stats.total_latency_ns, latency);
+	if (latency > worker->stats.max_latency_ns)
+		__atomic_store_n(&worker->stats.max_latency_ns, latency,
+				__ATOMIC_RELAXED);
+}
+
+static void *worker_run(void *arg)
+{
+	struct driver_worker *worker = arg;
+	uint64_t consumed = 0;
+	uint64_t published;
+	uint64_t count;
+	ssize_t sret;
+	bool stop;
+
+	do {
+		sret = read(worker->event_fd, &count, sizeof(count));
+		if (sret < 0 && errno != EINTR) {
+			ULOGE("read: %m");
+			break;
+		}
+		/* stop is read first, the frames published before are seen */
+		stop = __atomic_load_n(&worker->stop, __ATOMIC_ACQUIRE);
+		published = __atomic_load_n(&worker->published,
+				__ATOMIC_ACQUIRE);
+		if (published != consumed)
+			worker_commit(worker, published - consumed);
+		consumed = published;
+	} while (!stop);
+
+	return NULL;
+}
+
+static void wake_up(struct driver_worker *worker)
+{
+	uint64_t one = 1;
+
+	if (write(worker->event_fd, &one, sizeof(one)) < 0)
+		ULOGE("write: %m");
+}
+
+static void worker_free(struct driver_worker *worker)
+{
+	if (worker->event_fd != -1)
+		close(worker->event_fd);
+	free(worker->channels);
+	free(worker->values);
+	free(worker->posted);
+	free(worker->batch);
+	free(worker);
+}
+
+struct driver_worker *driver_worker_new(struct led_driver *driver,
+		struct led_channel *const *channels, uint32_t nb_slots)
+{
+	int ret;
+	uint32_t slot;
+	struct driver_worker *worker;
+
+	if (driver == NULL || (channels == NULL && nb_slots != 0)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	worker = calloc(1, sizeof(*worker));
+	if (worker == NULL)
+		return NULL;
+	worker->driver = driver;
+	worker->nb_slots = nb_slots;
+	worker->event_fd = eventfd(0, EFD_CLOEXEC);
+	if (worker->event_fd == -1) {
+		ret = -errno;
+		ULOGE("eventfd: %m");
+		goto err;
+	}
+	/* at least one element each, for calloc not to return NULL */
+	worker->channels = calloc(nb_slots + 1, sizeof(*worker->channels));
+	worker->values = calloc(nb_slots + 1, sizeof(*worker->values));
+	worker->posted = calloc(NB_WORDS(nb_slots) + 1,
+			sizeof(*worker->posted));
+	worker->batch = calloc(nb_slots + 1, sizeof(*worker->batch));
+	if (worker->channels == NULL || worker->values == NULL ||
+			worker->posted == NULL || worker->batch == NULL) {
+		ret = -errno;
+		ULOGE("calloc: %m");
+		goto err;
+	}
+	for (slot = 0; slot < nb_slots; slot++)
+		if (channels[slot] != NULL &&
+				channels[slot]->led->driver == driver)
+			worker->channels[slot] = channels[slot];
+
+	ret = pthread_create(&worker->thread, NULL, worker_run, worker);
+	if (ret != 0) {
+		ret = -ret;
+		ULOGE("pthread_create: %s", strerror(-ret));
+		goto err;
+	}
+
+	return worker;
+err:
+	worker_free(worker);
+	errno = -ret;
+
+	return NULL;
+}
+
+void driver_worker_post(struct driver_worker *worker, uint32_t slot,
+		uint8_t value)
+{
+	if (slot >= worker->nb_slots)
+		return;
+
+	__atomic_store_n(worker->values + slot, value, __ATOMIC_RELAXED);
+	__atomic_fetch_or(worker->posted + slot / WORD_BITS,
+			UINT64_C(1) << (slot % WORD_BITS), __ATOMIC_RELEASE);
+}
+
+void driver_worker_publish(struct driver_worker *worker)
+{
+	__atomic_store_n(&worker->publish_ns, now_ns(), __ATOMIC_RELAXED);
+	__atomic_store_n(&worker->published, worker->published + 1,
+			__ATOMIC_RELEASE);
+	wake_up(worker);
+}
+
+void driver_worker_get_stats(const struct driver_worker *worker,
+		struct driver_stats *stats)
+{
+	stats->commits = __atomic_load_n(&worker->stats.commits,
+			__ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&worker->stats.dropped,
+			__ATOMIC_RELAXED);
+	stats->total_latency_ns = __atomic_load_n(
+			&worker->stats.total_latency_ns, __ATOMIC_RELAXED);
+	stats->max_latency_ns = __atomic_load_n(&worker->stats.max_latency_ns,
+			__ATOMIC_RELAXED);
+}
+
+void driver_worker_destroy(struct driver_worker *worker)
+{
+	if (worker == NULL)
+		return;
+
+	__atomic_store_n(&worker->stop, true, __ATOMIC_RELEASE);
+	wake_up(worker);
+	pthread_join(worker->thread, NULL);
+	worker_free(worker);
+}
@@ -0,0 +1,81 @@
+/**
+ * @file driver_worker_priv.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef LEDD_PLUGINS_SRC_DRIVER_WORKER_PRIV_H_
+#define LEDD_PLUGINS_SRC_DRIVER_WORKER_PRIV_H_
+#include <inttypes.h>
+
+struct led_driver;
+struct led_channel;
+
+/* commit statistics of a driver */
+struct driver_stats {
+	/* calls to the driver's commit, or series of set_value calls */
+	uint64_t commits;
+	/* frames merged into a later one before reaching the driver */
+	uint64_t dropped;
+	/*
+	 * time from the publication of a frame to the return of the driver,
+	 * for the last frame published, if several were merged
+	 */
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+};
+
+/*
+ * thread calling an async driver, fed by the event loop's thread through a
+ * mailbox holding the latest value posted for each channel, the frames
+ * published while the driver is busy are merged into one commit
+ */
+struct driver_worker;
+
+/*
+ * starts the worker of driver, channels are the channels of all the drivers,
+ * by slot, only the driver's ones are used, they mustn't be added or destroyed
+ * until the worker is destroyed. Returns NULL with errno set on error
+ */
+struct driver_worker *driver_worker_new(struct led_driver *driver,
+		struct led_channel *const *channels, uint32_t nb_slots);
+
+/* sets the value of the channel of a slot for the next frame published */
+void driver_worker_post(struct driver_worker *worker, uint32_t slot,
+		uint8_t value);
+
+/* hands the values posted so far to the worker */
+void driver_worker_publish(struct driver_worker *worker);
+
+void driver_worker_get_stats(const struct driver_worker *worker,
+		struct driver_stats *stats);
+
+/* commits the values published, if any, then stops the worker */
+void driver_worker_destroy(struct driver_worker *worker);
+
+#endif /* LEDD_PLUGINS_SRC_DRIVER_WORKER_PRIV_H_ */
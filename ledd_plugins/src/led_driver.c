@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <time.h>
 
 #define ULOG_TAG led_driver
 #include <ulog.h>
@@ -46,10 +47,55 @@ ULOG_DECLARE_TAG(led_driver);
 #include <ledd_plugin.h>
 
 #include "led_driver_priv.h"
+#include "name_index_priv.h"
+#include "arena_priv.h"
+#include "string_pool_priv.h"
+#include "driver_worker_priv.h"
 
 static struct led_driver *led_drivers[LED_MAX_DRIVERS];
 static unsigned nb_drivers;
+/* by driver index, the worker is NULL if the driver is committed inline */
+static struct driver_worker *workers[LED_MAX_DRIVERS];
+/* by driver index, for the drivers committed inline */
+static struct driver_stats stats[LED_MAX_DRIVERS];
+/*
+ * the list keeps the leds in their declaration order, the indices are for the
+ * lookups by name
+ */
 static struct rs_dll leds;
+static struct name_index drivers_index;
+static struct name_index leds_index;
+/* channels are indexed by the (led id, channel id) pair */
+static struct name_index channels_index;
+/* leds are freed all at once by led_driver_cleanup(), their ids are interned */
+static struct arena leds_arena;
+/* next dense led index */
+static uint32_t nb_leds;
+
+/*
+ * values set since the last commit, by slot, with one dirty bit per slot whose
+ * value differs from the channel's committed one
+ */
+struct frame {
+	uint32_t nb_slots;
+	uint8_t *values;
+	/*
+	 * last value handed to the driver, the channel's value field may lag
+	 * behind for an async driver, whose worker thread owns it
+	 */
+	uint8_t *committed;
+	uint64_t *dirty;
+	uint32_t nb_dirty;
+	/* channel of each slot, NULL if none */
+	struct led_channel **channels;
+	/* scratch array, for grouping the dirty channels by driver */
+	struct led_channel **pending;
+};
+
+static struct frame frame;
+
+#define FRAME_WORD_BITS 64
+#define FRAME_NB_WORDS(n) (((n) + FRAME_WORD_BITS - 1) / FRAME_WORD_BITS)
 
 static bool driver_is_invalid(const struct led_driver *driver)
 {
@@ -61,6 +107,254 @@ static bool driver_is_invalid(const struct led_driver *driver)
 			driver->ops.set_value == NULL;
 }
 
+static int get_driver_index(const struct led_driver *driver)
+{
+	unsigned i;
+
+	for (i = 0; i < nb_drivers; i++)
+		if (led_drivers[i] == driver)
+			return i;
+
+	return -1;
+}
+
+static uint32_t get_channel_slot(const struct led_channel *channel)
+{
+	const struct led *led = channel->led;
+	uint8_t i;
+
+	for (i = 0; i < led->nb_channels; i++)
+		if (led->channels[i] == channel)
+			break;
+
+	return led->index * LED_MAX_CHANNELS_PER_LED + i;
+}
+
+static void frame_set_dirty(uint32_t slot, bool dirty)
+{
+	uint64_t bit = UINT64_C(1) << (slot % FRAME_WORD_BITS);
+	uint64_t *word = frame.dirty + slot / FRAME_WORD_BITS;
+
+	if (dirty == !!(*word & bit))
+		return;
+
+	*word ^= bit;
+	if (dirty)
+		frame.nb_dirty++;
+	else
+		frame.nb_dirty--;
+}
+
+/* makes room for the channels of the leds up to nb_leds, included */
+static int frame_grow(void)
+{
+	uint32_t nb_slots = nb_leds * LED_MAX_CHANNELS_PER_LED;
+	uint32_t nb_words = FRAME_NB_WORDS(nb_slots);
+	uint32_t old_nb_words = FRAME_NB_WORDS(frame.nb_slots);
+	uint8_t *values;
+	uint8_t *committed;
+	uint64_t *dirty;
+	struct led_channel **channels;
+	struct led_channel **pending;
+
+	if (nb_slots <= frame.nb_slots)
+		return 0;
+
+	values = realloc(frame.values, nb_slots * sizeof(*values));
+	if (values == NULL)
+		return -errno;
+	frame.values = values;
+	committed = realloc(frame.committed, nb_slots * sizeof(*committed));
+	if (committed == NULL)
+		return -errno;
+	frame.committed = committed;
+	dirty = realloc(frame.dirty, nb_words * sizeof(*dirty));
+	if (dirty == NULL)
+		return -errno;
+	frame.dirty = dirty;
+	channels = realloc(frame.channels, nb_slots * sizeof(*channels));
+	if (channels == NULL)
+		return -errno;
+	frame.channels = channels;
+	pending = realloc(frame.pending, nb_slots * sizeof(*pending));
+	if (pending == NULL)
+		return -errno;
+	frame.pending = pending;
+
+	memset(values + frame.nb_slots, 0, nb_slots - frame.nb_slots);
+	memset(committed + frame.nb_slots, 0, nb_slots - frame.nb_slots);
+	memset(dirty + old_nb_words, 0,
+			(nb_words - old_nb_words) * sizeof(*dirty));
+	memset(channels + frame.nb_slots, 0,
+			(nb_slots - frame.nb_slots) * sizeof(*channels));
+	frame.nb_slots = nb_slots;
+
+	return 0;
+}
+
+/* the slots of the led's channels follow their position, update them */
+static void frame_map_led(const struct led *led)
+{
+	uint32_t first = led->index * LED_MAX_CHANNELS_PER_LED;
+	uint8_t i;
+
+	for (i = 0; i < LED_MAX_CHANNELS_PER_LED; i++) {
+		frame_set_dirty(first + i, false);
+		frame.channels[first + i] = i < led->nb_channels ?
+				led->channels[i] : NULL;
+		if (i >= led->nb_channels)
+			continue;
+		frame.values[first + i] = led->channels[i]->value;
+		frame.committed[first + i] = led->channels[i]->value;
+	}
+}
+
+static void frame_cleanup(void)
+{
+	free(frame.values);
+	free(frame.committed);
+	free(frame.dirty);
+	free(frame.channels);
+	free(frame.pending);
+	memset(&frame, 0, sizeof(frame));
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+int led_driver_commit_channels(struct led_driver *driver,
+		struct led_channel **channels, unsigned nb_channels)
+{
+	int ret;
+	int result = 0;
+	unsigned i;
+
+	if (driver->ops.commit != NULL)
+		return driver->ops.commit(driver, channels, nb_channels);
+
+	/* calls set_value for each channel, for the drivers without commit */
+	for (i = 0; i < nb_channels; i++) {
+		ret = driver->ops.set_value(channels[i], channels[i]->value);
+		if (ret < 0)
+			result = ret;
+	}
+
+	return result;
+}
+
+/* inline commit, on the loop's thread */
+static int commit_driver(int d, struct led_channel **channels,
+		unsigned nb_channels)
+{
+	int ret;
+	uint64_t start = now_ns();
+	uint64_t latency;
+
+	ret = led_driver_commit_channels(led_drivers[d], channels,
+			nb_channels);
+	latency = now_ns() - start;
+	stats[d].commits++;
+	stats[d].total_latency_ns += latency;
+	if (latency > stats[d].max_latency_ns)
+		stats[d].max_latency_ns = latency;
+
+	return ret;
+}
+
+/*
+ * one pass over the dirty bitmap, the dirty channels are grouped by driver with
+ * a counting sort, the values set by the drivers during the pass are left for
+ * the next one. The values of the async drivers are posted to their worker
+ * instead, and published at the end of the pass
+ */
+static int commit_pass(void)
+{
+	int ret;
+	int result = 0;
+	int d;
+	unsigned counts[LED_MAX_DRIVERS] = {0};
+	unsigned offsets[LED_MAX_DRIVERS];
+	bool posted[LED_MAX_DRIVERS] = {false};
+	unsigned total = 0;
+	uint32_t w;
+	uint32_t slot;
+	uint64_t bits;
+	struct led_channel *channel;
+	struct led_driver *driver;
+
+	for (w = 0; w < FRAME_NB_WORDS(frame.nb_slots); w++)
+		for (bits = frame.dirty[w]; bits != 0; bits &= bits - 1) {
+			slot = w * FRAME_WORD_BITS + __builtin_ctzll(bits);
+			d = get_driver_index(frame.channels[slot]->led->driver);
+			if (d < 0)
+				continue;
+			frame.committed[slot] = frame.values[slot];
+			if (workers[d] == NULL) {
+				counts[d]++;
+				continue;
+			}
+			driver_worker_post(workers[d], slot,
+					frame.values[slot]);
+			posted[d] = true;
+		}
+	for (d = 0; d < (int)nb_drivers; d++) {
+		offsets[d] = total;
+		total += counts[d];
+	}
+	for (w = 0; w < FRAME_NB_WORDS(frame.nb_slots); w++) {
+		for (bits = frame.dirty[w]; bits != 0; bits &= bits - 1) {
+			slot = w * FRAME_WORD_BITS + __builtin_ctzll(bits);
+			channel = frame.channels[slot];
+			d = get_driver_index(channel->led->driver);
+			if (d < 0 || workers[d] != NULL)
+				continue;
+			channel->value = frame.values[slot];
+			frame.pending[offsets[d]++] = channel;
+		}
+		frame.dirty[w] = 0;
+	}
+	frame.nb_dirty = 0;
+
+	for (d = 0, total = 0; d < (int)nb_drivers; d++) {
+		if (posted[d])
+			driver_worker_publish(workers[d]);
+		if (counts[d] == 0)
+			continue;
+		driver = led_drivers[d];
+		ret = commit_driver(d, frame.pending + total, counts[d]);
+		if (ret < 0) {
+			ULOGW("driver %s commit: %s", driver->name,
+					strerror(-ret));
+			result = ret;
+		}
+		total += counts[d];
+	}
+
+	return result;
+}
+
+int led_driver_commit(void)
+{
+	int ret;
+	int result = 0;
+	unsigned pass;
+
+	/* drivers built on others' leds may set them while being committed */
+	for (pass = 0; frame.nb_dirty != 0 && pass <= LED_MAX_DRIVERS; pass++) {
+		ret = commit_pass();
+		if (ret < 0)
+			result = ret;
+	}
+
+	return result;
+}
+
 /* driver API */
 void led_driver_init(void)
 {
@@ -69,11 +363,16 @@ void led_driver_init(void)
 
 int led_driver_register(struct led_driver *driver)
 {
+	int ret;
+
 	if (driver_is_invalid(driver))
 		return -EINVAL;
 	if (nb_drivers == LED_MAX_DRIVERS)
 		return -ENOMEM;
 
+	ret = name_index_add(&drivers_index, driver->name, driver);
+	if (ret < 0)
+		return ret;
 	led_drivers[nb_drivers] = driver;
 	nb_drivers++;
 
@@ -84,11 +383,14 @@ void led_driver_tick_all_drivers(void)
 {
 	unsigned i = nb_drivers;
 
+	led_driver_commit();
 	while (i--) {
-		if (led_drivers[i]->ops.tick == NULL)
+		/* an async driver is ticked by its worker, after each commit */
+		if (led_drivers[i]->ops.tick == NULL || workers[i] != NULL)
 			continue;
 
 		led_drivers[i]->ops.tick(led_drivers[i]);
+		led_driver_commit();
 	}
 }
 
@@ -100,9 +402,18 @@ void led_driver_unregister(const struct led_driver *driver)
 		if (led_drivers[i] != driver)
 			continue;
 
-		for (i++; i < nb_drivers; i++)
+		name_index_remove(&drivers_index, driver->name);
+		if (name_index_get_count(&drivers_index) == 0)
+			name_index_cleanup(&drivers_index);
+		driver_worker_destroy(workers[i]);
+		for (i++; i < nb_drivers; i++) {
 			led_drivers[i - 1] = led_drivers[i];
+			workers[i - 1] = workers[i];
+			stats[i - 1] = stats[i];
+		}
 		nb_drivers--;
+		workers[nb_drivers] = NULL;
+		memset(stats + nb_drivers, 0, sizeof(stats[nb_drivers]));
 		return;
 	}
 }
@@ -110,55 +421,36 @@ void led_driver_unregister(const struct led_driver *driver)
 /* private API */
 static struct led_driver *get_driver_by_name(const char *name)
 {
-	unsigned i;
-
-	for (i = 0; i < nb_drivers; i++)
-		if (ut_string_match(led_drivers[i]->name, name))
-			return led_drivers[i];
-
-	errno = -ESRCH;
-
-	return NULL;
+	return name_index_find(&drivers_index, name);
 }
 
-static RS_NODE_MATCH_STR_MEMBER(led, id, node)
-
 #define to_led(n) ut_container_of(n, struct led, node)
 
 static struct led *get_led_by_id(const char *led_id)
 {
-	struct rs_node *node;
-
-	node = rs_dll_find_match(&leds, led_match_str_id, led_id);
-	if (node != NULL)
-		return to_led(node);
-
-	errno = ESRCH;
-
-	return NULL;
+	return name_index_find(&leds_index, led_id);
 }
 
 static struct led_channel *get_channel_by_id(struct led *led,
 		const char *channel_id)
 {
-	unsigned i;
-
-	for (i = 0; i < led->nb_channels; i++)
-		if (ut_string_match(channel_id, led->channels[i]->id))
-			return led->channels[i];
-
-	errno = ESRCH;
-
-	return NULL;
+	return name_index_find_pair(&channels_index, led->id, channel_id);
 }
 
 static int led_add_channel(struct led *led, struct led_channel *channel)
 {
+	int ret;
+
 	if (led->nb_channels == LED_MAX_CHANNELS_PER_LED)
 		return -ENOMEM;
 
+	ret = name_index_add_pair(&channels_index, led->id, channel->id,
+			channel);
+	if (ret < 0)
+		return ret;
 	led->channels[led->nb_channels] = channel;
 	led->nb_channels++;
+	frame_map_led(led);
 
 	return 0;
 }
@@ -168,11 +460,14 @@ static void led_remove_channel(struct led *led, struct led_channel *channel)
 	unsigned i;
 
 	for (i = 0; i < led->nb_channels; i++)
-		if (ut_string_match(channel->id, led->channels[i]->id)) {
+		if (channel == led->channels[i]) {
+			name_index_remove_pair(&channels_index, led->id,
+					channel->id);
 			/* channel found, shift all the channels above */
 			for (i++; i < led->nb_channels; i++)
 				led->channels[i - 1] = led->channels[i];
 			led->nb_channels--;
+			frame_map_led(led);
 			return;
 		}
 }
@@ -187,11 +482,10 @@ static void destroy_channel(struct led_channel *channel)
 
 	led_remove_channel(channel->led, channel);
 
-	free(channel->id);
 	driver->ops.channel_destroy(channel);
 }
 
-/* preserves errno */
+/* preserves errno, the led's memory is released with leds_arena */
 static void led_destroy(struct led *led)
 {
 	int old_errno;
@@ -201,11 +495,12 @@ static void led_destroy(struct led *led)
 
 	while (led->nb_channels != 0)
 		destroy_channel(led->channels[0]);
-	rs_dll_remove(&leds, &led->node);
 	old_errno = errno;
-	free(led->id);
+	if (led->id != NULL && get_led_by_id(led->id) == led) {
+		name_index_remove(&leds_index, led->id);
+		rs_dll_remove(&leds, &led->node);
+	}
 	memset(led, 0, sizeof(*led));
-	free(led);
 	errno = old_errno;
 }
 
@@ -230,6 +525,7 @@ static void driver_pomp_cb(int fd, uint32_t revents, void *userdata)
 
 int led_new(const char *driver_name, const char *led_id)
 {
+	int ret;
 	struct led_driver *driver;
 	struct led *led;
 
@@ -240,21 +536,36 @@ int led_new(const char *driver_name, const char *led_id)
 		ULOGE("no driver named %s found", driver_name);
 		return -ESRCH;
 	}
-	led = calloc(1, sizeof(*led));
+	led = arena_alloc(&leds_arena, sizeof(*led));
 	if (led == NULL)
 		return -errno;
 
-	led->id = strdup(led_id);
-	if (led->id == NULL)
+	led->id = string_pool_intern(led_id);
+	if (led->id == NULL) {
+		ret = -errno;
 		goto err;
+	}
 	led->driver = driver;
+	ret = name_index_add(&leds_index, led->id, led);
+	if (ret < 0) {
+		ULOGE("led %s: %s", led_id, strerror(-ret));
+		goto err;
+	}
+	led->index = nb_leds++;
+	ret = frame_grow();
+	if (ret < 0) {
+		ULOGE("frame_grow: %s", strerror(-ret));
+		nb_leds--;
+		name_index_remove(&leds_index, led->id);
+		goto err;
+	}
 	rs_dll_enqueue(&leds, &led->node);
 
 	return 0;
 err:
 	led_destroy(led);
 
-	return -errno;
+	return ret;
 }
 
 void led_driver_cleanup(void)
@@ -262,11 +573,57 @@ void led_driver_cleanup(void)
 	struct rs_node *node;
 	struct led *led;
 
-	while (rs_dll_get_count(&leds) != 0) {
-		node = rs_dll_pop(&leds);
+	while ((node = rs_dll_next_from(&leds, NULL)) != NULL) {
 		led = to_led(node);
 		led_destroy(led);
 	}
+	name_index_cleanup(&channels_index);
+	name_index_cleanup(&leds_index);
+	arena_release(&leds_arena);
+	nb_leds = 0;
+	frame_cleanup();
+}
+
+uint32_t led_driver_get_nb_leds(void)
+{
+	return nb_leds;
+}
+
+uint32_t led_driver_get_nb_slots(void)
+{
+	return nb_leds * LED_MAX_CHANNELS_PER_LED;
+}
+
+uint32_t led_driver_get_channel_slot(const struct led_channel *channel)
+{
+	return get_channel_slot(channel);
+}
+
+const uint8_t *led_driver_get_committed_values(uint32_t *nb_slots)
+{
+	*nb_slots = frame.nb_slots;
+
+	return frame.committed;
+}
+
+const struct led *led_driver_get_led(const char *led_id)
+{
+	return get_led_by_id(led_id);
+}
+
+const struct led *led_driver_next_led(const struct led *led)
+{
+	struct rs_node *node;
+
+	node = rs_dll_next_from(&leds, led == NULL ? NULL :
+			(struct rs_node *)&led->node);
+
+	return node == NULL ? NULL : to_led(node);
+}
+
+struct led_channel *led_driver_get_channel_by_slot(uint32_t slot)
+{
+	return slot < frame.nb_slots ? frame.channels[slot] : NULL;
 }
 
 int led_channel_new(const char *led_id, const char *channel_id,
@@ -290,12 +647,12 @@ int led_channel_new(const char *led_id, const char *channel_id,
 			parameters);
 	if (channel == NULL)
 		return -errno;
-	channel->id = strdup(channel_id);
+	channel->led = led;
+	channel->id = string_pool_intern(channel_id);
 	if (channel->id == NULL) {
 		ret = -errno;
 		goto err;
 	}
-	channel->led = led;
 	ret = led_add_channel(led, channel);
 	if (ret < 0)
 		goto err;
@@ -308,7 +665,6 @@ err:
 
 void led_channel_destroy(const char *led_id, const char *channel_id)
 {
-	unsigned i;
 	struct led *led;
 	struct led_channel *channel;
 
@@ -316,33 +672,60 @@ void led_channel_destroy(const char *led_id, const char *channel_id)
 	if (led == NULL)
 		return;
 
-	for (i = 0; i < led->nb_channels; i++) {
-		channel = led->channels[i];
-		if (ut_string_match(channel->id, channel_id))
-			destroy_channel(channel);
-	}
+	channel = get_channel_by_id(led, channel_id);
+	if (channel != NULL)
+		destroy_channel(channel);
 }
 
-int led_driver_set_value(const char *led_id, const char *channel_id,
-		uint8_t value)
+struct led_channel *led_driver_get_channel(const char *led_id,
+		const char *channel_id)
 {
 	struct led *led;
 	struct led_channel *channel;
 
+	if (led_id == NULL || channel_id == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
 	led = get_led_by_id(led_id);
-	if (led == NULL)
-		return -ESRCH;
+	if (led == NULL) {
+		errno = ESRCH;
+		return NULL;
+	}
 	channel = get_channel_by_id(led, channel_id);
 	if (channel == NULL)
-		return -ESRCH;
+		errno = ESRCH;
 
-	/* don't call the driver if the value hasn't changed */
-	if (channel->value == value)
-		return 0;
+	return channel;
+}
+
+int led_driver_set_channel_value(struct led_channel *channel, uint8_t value)
+{
+	uint32_t slot;
 
-	channel->value = value;
+	if (channel == NULL)
+		return -EINVAL;
+	slot = get_channel_slot(channel);
+	if (slot >= frame.nb_slots)
+		return -ERANGE;
+
+	/* the driver won't be called if the value is back to its current one */
+	frame.values[slot] = value;
+	frame_set_dirty(slot, frame.committed[slot] != value);
+
+	return 0;
+}
+
+int led_driver_set_value(const char *led_id, const char *channel_id,
+		uint8_t value)
+{
+	struct led_channel *channel;
+
+	channel = led_driver_get_channel(led_id, channel_id);
+	if (channel == NULL)
+		return -ESRCH;
 
-	return led->driver->ops.set_value(channel, value);
+	return led_driver_set_channel_value(channel, value);
 }
 
 int led_driver_register_drivers_in_pomp_loop(struct pomp_loop *loop)
@@ -389,6 +772,37 @@ void led_driver_unregister_drivers_from_pomp_loop(struct pomp_loop *loop)
 	}
 }
 
+int led_driver_start_workers(void)
+{
+	unsigned i;
+
+	for (i = 0; i < nb_drivers; i++) {
+		if (!led_drivers[i]->async || workers[i] != NULL)
+			continue;
+		workers[i] = driver_worker_new(led_drivers[i], frame.channels,
+				frame.nb_slots);
+		if (workers[i] == NULL) {
+			ULOGW("driver_worker_new(%s): %m, committed inline",
+					led_drivers[i]->name);
+			continue;
+		}
+		ULOGI("driver %s committed by a worker thread",
+				led_drivers[i]->name);
+	}
+
+	return 0;
+}
+
+void led_driver_stop_workers(void)
+{
+	unsigned i;
+
+	for (i = 0; i < nb_drivers; i++) {
+		driver_worker_destroy(workers[i]);
+		workers[i] = NULL;
+	}
+}
+
 static int apply_value_to_led(struct led *led, uint8_t value)
 {
 	int ret;
@@ -398,9 +812,9 @@ static int apply_value_to_led(struct led *led, uint8_t value)
 
 	for (i = 0; i < led->nb_channels; i++) {
 		channel = led->channels[i];
-		ret = led_driver_set_value(led->id, channel->id, value);
+		ret = led_driver_set_channel_value(channel, value);
 		if (ret < 0) {
-			ULOGW("led_driver_set_value(%s, %"PRIu8"): %s",
+			ULOGW("led_driver_set_channel_value(%s, %"PRIu8"): %s",
 					channel->id, value, strerror(-ret));
 			result = ret;
 		}
@@ -425,19 +839,22 @@ int led_driver_paint_it_black(void)
 			result = ret;
 		}
 	}
+	ret = led_driver_commit();
+	if (ret < 0)
+		result = ret;
 
 	return result;
 }
 
 int led_driver_apply_default_value(const char *led_id, uint8_t value)
 {
-	struct rs_node *node = NULL;
+	struct led *led;
 
-	node = rs_dll_find_match(&leds, led_match_str_id, led_id);
-	if (node == NULL)
+	led = get_led_by_id(led_id);
+	if (led == NULL)
 		return -ESRCH;
 
-	return apply_value_to_led(to_led(node), value);
+	return apply_value_to_led(led, value);
 }
 
 void led_drivers_dump_config(void)
@@ -445,8 +862,24 @@ void led_drivers_dump_config(void)
 	const struct led *led;
 	const struct led_channel *channel;
 	struct rs_node *node = NULL;
+	struct driver_stats s;
+	unsigned d;
 	uint8_t i;
 
+	for (d = 0; d < nb_drivers; d++) {
+		if (workers[d] != NULL)
+			driver_worker_get_stats(workers[d], &s);
+		else
+			s = stats[d];
+		ULOGI("driver %s (%s): %"PRIu64" commits, latency %.3f ms "
+				"average, %.3f ms max, %"PRIu64" frames dropped",
+				led_drivers[d]->name,
+				workers[d] != NULL ? "worker" : "inline",
+				s.commits, s.commits == 0 ? 0. :
+				s.total_latency_ns / 1e6 / s.commits,
+				s.max_latency_ns / 1e6, s.dropped);
+	}
+
 	while ((node = rs_dll_next_from(&leds, node))) {
 		led = to_led(node);
 		ULOGI("led %s (driver \"%s\"):", led->id, led->driver->name);
@@ -36,6 +36,7 @@
 
 struct led;
 struct led_channel;
+struct led_driver;
 
 void led_driver_init(void);
 
@@ -43,10 +44,63 @@ void led_driver_cleanup(void);
 
 void led_channel_destroy(const char *led_id, const char *channel_id);
 
+/* leds indices are in [0, led_driver_get_nb_leds()) */
+uint32_t led_driver_get_nb_leds(void);
+
+/*
+ * slots are dense indices of the led channels, in
+ * [0, led_driver_get_nb_slots()), led->index x LED_MAX_CHANNELS_PER_LED + the
+ * position of the channel in its led
+ */
+uint32_t led_driver_get_nb_slots(void);
+
+uint32_t led_driver_get_channel_slot(const struct led_channel *channel);
+
+/* returns NULL if no led has this id */
+const struct led *led_driver_get_led(const char *led_id);
+
+/*
+ * iterates over the leds, in their declaration order, starting with the first
+ * if led is NULL, returns NULL after the last
+ */
+const struct led *led_driver_next_led(const struct led *led);
+
+/* returns NULL if no channel has this slot */
+struct led_channel *led_driver_get_channel_by_slot(uint32_t slot);
+
+/*
+ * returns the values last committed to the drivers, by slot, nb_slots is set to
+ * their number, valid until a channel is added
+ */
+const uint8_t *led_driver_get_committed_values(uint32_t *nb_slots);
+
 int led_driver_register_drivers_in_pomp_loop(struct pomp_loop *loop);
 
 void led_driver_unregister_drivers_from_pomp_loop(struct pomp_loop *loop);
 
+/*
+ * calls the drivers for the channels whose value changed since the last
+ * commit, grouped by driver, returns the last error
+ */
+int led_driver_commit(void);
+
+/*
+ * calls the commit op of the driver, or its set_value op for each channel, the
+ * value fields of the channels hold their new value, returns the last error
+ */
+int led_driver_commit_channels(struct led_driver *driver,
+		struct led_channel **channels, unsigned nb_channels);
+
+/*
+ * starts a worker thread for each async driver, which commits its values from
+ * then on. No channel can be added or destroyed until the workers are stopped.
+ * A driver whose worker can't be started is committed inline
+ */
+int led_driver_start_workers(void);
+
+/* commits the values pending, then stops the workers */
+void led_driver_stop_workers(void);
+
 /* put all channels to black, returns the last set_value error */
 int led_driver_paint_it_black(void);
 
@@ -44,6 +44,8 @@ ULOG_DECLARE_TAG(ledd_lua_globals);
 
 #define LUA_GLOBALS_MAX 200
 
+#define FNV64_PRIME 1099511628211ull
+
 enum lua_global_type {
 	LUA_GLOBAL_VALUE_INVALID = 0,
 	LUA_GLOBAL_VALUE_INT,
@@ -159,6 +161,49 @@ int lua_globals_register_all(lua_State *l)
 	return 0;
 }
 
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= FNV64_PRIME;
+	}
+
+	return hash;
+}
+
+uint64_t lua_globals_hash(uint64_t hash, enum lua_globals_config_type config)
+{
+	int i;
+	const struct lua_global *global;
+	uint64_t global_hash;
+	uint64_t sum = 0;
+
+	for (i = 0; i < LUA_GLOBALS_MAX && is_valid(lua_globals[i].type); i++) {
+		global = lua_globals + i;
+		if (global->config != config)
+			continue;
+
+		/* the terminating '\0' separates the name from the value */
+		global_hash = hash_bytes(hash, global->name,
+				strlen(global->name) + 1);
+		global_hash = hash_bytes(global_hash, &global->type,
+				sizeof(global->type));
+		if (global->type == LUA_GLOBAL_VALUE_INT)
+			global_hash = hash_bytes(global_hash,
+					&global->int_value,
+					sizeof(global->int_value));
+		/*
+		 * summed, the registration order of the plug-ins doesn't
+		 * matter, e.g. between different link orders of ledd-static
+		 */
+		sum += global_hash;
+	}
+
+	return hash_bytes(hash, &sum, sizeof(sum));
+}
+
 static __attribute__((destructor)) void lua_globals_cleanup(void)
 {
 	int i;
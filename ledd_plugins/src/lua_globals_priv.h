@@ -34,4 +34,11 @@
 
 int lua_globals_register_all(lua_State *l);
 
+/*
+ * folds the names and values of the lua globals available to a config file into
+ * a 64 bits FNV-1a hash, whatever their registration order. C functions are
+ * only identified by their name
+ */
+uint64_t lua_globals_hash(uint64_t hash, enum lua_globals_config_type config);
+
 #endif /* LEDD_PLUGINS_SRC_LUA_GLOBALS_PRIV_H_ */
@@ -0,0 +1,255 @@
+/**
+ * @file name_index.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "name_index_priv.h"
+
+#define NAME_INDEX_MIN_CAPACITY 16
+
+/* marks the slot of a removed entry, so that probe sequences aren't broken */
+static const char tombstone[] = "";
+
+static bool entry_is_free(const struct name_index_entry *entry)
+{
+	return entry->name == NULL || entry->name == tombstone;
+}
+
+static bool subname_match(const char *s1, const char *s2)
+{
+	if (s1 == NULL || s2 == NULL)
+		return s1 == s2;
+
+	return strcmp(s1, s2) == 0;
+}
+
+static bool entry_match(const struct name_index_entry *entry, uint32_t hash,
+		const char *name, const char *subname)
+{
+	return entry->hash == hash && strcmp(entry->name, name) == 0 &&
+			subname_match(entry->subname, subname);
+}
+
+/* FNV-1a, with a '\0' separator between name and subname */
+uint32_t name_index_hash(const char *name, const char *subname)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0')
+		hash = (hash ^ (uint8_t)*(name++)) * 16777619u;
+	if (subname == NULL)
+		return hash;
+
+	hash *= 16777619u;
+	while (*subname != '\0')
+		hash = (hash ^ (uint8_t)*(subname++)) * 16777619u;
+
+	return hash;
+}
+
+/* returns the slot of the entry, or of the first empty slot met */
+static struct name_index_entry *lookup(const struct name_index *index,
+		uint32_t hash, const char *name, const char *subname)
+{
+	uint32_t mask = index->capacity - 1;
+	uint32_t i;
+	struct name_index_entry *entry;
+
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		entry = index->entries + i;
+		if (entry->name == NULL)
+			return entry;
+		if (entry->name != tombstone &&
+				entry_match(entry, hash, name, subname))
+			return entry;
+	}
+}
+
+static int resize(struct name_index *index, uint32_t capacity)
+{
+	uint32_t i;
+	struct name_index_entry *old_entries = index->entries;
+	uint32_t old_capacity = index->capacity;
+	struct name_index_entry *entry;
+
+	index->entries = calloc(capacity, sizeof(*index->entries));
+	if (index->entries == NULL) {
+		index->entries = old_entries;
+		return -errno;
+	}
+	index->capacity = capacity;
+	index->tombstones = 0;
+
+	for (i = 0; i < old_capacity; i++) {
+		if (entry_is_free(old_entries + i))
+			continue;
+		entry = lookup(index, old_entries[i].hash, old_entries[i].name,
+				old_entries[i].subname);
+		*entry = old_entries[i];
+	}
+	free(old_entries);
+
+	return 0;
+}
+
+/* keeps the load factor, tombstones included, under 3/4 */
+static int reserve_one(struct name_index *index)
+{
+	uint32_t capacity;
+
+	if ((index->count + index->tombstones + 1) * 4 <= index->capacity * 3)
+		return 0;
+
+	capacity = NAME_INDEX_MIN_CAPACITY;
+	while ((index->count + 1) * 2 > capacity)
+		capacity *= 2;
+
+	return resize(index, capacity);
+}
+
+int name_index_add_pair(struct name_index *index, const char *name,
+		const char *subname, void *value)
+{
+	int ret;
+	uint32_t hash;
+	uint32_t mask;
+	uint32_t i;
+	struct name_index_entry *entry;
+	struct name_index_entry *slot = NULL;
+
+	if (index == NULL || name == NULL)
+		return -EINVAL;
+
+	ret = reserve_one(index);
+	if (ret < 0)
+		return ret;
+
+	/* reuse the first tombstone of the probe sequence, if any */
+	hash = name_index_hash(name, subname);
+	mask = index->capacity - 1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		entry = index->entries + i;
+		if (entry->name == NULL)
+			break;
+		if (entry->name == tombstone) {
+			if (slot == NULL)
+				slot = entry;
+			continue;
+		}
+		if (entry_match(entry, hash, name, subname))
+			return -EEXIST;
+	}
+	if (slot == NULL)
+		slot = entry;
+	else
+		index->tombstones--;
+
+	slot->name = name;
+	slot->subname = subname;
+	slot->value = value;
+	slot->hash = hash;
+	index->count++;
+
+	return 0;
+}
+
+int name_index_add(struct name_index *index, const char *name, void *value)
+{
+	return name_index_add_pair(index, name, NULL, value);
+}
+
+void *name_index_find_pair(const struct name_index *index, const char *name,
+		const char *subname)
+{
+	struct name_index_entry *entry;
+
+	if (index == NULL || name == NULL || index->count == 0) {
+		errno = ESRCH;
+		return NULL;
+	}
+
+	entry = lookup(index, name_index_hash(name, subname), name, subname);
+	if (entry->name == NULL) {
+		errno = ESRCH;
+		return NULL;
+	}
+
+	return entry->value;
+}
+
+void *name_index_find(const struct name_index *index, const char *name)
+{
+	return name_index_find_pair(index, name, NULL);
+}
+
+int name_index_remove_pair(struct name_index *index, const char *name,
+		const char *subname)
+{
+	struct name_index_entry *entry;
+
+	if (index == NULL || name == NULL)
+		return -EINVAL;
+	if (index->count == 0)
+		return -ESRCH;
+
+	entry = lookup(index, name_index_hash(name, subname), name, subname);
+	if (entry->name == NULL)
+		return -ESRCH;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->name = tombstone;
+	index->count--;
+	index->tombstones++;
+
+	return 0;
+}
+
+int name_index_remove(struct name_index *index, const char *name)
+{
+	return name_index_remove_pair(index, name, NULL);
+}
+
+uint32_t name_index_get_count(const struct name_index *index)
+{
+	return index == NULL ? 0 : index->count;
+}
+
+void name_index_cleanup(struct name_index *index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->entries);
+	memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,84 @@
+/**
+ * @file name_index_priv.h
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef LEDD_PLUGINS_SRC_NAME_INDEX_PRIV_H_
+#define LEDD_PLUGINS_SRC_NAME_INDEX_PRIV_H_
+#include <inttypes.h>
+
+/*
+ * open-addressing hash index, mapping a name, or a pair of names (e.g. a led
+ * and one of its channels) to a value.
+ * the names aren't copied, they must stay valid as long as they are indexed.
+ * an index must be zeroed before first use, no other initialization needed.
+ * it only maps names to values, the iteration order of the indexed objects must
+ * be kept by their owner.
+ */
+struct name_index_entry {
+	const char *name;
+	/* NULL for single names */
+	const char *subname;
+	void *value;
+	uint32_t hash;
+};
+
+struct name_index {
+	struct name_index_entry *entries;
+	/* always 0 or a power of 2 */
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t tombstones;
+};
+
+uint32_t name_index_hash(const char *name, const char *subname);
+
+/* returns -EEXIST if the name (pair) is already indexed */
+int name_index_add(struct name_index *index, const char *name, void *value);
+
+int name_index_add_pair(struct name_index *index, const char *name,
+		const char *subname, void *value);
+
+/* returns NULL with errno set to ESRCH if not found */
+void *name_index_find(const struct name_index *index, const char *name);
+
+void *name_index_find_pair(const struct name_index *index, const char *name,
+		const char *subname);
+
+/* returns -ESRCH if not found */
+int name_index_remove(struct name_index *index, const char *name);
+
+int name_index_remove_pair(struct name_index *index, const char *name,
+		const char *subname);
+
+uint32_t name_index_get_count(const struct name_index *index);
+
+void name_index_cleanup(struct name_index *index);
+
+#endif /* LEDD_PLUGINS_SRC_NAME_INDEX_PRIV_H_ */
@@ -0,0 +1,100 @@
+/**
+ * @file string_pool.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "string_pool_priv.h"
+#include "arena_priv.h"
+#include "name_index_priv.h"
+
+static struct arena strings_arena;
+/* maps the interned strings to themselves */
+static struct name_index strings_index;
+/* leds and channels can be created by plug-ins, from any thread */
+static pthread_mutex_t strings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *intern(const char *str)
+{
+	int ret;
+	char *interned;
+
+	interned = name_index_find(&strings_index, str);
+	if (interned != NULL)
+		return interned;
+
+	interned = arena_strdup(&strings_arena, str);
+	if (interned == NULL)
+		return NULL;
+	ret = name_index_add(&strings_index, interned, interned);
+	if (ret < 0) {
+		errno = -ret;
+		return NULL;
+	}
+
+	return interned;
+}
+
+const char *string_pool_intern(const char *str)
+{
+	const char *interned;
+
+	if (str == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&strings_mutex);
+	interned = intern(str);
+	pthread_mutex_unlock(&strings_mutex);
+
+	return interned;
+}
+
+size_t string_pool_get_size(void)
+{
+	size_t size;
+
+	pthread_mutex_lock(&strings_mutex);
+	size = strings_arena.size;
+	pthread_mutex_unlock(&strings_mutex);
+
+	return size;
+}
+
+void string_pool_cleanup(void)
+{
+	pthread_mutex_lock(&strings_mutex);
+	name_index_cleanup(&strings_index);
+	arena_release(&strings_arena);
+	pthread_mutex_unlock(&strings_mutex);
+}
@@ -0,0 +1,570 @@
+/**
+ * @file ldc.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Command-line client for the ledd daemon, on top of libledd_client. Either
+ * sends the command passed on the command line, or, with --batch, the commands
+ * read on stdin, one per line, over a single connection.
+ */
+
+#include <sys/types.h>
+#include <poll.h>
+
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <error.h>
+
+#include <ledd_client.h>
+
+/* same as pomp-cli --timeout 2, used by the former shell implementation */
+#define LDC_TIMEOUT_MS 2000
+#define LDC_EXIT_TIMEOUT 2
+/* the longest command, set_value, plus one to detect extra arguments */
+#define LDC_MAX_ARGS 5
+
+struct ldc {
+	struct ledd_client *client;
+	struct ledd_client_batch *batch;
+	bool verbose;
+	/* commands are sent in batches, acknowledged by ledd */
+	bool ack;
+	bool connected;
+	bool disconnected;
+	bool ids_received;
+	/* the daemon can't be reached after that */
+	bool quit_sent;
+	/* sequence number of the batch waiting for its ack */
+	uint32_t seq;
+	bool acked;
+	int status;
+};
+
+struct ldc_command {
+	const char *name;
+	int argc;
+	int (*run)(struct ldc *ldc, char *argv[]);
+};
+
+static void usage(void)
+{
+	puts("Command-line client for the ledd daemon\n"
+"Usage : ldc [options] set_pattern pattern resume\n"
+"                 resume can be \"true\" or \"false\", if true, once the current\n"
+"                 pattern is finished, the previous one will resume where it was\n"
+"                 stopped, if false, the previous pattern is discarded, the\n"
+"                 patterns set during the same tick are reduced to their net\n"
+"                 effect and applied at the next tick\n"
+"        ldc [options] set_pattern_now pattern resume\n"
+"                 same as set_pattern, but the pattern starts right away\n"
+"        ldc [options] quit\n"
+"                 asks the ledd daemon to quit\n"
+"        ldc [options] dump_config patterns|platform|global|timing|compositor\n"
+"                 dumps (partially) the result of the parsing of one of the 3\n"
+"                 ledd configuration files, \"patterns\" will ask to dump\n"
+"                 the patterns.conf file (usually /etc/ledd/patterns.conf) and so\n"
+"                 on..., \"timing\" dumps the player's overrun counters and the\n"
+"                 commands coalesced and \"compositor\" the layers of the streams\n"
+"                 playing\n"
+"        ldc [options] set_value led_id channel_id value\n"
+"                 set a led's channel to a given value, regardless of the current\n"
+"                 led pattern being played, if any, note that this is a debug\n"
+"                 operation and that patterns and manual values can conflict in\n"
+"                 unexpected ways\n"
+"        ldc [options] warm_up_pattern pattern\n"
+"                 computes in advance the values of a pattern, when ledd is\n"
+"                 configured with lazy_patterns, so that it starts playing\n"
+"                 without delay\n"
+"        ldc [options] reload_patterns\n"
+"                 reads the patterns configuration again, without restarting\n"
+"                 ledd, only the patterns modified are recomputed and the\n"
+"                 patterns playing aren't interrupted\n"
+"        ldc [options] -b|--batch\n"
+"                 reads the commands on stdin, one per line, with the same\n"
+"                 syntax as above, without \"ldc [options]\", and sends them\n"
+"                 over the same connection, empty lines and lines starting\n"
+"                 with # are ignored\n"
+"        options:\n"
+"            -v make the output verbose\n"
+"            -a|--ack waits for ledd to acknowledge each set_pattern,\n"
+"               set_pattern_now and set_value, the commands ledd rejects are\n"
+"               reported and make ldc exit with status 1\n"
+"        ldc exits with status 2 if ledd doesn't answer in 2 seconds, the\n"
+"        address of ledd is read in $LEDD_GLOBAL_CONF, defaulting to\n"
+"        /etc/ledd/global.conf");
+}
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * UINT64_C(1000) + ts.tv_nsec / 1000000;
+}
+
+static bool is_connected(const struct ldc *ldc)
+{
+	return ldc->connected;
+}
+
+static bool has_ids(const struct ldc *ldc)
+{
+	return ldc->ids_received;
+}
+
+static bool is_acked(const struct ldc *ldc)
+{
+	return ldc->acked;
+}
+
+/* processes the events of the client until done returns true */
+static int wait_until(struct ldc *ldc, bool (*done)(const struct ldc *ldc))
+{
+	int ret;
+	uint64_t now;
+	uint64_t deadline;
+	struct pollfd pfd = {
+		.fd = ledd_client_get_fd(ldc->client),
+		.events = POLLIN,
+	};
+
+	deadline = monotonic_ms() + LDC_TIMEOUT_MS;
+	while (!done(ldc)) {
+		if (ldc->disconnected)
+			return -ECONNRESET;
+		now = monotonic_ms();
+		if (now >= deadline)
+			return -ETIMEDOUT;
+		ret = poll(&pfd, 1, deadline - now);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (ret == 0)
+			continue;
+		ret = ledd_client_process_events(ldc->client);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* processes the events already received, without waiting */
+static int drain_events(struct ldc *ldc)
+{
+	int ret;
+	struct pollfd pfd = {
+		.fd = ledd_client_get_fd(ldc->client),
+		.events = POLLIN,
+	};
+
+	ret = poll(&pfd, 1, 0);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+	if (ret > 0) {
+		ret = ledd_client_process_events(ldc->client);
+		if (ret < 0)
+			return ret;
+	}
+
+	return ldc->disconnected ? -ECONNRESET : 0;
+}
+
+static int send_batch(struct ldc *ldc, uint32_t flags)
+{
+	int ret;
+
+	ret = ledd_client_batch_send(ldc->client, ldc->batch,
+			flags | LEDD_CLIENT_BATCH_ACK, &ldc->seq);
+	if (ret < 0)
+		return ret;
+	ldc->acked = false;
+	ret = wait_until(ldc, is_acked);
+	if (ret < 0)
+		return ret;
+	if (ldc->verbose)
+		printf("batch %"PRIu32" acknowledged: %s\n", ldc->seq,
+				ldc->status == 0 ? "applied" :
+				strerror(-ldc->status));
+
+	return ldc->status;
+}
+
+static int parse_resume(const char *arg, bool *resume)
+{
+	if (strcmp(arg, "true") == 0)
+		*resume = true;
+	else if (strcmp(arg, "false") == 0)
+		*resume = false;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int send_pattern(struct ldc *ldc, char *argv[], bool now)
+{
+	int ret;
+	int id;
+	bool resume;
+
+	ret = parse_resume(argv[1], &resume);
+	if (ret < 0)
+		return ret;
+	if (!ldc->ack)
+		return now ? ledd_client_set_pattern_now(ldc->client, argv[0],
+				resume) : ledd_client_set_pattern(ldc->client,
+				argv[0], resume);
+
+	id = ledd_client_get_pattern_id(ldc->client, argv[0]);
+	if (id < 0)
+		return id;
+	ret = ledd_client_batch_set_pattern(ldc->batch, id, resume);
+	if (ret < 0)
+		return ret;
+
+	return send_batch(ldc, now ? LEDD_CLIENT_BATCH_NOW : 0);
+}
+
+static int run_set_pattern(struct ldc *ldc, char *argv[])
+{
+	return send_pattern(ldc, argv, false);
+}
+
+static int run_set_pattern_now(struct ldc *ldc, char *argv[])
+{
+	return send_pattern(ldc, argv, true);
+}
+
+static int run_quit(struct ldc *ldc, char *argv[])
+{
+	ldc->quit_sent = true;
+
+	return ledd_client_quit(ldc->client);
+}
+
+static int run_dump_config(struct ldc *ldc, char *argv[])
+{
+	return ledd_client_dump_config(ldc->client, argv[0]);
+}
+
+static int run_set_value(struct ldc *ldc, char *argv[])
+{
+	int ret;
+	int id;
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul(argv[2], &end, 0);
+	if (errno != 0 || *end != '\0' || end == argv[2])
+		return -EINVAL;
+	/* ledd does the same for the values received */
+	if (value > UINT8_MAX)
+		value = UINT8_MAX;
+	if (!ldc->ack)
+		return ledd_client_set_value(ldc->client, argv[0], argv[1],
+				value);
+
+	id = ledd_client_get_channel_id(ldc->client, argv[0], argv[1]);
+	if (id < 0)
+		return id;
+	ret = ledd_client_batch_set_value(ldc->batch, id, value);
+	if (ret < 0)
+		return ret;
+
+	return send_batch(ldc, 0);
+}
+
+static int run_warm_up_pattern(struct ldc *ldc, char *argv[])
+{
+	return ledd_client_warm_up_pattern(ldc->client, argv[0]);
+}
+
+static int run_reload_patterns(struct ldc *ldc, char *argv[])
+{
+	int ret;
+
+	ret = ledd_client_reload_patterns(ldc->client);
+	if (ret < 0 || !ldc->ack)
+		return ret;
+
+	/*
+	 * the patterns added must be known to the commands which follow, ledd
+	 * answers the hello even if the reload failed
+	 */
+	ldc->ids_received = false;
+	ret = ledd_client_hello(ldc->client);
+	if (ret < 0)
+		return ret;
+
+	return wait_until(ldc, has_ids);
+}
+
+static const struct ldc_command commands[] = {
+	{ "set_pattern", 2, run_set_pattern },
+	{ "set_pattern_now", 2, run_set_pattern_now },
+	{ "quit", 0, run_quit },
+	{ "dump_config", 1, run_dump_config },
+	{ "set_value", 3, run_set_value },
+	{ "warm_up_pattern", 1, run_warm_up_pattern },
+	{ "reload_patterns", 0, run_reload_patterns },
+};
+
+static const struct ldc_command *find_command(int argc, char *argv[])
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(commands) / sizeof(*commands); i++)
+		if (strcmp(argv[0], commands[i].name) == 0)
+			return commands[i].argc == argc - 1 ? commands + i :
+					NULL;
+
+	return NULL;
+}
+
+static void connection_cb(void *userdata, bool connected)
+{
+	struct ldc *ldc = userdata;
+
+	if (connected)
+		ldc->connected = true;
+	else if (ldc->connected)
+		ldc->disconnected = true;
+}
+
+static void ids_cb(void *userdata)
+{
+	struct ldc *ldc = userdata;
+
+	ldc->ids_received = true;
+}
+
+static void ack_cb(void *userdata, uint32_t seq, int status)
+{
+	struct ldc *ldc = userdata;
+
+	if (seq != ldc->seq)
+		return;
+	ldc->acked = true;
+	ldc->status = status;
+}
+
+static const struct ledd_client_ops client_ops = {
+	.connection_cb = connection_cb,
+	.ids_cb = ids_cb,
+	.ack_cb = ack_cb,
+};
+
+static void ldc_cleanup(struct ldc *ldc)
+{
+	ledd_client_batch_destroy(&ldc->batch);
+	ledd_client_destroy(&ldc->client);
+}
+
+static int ldc_init(struct ldc *ldc)
+{
+	int ret;
+	char *address;
+
+	address = ledd_client_get_ledd_address(getenv("LEDD_GLOBAL_CONF"));
+	if (address == NULL)
+		return -errno;
+	if (ldc->verbose)
+		printf("connecting to ledd using address %s\n", address);
+	ldc->client = ledd_client_new(address, &client_ops, ldc);
+	free(address);
+	if (ldc->client == NULL)
+		return -errno;
+	ldc->batch = ledd_client_batch_new();
+	if (ldc->batch == NULL) {
+		ret = -errno;
+		goto err;
+	}
+
+	ret = ledd_client_connect(ldc->client);
+	if (ret < 0)
+		goto err;
+	ret = wait_until(ldc, is_connected);
+	if (ret < 0)
+		goto err;
+	if (ldc->ack) {
+		ret = ledd_client_hello(ldc->client);
+		if (ret < 0)
+			goto err;
+		ret = wait_until(ldc, has_ids);
+		if (ret < 0)
+			goto err;
+	}
+
+	return 0;
+err:
+	ldc_cleanup(ldc);
+
+	return ret;
+}
+
+static int exit_status(int ret)
+{
+	if (ret == -ETIMEDOUT)
+		return LDC_EXIT_TIMEOUT;
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* the connection is lost or ledd doesn't answer, no use going further */
+static bool is_fatal(int ret)
+{
+	return ret == -ETIMEDOUT || ret == -ECONNRESET;
+}
+
+static int run_batch(struct ldc *ldc)
+{
+	int ret;
+	int status = 0;
+	char *line = NULL;
+	size_t size = 0;
+	unsigned lineno = 0;
+	int argc;
+	char *argv[LDC_MAX_ARGS];
+	char *saveptr;
+	const struct ldc_command *command;
+
+	while (getline(&line, &size, stdin) != -1) {
+		lineno++;
+		argc = 0;
+		argv[argc] = strtok_r(line, " \t\n", &saveptr);
+		while (argv[argc] != NULL && argc < LDC_MAX_ARGS - 1)
+			argv[++argc] = strtok_r(NULL, " \t\n", &saveptr);
+		if (argv[argc] != NULL)
+			argc++;
+		if (argc == 0 || argv[0][0] == '#')
+			continue;
+
+		ret = drain_events(ldc);
+		if (ret < 0) {
+			status = ret;
+			break;
+		}
+		command = find_command(argc, argv);
+		if (command == NULL) {
+			error_at_line(0, 0, "stdin", lineno,
+					"invalid command %s", argv[0]);
+			status = -EINVAL;
+			continue;
+		}
+		ret = command->run(ldc, argv + 1);
+		if (ret < 0) {
+			error_at_line(0, -ret, "stdin", lineno, "%s", argv[0]);
+			status = ret;
+			if (is_fatal(ret))
+				break;
+		}
+	}
+	free(line);
+	if (is_fatal(status) || ldc->ack || ldc->quit_sent)
+		return status;
+
+	/*
+	 * ledd answers the messages in order, once the ids are received, all the
+	 * commands have left the client's buffers
+	 */
+	ret = ledd_client_hello(ldc->client);
+	if (ret == 0)
+		ret = wait_until(ldc, has_ids);
+
+	return ret < 0 ? ret : status;
+}
+
+static struct ldc ldc;
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	int i;
+	bool batch = false;
+	const struct ldc_command *command = NULL;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-v") == 0) {
+			ldc.verbose = true;
+		} else if (strcmp(argv[i], "-a") == 0 ||
+				strcmp(argv[i], "--ack") == 0) {
+			ldc.ack = true;
+		} else if (strcmp(argv[i], "-b") == 0 ||
+				strcmp(argv[i], "--batch") == 0) {
+			batch = true;
+		} else {
+			usage();
+			return strcmp(argv[i], "-h") == 0 ||
+					strcmp(argv[i], "-?") == 0 ||
+					strcmp(argv[i], "--help") == 0 ?
+					EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (!batch) {
+		if (i == argc || strcmp(argv[i], "help") == 0) {
+			usage();
+			return EXIT_SUCCESS;
+		}
+		command = find_command(argc - i, argv + i);
+		if (command == NULL) {
+			usage();
+			return EXIT_FAILURE;
+		}
+	} else if (i != argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	ret = ldc_init(&ldc);
+	if (ret < 0) {
+		error(0, -ret, "connection to ledd");
+		return exit_status(ret);
+	}
+
+	if (batch) {
+		ret = run_batch(&ldc);
+	} else {
+		ret = command->run(&ldc, argv + i + 1);
+		if (ret < 0)
+			error(0, -ret, "%s", command->name);
+	}
+
+	ldc_cleanup(&ldc);
+
+	return exit_status(ret);
+}
@@ -0,0 +1,151 @@
+/**
+ * @file ledd_patterns_gen.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Build-time generator of a C file embedding the patterns of a patterns.conf,
+ * compiled, as const data, for ledd-static based products: once linked in the
+ * program, ledd uses them in place, without running lua on patterns.conf.
+ * usage: ledd-patterns-gen global.conf output.c
+ * the patterns_config entry of global.conf is the patterns.conf compiled, the
+ * plug-ins linked in the generator must register the same transitions and lua
+ * globals as the ones of the product.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define ULOG_TAG ledd_patterns_gen
+#include <ulog.h>
+ULOG_DECLARE_TAG(ledd_patterns_gen);
+
+#include "utils.h"
+#include "global.h"
+#include "pattern.h"
+#include "string_pool_priv.h"
+
+#define BYTES_PER_LINE 12
+
+static int emit_c_file(FILE *out, const char *patterns_config,
+		const uint8_t *image, size_t size)
+{
+	size_t i;
+
+	fprintf(out, "/* generated by ledd-patterns-gen from %s, do not edit */\n"
+			"#include <stdint.h>\n"
+			"\n"
+			"#include <ledd.h>\n"
+			"\n"
+			"/* aligned, the structures of the image are used in place "
+			"*/\n"
+			"static const uint8_t ledd_patterns_image[] "
+			"__attribute__((aligned(8))) = {", patterns_config);
+	for (i = 0; i < size; i++)
+		fprintf(out, "%s0x%02"PRIx8",", i % BYTES_PER_LINE == 0 ?
+				"\n\t" : " ", image[i]);
+	fprintf(out, "\n};\n"
+			"\n"
+			"static __attribute__((constructor)) void "
+			"ledd_patterns_image_register(void)\n"
+			"{\n"
+			"\tledd_set_static_patterns(ledd_patterns_image,\n"
+			"\t\t\tsizeof(ledd_patterns_image));\n"
+			"}\n");
+
+	return fflush(out) == 0 && !ferror(out) ? 0 : -EIO;
+}
+
+static int generate(const char *output)
+{
+	int ret;
+	char *image = NULL;
+	size_t size = 0;
+	FILE *stream;
+	FILE *out;
+	const char *patterns_config = global_get_patterns_config();
+
+	stream = open_memstream(&image, &size);
+	if (stream == NULL) {
+		ret = -errno;
+		ULOGE("open_memstream: %m");
+		return ret;
+	}
+	ret = patterns_generate_image(patterns_config, stream);
+	fclose(stream);
+	if (ret < 0) {
+		ULOGE("patterns_generate_image(%s): %s", patterns_config,
+				strerror(-ret));
+		goto out;
+	}
+
+	out = fopen(output, "we");
+	if (out == NULL) {
+		ret = -errno;
+		ULOGE("fopen(%s): %m", output);
+		goto out;
+	}
+	ret = emit_c_file(out, patterns_config, (const uint8_t *)image, size);
+	if (fclose(out) != 0 && ret == 0)
+		ret = -errno;
+	if (ret < 0) {
+		ULOGE("writing %s: %s", output, strerror(-ret));
+		unlink(output);
+		goto out;
+	}
+	ULOGI("%s: %zu bytes of patterns from %s", output, size,
+			patterns_config);
+out:
+	free(image);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s global.conf output.c\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ret = global_init(argv[1]);
+	if (ret < 0) {
+		ULOGE("global_init(%s): %s", argv[1], strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	ret = generate(argv[2]);
+	global_cleanup();
+	config_cleanup();
+	string_pool_cleanup();
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file name_index_bench.c
+ *
+ * Copyright (c) 2016 Parrot S.A.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT COMPANY BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Compares the cost of looking up leds, led channels and patterns by name, with
+ * the name index used by ledd and with the linear scan it replaced.
+ * usage: name_index_bench [nb_leds [nb_patterns [nb_lookups]]]
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "name_index_priv.h"
+
+#define NAME_SIZE 32
+#define CHANNELS_PER_LED 3
+
+static const char * const channel_names[CHANNELS_PER_LED] = {
+	"hue",
+	"saturation",
+	"value",
+};
+
+struct names {
+	char (*names)[NAME_SIZE];
+	unsigned count;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int names_init(struct names *names, const char *prefix, unsigned count)
+{
+	unsigned i;
+
+	names->names = calloc(count, sizeof(*names->names));
+	if (names->names == NULL)
+		return -1;
+	names->count = count;
+	for (i = 0; i < count; i++)
+		snprintf(names->names[i], NAME_SIZE, "%s_%u", prefix, i);
+
+	return 0;
+}
+
+/* what get_led_by_id() and get_pattern() used to do, minus the list hops */
+static const char *linear_find(const struct names *names, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < names->count; i++)
+		if (strcmp(names->names[i], name) == 0)
+			return names->names[i];
+
+	return NULL;
+}
+
+/* returns the mean cost of a lookup in ns */
+static double bench_index(const struct name_index *index,
+		const struct names *names, const unsigned *queries,
+		unsigned nb_lookups, const char *subname)
+{
+	unsigned i;
+	unsigned found = 0;
+	double start;
+
+	start = now_ns();
+	for (i = 0; i < nb_lookups; i++)
+		found += name_index_find_pair(index,
+				names->names[queries[i]], subname) != NULL;
+	if (found != nb_lookups)
+		fprintf(stderr, "only %u/%u names found\n", found, nb_lookups);
+
+	return (now_ns() - start) / nb_lookups;
+}
+
+static double bench_linear(const struct names *names, const unsigned *queries,
+		unsigned nb_lookups)
+{
+	unsigned i;
+	unsigned found = 0;
+	double start;
+
+	start = now_ns();
+	for (i = 0; i < nb_lookups; i++)
+		found += linear_find(names, names->names[queries[i]]) != NULL;
+	if (found != nb_lookups)
+		fprintf(stderr, "only %u/%u names found\n", found, nb_lookups);
+
+	return (now_ns() - start) / nb_lookups;
+}
+
+static int bench(const char *prefix, unsigned count, unsigned nb_lookups,
+		bool with_channels)
+{
+	int ret;
+	unsigned i;
+	unsigned j;
+	struct names names;
+	struct name_index index;
+	struct name_index channels;
+	unsigned *queries;
+	double start;
+	double build;
+
+	memset(&index, 0, sizeof(index));
+	memset(&channels, 0, sizeof(channels));
+	queries = calloc(nb_lookups, sizeof(*queries));
+	if (queries == NULL || names_init(&names, prefix, count) < 0) {
+		fprintf(stderr, "calloc: %m\n");
+		return EXIT_FAILURE;
+	}
+	srand(count);
+	for (i = 0; i < nb_lookups; i++)
+		queries[i] = rand() % count;
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		ret = name_index_add(&index, names.names[i], names.names[i]);
+		if (ret < 0)
+			return EXIT_FAILURE;
+		for (j = 0; with_channels && j < CHANNELS_PER_LED; j++) {
+			ret = name_index_add_pair(&channels, names.names[i],
+					channel_names[j], names.names[i]);
+			if (ret < 0)
+				return EXIT_FAILURE;
+		}
+	}
+	build = (now_ns() - start) / 1e6;
+
+	printf("%u %ss, %u lookups\n", count, prefix, nb_lookups);
+	printf("\tindex build:   %10.3f ms\n", build);
+	printf("\tindex lookup:  %10.1f ns\n", bench_index(&index, &names,
+			queries, nb_lookups, NULL));
+	if (with_channels)
+		printf("\tchannel lookup:%10.1f ns\n", bench_index(&channels,
+				&names, queries, nb_lookups, "value"));
+	printf("\tlinear lookup: %10.1f ns\n", bench_linear(&names, queries,
+			nb_lookups));
+
+	name_index_cleanup(&channels);
+	name_index_cleanup(&index);
+	free(names.names);
+	free(queries);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	unsigned nb_leds = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000;
+	unsigned nb_patterns = argc > 2 ? strtoul(argv[2], NULL, 0) : 10000;
+	unsigned nb_lookups = argc > 3 ? strtoul(argv[3], NULL, 0) : 100000;
+
+	if (nb_leds == 0 || nb_patterns == 0 || nb_lookups == 0) {
+		fprintf(stderr, "usage: %s [nb_leds [nb_patterns "
+				"[nb_lookups]]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ret = bench("led", nb_leds, nb_lookups, true);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+
+	return bench("pattern", nb_patterns, nb_lookups, false);
+}
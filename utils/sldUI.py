@@ -76,14 +76,24 @@ class SocketLedDriverClient(object):
     def post(self, handler, req):
         gobject.idle_add(self.handle, handler, req)
 
+    def setValue(self, channel, value):
+        if channel == "red":
+            self.color.red = value * 256
+        if channel == "green":
+            self.color.green = value * 256
+        if channel == "blue":
+            self.color.blue = value * 256
+
     def recvMessage(self, ctx, conn, msg):
-        res = msg.read("%s%s%u")
-        if res[1] == "red":
-            self.color.red = res[2] * 256
-        if res[1] == "green":
-            self.color.green = res[2] * 256
-        if res[1] == "blue":
-            self.color.blue = res[2] * 256
+        if msg.msgid == 1:
+            # all the values changed during a tick, one line per channel
+            res = msg.read("%u%s")
+            for line in res[1].splitlines():
+                (led, channel, value) = line.split()
+                self.setValue(channel, int(value))
+        else:
+            res = msg.read("%s%s%u")
+            self.setValue(res[1], res[2])
         self.event_box.modify_bg(gtk.STATE_NORMAL, self.color)
 
     def on_window_destroy(self, widget):